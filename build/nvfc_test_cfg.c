@@ -0,0 +1,208 @@
+// Generated by nvf_root_to_c(). Do not edit.
+#include "nvf.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+static const struct {
+    nvf_num len;
+    char data[4];
+} nvfc_test_cfg_a0_1 = {3, "two"};
+static const struct {
+    nvf_num len;
+    uint8_t data[1];
+} nvfc_test_cfg_a0_3 = {1, {
+    0x04
+}};
+static const uint8_t nvfc_test_cfg_a0_types[] = {
+    NVF_INT,
+    NVF_STRING,
+    NVF_ARRAY,
+    NVF_BLOB,
+};
+static const nvf_value nvfc_test_cfg_a0_values[] = {
+    {.v_int = INT64_C(1)},
+    {.v_string = (nvf_str *)&nvfc_test_cfg_a0_1},
+    {.array_i = 1},
+    {.v_blob = (nvf_blob *)&nvfc_test_cfg_a0_3},
+};
+static const uint8_t nvfc_test_cfg_a1_types[] = {
+    NVF_INT,
+};
+static const nvf_value nvfc_test_cfg_a1_values[] = {
+    {.v_int = INT64_C(3)},
+};
+static const struct {
+    nvf_num len;
+    char data[10];
+} nvfc_test_cfg_m0_0 = {9, "nvfc test"};
+static const struct {
+    nvf_num len;
+    uint8_t data[3];
+} nvfc_test_cfg_m0_3 = {3, {
+    0x0a, 0x0b, 0x0c
+}};
+static NVF_BLOB_REF_STRUCT(, 14) nvfc_test_cfg_m0_4 = {
+    .offset = UINT64_C(2),
+    .len = 8,
+    .path_len = 13,
+    .path = "nvfc_test.nvf",
+};
+static const uint8_t nvfc_test_cfg_m0_types[] = {
+    NVF_STRING,
+    NVF_INT,
+    NVF_FLOAT,
+    NVF_BLOB,
+    NVF_BLOB_REF,
+    NVF_ARRAY,
+    NVF_MAP,
+};
+static const nvf_value nvfc_test_cfg_m0_values[] = {
+    {.v_string = (nvf_str *)&nvfc_test_cfg_m0_0},
+    {.v_int = INT64_C(42)},
+    {.v_float = 0x1p-2},
+    {.v_blob = (nvf_blob *)&nvfc_test_cfg_m0_3},
+    {.v_blob_ref = (nvf_blob_ref *)&nvfc_test_cfg_m0_4},
+    {.array_i = 0},
+    {.map_i = 1},
+};
+static const nvf_name nvfc_test_cfg_m0_names[] = {
+    {0x8d39bde6, 4, 0},
+    {0x39b1ddf4, 5, 5},
+    {0xc1121e84, 5, 11},
+    {0x5acad8be, 3, 17},
+    {0x42f48402, 3, 21},
+    {0x0cfb5881, 4, 25},
+    {0xe80c2f78, 1, 30},
+};
+static const char nvfc_test_cfg_m0_name_data[] =
+    "name\000count\000ratio\000bin\000ref\000list\000m\000";
+static const uint8_t nvfc_test_cfg_m1_types[] = {
+    NVF_INT,
+    NVF_INT,
+    NVF_INT,
+    NVF_INT,
+    NVF_INT,
+    NVF_INT,
+    NVF_INT,
+    NVF_INT,
+    NVF_INT,
+    NVF_MAP,
+};
+static const nvf_value nvfc_test_cfg_m1_values[] = {
+    {.v_int = INT64_C(1)},
+    {.v_int = INT64_C(2)},
+    {.v_int = INT64_C(3)},
+    {.v_int = INT64_C(4)},
+    {.v_int = INT64_C(5)},
+    {.v_int = INT64_C(6)},
+    {.v_int = INT64_C(7)},
+    {.v_int = INT64_C(8)},
+    {.v_int = INT64_C(9)},
+    {.map_i = 2},
+};
+static const nvf_name nvfc_test_cfg_m1_names[] = {
+    {0xe40c292c, 1, 0},
+    {0xe70c2de5, 1, 2},
+    {0xe60c2c52, 1, 4},
+    {0xe10c2473, 1, 6},
+    {0xe00c22e0, 1, 8},
+    {0xe30c2799, 1, 10},
+    {0xe20c2606, 1, 12},
+    {0xed0c3757, 1, 14},
+    {0xec0c35c4, 1, 16},
+    {0xdc4e3915, 3, 18},
+};
+static const char nvfc_test_cfg_m1_name_data[] =
+    "a\000b\000c\000d\000e\000f\000g\000h\000i\000sub\000";
+static const uint32_t nvfc_test_cfg_m1_hash_seeds[] = {
+    0x0000000b, 0x00000029, 0x00000002,
+};
+static const nvf_num nvfc_test_cfg_m1_hash_slots[] = {
+    2, 9, 0, 7, 8, 4, 1, 5,
+    6, 3,
+};
+static const struct {
+    nvf_num len;
+    char data[7];
+} nvfc_test_cfg_m2_0 = {6, "nested"};
+static const uint8_t nvfc_test_cfg_m2_types[] = {
+    NVF_STRING,
+};
+static const nvf_value nvfc_test_cfg_m2_values[] = {
+    {.v_string = (nvf_str *)&nvfc_test_cfg_m2_0},
+};
+static const nvf_name nvfc_test_cfg_m2_names[] = {
+    {0xfd0c5087, 1, 0},
+};
+static const char nvfc_test_cfg_m2_name_data[] =
+    "x\000";
+static const nvf_array nvfc_test_cfg_arrays[] = {
+    {
+        .types = (uint8_t *)nvfc_test_cfg_a0_types,
+        .values = (nvf_value *)nvfc_test_cfg_a0_values,
+        .num = 4,
+        .cap = 4,
+    },
+    {
+        .types = (uint8_t *)nvfc_test_cfg_a1_types,
+        .values = (nvf_value *)nvfc_test_cfg_a1_values,
+        .num = 1,
+        .cap = 1,
+    },
+};
+static const nvf_map nvfc_test_cfg_maps[] = {
+    {
+        .names = (nvf_name *)nvfc_test_cfg_m0_names,
+        .name_data = (char *)nvfc_test_cfg_m0_name_data,
+        .name_len = 32,
+        .name_cap = 32,
+        .arr = {
+            .types = (uint8_t *)nvfc_test_cfg_m0_types,
+            .values = (nvf_value *)nvfc_test_cfg_m0_values,
+            .num = 7,
+            .cap = 7,
+        },
+    },
+    {
+        .names = (nvf_name *)nvfc_test_cfg_m1_names,
+        .name_data = (char *)nvfc_test_cfg_m1_name_data,
+        .name_len = 22,
+        .name_cap = 22,
+        .arr = {
+            .types = (uint8_t *)nvfc_test_cfg_m1_types,
+            .values = (nvf_value *)nvfc_test_cfg_m1_values,
+            .num = 10,
+            .cap = 10,
+        },
+        .hash_seeds = (uint32_t *)nvfc_test_cfg_m1_hash_seeds,
+        .hash_slots = (nvf_num *)nvfc_test_cfg_m1_hash_slots,
+        .hash_seed_num = 3,
+    },
+    {
+        .names = (nvf_name *)nvfc_test_cfg_m2_names,
+        .name_data = (char *)nvfc_test_cfg_m2_name_data,
+        .name_len = 2,
+        .name_cap = 2,
+        .arr = {
+            .types = (uint8_t *)nvfc_test_cfg_m2_types,
+            .values = (nvf_value *)nvfc_test_cfg_m2_values,
+            .num = 1,
+            .cap = 1,
+        },
+    },
+};
+
+nvf_root nvfc_test_cfg = {
+    .realloc_inst = realloc,
+    .free_inst = free,
+    .array_num = 2,
+    .array_cap = 2,
+    .arrays = (nvf_array *)nvfc_test_cfg_arrays,
+    .map_num = 3,
+    .map_cap = 3,
+    .maps = (nvf_map *)nvfc_test_cfg_maps,
+    .fingerprint = 0x1ed9c4d67816224ull,
+    .frozen = NVF_FROZEN_STATIC,
+    .init_val = NVF_INIT_VAL,
+};
@@ -0,0 +1,9 @@
+// Generated by nvf_root_to_c(). Do not edit.
+#ifndef NVFC_TEST_CFG_H
+#define NVFC_TEST_CFG_H
+
+#include "nvf.h"
+
+extern nvf_root nvfc_test_cfg;
+
+#endif
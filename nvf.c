@@ -1,12 +1,35 @@
 #include "nvf.h"
 
 #include <ctype.h>
+#include <fcntl.h>
+#include <inttypes.h>
 #include <limits.h>
 #include <math.h>
+#include <pthread.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Base64 BLOBs use SSSE3 when the CPU has it. It's picked at runtime, so the
+// library doesn't need to be built for it. Define NVF_NO_SSSE3 to always use
+// the scalar code.
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) &&         \
+    !defined(NVF_NO_SSSE3)
+#define NVF_B64_SSSE3
+#include <tmmintrin.h>
+#endif
+
+#ifdef NVF_INSTRUMENT
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#endif
 
 #define CASE_STR(str)                                                          \
     case str:                                                                  \
@@ -21,6 +44,7 @@ const char *nvf_type_str(nvf_data_type dt) {
         CASE_STR(NVF_STRING);
         CASE_STR(NVF_MAP);
         CASE_STR(NVF_ARRAY);
+        CASE_STR(NVF_BLOB_REF);
         CASE_STR(NVF_TYPE_END);
     default:
         return NULL;
@@ -43,6 +67,10 @@ const char *nvf_err_str(nvf_err e) {
         CASE_STR(NVF_DUP_NAME);
         CASE_STR(NVF_UNMATCHED_BRACE);
         CASE_STR(NVF_NUM_OVF);
+        CASE_STR(NVF_IO_ERR);
+        CASE_STR(NVF_NOT_SUPPORTED);
+        CASE_STR(NVF_READ_ONLY);
+        CASE_STR(NVF_STOPPED);
         CASE_STR(NVF_ERR_END);
     default:
         return NULL;
@@ -58,6 +86,409 @@ uint8_t nvf_hex_char_to_u8(char in) {
     return UINT8_MAX;
 }
 
+// Return UINT8_MAX on error.
+uint8_t nvf_b64_char_to_u8(char in) {
+    IF_RET(in >= 'A' && in <= 'Z', in - 'A');
+    IF_RET(in >= 'a' && in <= 'z', 26 + in - 'a');
+    IF_RET(in >= '0' && in <= '9', 52 + in - '0');
+    IF_RET(in == '+', 62);
+    IF_RET(in == '/', 63);
+
+    return UINT8_MAX;
+}
+
+const char nvf_b64_chars[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+#ifdef NVF_B64_SSSE3
+// 1 if the CPU has SSSE3, 0 if it doesn't, or -1 before it's been checked.
+// Threads checking at the same time store the same answer.
+static int8_t nvf_ssse3 = -1;
+
+bool nvf_has_ssse3(void) {
+    int8_t has = __atomic_load_n(&nvf_ssse3, __ATOMIC_RELAXED);
+    if (has < 0) {
+        has = __builtin_cpu_supports("ssse3") != 0;
+        __atomic_store_n(&nvf_ssse3, has, __ATOMIC_RELAXED);
+    }
+    return has;
+}
+
+// Translate 16 base64 characters to their 6 bit values. Bits are set in
+// *bad_mask for the characters that aren't base64 digits. This is Wojciech
+// Muła's decoder.
+__attribute__((target("ssse3"))) __m128i nvf_b64_translate(__m128i in,
+                                                            int *bad_mask) {
+    const __m128i lut_lo =
+        _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                      0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m128i lut_hi =
+        _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10,
+                      0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll =
+        _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask_2f = _mm_set1_epi8(0x2f);
+    __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(in, 4), mask_2f);
+    __m128i lo_nibbles = _mm_and_si128(in, mask_2f);
+    __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+    __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+    __m128i eq_2f = _mm_cmpeq_epi8(in, mask_2f);
+    __m128i roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2f, hi_nibbles));
+    __m128i bad = _mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128());
+    *bad_mask = ~_mm_movemask_epi8(bad) & 0xffff;
+    return _mm_add_epi8(in, roll);
+}
+
+__attribute__((target("ssse3"))) uintptr_t
+nvf_b64_span_ssse3(const char *data, uintptr_t len) {
+    uintptr_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        int bad_mask = 0;
+        nvf_b64_translate(_mm_loadu_si128((const __m128i *)(data + i)),
+                          &bad_mask);
+        if (bad_mask != 0) {
+            return i + __builtin_ctz(bad_mask);
+        }
+    }
+    return i;
+}
+
+__attribute__((target("ssse3"))) uintptr_t
+nvf_decode_b64_ssse3(const char *in, uintptr_t len, uint8_t *out) {
+    const __m128i pack_shuffle = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14,
+                                               13, 12, -1, -1, -1, -1);
+    uintptr_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        int bad_mask = 0;
+        __m128i vals = nvf_b64_translate(
+            _mm_loadu_si128((const __m128i *)(in + i)), &bad_mask);
+        // Merge the 6 bit values into 12 bits, then 24 bits, then drop the
+        // unused bytes.
+        __m128i merged =
+            _mm_maddubs_epi16(vals, _mm_set1_epi32(0x01400140));
+        merged = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+        merged = _mm_shuffle_epi8(merged, pack_shuffle);
+        uint8_t tmp[16];
+        _mm_storeu_si128((__m128i *)tmp, merged);
+        memcpy(out + i / 4 * 3, tmp, 12);
+    }
+    return i;
+}
+
+__attribute__((target("ssse3"))) uintptr_t
+nvf_encode_b64_ssse3(const uint8_t *in, uintptr_t len, char *out) {
+    const __m128i split_shuffle =
+        _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    const __m128i shift_lut = _mm_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    uintptr_t i = 0;
+    // Each step reads 16 bytes and encodes the first 12.
+    for (; i + 16 <= len; i += 12) {
+        __m128i in_v = _mm_loadu_si128((const __m128i *)(in + i));
+        in_v = _mm_shuffle_epi8(in_v, split_shuffle);
+        // Move each 6 bit value into its own byte.
+        __m128i t0 = _mm_and_si128(in_v, _mm_set1_epi32(0x0fc0fc00));
+        __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+        __m128i t2 = _mm_and_si128(in_v, _mm_set1_epi32(0x003f03f0));
+        __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+        __m128i vals = _mm_or_si128(t1, t3);
+        // Pick the offset from each value to its character.
+        __m128i shift = _mm_subs_epu8(vals, _mm_set1_epi8(51));
+        __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), vals);
+        shift = _mm_or_si128(shift, _mm_and_si128(less, _mm_set1_epi8(13)));
+        shift = _mm_shuffle_epi8(shift_lut, shift);
+        _mm_storeu_si128((__m128i *)(out + i / 3 * 4),
+                         _mm_add_epi8(shift, vals));
+    }
+    return i;
+}
+#endif
+
+// Count the base64 digits at the start of data.
+uintptr_t nvf_b64_span(const char *data, uintptr_t len) {
+    uintptr_t i = 0;
+#ifdef NVF_B64_SSSE3
+    if (nvf_has_ssse3()) {
+        i = nvf_b64_span_ssse3(data, len);
+    }
+#endif
+    for (; i < len && nvf_b64_char_to_u8(data[i]) != UINT8_MAX; ++i) {
+    }
+    return i;
+}
+
+// Convert len base64 digits, found with nvf_b64_span(), to len * 3 / 4 bytes.
+void nvf_decode_b64(const char *in, uintptr_t len, uint8_t *out) {
+    uintptr_t i = 0;
+#ifdef NVF_B64_SSSE3
+    if (nvf_has_ssse3()) {
+        i = nvf_decode_b64_ssse3(in, len, out);
+    }
+#endif
+    uint32_t bits = 0;
+    uintptr_t o_i = i / 4 * 3;
+    for (; i < len; ++i) {
+        bits = bits << 6 | nvf_b64_char_to_u8(in[i]);
+        if (i % 4 == 3) {
+            out[o_i++] = bits >> 16;
+            out[o_i++] = bits >> 8;
+            out[o_i++] = bits;
+            bits = 0;
+        }
+    }
+    // The last 2 or 3 digits hold 1 or 2 bytes.
+    if (len % 4 == 2) {
+        out[o_i] = bits >> 4;
+    } else if (len % 4 == 3) {
+        out[o_i++] = bits >> 10;
+        out[o_i] = bits >> 2;
+    }
+}
+
+// The length of len bytes in base64, with padding.
+uintptr_t nvf_encoded_b64_len(uintptr_t len) { return (len + 2) / 3 * 4; }
+
+// Write len bytes as base64 with padding. Returns the end of the written data.
+char *nvf_encode_b64(const uint8_t *in, uintptr_t len, char *out) {
+    uintptr_t i = 0;
+#ifdef NVF_B64_SSSE3
+    if (nvf_has_ssse3()) {
+        i = nvf_encode_b64_ssse3(in, len, out);
+    }
+#endif
+    out += i / 3 * 4;
+    for (; i + 3 <= len; i += 3) {
+        uint32_t bits = in[i] << 16 | in[i + 1] << 8 | in[i + 2];
+        *out++ = nvf_b64_chars[bits >> 18];
+        *out++ = nvf_b64_chars[bits >> 12 & 0x3f];
+        *out++ = nvf_b64_chars[bits >> 6 & 0x3f];
+        *out++ = nvf_b64_chars[bits & 0x3f];
+    }
+    if (i < len) {
+        uint32_t bits = in[i] << 16 | (i + 1 < len ? in[i + 1] << 8 : 0);
+        *out++ = nvf_b64_chars[bits >> 18];
+        *out++ = nvf_b64_chars[bits >> 12 & 0x3f];
+        *out++ = i + 1 < len ? nvf_b64_chars[bits >> 6 & 0x3f] : '=';
+        *out++ = '=';
+    }
+    return out;
+}
+
+#ifdef NVF_INSTRUMENT
+// Each thread gets its own counters so parsing on multiple threads works.
+static _Thread_local nvf_parse_stats nvf_inst;
+
+// A hook and its context, swapped together so a thread never calls one
+// hook with another's context. Old entries are never freed since another
+// thread may still be calling them. They're kept linked so they stay
+// reachable.
+typedef struct nvf_inst_hook_entry {
+    nvf_parse_hook hook;
+    void *ctx;
+    struct nvf_inst_hook_entry *prev;
+} nvf_inst_hook_entry;
+static nvf_inst_hook_entry *nvf_inst_hook;
+
+uint64_t nvf_inst_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+// Count a value and the time it took to read or write it.
+void nvf_inst_value(nvf_data_type dt, uintptr_t bytes, uint64_t start) {
+    nvf_inst.values[dt]++;
+    if (dt == NVF_MAP || dt == NVF_ARRAY) {
+        return;
+    }
+    nvf_inst.value_bytes[dt] += bytes;
+    if (start == 0) {
+        return;
+    }
+    nvf_phase phase = NVF_PHASE_BLOB;
+    if (dt == NVF_INT || dt == NVF_FLOAT) {
+        phase = NVF_PHASE_NUMBER;
+    } else if (dt == NVF_STRING) {
+        phase = NVF_PHASE_STRING;
+    }
+    nvf_inst.ticks[phase] += nvf_inst_ticks() - start;
+}
+
+// Add counters from another thread to this thread's.
+void nvf_inst_merge(const nvf_parse_stats *in) {
+    nvf_inst.tokens += in->tokens;
+    nvf_inst.allocs += in->allocs;
+    nvf_inst.reallocs += in->reallocs;
+    for (int t_i = 0; t_i < NVF_TYPE_END; ++t_i) {
+        nvf_inst.values[t_i] += in->values[t_i];
+        nvf_inst.value_bytes[t_i] += in->value_bytes[t_i];
+    }
+    for (int p_i = 0; p_i < NVF_PHASE_END; ++p_i) {
+        nvf_inst.ticks[p_i] += in->ticks[p_i];
+    }
+}
+
+void nvf_inst_finish(void) {
+    const nvf_inst_hook_entry *e =
+        __atomic_load_n(&nvf_inst_hook, __ATOMIC_ACQUIRE);
+    if (e != NULL && e->hook != NULL) {
+        e->hook(&nvf_inst, e->ctx);
+    }
+}
+
+nvf_err nvf_parse_stats_get(nvf_parse_stats *out) {
+    IF_RET(out == NULL, NVF_BAD_ARG);
+    *out = nvf_inst;
+    return NVF_OK;
+}
+
+nvf_err nvf_set_parse_hook(nvf_parse_hook hook, void *ctx) {
+    nvf_inst_hook_entry *e = malloc(sizeof(*e));
+    IF_RET(e == NULL, NVF_BAD_ALLOC);
+    e->hook = hook;
+    e->ctx = ctx;
+    e->prev = __atomic_load_n(&nvf_inst_hook, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&nvf_inst_hook, &e->prev, e, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+    return NVF_OK;
+}
+
+#define NVF_INST_ADD(field, n) (nvf_inst.field += (n))
+#define NVF_INST_START(var) uint64_t var = nvf_inst_ticks()
+#define NVF_INST_STOP(var, phase)                                              \
+    (nvf_inst.ticks[phase] += nvf_inst_ticks() - var)
+#define NVF_INST_VALUE(dt, bytes, start) nvf_inst_value(dt, bytes, start)
+#define NVF_INST_RESET() bzero(&nvf_inst, sizeof(nvf_inst))
+#define NVF_INST_SAVE(out) ((out) = nvf_inst)
+#define NVF_INST_MERGE(in) nvf_inst_merge(&(in))
+#define NVF_INST_FINISH() nvf_inst_finish()
+#else
+nvf_err nvf_parse_stats_get(nvf_parse_stats *out) { return NVF_NOT_SUPPORTED; }
+
+nvf_err nvf_set_parse_hook(nvf_parse_hook hook, void *ctx) {
+    return NVF_NOT_SUPPORTED;
+}
+
+#define NVF_INST_ADD(field, n) ((void)0)
+#define NVF_INST_START(var)
+#define NVF_INST_STOP(var, phase) ((void)0)
+#define NVF_INST_VALUE(dt, bytes, start) ((void)(bytes))
+#define NVF_INST_RESET() ((void)0)
+#define NVF_INST_SAVE(out) ((void)0)
+#define NVF_INST_MERGE(in) ((void)0)
+#define NVF_INST_FINISH() ((void)0)
+#endif
+
+// The size of a block from a root's allocator. Allocators with a context are
+// never asked for 0 bytes, so those blocks take 1.
+size_t nvf_alloc_size(size_t size) { return size > 0 ? size : 1; }
+
+// Resize memory with the root's allocator without counting it. old_size is
+// the size ptr was allocated with.
+void *nvf_alloc_raw(const nvf_root *root, void *ptr, size_t old_size,
+                    size_t size) {
+    IF_RET(root->allocator.alloc == NULL, root->realloc_inst(ptr, size));
+    return root->allocator.alloc(root->allocator.ctx, ptr,
+                                 ptr == NULL ? 0 : nvf_alloc_size(old_size),
+                                 nvf_alloc_size(size));
+}
+
+// Every allocation the root makes goes through here so they can be counted.
+void *nvf_realloc(nvf_root *root, void *ptr, size_t old_size, size_t size) {
+    // Frozen roots may be read by several threads, so they aren't written to.
+    if (!root->frozen) {
+        ++root->alloc_calls;
+    }
+    if (ptr == NULL) {
+        NVF_INST_ADD(allocs, 1);
+    } else {
+        NVF_INST_ADD(reallocs, 1);
+    }
+    NVF_INST_START(alloc_start);
+    void *new_ptr = nvf_alloc_raw(root, ptr, old_size, size);
+    NVF_INST_STOP(alloc_start, NVF_PHASE_ALLOC);
+    return new_ptr;
+}
+
+// Free memory from nvf_realloc(). size is the size it was allocated with.
+void nvf_dealloc(const nvf_root *root, void *ptr, size_t size) {
+    if (root->allocator.alloc == NULL) {
+        root->free_inst(ptr);
+    } else if (ptr != NULL) {
+        root->allocator.alloc(root->allocator.ctx, ptr, nvf_alloc_size(size),
+                              0);
+    }
+}
+
+// Check if memory from one root can be freed by another.
+bool nvf_same_alloc(const nvf_root *a, const nvf_root *b) {
+    return a->free_inst == b->free_inst &&
+           a->allocator.alloc == b->allocator.alloc &&
+           a->allocator.ctx == b->allocator.ctx;
+}
+
+/// Blocks in a root's pool start at multiples of this.
+#define NVF_POOL_ALIGN (sizeof(uint64_t))
+
+// Round a block size up so the block after it in the pool is aligned.
+uintptr_t nvf_pool_size(uintptr_t size) {
+    return (size + NVF_POOL_ALIGN - 1) & ~(NVF_POOL_ALIGN - 1);
+}
+
+bool nvf_in_pool(const nvf_root *root, const void *ptr) {
+    const uint8_t *p = ptr;
+    return root->pool != NULL && p >= root->pool &&
+           p < root->pool + root->pool_cap;
+}
+
+// Allocate memory for a name, string or BLOB. These come from the root's pool
+// while it has room, so a presized parse doesn't allocate them one by one.
+// Old memory from the pool is left there since it's freed with the pool.
+void *nvf_alloc_leaf(nvf_root *root, void *ptr, size_t old_size,
+                     size_t size) {
+    if (ptr != NULL && !nvf_in_pool(root, ptr)) {
+        return nvf_realloc(root, ptr, old_size, size);
+    }
+    uintptr_t pool_size = nvf_pool_size(size);
+    // Other roots sharing the pool may use its free space too.
+    if (root->pool_refs == NULL &&
+        root->pool_cap - root->pool_len >= pool_size) {
+        void *out = root->pool + root->pool_len;
+        root->pool_len += pool_size;
+        return out;
+    }
+    return nvf_realloc(root, NULL, 0, size);
+}
+
+// Free memory of the given size unless it's part of the root's pool.
+void nvf_free(nvf_root *root, void *ptr, size_t size) {
+    if (!nvf_in_pool(root, ptr)) {
+        nvf_dealloc(root, ptr, size);
+    }
+}
+
+// Let go of the root's pool. A shared pool is only freed by the last root
+// using it. Frozen roots keep the count in the pool itself.
+void nvf_pool_release(nvf_root *root) {
+    uint64_t *refs = root->pool_refs;
+    if (refs == NULL || __atomic_sub_fetch(refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        if (refs != NULL && !nvf_in_pool(root, refs)) {
+            nvf_dealloc(root, refs, sizeof(*refs));
+        }
+        nvf_dealloc(root, root->pool, root->pool_cap);
+    }
+    root->pool = NULL;
+    root->pool_refs = NULL;
+    root->pool_len = 0;
+    root->pool_cap = 0;
+}
+
 nvf_root nvf_root_init(realloc_fn realloc_inst, free_fn free_inst) {
     nvf_root r = {
         .realloc_inst = realloc_inst,
@@ -69,37 +500,153 @@ nvf_root nvf_root_init(realloc_fn realloc_inst, free_fn free_inst) {
 
 nvf_root nvf_root_default_init(void) { return nvf_root_init(realloc, free); }
 
+nvf_root nvf_root_alloc_init(nvf_allocator allocator) {
+    nvf_root r = {0};
+    if (allocator.alloc != NULL) {
+        r.allocator = allocator;
+        r.init_val = NVF_INIT_VAL;
+    }
+    return r;
+}
+
+void nvf_root_free(nvf_root *root, void *ptr, uintptr_t size) {
+    if (root != NULL) {
+        nvf_dealloc(root, ptr, size);
+    }
+}
+
+nvf_root nvf_root_overlay_init(nvf_root *base) {
+    // Leave the overlay uninitialized so using it returns NVF_NOT_INIT.
+    if (base == NULL || base->init_val != NVF_INIT_VAL) {
+        nvf_root r = {0};
+        return r;
+    }
+    nvf_root r = nvf_root_init(base->realloc_inst, base->free_inst);
+    r.allocator = base->allocator;
+    r.base = base;
+    return r;
+}
+
+nvf_err nvf_blob_ref_get(nvf_blob_ref *ref, const uint8_t **out,
+                         uintptr_t *out_len) {
+    IF_RET(ref == NULL || out == NULL || out_len == NULL, NVF_BAD_ARG);
+
+    // Compiled roots map their references lazily even though several threads
+    // may read them, so the mapping is published with a compare and swap.
+    uint8_t *data = __atomic_load_n(&ref->data, __ATOMIC_ACQUIRE);
+    if (data == NULL) {
+        int fd = open(ref->path, O_RDONLY);
+        IF_RET(fd < 0, NVF_IO_ERR);
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            return NVF_IO_ERR;
+        }
+        uint64_t file_len = st.st_size;
+        if (ref->offset > file_len || ref->len > file_len - ref->offset) {
+            close(fd);
+            return NVF_BAD_DATA;
+        }
+        // mmap() needs the offset to be page aligned. Map from the start of
+        // the page and skip the extra bytes.
+        uint64_t page_len = sysconf(_SC_PAGESIZE);
+        uint64_t map_offset = ref->offset - ref->offset % page_len;
+        uintptr_t map_len = ref->len + (ref->offset - map_offset);
+        void *map_start =
+            mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, map_offset);
+        close(fd);
+        IF_RET(map_start == MAP_FAILED, NVF_IO_ERR);
+
+        uint8_t *mapped = (uint8_t *)map_start + (ref->offset - map_offset);
+        if (__atomic_compare_exchange_n(&ref->data, &data, mapped, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            // Only the thread that published the mapping owns it.
+            __atomic_store_n(&ref->map_start, map_start, __ATOMIC_RELAXED);
+            __atomic_store_n(&ref->map_len, map_len, __ATOMIC_RELAXED);
+            data = mapped;
+        } else {
+            // Another thread mapped it first, and data is its mapping.
+            munmap(map_start, map_len);
+        }
+    }
+    *out = data;
+    *out_len = ref->len;
+    return NVF_OK;
+}
+
+void nvf_unmap_blob_ref(nvf_blob_ref *ref) {
+    if (ref->map_start != NULL) {
+        munmap(ref->map_start, ref->map_len);
+    }
+    ref->map_start = NULL;
+    ref->map_len = 0;
+    ref->data = NULL;
+}
+
+// Check if a root has an allocator to free its memory with.
+bool nvf_can_free(const nvf_root *root) {
+    return root->free_inst != NULL || root->allocator.alloc != NULL;
+}
+
+// Get the size of a string, BLOB or BLOB reference.
+uintptr_t nvf_leaf_len(nvf_data_type dt, nvf_value v) {
+    if (dt == NVF_STRING) {
+        return sizeof(*v.v_string) + v.v_string->len + 1;
+    } else if (dt == NVF_BLOB) {
+        return sizeof(*v.v_blob) + v.v_blob->len;
+    } else if (dt == NVF_BLOB_REF) {
+        return sizeof(*v.v_blob_ref) + v.v_blob_ref->path_len + 1;
+    }
+    return 0;
+}
+
+// Get the string, BLOB or BLOB reference a failed parse left in an array's
+// next entry, and its size, so it can be reused or freed. Returns NULL if
+// there isn't one.
+void *nvf_stale_leaf(const nvf_array *arr, uintptr_t *len) {
+    *len = arr->num < arr->cap ? nvf_leaf_len(arr->types[arr->num],
+                                              arr->values[arr->num])
+                               : 0;
+    return *len > 0 ? arr->values[arr->num].v_string : NULL;
+}
+
 nvf_err nvf_deinit_array(nvf_root *n_r, nvf_array *a) {
     IF_RET(n_r->init_val != NVF_INIT_VAL, NVF_NOT_INIT);
-    free_fn f_fn = n_r->free_inst;
-    IF_RET(f_fn == NULL, NVF_BAD_ARG);
+    IF_RET(!nvf_can_free(n_r), NVF_BAD_ARG);
 
     for (nvf_num i = 0; i < a->num; ++i) {
-        if (a->types[i] == NVF_STRING) {
-            f_fn(a->values[i].v_string);
-        } else if (a->types[i] == NVF_BLOB) {
-            f_fn(a->values[i].v_blob);
+        if (a->types[i] == NVF_BLOB_REF) {
+            nvf_unmap_blob_ref(a->values[i].v_blob_ref);
+        }
+        uintptr_t len = nvf_leaf_len(a->types[i], a->values[i]);
+        if (len > 0) {
+            // All the leaf pointers are in the same place in the union.
+            nvf_free(n_r, a->values[i].v_string, len);
         }
     }
-    f_fn(a->types);
-    f_fn(a->values);
+    uintptr_t stale_len = 0;
+    void *stale = nvf_stale_leaf(a, &stale_len);
+    if (stale != NULL) {
+        nvf_free(n_r, stale, stale_len);
+    }
+    nvf_free(n_r, a->types, a->cap * sizeof(*a->types));
+    nvf_free(n_r, a->values, a->cap * sizeof(*a->values));
 
     bzero(a, sizeof(*a));
     return NVF_OK;
 }
 nvf_err nvf_deinit_map(nvf_root *n_r, nvf_map *m) {
     IF_RET(n_r->init_val != NVF_INIT_VAL, NVF_NOT_INIT);
-    free_fn f_fn = n_r->free_inst;
-    IF_RET(f_fn == NULL, NVF_BAD_ARG);
+    IF_RET(!nvf_can_free(n_r), NVF_BAD_ARG);
 
-    // We need end because we zero the 'values' array. Make a copy to keep
-    // it from changing.
-    for (nvf_num i = 0, end = m->arr.num; i < end; ++i) {
-        f_fn(m->names[i]);
-    }
+    // The names have room for as many entries as the values do.
+    nvf_num cap = m->arr.cap, num = m->arr.num;
     nvf_err r = nvf_deinit_array(n_r, &m->arr);
     IF_RET(r != NVF_OK, r);
-    f_fn(m->names);
+    nvf_free(n_r, m->names, cap * sizeof(*m->names));
+    nvf_free(n_r, m->name_data, m->name_cap);
+    nvf_free(n_r, m->hash_seeds, m->hash_seed_num * sizeof(*m->hash_seeds));
+    nvf_free(n_r, m->hash_slots, num * sizeof(*m->hash_slots));
 
     bzero(m, sizeof(*m));
     return NVF_OK;
@@ -107,20 +654,24 @@ nvf_err nvf_deinit_map(nvf_root *n_r, nvf_map *m) {
 
 nvf_err nvf_deinit(nvf_root *n_r) {
     IF_RET(n_r->init_val != NVF_INIT_VAL, NVF_NOT_INIT);
-    free_fn f_fn = n_r->free_inst;
-    IF_RET(f_fn == NULL, NVF_BAD_ARG);
+    // Compiled roots are static data, so there's nothing to free.
+    IF_RET(n_r->frozen == NVF_FROZEN_STATIC, NVF_READ_ONLY);
+    IF_RET(!nvf_can_free(n_r), NVF_BAD_ARG);
 
-    for (nvf_num a_i = 0; a_i < n_r->array_num; ++a_i) {
+    // Go up to the capacity since a presized parse allocates maps and arrays
+    // before they're reached. Unused entries are zeroed.
+    for (nvf_num a_i = 0; a_i < n_r->array_cap; ++a_i) {
         nvf_err r = nvf_deinit_array(n_r, &n_r->arrays[a_i]);
         IF_RET(r != NVF_OK, r);
     }
-    f_fn(n_r->arrays);
+    nvf_free(n_r, n_r->arrays, n_r->array_cap * sizeof(*n_r->arrays));
 
-    for (nvf_num m_i = 0; m_i < n_r->map_num; ++m_i) {
+    for (nvf_num m_i = 0; m_i < n_r->map_cap; ++m_i) {
         nvf_err r = nvf_deinit_map(n_r, &n_r->maps[m_i]);
         IF_RET(r != NVF_OK, r);
     }
-    f_fn(n_r->maps);
+    nvf_free(n_r, n_r->maps, n_r->map_cap * sizeof(*n_r->maps));
+    nvf_pool_release(n_r);
 
     // This zeros out the init_value member too, which we absolutely want.
     // That prevents this struct from being passed into another function.
@@ -128,663 +679,3432 @@ nvf_err nvf_deinit(nvf_root *n_r) {
     return NVF_OK;
 }
 
-nvf_err nvf_get_map(nvf_root *root, const char **m_names, nvf_num name_depth,
-                    nvf_map *map_out) {
-    IF_RET(root == NULL || m_names == NULL || map_out == NULL, NVF_BAD_ARG);
-
-    nvf_map *cur_map = root->maps;
-    nvf_num n_i = 0;
-    for (; n_i < name_depth; ++n_i) {
-        nvf_num m_i = 0;
-        for (; m_i < cur_map->arr.num; ++m_i) {
-            if (strcmp(m_names[n_i], cur_map->names[m_i]) == 0) {
-                if (cur_map->arr.types[m_i] == NVF_MAP) {
-                    nvf_num new_map_i = cur_map->arr.values[m_i].map_i;
-                    cur_map = &root->maps[new_map_i];
-                    goto search_next;
-                } else {
-                    return NVF_NOT_FOUND;
-                }
-            }
+// Free the strings and BLOBs in an array and empty it. The array keeps
+// its storage. Returns how many bytes of the pool the freed memory would take.
+uintptr_t nvf_reset_array(nvf_root *root, nvf_array *a) {
+    uintptr_t pool_len = 0;
+    for (nvf_num i = 0; i < a->num; ++i) {
+        if (a->types[i] == NVF_BLOB_REF) {
+            nvf_unmap_blob_ref(a->values[i].v_blob_ref);
+        }
+        uintptr_t len = nvf_leaf_len(a->types[i], a->values[i]);
+        if (len > 0) {
+            pool_len += nvf_pool_size(len);
+            nvf_free(root, a->values[i].v_string, len);
         }
-        // If we didn't find a name after going through the whole list, it's not
-        // here. That's an error.
-        IF_RET(m_i >= cur_map->arr.num, NVF_NOT_FOUND);
-    search_next:;
     }
-    if (n_i == name_depth) {
-        *map_out = *cur_map;
-        return NVF_OK;
+    uintptr_t stale_len = 0;
+    void *stale = nvf_stale_leaf(a, &stale_len);
+    if (stale != NULL) {
+        nvf_free(root, stale, stale_len);
     }
-
-    return NVF_NOT_FOUND;
+    // The parser reallocates the pointers in unused entries, so they have to
+    // be zeroed.
+    if (a->cap > 0) {
+        bzero(a->types, a->cap * sizeof(*a->types));
+        bzero(a->values, a->cap * sizeof(*a->values));
+    }
+    a->num = 0;
+    return pool_len;
 }
 
-nvf_err nvf_get_value(nvf_root *root, const char **names, nvf_num name_depth,
-                      void *out, uintptr_t *out_len, nvf_data_type dt) {
-    IF_RET(root == NULL || names == NULL || out == NULL || name_depth == 0 ||
-               out_len == NULL,
-           NVF_BAD_ARG);
+nvf_err nvf_root_reset(nvf_root *root) {
+    IF_RET(root == NULL, NVF_BAD_ARG);
+    IF_RET(root->init_val != NVF_INIT_VAL, NVF_NOT_INIT);
+    IF_RET(root->frozen, NVF_READ_ONLY);
 
-    // We assume this array of names is null terminated.
-    nvf_map parent_map;
-    // NOTE: this can overflow if name_depth == 0
-    nvf_err e = nvf_get_map(root, names, name_depth - 1, &parent_map);
-    IF_RET(e != NVF_OK, e);
+    // Pooled memory is reused as it is. Everything else is freed and added
+    // to the pool's size.
+    uintptr_t pool_len = root->pool_cap;
+    for (nvf_num a_i = 0; a_i < root->array_num; ++a_i) {
+        pool_len += nvf_reset_array(root, &root->arrays[a_i]);
+    }
+    for (nvf_num m_i = 0; m_i < root->map_num; ++m_i) {
+        nvf_map *m = &root->maps[m_i];
+        m->name_len = 0;
+        pool_len += nvf_reset_array(root, &m->arr);
+    }
+    root->array_num = 0;
+    root->map_num = 0;
+    root->fingerprint = 0;
 
-    nvf_num n_i = 0;
-    const char *name = names[name_depth - 1];
-    for (; n_i < parent_map.arr.num; ++n_i) {
-        if (strcmp(name, parent_map.names[n_i]) == 0) {
-            if (parent_map.arr.types[n_i] == dt) {
-                if (dt == NVF_BLOB) {
-                    uintptr_t stored_len =
-                        parent_map.arr.values[n_i].v_blob->len;
-                    if (stored_len > *out_len) {
-                        *out_len = stored_len;
-                        return NVF_BUF_OVF;
-                    }
-                    *out_len = stored_len;
-                    memcpy(out, parent_map.arr.values[n_i].v_blob->data,
-                           stored_len);
-                } else if (dt == NVF_STRING) {
-                    uintptr_t stored_len =
-                        strlen(parent_map.arr.values[n_i].v_string) + 1;
-                    if (stored_len > *out_len) {
-                        *out_len = stored_len;
-                        return NVF_BUF_OVF;
-                    }
-                    *out_len = stored_len;
-                    memcpy(out, parent_map.arr.values[n_i].v_string,
-                           stored_len);
-                } else if (dt == NVF_INT) {
-                    int64_t *i_out = out;
-                    *i_out = parent_map.arr.values[n_i].v_int;
-                    *out_len = sizeof(*i_out);
-                } else if (dt == NVF_FLOAT) {
-                    double *f_out = out;
-                    *f_out = parent_map.arr.values[n_i].v_float;
-                    *out_len = sizeof(*f_out);
-                } else if (dt == NVF_ARRAY) {
-                    nvf_array *a_out = out;
-                    nvf_num arr_out_i = parent_map.arr.values[n_i].array_i;
-                    *a_out = root->arrays[arr_out_i];
-                    *out_len = sizeof(*a_out);
-                } else {
-                    return NVF_BAD_VALUE_TYPE;
-                }
-                return NVF_OK;
-            } else {
-                return NVF_BAD_VALUE_TYPE;
-            }
+    // Other roots still read a shared pool, so this root gets its own.
+    if (pool_len > root->pool_cap || root->pool_refs != NULL) {
+        // Nothing in the pool is used, so it doesn't need to be copied.
+        nvf_pool_release(root);
+        if (pool_len > 0) {
+            root->pool = nvf_realloc(root, NULL, 0, pool_len);
+            IF_RET(root->pool == NULL, NVF_BAD_ALLOC);
+            root->pool_cap = pool_len;
         }
     }
+    root->pool_len = 0;
+    return NVF_OK;
+}
 
-    return NVF_NOT_FOUND;
+// Add a block of memory to a usage count.
+void nvf_add_usage(nvf_mem_usage *usage, uintptr_t *allocs, uintptr_t used,
+                   uintptr_t reserved) {
+    usage->used += used;
+    usage->reserved += reserved;
+    *allocs += reserved > 0;
 }
 
-nvf_err nvf_get_value_alloc(nvf_root *root, const char **names,
-                            nvf_num name_depth, void **out, uintptr_t *out_len,
-                            nvf_data_type dt) {
-    IF_RET(dt != NVF_BLOB && NVF_STRING != dt, NVF_BAD_ARG);
-    // Call the get_value function once to get the item length before
-    // allocating.
-    uint8_t tmp_out[1] = {0};
-    uintptr_t tmp_out_len = sizeof(tmp_out);
-    nvf_err r =
-        nvf_get_value(root, names, name_depth, tmp_out, &tmp_out_len, dt);
-    IF_RET(r != NVF_OK && r != NVF_BUF_OVF, r);
-    *out_len = tmp_out_len;
-
-    // We have the length now. If it's one, our buffer already holds the answer.
-    uint8_t *out_alloc = root->realloc_inst(NULL, tmp_out_len);
-    IF_RET(out_alloc == NULL, NVF_BAD_ALLOC);
-    *out = (void *)out_alloc;
-    if (tmp_out_len == sizeof(tmp_out)) {
-        *out_alloc = *tmp_out;
+// Returns 1 if ptr is an allocation of its own, which isn't true of memory in
+// the root's pool.
+uintptr_t nvf_is_alloc(const nvf_root *root, const void *ptr) {
+    return ptr != NULL && !nvf_in_pool(root, ptr);
+}
+
+// Count a string or BLOB. Ones in the root's pool aren't allocations of their
+// own.
+void nvf_leaf_usage(const nvf_root *root, nvf_stats *st, nvf_mem_usage *usage,
+                    const void *ptr, uintptr_t len) {
+    if (nvf_in_pool(root, ptr)) {
+        usage->used += len;
+        usage->reserved += nvf_pool_size(len);
     } else {
-        r = nvf_get_value(root, names, name_depth, *out, out_len, dt);
-        IF_RET(r != NVF_OK, r);
+        nvf_add_usage(usage, &st->allocs, len, len);
+    }
+}
+
+// Count the memory used by an array's types and values, and by the values
+// themselves.
+void nvf_array_stats(const nvf_root *root, const nvf_array *a,
+                     nvf_stats *st) {
+    uintptr_t entry_len = sizeof(*a->types) + sizeof(*a->values);
+    st->values.used += a->num * entry_len;
+    st->values.reserved += a->cap * entry_len;
+    st->allocs += nvf_is_alloc(root, a->types);
+    st->allocs += nvf_is_alloc(root, a->values);
+
+    for (nvf_num i = 0; i < a->num; ++i) {
+        nvf_value v = a->values[i];
+        if (a->types[i] == NVF_STRING) {
+            uintptr_t len = sizeof(*v.v_string) + v.v_string->len + 1;
+            nvf_leaf_usage(root, st, &st->strings, v.v_string, len);
+        } else if (a->types[i] == NVF_BLOB) {
+            uintptr_t len = sizeof(*v.v_blob) + v.v_blob->len;
+            nvf_leaf_usage(root, st, &st->blobs, v.v_blob, len);
+        } else if (a->types[i] == NVF_BLOB_REF) {
+            uintptr_t len = sizeof(*v.v_blob_ref) + v.v_blob_ref->path_len + 1;
+            nvf_leaf_usage(root, st, &st->blobs, v.v_blob_ref, len);
+            st->mapped += v.v_blob_ref->map_len;
+        }
+    }
+}
+
+nvf_err nvf_root_stats(nvf_root *root, nvf_stats *out) {
+    IF_RET(root == NULL || out == NULL, NVF_BAD_ARG);
+    IF_RET(root->init_val != NVF_INIT_VAL, NVF_NOT_INIT);
+
+    nvf_stats st = {0};
+    st.tables.used = root->map_num * sizeof(*root->maps) +
+                     root->array_num * sizeof(*root->arrays);
+    st.tables.reserved = root->map_cap * sizeof(*root->maps) +
+                         root->array_cap * sizeof(*root->arrays);
+    st.allocs += nvf_is_alloc(root, root->maps);
+    st.allocs += nvf_is_alloc(root, root->arrays);
+
+    for (nvf_num a_i = 0; a_i < root->array_num; ++a_i) {
+        nvf_array_stats(root, &root->arrays[a_i], &st);
+    }
+    for (nvf_num m_i = 0; m_i < root->map_num; ++m_i) {
+        nvf_map *m = &root->maps[m_i];
+        nvf_array_stats(root, &m->arr, &st);
+
+        st.names.used += m->arr.num * sizeof(*m->names) + m->name_len;
+        st.names.reserved += m->arr.cap * sizeof(*m->names) + m->name_cap;
+        st.allocs += nvf_is_alloc(root, m->names);
+        st.allocs += nvf_is_alloc(root, m->name_data);
+        if (m->hash_slots != NULL) {
+            uintptr_t hash_len = m->hash_seed_num * sizeof(*m->hash_seeds) +
+                                 m->arr.num * sizeof(*m->hash_slots);
+            st.names.used += hash_len;
+            st.names.reserved += hash_len;
+        }
+    }
+
+    nvf_mem_usage *parts[] = {&st.names, &st.strings, &st.blobs, &st.values,
+                              &st.tables};
+    for (uintptr_t p_i = 0; p_i < sizeof(parts) / sizeof(*parts); ++p_i) {
+        st.total.used += parts[p_i]->used;
+        st.total.reserved += parts[p_i]->reserved;
     }
+    // The unused end of the pool doesn't belong to any part.
+    st.total.reserved += root->pool_cap - root->pool_len;
+    st.allocs += root->pool != NULL;
+    st.slack = st.total.reserved - st.total.used;
+    st.alloc_calls = root->alloc_calls;
+
+    *out = st;
     return NVF_OK;
 }
 
-nvf_err nvf_get_blob_alloc(nvf_root *root, const char **names,
-                           nvf_num name_depth, uint8_t **out,
-                           uintptr_t *out_len) {
-    return nvf_get_value_alloc(root, names, name_depth, (void **)out, out_len,
-                               NVF_BLOB);
+// Hash a name with 32-bit FNV-1a.
+uint32_t nvf_hash(const char *data, uintptr_t len) {
+    uint32_t hash = 2166136261u;
+    for (uintptr_t i = 0; i < len; ++i) {
+        hash ^= (uint8_t)data[i];
+        hash *= 16777619u;
+    }
+    return hash;
 }
 
-nvf_err nvf_get_str_alloc(nvf_root *root, const char **names,
-                          nvf_num name_depth, char **out, uintptr_t *out_len) {
-    return nvf_get_value_alloc(root, names, name_depth, (void **)out, out_len,
-                               NVF_STRING);
+// Multiply two 64-bit numbers and fold the 128-bit product into 64 bits.
+uint64_t nvf_mum(uint64_t a, uint64_t b) {
+#ifdef __SIZEOF_INT128__
+    __uint128_t p = (__uint128_t)a * b;
+    return (uint64_t)p ^ (uint64_t)(p >> 64);
+#else
+    uint64_t a_lo = (uint32_t)a, a_hi = a >> 32;
+    uint64_t b_lo = (uint32_t)b, b_hi = b >> 32;
+    uint64_t lo_lo = a_lo * b_lo, hi_lo = a_hi * b_lo;
+    uint64_t lo_hi = a_lo * b_hi, hi_hi = a_hi * b_hi;
+    uint64_t cross = (lo_lo >> 32) + (uint32_t)hi_lo + lo_hi;
+    uint64_t hi = hi_hi + (hi_lo >> 32) + (cross >> 32);
+    return ((cross << 32) | (uint32_t)lo_lo) ^ hi;
+#endif
 }
 
-nvf_tag_value nvf_array_get_item(const nvf_array *arr, nvf_num arr_i) {
-    if (arr_i < arr->num) {
-        nvf_tag_value r2 = {
-            .val = arr->values[arr_i],
-            .type = arr->types[arr_i],
-        };
-        return r2;
+// Hash 32 bytes into two lanes, wyhash style. The lanes don't depend on each
+// other, so the multiplies overlap.
+void nvf_fingerprint_block(const char *data, uint64_t *h0, uint64_t *h1) {
+    uint64_t w[4];
+    memcpy(w, data, sizeof(w));
+    *h0 = nvf_mum(w[0] ^ 0xe7037ed1a0b428dbull, w[1] ^ *h0);
+    *h1 = nvf_mum(w[2] ^ 0x8ebc6af09c88c6e3ull, w[3] ^ *h1);
+}
+
+// Hash data, continuing from the fingerprint seed.
+uint64_t nvf_fingerprint_seeded(const char *data, uintptr_t len,
+                                uint64_t seed) {
+    uint64_t h0 = seed ^ 0xa0761d6478bd642full;
+    uint64_t h1 = seed ^ 0x589965cc75374cc3ull;
+    uintptr_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        nvf_fingerprint_block(data + i, &h0, &h1);
     }
-    nvf_tag_value r = {
-        .val = {0},
-        .type = NVF_NONE,
-    };
-    return r;
+    if (i < len) {
+        char tail[32] = {0};
+        memcpy(tail, data + i, len - i);
+        nvf_fingerprint_block(tail, &h0, &h1);
+    }
+    uint64_t h = nvf_mum(h0 ^ len, h1 ^ 0xa0761d6478bd642full);
+    h = nvf_mum(h ^ 0xe7037ed1a0b428dbull, len ^ 0x8ebc6af09c88c6e3ull);
+    // 0 means a root has no fingerprint.
+    return h == 0 ? 1 : h;
 }
 
-nvf_err nvf_get_array_from_i(nvf_root *root, nvf_num arr_i, nvf_array *out) {
-    IF_RET(arr_i >= root->array_num, NVF_BUF_OVF);
-    *out = root->arrays[arr_i];
-    return NVF_OK;
+uint64_t nvf_fingerprint(const char *data, uintptr_t data_len) {
+    return nvf_fingerprint_seeded(data, data_len, 0);
 }
 
-nvf_err nvf_get_array(nvf_root *root, const char **names, nvf_num name_depth,
-                      nvf_array *out) {
-    uintptr_t out_len = sizeof(*out);
-    return nvf_get_value(root, names, name_depth, out, &out_len, NVF_ARRAY);
+// Compare a map's name with one that may not be null terminated. The hash
+// and length are checked first so most names are never read.
+bool nvf_name_eq(const nvf_map *m, nvf_num name_i, uint32_t hash,
+                 const char *name, uintptr_t name_len) {
+    const nvf_name *n = &m->names[name_i];
+    return n->hash == hash && n->len == name_len &&
+           memcmp(m->name_data + n->offset, name, name_len) == 0;
 }
 
-nvf_err nvf_get_float(nvf_root *root, const char **names, nvf_num name_depth,
-                      double *out) {
-    uintptr_t out_len = sizeof(*out);
-    return nvf_get_value(root, names, name_depth, out, &out_len, NVF_FLOAT);
+// Scale a hash to [0, range). This is faster than %, and uses the high bits of
+// the hash instead of the low ones.
+nvf_num nvf_hash_range(uint32_t hash, nvf_num range) {
+    return (nvf_num)(((uint64_t)hash * range) >> 32);
 }
 
-nvf_err nvf_get_blob(nvf_root *root, const char **names, nvf_num name_depth,
-                     uint8_t *bin_out, uintptr_t *bin_out_len) {
-    return nvf_get_value(root, names, name_depth, bin_out, bin_out_len,
-                         NVF_BLOB);
+// Mix a hash with murmur3's finalizer, so every bit of it changes about half
+// the bits of the result.
+uint32_t nvf_hash_mix(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x85ebca6bu;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35u;
+    x ^= x >> 16;
+    return x;
 }
 
-// str_out_len should include the null terminator.
-nvf_err nvf_get_str(nvf_root *root, const char **names, nvf_num name_depth,
-                    char *str_out, uintptr_t *str_out_len) {
-    return nvf_get_value(root, names, name_depth, str_out, str_out_len,
-                         NVF_STRING);
+// Pick the seed bucket for a name in a map's perfect hash. FNV-1a hashes of
+// short names differ mostly in their low bits, so the hash is mixed first or
+// most names would share a bucket.
+nvf_num nvf_hash_bucket(uint32_t hash, nvf_num bucket_num) {
+    return nvf_hash_range(nvf_hash_mix(hash ^ 0x5bd1e995u), bucket_num);
 }
 
-nvf_err nvf_get_int(nvf_root *root, const char **names, nvf_num name_depth,
-                    int64_t *out) {
-    uintptr_t out_len = sizeof(*out);
-    return nvf_get_value(root, names, name_depth, out, &out_len, NVF_INT);
+// Pick a slot in a map's perfect hash from a name's hash and its seed.
+nvf_num nvf_hash_slot(uint32_t hash, uint32_t seed, nvf_num slot_num) {
+    // Mix the hash with the seed so each seed moves the name to an unrelated
+    // slot.
+    return nvf_hash_range(nvf_hash_mix(hash ^ (seed * 0x9e3779b9u)), slot_num);
 }
 
-uintptr_t nvf_next_token_i(const char *data, uintptr_t data_len) {
-    uintptr_t d_i = 0;
-    for (; d_i < data_len; ++d_i) {
-        if (isspace(data[d_i])) {
-            continue;
+// Find a name in a map and set *out_i to its index. Frozen maps use their
+// perfect hash. Other maps are scanned.
+bool nvf_map_find(const nvf_map *m, uint32_t hash, const char *name,
+                  uintptr_t name_len, nvf_num *out_i) {
+    if (m->hash_slots != NULL) {
+        uint32_t seed = m->hash_seeds[nvf_hash_bucket(hash, m->hash_seed_num)];
+        nvf_num n_i = m->hash_slots[nvf_hash_slot(hash, seed, m->arr.num)];
+        IF_RET(!nvf_name_eq(m, n_i, hash, name, name_len), false);
+        *out_i = n_i;
+        return true;
+    }
+    for (nvf_num n_i = 0; n_i < m->arr.num; ++n_i) {
+        if (nvf_name_eq(m, n_i, hash, name, name_len)) {
+            *out_i = n_i;
+            return true;
         }
-        if (data[d_i] == '#') {
-            ++d_i;
-            if (d_i < data_len && data[d_i] == '[') {
-            scan_till_bracket:
-                for (; d_i < data_len && data[d_i] != ']'; ++d_i) {
-                }
-                ++d_i;
-                // Keep looking for the end of the comment.
-                if (d_i < data_len && data[d_i] != '#') {
-                    goto scan_till_bracket;
+    }
+    return false;
+}
+
+const char *nvf_map_name(const nvf_map *m, nvf_num name_i) {
+    IF_RET(m == NULL || name_i >= m->arr.num, NULL);
+    return m->name_data + m->names[name_i].offset;
+}
+
+/// Maps with fewer names than this are scanned instead of hashed. Scanning a
+/// few hashes in a row is faster than computing a slot.
+#define NVF_MPH_MIN_NAMES (8)
+/// The most names that can share a seed in a map's perfect hash. Maps with
+/// more than this in one bucket are scanned instead.
+#define NVF_MPH_MAX_BUCKET (32)
+/// The most seeds to try for one bucket before giving up.
+#define NVF_MPH_MAX_SEED (1u << 24)
+
+// Build a minimal perfect hash of a map's names with hash and displace. The
+// names are split into buckets by hash. Going from the biggest bucket to the
+// smallest, each bucket gets the first seed that puts all of its names in
+// free slots. m->hash_seeds and m->hash_slots need room for
+// m->hash_seed_num and m->arr.num entries. Returns false if no hash could be
+// built, like when two names have the same hash.
+bool nvf_build_mph(nvf_root *root, nvf_map *m) {
+    nvf_num n = m->arr.num;
+    nvf_num bucket_num = m->hash_seed_num;
+    // One scratch block holds the buckets in the order they're placed, where
+    // each bucket's names start in members, the names sorted by bucket, and
+    // which slots are taken.
+    uintptr_t tmp_num = 2 * (uintptr_t)bucket_num + 1 + 2 * (uintptr_t)n;
+    nvf_num *tmp = nvf_realloc(root, NULL, 0, tmp_num * sizeof(*tmp));
+    IF_RET(tmp == NULL, false);
+    bzero(tmp, tmp_num * sizeof(*tmp));
+    nvf_num *order = tmp;
+    nvf_num *starts = order + bucket_num;
+    nvf_num *members = starts + bucket_num + 1;
+    nvf_num *taken = members + n;
+
+    for (nvf_num i = 0; i < n; ++i) {
+        ++starts[nvf_hash_bucket(m->names[i].hash, bucket_num) + 1];
+    }
+    nvf_num max_size = 0;
+    for (nvf_num b = 0; b < bucket_num; ++b) {
+        max_size = starts[b + 1] > max_size ? starts[b + 1] : max_size;
+        starts[b + 1] += starts[b];
+    }
+    bool built = max_size <= NVF_MPH_MAX_BUCKET;
+    // Use taken to count the names put in each bucket so far.
+    for (nvf_num i = 0; built && i < n; ++i) {
+        nvf_num b = nvf_hash_bucket(m->names[i].hash, bucket_num);
+        members[starts[b] + taken[b]++] = i;
+    }
+    bzero(taken, n * sizeof(*taken));
+
+    // Sort the buckets from biggest to smallest. Bucket sizes are small, so
+    // go through every size.
+    nvf_num order_num = 0;
+    for (nvf_num size = max_size; built && size > 0; --size) {
+        for (nvf_num b = 0; b < bucket_num; ++b) {
+            if (starts[b + 1] - starts[b] == size) {
+                order[order_num++] = b;
+            }
+        }
+    }
+
+    bzero(m->hash_seeds, bucket_num * sizeof(*m->hash_seeds));
+    for (nvf_num o_i = 0; built && o_i < order_num; ++o_i) {
+        nvf_num b = order[o_i];
+        nvf_num *bucket = members + starts[b];
+        nvf_num size = starts[b + 1] - starts[b];
+        // No seed can split names with the same hash.
+        for (nvf_num i = 0; i < size; ++i) {
+            for (nvf_num j = i + 1; j < size; ++j) {
+                built &= m->names[bucket[i]].hash != m->names[bucket[j]].hash;
+            }
+        }
+
+        bool placed = false;
+        for (uint32_t seed = 0; built && !placed && seed < NVF_MPH_MAX_SEED;
+             ++seed) {
+            nvf_num i = 0;
+            for (; i < size; ++i) {
+                nvf_num slot = nvf_hash_slot(m->names[bucket[i]].hash, seed, n);
+                if (taken[slot]) {
+                    break;
                 }
+                taken[slot] = 1;
+                m->hash_slots[slot] = bucket[i];
+            }
+            placed = i == size;
+            if (placed) {
+                m->hash_seeds[b] = seed;
             } else {
-                // Just go to a newline.
-                for (; d_i < data_len && data[d_i] != '\n'; ++d_i) {
+                // Free the slots this seed took.
+                while (i-- > 0) {
+                    taken[nvf_hash_slot(m->names[bucket[i]].hash, seed, n)] = 0;
                 }
             }
-            continue;
         }
-        break;
+        built &= placed;
     }
-    return d_i;
+
+    nvf_dealloc(root, tmp, tmp_num * sizeof(*tmp));
+    return built;
 }
 
-nvf_err nvf_ensure_array_cap(nvf_root *root, nvf_array *arr) {
-    IF_RET(root == NULL || arr == NULL, NVF_BAD_ARG);
+// Take len bytes from the block a frozen root is packed into.
+void *nvf_freeze_take(uint8_t *block, uintptr_t *off, uintptr_t len) {
+    IF_RET(len == 0, NULL);
+    void *out = block + *off;
+    *off += nvf_pool_size(len);
+    return out;
+}
 
-    if (arr->num + 1 > arr->cap) {
-        nvf_num next_cap = arr->cap * 2 + 4;
-        uint8_t *new_types =
-            root->realloc_inst(arr->types, next_cap * sizeof(*arr->types));
-        IF_RET(new_types == NULL, NVF_BAD_ALLOC);
-        bzero(new_types + arr->num,
-              sizeof(*arr->types) * (next_cap - arr->num));
-        arr->types = new_types;
+// The number of seeds in a map's perfect hash. More names per seed takes
+// less memory but longer to build.
+nvf_num nvf_mph_seed_num(nvf_num name_num) {
+    return name_num < NVF_MPH_MIN_NAMES ? 0 : name_num / 4 + 1;
+}
+
+// The number of slots in a map's perfect hash.
+nvf_num nvf_mph_slot_num(nvf_num name_num) {
+    return name_num < NVF_MPH_MIN_NAMES ? 0 : name_num;
+}
 
-        nvf_value *new_values =
-            root->realloc_inst(arr->values, next_cap * sizeof(*arr->values));
-        IF_RET(new_values == NULL, NVF_BAD_ALLOC);
-        bzero(new_values + arr->num,
-              sizeof(*arr->values) * (next_cap - arr->num));
-        arr->values = new_values;
-        arr->cap = next_cap;
+// Get the bytes an array takes once it's frozen.
+uintptr_t nvf_freeze_array_len(const nvf_array *a) {
+    uintptr_t len = nvf_pool_size(a->num * sizeof(*a->types)) +
+                    nvf_pool_size(a->num * sizeof(*a->values));
+    for (nvf_num i = 0; i < a->num; ++i) {
+        len += nvf_pool_size(nvf_leaf_len(a->types[i], a->values[i]));
     }
-    return NVF_OK;
+    return len;
 }
 
-nvf_err nvf_ensure_map_cap(nvf_root *root, nvf_map *m) {
-    IF_RET(root == NULL, NVF_BAD_ARG);
+// Copy an array and its strings and BLOBs into a frozen root's block.
+void nvf_freeze_array(nvf_array *dst, const nvf_array *src, uint8_t *block,
+                      uintptr_t *off) {
+    dst->num = src->num;
+    dst->cap = src->num;
+    dst->types = nvf_freeze_take(block, off, src->num * sizeof(*src->types));
+    dst->values = nvf_freeze_take(block, off, src->num * sizeof(*src->values));
+    for (nvf_num i = 0; i < src->num; ++i) {
+        dst->types[i] = src->types[i];
+        dst->values[i] = src->values[i];
+        uintptr_t len = nvf_leaf_len(src->types[i], src->values[i]);
+        if (len > 0) {
+            // All the leaf pointers are in the same place in the union.
+            void *leaf = nvf_freeze_take(block, off, len);
+            memcpy(leaf, src->values[i].v_string, len);
+            dst->values[i].v_string = leaf;
+        }
+    }
+}
 
-    nvf_num old_cap = m->arr.cap;
-    nvf_err e = nvf_ensure_array_cap(root, &m->arr);
-    IF_RET(e != NVF_OK, e);
+nvf_err nvf_root_freeze(nvf_root *root) {
+    IF_RET(root == NULL, NVF_BAD_ARG);
+    IF_RET(root->init_val != NVF_INIT_VAL, NVF_NOT_INIT);
+    IF_RET(root->frozen, NVF_OK);
 
-    // Only resize if we need to (when the internal array resized).
-    nvf_num next_cap = m->arr.cap;
-    if (old_cap != next_cap) {
-        nvf_num next_cap = m->arr.cap;
-        char **new_names =
-            root->realloc_inst(m->names, next_cap * sizeof(*m->names));
-        IF_RET(new_names == NULL, NVF_BAD_ALLOC);
-        // Zero the new allocated pointers.
-        bzero(new_names + m->arr.num,
-              sizeof(*new_names) * (next_cap - m->arr.num));
-        m->names = new_names;
+    // Find how big the block needs to be. The block holds its own reference
+    // count so shared clones of a frozen root don't change the root.
+    uintptr_t block_len = nvf_pool_size(sizeof(uint64_t)) +
+                          nvf_pool_size(root->map_num * sizeof(nvf_map)) +
+                          nvf_pool_size(root->array_num * sizeof(nvf_array));
+    for (nvf_num a_i = 0; a_i < root->array_num + root->map_num; ++a_i) {
+        nvf_array *a = a_i < root->array_num
+                           ? &root->arrays[a_i]
+                           : &root->maps[a_i - root->array_num].arr;
+        block_len += nvf_freeze_array_len(a);
+    }
+    for (nvf_num m_i = 0; m_i < root->map_num; ++m_i) {
+        const nvf_map *m = &root->maps[m_i];
+        block_len += nvf_pool_size(m->arr.num * sizeof(*m->names)) +
+                     nvf_pool_size(m->name_len) +
+                     nvf_pool_size(nvf_mph_seed_num(m->arr.num) *
+                                   sizeof(*m->hash_seeds)) +
+                     nvf_pool_size(nvf_mph_slot_num(m->arr.num) *
+                                   sizeof(*m->hash_slots));
     }
 
-    return NVF_OK;
-}
+    uint8_t *block = nvf_realloc(root, NULL, 0, block_len);
+    IF_RET(block == NULL && block_len > 0, NVF_BAD_ALLOC);
+    uintptr_t off = 0;
+    nvf_root frozen = *root;
+    frozen.pool = block;
+    frozen.pool_len = block_len;
+    frozen.pool_cap = block_len;
+    frozen.pool_refs = nvf_freeze_take(block, &off, sizeof(uint64_t));
+    *frozen.pool_refs = 1;
+    frozen.map_cap = root->map_num;
+    frozen.maps =
+        nvf_freeze_take(block, &off, root->map_num * sizeof(*root->maps));
+    frozen.array_cap = root->array_num;
+    frozen.arrays =
+        nvf_freeze_take(block, &off, root->array_num * sizeof(*root->arrays));
 
-nvf_err_data_i nvf_parse_buf_map_arr(const char *data, uintptr_t data_len,
-                                     nvf_root *root, nvf_num map_arr_i,
-                                     nvf_parse_type p_type) {
-    nvf_err_data_i r = {
-        .data_i = 0,
-        .err = NVF_OK,
-    };
-    IF_RET_DATA(root == NULL, r, NVF_BAD_ARG);
-    IF_RET_DATA(p_type != NVF_PARSE_MAP && p_type != NVF_PARSE_ARRAY, r,
-                NVF_BAD_ARG);
-    IF_RET_DATA(root->init_val != NVF_INIT_VAL, r, NVF_NOT_INIT);
+    for (nvf_num a_i = 0; a_i < root->array_num; ++a_i) {
+        nvf_freeze_array(&frozen.arrays[a_i], &root->arrays[a_i], block, &off);
+    }
+    for (nvf_num m_i = 0; m_i < root->map_num; ++m_i) {
+        const nvf_map *src = &root->maps[m_i];
+        nvf_map *dst = &frozen.maps[m_i];
+        bzero(dst, sizeof(*dst));
+        nvf_freeze_array(&dst->arr, &src->arr, block, &off);
 
-    // TODO: make a better error code for this.
-    bool ovf_cond = p_type == NVF_PARSE_MAP ? map_arr_i >= root->map_num
-                                            : map_arr_i >= root->array_num;
-    IF_RET_DATA(ovf_cond, r, NVF_BUF_OVF);
-    nvf_map *cur_map = p_type == NVF_PARSE_MAP ? root->maps + map_arr_i : NULL;
-    nvf_array *cur_arr =
-        cur_map == NULL ? root->arrays + map_arr_i : &cur_map->arr;
-    for (; r.data_i < data_len; ++r.data_i) {
-        r.data_i += nvf_next_token_i(data + r.data_i, data_len - r.data_i);
-        IF_RET_DATA(r.data_i >= data_len, r, NVF_OK);
-        if (data[r.data_i] == '}' || data[r.data_i] == ']') {
-            // When parsing an array, encountering a brace might be valid since
-            // We don't put values in an array by defult.
-            IF_RET_DATA(data[r.data_i] == '}' && map_arr_i == 0, r,
-                        NVF_UNMATCHED_BRACE);
-            // Skip over the brace so the calling function doesn't detect it.
-            ++r.data_i;
-            r.err = NVF_OK;
-            return r;
+        nvf_num n = src->arr.num;
+        dst->names = nvf_freeze_take(block, &off, n * sizeof(*dst->names));
+        if (n > 0) {
+            memcpy(dst->names, src->names, n * sizeof(*dst->names));
         }
-        // TODO: Add multiline comment scanning between the names and values.
-
-        const char *name = NULL;
-        uintptr_t name_len = 0;
-        // Skip checking names if we're not storing them anyway.
-        if (cur_map != NULL) {
-            name = &data[r.data_i];
-            while (r.data_i < data_len && !isspace(data[r.data_i])) {
-                char ch = data[r.data_i];
-                if (ch == '{' || ch == '[') {
-                    // Account for the extra step we took to see the
-                    // brace/bracket
-                    --r.data_i;
-                    break;
-                }
-                r.data_i++;
-            }
-            IF_RET_DATA(data_len <= r.data_i, r, NVF_BUF_OVF);
-            name_len = (data + r.data_i) - name;
-            // Make sure the name doesn't collide with anything we already have.
-            nvf_num n_i = 0;
-            for (; n_i < cur_arr->num; ++n_i) {
-                // The name we inferred isn't null terminated.
-                // That means we can't use strcmp.
-                // Do it more manually instead.
-                // TODO: Add a test for this.
-                size_t m_name_len = strlen(cur_map->names[n_i]);
-                IF_RET_DATA(m_name_len == name_len &&
-                                memcmp(cur_map->names[n_i], name, m_name_len) ==
-                                    0,
-                            r, NVF_BUF_OVF);
-            }
+        dst->name_len = src->name_len;
+        dst->name_cap = src->name_len;
+        dst->name_data = nvf_freeze_take(block, &off, src->name_len);
+        if (src->name_len > 0) {
+            memcpy(dst->name_data, src->name_data, src->name_len);
         }
 
-        r.data_i += nvf_next_token_i(data + r.data_i, data_len - r.data_i);
-        IF_RET_DATA(r.data_i >= data_len, r, NVF_BUF_OVF);
+        dst->hash_seed_num = nvf_mph_seed_num(n);
+        dst->hash_seeds = nvf_freeze_take(
+            block, &off, dst->hash_seed_num * sizeof(*dst->hash_seeds));
+        dst->hash_slots = nvf_freeze_take(
+            block, &off, nvf_mph_slot_num(n) * sizeof(*dst->hash_slots));
+        if (dst->hash_slots != NULL && !nvf_build_mph(root, dst)) {
+            // Scan this map instead.
+            dst->hash_seeds = NULL;
+            dst->hash_slots = NULL;
+            dst->hash_seed_num = 0;
+        }
+    }
 
-        // We've found value. Parse it depending on what it is.
-        const char *value = &data[r.data_i];
-        if (data[r.data_i] == '-' || isdigit(data[r.data_i])) {
-            // Int parsing has to be first because ints are valid floats.
-            nvf_value npv = {0};
-            nvf_data_type npt = NVF_INT;
-            char *end = (char *)value;
-            npv.v_int = strtoll(value, &end, 0);
-            IF_RET_DATA(npv.v_int == LLONG_MAX || npv.v_int == LLONG_MIN, r,
-                        NVF_NUM_OVF);
-            IF_RET_DATA(end == value, r, NVF_BAD_VALUE_FMT);
-            char end_c = *end;
-            bool int_parse_failed =
-                !(isspace(end_c) || end_c == '[' || end_c == ']');
-            if (int_parse_failed) {
-                // Try parsing as an int first, if it doesn't work, try a float
-                // .
-                npt = NVF_FLOAT;
-                npv.v_float = strtod(value, &end);
-                IF_RET_DATA(npv.v_float == HUGE_VAL ||
-                                npv.v_float == HUGE_VALF ||
-                                npv.v_float == HUGE_VALL,
-                            r, NVF_NUM_OVF);
-                IF_RET_DATA(end == value, r, NVF_BAD_VALUE_FMT);
-
-                end_c = *end;
-                bool float_parse_failed =
-                    !(isspace(end_c) || end_c == '[' || end_c == ']');
-                IF_RET_DATA(float_parse_failed, r, NVF_BAD_VALUE_FMT);
+    // The frozen root owns the BLOB mappings now. Keep the old root from
+    // unmapping them when it's freed.
+    for (nvf_num a_i = 0; a_i < root->array_num + root->map_num; ++a_i) {
+        nvf_array *a = a_i < root->array_num
+                           ? &root->arrays[a_i]
+                           : &root->maps[a_i - root->array_num].arr;
+        for (nvf_num i = 0; i < a->num; ++i) {
+            if (a->types[i] == NVF_BLOB_REF) {
+                a->values[i].v_blob_ref->map_start = NULL;
             }
-            // Subtract one because the for loop will increment it anyway.
-            r.data_i = end - data - 1;
+        }
+    }
+    frozen.alloc_calls = root->alloc_calls;
+    frozen.fingerprint = root->fingerprint;
+    nvf_err e = nvf_deinit(root);
+    IF_RET(e != NVF_OK, e);
+    frozen.frozen = 1;
+    *root = frozen;
+    return NVF_OK;
+}
 
-            // Grow the current map if we need to.
-            if (cur_map == NULL) {
-                r.err = nvf_ensure_array_cap(root, cur_arr);
-            } else {
-                r.err = nvf_ensure_map_cap(root, cur_map);
+// Move a root's strings and BLOBs into one block that becomes its pool, so
+// the pool can be shared. BLOB references in the old pool are copied out of
+// it. Roots with all their strings and BLOBs in the pool already are left
+// alone.
+nvf_err nvf_pack_leaves(nvf_root *root) {
+    uintptr_t block_len = 0;
+    bool loose = false;
+    for (nvf_num a_i = 0; a_i < root->array_num + root->map_num; ++a_i) {
+        const nvf_array *a = a_i < root->array_num
+                                 ? &root->arrays[a_i]
+                                 : &root->maps[a_i - root->array_num].arr;
+        for (nvf_num i = 0; i < a->num; ++i) {
+            if (a->types[i] == NVF_STRING || a->types[i] == NVF_BLOB) {
+                block_len +=
+                    nvf_pool_size(nvf_leaf_len(a->types[i], a->values[i]));
+                loose |= !nvf_in_pool(root, a->values[i].v_string);
             }
-            IF_RET_DATA(r.err != NVF_OK, r, r.err);
-            // The array's arrays could have been reallocated.
-            // Update the pointers so they point to the right location.
-            // cur_arr = &root->maps[map_arr_i].arr;
+        }
+    }
+    IF_RET(!loose, NVF_OK);
 
-            // Now that we have enough memory, add the integer value to the map.
-            cur_arr->values[cur_arr->num] = npv;
-            cur_arr->types[cur_arr->num] = npt;
-        } else if (data[r.data_i] == '"') {
-            // Grow the current map if we need to.
-            r.err = cur_map == NULL ? nvf_ensure_array_cap(root, cur_arr)
-                                    : nvf_ensure_map_cap(root, cur_map);
-            uintptr_t tot_str_len = 0;
-            // Allow multiline strings kind of like C does
-            // The final result will be a concatenation of the lines.
-            // string_name "line 1"
-            //             "line 2"
-            // 'string_name' will be "line 1line2".
-            char *d_str = cur_arr->values[cur_arr->num].v_string;
-            while (true) {
-                // r.data_i should be the quote's index. Add one to get the
-                // first character of the string.
-                ++r.data_i;
-                uintptr_t str_start = r.data_i;
-                // Find the end of the string.
-                for (; r.data_i < data_len && data[r.data_i] != '"';
-                     ++r.data_i) {
-                    // Skip escape sequences.
-                    if (data[r.data_i] == '\\') {
-                        r.data_i++;
-                    }
-                }
-                IF_RET_DATA(r.data_i >= data_len, r, NVF_BUF_OVF);
-                // Don't include the end quote.
-                uintptr_t str_part_len = r.data_i - str_start;
-
-                IF_RET_DATA(r.err != NVF_OK, r, r.err);
-
-                uintptr_t new_str_len = tot_str_len + str_part_len;
-                d_str = root->realloc_inst(d_str, new_str_len + 1);
-                IF_RET_DATA(d_str == NULL, r, NVF_BAD_ALLOC);
-                d_str[new_str_len] = '\0';
-                const char *d_str_start = data + str_start;
-                bool esc_char = false;
-                for (nvf_num s_i = 0; s_i < str_part_len; ++s_i) {
-                    if (d_str_start[s_i] == '\\') {
-                        esc_char = true;
-                    } else if (esc_char) {
-                        esc_char = false;
-                        bool assigned = false;
-#define MATCH_ASSIGN(i_char, e_char, dest, src, assigned)                      \
-    do {                                                                       \
-        if (i_char == src) {                                                   \
-            dest = e_char;                                                     \
-            assigned = true;                                                   \
-        }                                                                      \
-    } while (0)
-                        MATCH_ASSIGN('n', '\n', d_str[tot_str_len],
-                                     d_str_start[s_i], assigned);
-                        MATCH_ASSIGN('t', '\t', d_str[tot_str_len],
-                                     d_str_start[s_i], assigned);
-                        MATCH_ASSIGN('r', '\r', d_str[tot_str_len],
-                                     d_str_start[s_i], assigned);
-                        MATCH_ASSIGN('"', '"', d_str[tot_str_len],
-                                     d_str_start[s_i], assigned);
-                        MATCH_ASSIGN('\\', '\\', d_str[tot_str_len],
-                                     d_str_start[s_i], assigned);
-                        IF_RET_DATA(assigned == false, r, NVF_BAD_DATA);
-                        ++tot_str_len;
-                    } else {
-                        d_str[tot_str_len] = d_str_start[s_i];
-                        ++tot_str_len;
-                    }
-                }
-                // We're sitting at the quote, get past it so getting the next
-                // token works.
-                ++r.data_i;
-                r.data_i +=
-                    nvf_next_token_i(r.data_i + data, data_len - r.data_i);
-                // If the next token isn't a string, then we're done parsing
-                // this string.
-                if (data[r.data_i] != '"') {
-                    // Decrement because the for loop will increment again.
-                    --r.data_i;
-                    break;
-                }
+    uint8_t *block = nvf_realloc(root, NULL, 0, block_len);
+    IF_RET(block == NULL, NVF_BAD_ALLOC);
+    // BLOB references aren't shared, so they don't go in the block. Move the
+    // ones in the old pool out of it before it's released.
+    for (nvf_num a_i = 0; a_i < root->array_num + root->map_num; ++a_i) {
+        nvf_array *a = a_i < root->array_num
+                           ? &root->arrays[a_i]
+                           : &root->maps[a_i - root->array_num].arr;
+        for (nvf_num i = 0; i < a->num; ++i) {
+            if (a->types[i] != NVF_BLOB_REF ||
+                !nvf_in_pool(root, a->values[i].v_blob_ref)) {
+                continue;
             }
-            // Now that we have enough memory, add the string to the map.
-            cur_arr->values[cur_arr->num].v_string = d_str;
-            cur_arr->types[cur_arr->num] = NVF_STRING;
-        } else if (data[r.data_i] == 'b') {
-            // This case could be a blob.
-            // Make sure there's space for 'x' and one nibble of data.
-            IF_RET_DATA(r.data_i + 2 >= data_len, r, NVF_BUF_OVF);
-            ++r.data_i;
-            IF_RET_DATA(data[r.data_i] != 'x', r, NVF_BAD_VALUE_FMT);
-            ++r.data_i;
-            uintptr_t blob_start = r.data_i;
-            // Find the length of the BLOB before allocating memory.
-            for (; r.data_i < data_len && isxdigit(data[r.data_i]);
-                 ++r.data_i) {
+            uintptr_t len = nvf_leaf_len(a->types[i], a->values[i]);
+            nvf_blob_ref *ref = nvf_realloc(root, NULL, 0, len);
+            if (ref == NULL) {
+                nvf_dealloc(root, block, block_len);
+                return NVF_BAD_ALLOC;
             }
-            uintptr_t blob_len = r.data_i - blob_start;
-            IF_RET_DATA(blob_len == 0, r, NVF_BAD_VALUE_FMT);
-            // The for loop will increment this later. decrement it to account
-            // for that.
-            --r.data_i;
-
-            // Grow the current map if we need to.
-            if (cur_map == NULL) {
-                r.err = nvf_ensure_array_cap(root, cur_arr);
-            } else {
-                r.err = nvf_ensure_map_cap(root, cur_map);
+            memcpy(ref, a->values[i].v_blob_ref, len);
+            a->values[i].v_blob_ref = ref;
+        }
+        // A leaf a failed parse left in the old pool goes away with it.
+        uintptr_t stale_len = 0;
+        void *stale = nvf_stale_leaf(a, &stale_len);
+        if (stale != NULL && nvf_in_pool(root, stale)) {
+            a->types[a->num] = NVF_NONE;
+        }
+    }
+    uintptr_t off = 0;
+    for (nvf_num a_i = 0; a_i < root->array_num + root->map_num; ++a_i) {
+        nvf_array *a = a_i < root->array_num
+                           ? &root->arrays[a_i]
+                           : &root->maps[a_i - root->array_num].arr;
+        for (nvf_num i = 0; i < a->num; ++i) {
+            if (a->types[i] == NVF_STRING || a->types[i] == NVF_BLOB) {
+                uintptr_t len = nvf_leaf_len(a->types[i], a->values[i]);
+                void *leaf = nvf_freeze_take(block, &off, len);
+                memcpy(leaf, a->values[i].v_string, len);
+                nvf_free(root, a->values[i].v_string, len);
+                a->values[i].v_string = leaf;
             }
-            IF_RET_DATA(r.err != NVF_OK, r, r.err);
-
-            nvf_blob **map_blob = &cur_arr->values[cur_arr->num].v_blob;
-            uintptr_t bin_blob_len = (blob_len + 1) / 2;
-            nvf_blob *blob =
-                root->realloc_inst(*map_blob, sizeof(*blob) + bin_blob_len);
-            IF_RET_DATA(blob == NULL, r, NVF_BAD_ALLOC);
-            blob->len = bin_blob_len;
+        }
+    }
+    nvf_pool_release(root);
+    root->pool = block;
+    root->pool_len = block_len;
+    root->pool_cap = block_len;
+    return NVF_OK;
+}
 
-            // Get the data into the memory we allocated.
-            bool first_nibble = true;
-            for (uintptr_t b_i = 0; b_i < blob_len; ++b_i) {
-                uintptr_t b_d_i = blob_start + b_i;
-                uint8_t bin_val = nvf_hex_char_to_u8(data[b_d_i]);
-                IF_RET_DATA(bin_val == UINT8_MAX, r, NVF_BAD_VALUE_FMT);
+// Copy an array for nvf_root_clone(). Strings and BLOBs are copied into block
+// at *off, or shared if block is NULL. If this fails, out only holds the
+// entries that were copied, so it can still be freed.
+nvf_err nvf_clone_array(nvf_root *dst, nvf_array *out, const nvf_array *src,
+                        uint8_t *block, uintptr_t *off) {
+    bzero(out, sizeof(*out));
+    IF_RET(src->num == 0, NVF_OK);
+    out->types = nvf_realloc(dst, NULL, 0, src->num * sizeof(*out->types));
+    IF_RET(out->types == NULL, NVF_BAD_ALLOC);
+    out->values = nvf_realloc(dst, NULL, 0, src->num * sizeof(*out->values));
+    if (out->values == NULL) {
+        nvf_dealloc(dst, out->types, src->num * sizeof(*out->types));
+        out->types = NULL;
+        return NVF_BAD_ALLOC;
+    }
+    memcpy(out->types, src->types, src->num * sizeof(*out->types));
+    memcpy(out->values, src->values, src->num * sizeof(*out->values));
+    out->cap = src->num;
 
-                if (first_nibble) {
-                    blob->data[b_i / 2] = bin_val << 4;
-                    first_nibble = false;
-                } else {
-                    blob->data[b_i / 2] |= bin_val;
-                    first_nibble = true;
-                }
-            }
-            *map_blob = blob;
-            cur_arr->types[cur_arr->num] = NVF_BLOB;
-        } else if (data[r.data_i] == '{') {
-            // Don't allow maps to be nested in arrays.
-            IF_RET_DATA(p_type == NVF_PARSE_ARRAY || cur_map == NULL, r,
-                        NVF_ERROR);
-            ++r.data_i;
-            // Allocate a new map, then parse the data in the new map.
-            if (root->map_num + 1 > root->map_cap) {
-                // TODO: Make a macro for the 8 constant.
-                nvf_num new_cap = root->map_cap * 2 + 4;
-                nvf_map *new_map =
-                    root->realloc_inst(root->maps, new_cap * sizeof(*new_map));
-                IF_RET_DATA(new_map == NULL, r, NVF_BAD_ALLOC);
-                bzero(new_map + root->map_num,
-                      (new_cap - root->map_num) * sizeof(*new_map));
-                root->maps = new_map;
-                root->map_cap = new_cap;
+    for (nvf_num i = 0; i < src->num; ++i) {
+        nvf_data_type dt = src->types[i];
+        uintptr_t len = nvf_leaf_len(dt, src->values[i]);
+        // Each root maps its own BLOB references, so they're never shared.
+        if (len > 0 && (block != NULL || dt == NVF_BLOB_REF)) {
+            void *leaf = block != NULL ? nvf_freeze_take(block, off, len)
+                                       : nvf_realloc(dst, NULL, 0, len);
+            if (leaf == NULL) {
+                // The entries from here on still hold src's values. Clear
+                // them so they aren't freed with out.
+                bzero(out->types + i, (src->num - i) * sizeof(*out->types));
+                return NVF_BAD_ALLOC;
             }
-            cur_map = root->maps + map_arr_i;
-            cur_arr = &root->maps[map_arr_i].arr;
-
-            // Grow the current map if we need to.
-            if (cur_map == NULL) {
-                r.err = nvf_ensure_array_cap(root, cur_arr);
-            } else {
-                r.err = nvf_ensure_map_cap(root, cur_map);
+            memcpy(leaf, src->values[i].v_string, len);
+            out->values[i].v_string = leaf;
+            if (dt == NVF_BLOB_REF) {
+                out->values[i].v_blob_ref->data = NULL;
+                out->values[i].v_blob_ref->map_start = NULL;
+                out->values[i].v_blob_ref->map_len = 0;
             }
-            IF_RET_DATA(r.err != NVF_OK, r, r.err);
+        }
+        out->num = i + 1;
+    }
+    return NVF_OK;
+}
 
-            // TODO: See if we should increment map_num before or after this
-            // function.
-            ++root->map_num;
-            nvf_num new_map_num = root->map_num;
-            nvf_err_data_i r2 =
-                nvf_parse_buf_map_arr(data + r.data_i, data_len - r.data_i,
-                                      root, new_map_num - 1, NVF_PARSE_MAP);
-            r.data_i += r2.data_i;
-            // The for loop will increment this. Decrement it to account for
-            // that.
-            --r.data_i;
-            r.err = r2.err;
-            IF_RET(r.err != NVF_OK, r);
+nvf_err nvf_root_clone(nvf_root *dst, nvf_root *src, uint32_t flags) {
+    IF_RET(dst == NULL || src == NULL || dst == src, NVF_BAD_ARG);
+    IF_RET(dst->init_val != NVF_INIT_VAL || src->init_val != NVF_INIT_VAL,
+           NVF_NOT_INIT);
+    IF_RET(dst->frozen, NVF_READ_ONLY);
+    IF_RET(dst->map_cap != 0 || dst->array_cap != 0 || dst->pool != NULL,
+           NVF_BAD_ARG);
+    IF_RET((flags & ~NVF_CLONE_SHARE) != 0, NVF_BAD_ARG);
+    // A compiled root's data isn't allocated, so clones of it get copies.
+    bool share =
+        (flags & NVF_CLONE_SHARE) != 0 && src->frozen != NVF_FROZEN_STATIC;
+    IF_RET(share && !nvf_same_alloc(dst, src), NVF_BAD_ARG);
 
-            // The pointer to the map array may have moved, udpate it.
-            if (cur_map == NULL) {
-                cur_arr = root->arrays + map_arr_i;
-            } else {
-                cur_map = root->maps + map_arr_i;
-                cur_arr = &cur_map->arr;
+    // Set up the clone's pool first, so strings and BLOBs in it are never
+    // freed one by one if cloning fails.
+    uint8_t *block = NULL;
+    uintptr_t off = 0;
+    if (share) {
+        nvf_err e = nvf_pack_leaves(src);
+        IF_RET(e != NVF_OK, e);
+        if (src->pool != NULL) {
+            if (src->pool_refs == NULL) {
+                src->pool_refs =
+                    nvf_realloc(src, NULL, 0, sizeof(*src->pool_refs));
+                IF_RET(src->pool_refs == NULL, NVF_BAD_ALLOC);
+                *src->pool_refs = 1;
             }
-
-            cur_arr->values[cur_arr->num].map_i = new_map_num - 1;
-            cur_arr->types[cur_arr->num] = NVF_MAP;
-        } else if (data[r.data_i] == '[') {
-            ++r.data_i;
-            // Allocate a new map, then parse the data in the new map.
-            if (root->array_num + 1 > root->array_cap) {
-                // TODO: Make a macro for the 8 constant.
-                nvf_num new_cap = root->array_cap * 2 + 4;
-                nvf_array *new_arr = root->realloc_inst(
-                    root->arrays, new_cap * sizeof(*new_arr));
-                IF_RET_DATA(new_arr == NULL, r, NVF_BAD_ALLOC);
-                bzero(new_arr + root->array_num,
-                      (new_cap - root->array_num) * sizeof(*new_arr));
-                root->arrays = new_arr;
-                root->array_cap = new_cap;
+            __atomic_add_fetch(src->pool_refs, 1, __ATOMIC_RELAXED);
+            dst->pool = src->pool;
+            dst->pool_len = src->pool_cap;
+            dst->pool_cap = src->pool_cap;
+            dst->pool_refs = src->pool_refs;
+        }
+    } else {
+        uintptr_t block_len = 0;
+        for (nvf_num a_i = 0; a_i < src->array_num + src->map_num; ++a_i) {
+            const nvf_array *a = a_i < src->array_num
+                                     ? &src->arrays[a_i]
+                                     : &src->maps[a_i - src->array_num].arr;
+            for (nvf_num i = 0; i < a->num; ++i) {
+                block_len +=
+                    nvf_pool_size(nvf_leaf_len(a->types[i], a->values[i]));
             }
-            // The pointer value will be different depending on if we're parsing
-            // an array or a map. Make sure we account for that here. If we're
-            // parsing a map, our current array won't be changed.
-            cur_arr = cur_map == NULL ? root->arrays + map_arr_i : cur_arr;
+        }
+        if (block_len > 0) {
+            block = nvf_realloc(dst, NULL, 0, block_len);
+            IF_RET(block == NULL, NVF_BAD_ALLOC);
+            dst->pool = block;
+            dst->pool_len = block_len;
+            dst->pool_cap = block_len;
+        }
+    }
 
-            if (cur_map == NULL) {
-                r.err = nvf_ensure_array_cap(root, cur_arr);
-            } else {
-                r.err = nvf_ensure_map_cap(root, cur_map);
-            }
+    if (src->map_num > 0) {
+        dst->maps =
+            nvf_realloc(dst, NULL, 0, src->map_num * sizeof(*dst->maps));
+        IF_RET(dst->maps == NULL, NVF_BAD_ALLOC);
+        bzero(dst->maps, src->map_num * sizeof(*dst->maps));
+        dst->map_num = src->map_num;
+        dst->map_cap = src->map_num;
+    }
+    if (src->array_num > 0) {
+        dst->arrays =
+            nvf_realloc(dst, NULL, 0, src->array_num * sizeof(*dst->arrays));
+        IF_RET(dst->arrays == NULL, NVF_BAD_ALLOC);
+        bzero(dst->arrays, src->array_num * sizeof(*dst->arrays));
+        dst->array_num = src->array_num;
+        dst->array_cap = src->array_num;
+    }
+    for (nvf_num a_i = 0; a_i < src->array_num; ++a_i) {
+        nvf_err e = nvf_clone_array(dst, &dst->arrays[a_i], &src->arrays[a_i],
+                                    block, &off);
+        IF_RET(e != NVF_OK, e);
+    }
+    for (nvf_num m_i = 0; m_i < src->map_num; ++m_i) {
+        const nvf_map *s = &src->maps[m_i];
+        nvf_map *d = &dst->maps[m_i];
+        nvf_err e = nvf_clone_array(dst, &d->arr, &s->arr, block, &off);
+        IF_RET(e != NVF_OK, e);
+        // The names need room for as many entries as the values do, so
+        // they're allocated once the values' capacity is set.
+        if (s->arr.num > 0) {
+            d->names =
+                nvf_realloc(dst, NULL, 0, s->arr.num * sizeof(*d->names));
+            IF_RET(d->names == NULL, NVF_BAD_ALLOC);
+            memcpy(d->names, s->names, s->arr.num * sizeof(*d->names));
+        }
+        if (s->name_len > 0) {
+            d->name_data = nvf_realloc(dst, NULL, 0, s->name_len);
+            IF_RET(d->name_data == NULL, NVF_BAD_ALLOC);
+            memcpy(d->name_data, s->name_data, s->name_len);
+            d->name_len = s->name_len;
+            d->name_cap = s->name_len;
+        }
+    }
+    dst->base = src->base;
+    dst->fingerprint = src->fingerprint;
+    return NVF_OK;
+}
 
-            ++root->array_num;
-            // The array number may change if there's nested arrays. Save it
-            // just in case.
-            nvf_num new_arr_num = root->array_num;
+// Find the map at the end of a path without copying it.
+nvf_err nvf_find_map(nvf_root *root, const char **m_names, nvf_num name_depth,
+                     nvf_map **map_out) {
+    IF_RET(root->map_num == 0, NVF_NOT_FOUND);
 
-            nvf_err_data_i r2 =
-                nvf_parse_buf_map_arr(data + r.data_i, data_len - r.data_i,
-                                      root, new_arr_num - 1, NVF_PARSE_ARRAY);
-            r.data_i += r2.data_i;
-            // The for loop will increment this. Decrement it to account for
+    nvf_map *cur_map = root->maps;
+    for (nvf_num n_i = 0; n_i < name_depth; ++n_i) {
+        uintptr_t name_len = strlen(m_names[n_i]);
+        uint32_t hash = nvf_hash(m_names[n_i], name_len);
+        nvf_num m_i = 0;
+        bool found = nvf_map_find(cur_map, hash, m_names[n_i], name_len, &m_i);
+        IF_RET(!found || cur_map->arr.types[m_i] != NVF_MAP, NVF_NOT_FOUND);
+        cur_map = &root->maps[cur_map->arr.values[m_i].map_i];
+    }
+    *map_out = cur_map;
+    return NVF_OK;
+}
+
+nvf_err nvf_get_map(nvf_root *root, const char **m_names, nvf_num name_depth,
+                    nvf_map *map_out) {
+    IF_RET(root == NULL || m_names == NULL || map_out == NULL, NVF_BAD_ARG);
+
+    nvf_map *found = NULL;
+    nvf_err e = nvf_find_map(root, m_names, name_depth, &found);
+    if (e == NVF_NOT_FOUND && root->base != NULL) {
+        return nvf_get_map(root->base, m_names, name_depth, map_out);
+    }
+    IF_RET(e != NVF_OK, e);
+    *map_out = *found;
+    return NVF_OK;
+}
+
+// Find a value in a map and make sure it has the type dt. BLOB references
+// match NVF_BLOB.
+nvf_err nvf_map_value(const nvf_map *m, const char *name, nvf_data_type dt,
+                      nvf_value *out, nvf_data_type *out_type) {
+    uintptr_t name_len = strlen(name);
+    uint32_t hash = nvf_hash(name, name_len);
+    nvf_num n_i = 0;
+    IF_RET(!nvf_map_find(m, hash, name, name_len, &n_i), NVF_NOT_FOUND);
+
+    nvf_data_type found_type = m->arr.types[n_i];
+    bool type_match =
+        found_type == dt || (dt == NVF_BLOB && found_type == NVF_BLOB_REF);
+    IF_RET(!type_match, NVF_BAD_VALUE_TYPE);
+    *out = m->arr.values[n_i];
+    *out_type = found_type;
+    return NVF_OK;
+}
+
+// Find the value at the end of a path and make sure it has the type dt. The
+// value's pointers point into memory owned by the root. BLOB references
+// match NVF_BLOB, so check out_type to see which one was found. Overlays
+// look in their base when the path isn't found, and *owner, if it isn't
+// NULL, is set to the root the value was found in.
+nvf_err nvf_find_value(nvf_root *root, const char **names, nvf_num name_depth,
+                       nvf_data_type dt, nvf_value *out,
+                       nvf_data_type *out_type, nvf_root **owner) {
+    IF_RET(root == NULL || names == NULL || name_depth == 0, NVF_BAD_ARG);
+
+    nvf_map *parent_map = NULL;
+    nvf_err e = nvf_find_map(root, names, name_depth - 1, &parent_map);
+    if (e == NVF_OK) {
+        e = nvf_map_value(parent_map, names[name_depth - 1], dt, out,
+                          out_type);
+    }
+    if (e == NVF_NOT_FOUND && root->base != NULL) {
+        return nvf_find_value(root->base, names, name_depth, dt, out, out_type,
+                              owner);
+    }
+    if (e == NVF_OK && owner != NULL) {
+        *owner = root;
+    }
+    return e;
+}
+
+// Find a BLOB's data, mapping it first if it's in another file.
+nvf_err nvf_find_blob(nvf_root *root, const char **names, nvf_num name_depth,
+                      const uint8_t **out, uintptr_t *out_len) {
+    nvf_value val;
+    nvf_data_type type;
+    nvf_err e =
+        nvf_find_value(root, names, name_depth, NVF_BLOB, &val, &type, NULL);
+    IF_RET(e != NVF_OK, e);
+
+    if (type == NVF_BLOB_REF) {
+        return nvf_blob_ref_get(val.v_blob_ref, out, out_len);
+    }
+    *out = val.v_blob->data;
+    *out_len = val.v_blob->len;
+    return NVF_OK;
+}
+
+nvf_err nvf_get_value(nvf_root *root, const char **names, nvf_num name_depth,
+                      void *out, uintptr_t *out_len, nvf_data_type dt) {
+    IF_RET(out == NULL || out_len == NULL, NVF_BAD_ARG);
+
+    if (dt == NVF_BLOB) {
+        const uint8_t *blob = NULL;
+        uintptr_t stored_len = 0;
+        nvf_err e = nvf_find_blob(root, names, name_depth, &blob, &stored_len);
+        IF_RET(e != NVF_OK, e);
+        if (stored_len > *out_len) {
+            *out_len = stored_len;
+            return NVF_BUF_OVF;
+        }
+        *out_len = stored_len;
+        memcpy(out, blob, stored_len);
+        return NVF_OK;
+    }
+
+    nvf_value val;
+    nvf_data_type type;
+    // Arrays are indexed in the root they were found in, which may be a base.
+    nvf_root *owner = root;
+    nvf_err e =
+        nvf_find_value(root, names, name_depth, dt, &val, &type, &owner);
+    IF_RET(e != NVF_OK, e);
+
+    if (dt == NVF_STRING) {
+        // Copy the null terminator too.
+        uintptr_t stored_len = val.v_string->len + 1;
+        if (stored_len > *out_len) {
+            *out_len = stored_len;
+            return NVF_BUF_OVF;
+        }
+        *out_len = stored_len;
+        memcpy(out, val.v_string->data, stored_len);
+    } else if (dt == NVF_INT) {
+        int64_t *i_out = out;
+        *i_out = val.v_int;
+        *out_len = sizeof(*i_out);
+    } else if (dt == NVF_FLOAT) {
+        double *f_out = out;
+        *f_out = val.v_float;
+        *out_len = sizeof(*f_out);
+    } else if (dt == NVF_ARRAY) {
+        nvf_array *a_out = out;
+        *a_out = owner->arrays[val.array_i];
+        *out_len = sizeof(*a_out);
+    } else {
+        return NVF_BAD_VALUE_TYPE;
+    }
+    return NVF_OK;
+}
+
+nvf_err nvf_get_value_alloc(nvf_root *root, const char **names,
+                            nvf_num name_depth, void **out, uintptr_t *out_len,
+                            nvf_data_type dt) {
+    IF_RET(dt != NVF_BLOB && NVF_STRING != dt, NVF_BAD_ARG);
+    IF_RET(out == NULL || out_len == NULL, NVF_BAD_ARG);
+
+    const void *src = NULL;
+    uintptr_t len = 0;
+    if (dt == NVF_BLOB) {
+        const uint8_t *blob = NULL;
+        nvf_err r = nvf_find_blob(root, names, name_depth, &blob, &len);
+        IF_RET(r != NVF_OK, r);
+        src = blob;
+    } else {
+        nvf_value val;
+        nvf_data_type type;
+        nvf_err r =
+            nvf_find_value(root, names, name_depth, dt, &val, &type, NULL);
+        IF_RET(r != NVF_OK, r);
+        src = val.v_string->data;
+        // Copy the null terminator too.
+        len = val.v_string->len + 1;
+    }
+
+    // Always allocate at least one byte so empty BLOBs get a valid pointer.
+    uint8_t *out_alloc = nvf_realloc(root, NULL, 0, len > 0 ? len : 1);
+    IF_RET(out_alloc == NULL, NVF_BAD_ALLOC);
+    memcpy(out_alloc, src, len);
+    *out = (void *)out_alloc;
+    *out_len = len;
+    return NVF_OK;
+}
+
+nvf_err nvf_get_str_view(nvf_root *root, const char **names,
+                         nvf_num name_depth, const char **out,
+                         uintptr_t *out_len) {
+    IF_RET(out == NULL || out_len == NULL, NVF_BAD_ARG);
+
+    nvf_value val;
+    nvf_data_type type;
+    nvf_err r = nvf_find_value(root, names, name_depth, NVF_STRING, &val,
+                               &type, NULL);
+    IF_RET(r != NVF_OK, r);
+    *out = val.v_string->data;
+    *out_len = val.v_string->len;
+    return NVF_OK;
+}
+
+nvf_err nvf_get_blob_view(nvf_root *root, const char **names,
+                          nvf_num name_depth, const uint8_t **out,
+                          uintptr_t *out_len) {
+    IF_RET(out == NULL || out_len == NULL, NVF_BAD_ARG);
+    return nvf_find_blob(root, names, name_depth, out, out_len);
+}
+
+// Store an int in a signed field of size bytes.
+nvf_err nvf_bind_int(int64_t val, void *field, uintptr_t size) {
+    if (size == sizeof(int8_t)) {
+        IF_RET(val < INT8_MIN || val > INT8_MAX, NVF_NUM_OVF);
+        *(int8_t *)field = val;
+    } else if (size == sizeof(int16_t)) {
+        IF_RET(val < INT16_MIN || val > INT16_MAX, NVF_NUM_OVF);
+        *(int16_t *)field = val;
+    } else if (size == sizeof(int32_t)) {
+        IF_RET(val < INT32_MIN || val > INT32_MAX, NVF_NUM_OVF);
+        *(int32_t *)field = val;
+    } else if (size == sizeof(int64_t)) {
+        *(int64_t *)field = val;
+    } else {
+        return NVF_BAD_ARG;
+    }
+    return NVF_OK;
+}
+
+// Store a value in a field described by f.
+nvf_err nvf_bind_value(const nvf_bind_field *f, nvf_data_type type,
+                       nvf_value val, void *field) {
+    if (f->type == NVF_INT) {
+        return nvf_bind_int(val.v_int, field, f->size);
+    } else if (f->type == NVF_FLOAT) {
+        if (f->size == sizeof(float)) {
+            *(float *)field = val.v_float;
+        } else if (f->size == sizeof(double)) {
+            *(double *)field = val.v_float;
+        } else {
+            return NVF_BAD_ARG;
+        }
+    } else if (f->type == NVF_STRING) {
+        IF_RET(val.v_string->len + 1 > f->size, NVF_BUF_OVF);
+        memcpy(field, val.v_string->data, val.v_string->len + 1);
+    } else if (f->type == NVF_BLOB) {
+        const uint8_t *blob = NULL;
+        uintptr_t blob_len = 0;
+        if (type == NVF_BLOB_REF) {
+            nvf_err e = nvf_blob_ref_get(val.v_blob_ref, &blob, &blob_len);
+            IF_RET(e != NVF_OK, e);
+        } else {
+            blob = val.v_blob->data;
+            blob_len = val.v_blob->len;
+        }
+        IF_RET(blob_len > f->size, NVF_BUF_OVF);
+        memcpy(field, blob, blob_len);
+        bzero((uint8_t *)field + blob_len, f->size - blob_len);
+    } else {
+        return NVF_BAD_ARG;
+    }
+    return NVF_OK;
+}
+
+// Check if two fields have the same parent map.
+bool nvf_bind_same_parent(const nvf_bind_field *a, const nvf_bind_field *b) {
+    IF_RET(a->depth != b->depth, false);
+    for (nvf_num d_i = 0; d_i + 1 < a->depth; ++d_i) {
+        if (a->path[d_i] != b->path[d_i] &&
+            strcmp(a->path[d_i], b->path[d_i]) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+nvf_err nvf_bind(nvf_root *root, const nvf_bind_field *fields,
+                 nvf_num field_num, void *out, nvf_err *field_errs) {
+    IF_RET(root == NULL || fields == NULL || out == NULL, NVF_BAD_ARG);
+    IF_RET(root->init_val != NVF_INIT_VAL, NVF_NOT_INIT);
+
+    nvf_err first_err = NVF_OK;
+    // The last field whose parent map was looked up.
+    const nvf_bind_field *parent_f = NULL;
+    nvf_map *parent = NULL;
+    nvf_err parent_err = NVF_OK;
+    for (nvf_num f_i = 0; f_i < field_num; ++f_i) {
+        const nvf_bind_field *f = &fields[f_i];
+        nvf_err e = NVF_OK;
+        if (f->path == NULL || f->depth == 0) {
+            e = NVF_BAD_ARG;
+        } else {
+            // Only look the parent map up again when it changes.
+            if (parent_f == NULL || !nvf_bind_same_parent(f, parent_f)) {
+                parent_err = nvf_find_map(root, f->path, f->depth - 1, &parent);
+                parent_f = f;
+            }
+            e = parent_err;
+        }
+
+        nvf_value val;
+        nvf_data_type type;
+        if (e == NVF_OK) {
+            e = nvf_map_value(parent, f->path[f->depth - 1], f->type, &val,
+                              &type);
+        }
+        if (e == NVF_NOT_FOUND && root->base != NULL) {
+            e = nvf_find_value(root->base, f->path, f->depth, f->type, &val,
+                               &type, NULL);
+        }
+        if (e == NVF_OK) {
+            e = nvf_bind_value(f, type, val, (uint8_t *)out + f->offset);
+        }
+
+        if (field_errs != NULL) {
+            field_errs[f_i] = e;
+        }
+        if (first_err == NVF_OK) {
+            first_err = e;
+        }
+    }
+    return first_err;
+}
+
+nvf_err nvf_get_blob_alloc(nvf_root *root, const char **names,
+                           nvf_num name_depth, uint8_t **out,
+                           uintptr_t *out_len) {
+    return nvf_get_value_alloc(root, names, name_depth, (void **)out, out_len,
+                               NVF_BLOB);
+}
+
+nvf_err nvf_get_str_alloc(nvf_root *root, const char **names,
+                          nvf_num name_depth, char **out, uintptr_t *out_len) {
+    return nvf_get_value_alloc(root, names, name_depth, (void **)out, out_len,
+                               NVF_STRING);
+}
+
+nvf_tag_value nvf_array_get_item(const nvf_array *arr, nvf_num arr_i) {
+    if (arr_i < arr->num) {
+        nvf_tag_value r2 = {
+            .val = arr->values[arr_i],
+            .type = arr->types[arr_i],
+        };
+        return r2;
+    }
+    nvf_tag_value r = {
+        .val = {0},
+        .type = NVF_NONE,
+    };
+    return r;
+}
+
+nvf_err nvf_get_array_from_i(nvf_root *root, nvf_num arr_i, nvf_array *out) {
+    IF_RET(arr_i >= root->array_num, NVF_BUF_OVF);
+    *out = root->arrays[arr_i];
+    return NVF_OK;
+}
+
+// Check if a cursor is at an entry.
+bool nvf_cursor_at(const nvf_cursor *c) {
+    return c->arr != NULL && c->i < c->arr->num;
+}
+
+nvf_err nvf_cursor_root(const nvf_root *root, nvf_cursor *out) {
+    IF_RET(root == NULL || out == NULL, NVF_BAD_ARG);
+    IF_RET(root->init_val != NVF_INIT_VAL, NVF_NOT_INIT);
+    *out = (nvf_cursor){.root = root};
+    // Nothing has been parsed into the root yet.
+    IF_RET(root->map_num == 0, NVF_NOT_FOUND);
+    out->map = root->maps;
+    out->arr = &root->maps->arr;
+    return nvf_cursor_at(out) ? NVF_OK : NVF_NOT_FOUND;
+}
+
+nvf_err nvf_cursor_child(const nvf_cursor *c, nvf_cursor *out) {
+    IF_RET(c == NULL || out == NULL, NVF_BAD_ARG);
+    IF_RET(!nvf_cursor_at(c), NVF_NOT_FOUND);
+    nvf_value val = c->arr->values[c->i];
+    switch (c->arr->types[c->i]) {
+    case NVF_MAP:
+        IF_RET(val.map_i >= c->root->map_num, NVF_BAD_DATA);
+        *out = (nvf_cursor){
+            .root = c->root,
+            .map = &c->root->maps[val.map_i],
+            .arr = &c->root->maps[val.map_i].arr,
+        };
+        break;
+    case NVF_ARRAY:
+        IF_RET(val.array_i >= c->root->array_num, NVF_BAD_DATA);
+        *out = (nvf_cursor){
+            .root = c->root,
+            .arr = &c->root->arrays[val.array_i],
+        };
+        break;
+    default:
+        return NVF_BAD_VALUE_TYPE;
+    }
+    return nvf_cursor_at(out) ? NVF_OK : NVF_NOT_FOUND;
+}
+
+nvf_err nvf_cursor_next(nvf_cursor *c) {
+    IF_RET(c == NULL, NVF_BAD_ARG);
+    IF_RET(!nvf_cursor_at(c), NVF_NOT_FOUND);
+    ++c->i;
+    return nvf_cursor_at(c) ? NVF_OK : NVF_NOT_FOUND;
+}
+
+nvf_err nvf_cursor_find(nvf_cursor *c, const char *name) {
+    IF_RET(c == NULL || name == NULL, NVF_BAD_ARG);
+    IF_RET(c->arr == NULL, NVF_NOT_FOUND);
+    IF_RET(c->map == NULL, NVF_BAD_VALUE_TYPE);
+    uintptr_t name_len = strlen(name);
+    nvf_num n_i = 0;
+    IF_RET(!nvf_map_find(c->map, nvf_hash(name, name_len), name, name_len,
+                         &n_i),
+           NVF_NOT_FOUND);
+    c->i = n_i;
+    return NVF_OK;
+}
+
+const char *nvf_cursor_name(const nvf_cursor *c, nvf_num *len) {
+    IF_RET(c == NULL || c->map == NULL || !nvf_cursor_at(c), NULL);
+    if (len != NULL) {
+        *len = c->map->names[c->i].len;
+    }
+    return c->map->name_data + c->map->names[c->i].offset;
+}
+
+nvf_tag_value nvf_cursor_value(const nvf_cursor *c) {
+    if (c == NULL || c->arr == NULL) {
+        nvf_tag_value r = {
+            .val = {0},
+            .type = NVF_NONE,
+        };
+        return r;
+    }
+    return nvf_array_get_item(c->arr, c->i);
+}
+
+nvf_err nvf_get_array(nvf_root *root, const char **names, nvf_num name_depth,
+                      nvf_array *out) {
+    uintptr_t out_len = sizeof(*out);
+    return nvf_get_value(root, names, name_depth, out, &out_len, NVF_ARRAY);
+}
+
+nvf_err nvf_get_float(nvf_root *root, const char **names, nvf_num name_depth,
+                      double *out) {
+    uintptr_t out_len = sizeof(*out);
+    return nvf_get_value(root, names, name_depth, out, &out_len, NVF_FLOAT);
+}
+
+nvf_err nvf_get_blob(nvf_root *root, const char **names, nvf_num name_depth,
+                     uint8_t *bin_out, uintptr_t *bin_out_len) {
+    return nvf_get_value(root, names, name_depth, bin_out, bin_out_len,
+                         NVF_BLOB);
+}
+
+// str_out_len should include the null terminator.
+nvf_err nvf_get_str(nvf_root *root, const char **names, nvf_num name_depth,
+                    char *str_out, uintptr_t *str_out_len) {
+    return nvf_get_value(root, names, name_depth, str_out, str_out_len,
+                         NVF_STRING);
+}
+
+nvf_err nvf_get_int(nvf_root *root, const char **names, nvf_num name_depth,
+                    int64_t *out) {
+    uintptr_t out_len = sizeof(*out);
+    return nvf_get_value(root, names, name_depth, out, &out_len, NVF_INT);
+}
+
+// Character classes for the lexer. Looking bytes up in nvf_char_class keeps
+// the locale dependent <ctype.h> functions out of the parsing loops. Each byte
+// is listed on its own, since range designators are a GNU extension.
+enum {
+    NVF_CC_SPACE = 1 << 0,
+    NVF_CC_DIGIT = 1 << 1,
+    NVF_CC_HEX = 1 << 2,
+    NVF_CC_OPEN = 1 << 3,
+    NVF_CC_CLOSE = 1 << 4,
+};
+
+const uint8_t nvf_char_class[256] = {
+    ['\t'] = NVF_CC_SPACE, ['\n'] = NVF_CC_SPACE, ['\v'] = NVF_CC_SPACE,
+    ['\f'] = NVF_CC_SPACE, ['\r'] = NVF_CC_SPACE, [' '] = NVF_CC_SPACE,
+    ['0'] = NVF_CC_DIGIT | NVF_CC_HEX, ['1'] = NVF_CC_DIGIT | NVF_CC_HEX,
+    ['2'] = NVF_CC_DIGIT | NVF_CC_HEX, ['3'] = NVF_CC_DIGIT | NVF_CC_HEX,
+    ['4'] = NVF_CC_DIGIT | NVF_CC_HEX, ['5'] = NVF_CC_DIGIT | NVF_CC_HEX,
+    ['6'] = NVF_CC_DIGIT | NVF_CC_HEX, ['7'] = NVF_CC_DIGIT | NVF_CC_HEX,
+    ['8'] = NVF_CC_DIGIT | NVF_CC_HEX, ['9'] = NVF_CC_DIGIT | NVF_CC_HEX,
+    ['A'] = NVF_CC_HEX, ['B'] = NVF_CC_HEX, ['C'] = NVF_CC_HEX,
+    ['D'] = NVF_CC_HEX, ['E'] = NVF_CC_HEX, ['F'] = NVF_CC_HEX,
+    ['a'] = NVF_CC_HEX, ['b'] = NVF_CC_HEX, ['c'] = NVF_CC_HEX,
+    ['d'] = NVF_CC_HEX, ['e'] = NVF_CC_HEX, ['f'] = NVF_CC_HEX,
+    ['{'] = NVF_CC_OPEN,
+    ['['] = NVF_CC_OPEN,
+    ['}'] = NVF_CC_CLOSE,
+    [']'] = NVF_CC_CLOSE,
+};
+
+#define NVF_IS_CC(ch, cc) ((nvf_char_class[(uint8_t)(ch)] & (cc)) != 0)
+
+// The kinds of value a token can start. The parsers switch on these.
+typedef enum {
+    NVF_TOK_BAD = 0,
+    NVF_TOK_NUMBER,
+    NVF_TOK_STRING,
+    NVF_TOK_BLOB,
+    NVF_TOK_BLOB_REF,
+    NVF_TOK_MAP,
+    NVF_TOK_ARRAY,
+    NVF_TOK_CLOSE,
+} nvf_token;
+
+const uint8_t nvf_token_kind[256] = {
+    ['-'] = NVF_TOK_NUMBER, ['0'] = NVF_TOK_NUMBER, ['1'] = NVF_TOK_NUMBER,
+    ['2'] = NVF_TOK_NUMBER, ['3'] = NVF_TOK_NUMBER, ['4'] = NVF_TOK_NUMBER,
+    ['5'] = NVF_TOK_NUMBER, ['6'] = NVF_TOK_NUMBER, ['7'] = NVF_TOK_NUMBER,
+    ['8'] = NVF_TOK_NUMBER, ['9'] = NVF_TOK_NUMBER,
+    ['"'] = NVF_TOK_STRING,
+    ['b'] = NVF_TOK_BLOB,
+    ['{'] = NVF_TOK_MAP,
+    ['['] = NVF_TOK_ARRAY,
+    ['}'] = NVF_TOK_CLOSE,
+    [']'] = NVF_TOK_CLOSE,
+};
+
+// Find the kind of value that starts at data[d_i]. Only BLOBs need a second
+// byte to tell them apart from BLOB references.
+nvf_token nvf_token_at(const char *data, uintptr_t data_len, uintptr_t d_i) {
+    nvf_token t = nvf_token_kind[(uint8_t)data[d_i]];
+    if (t == NVF_TOK_BLOB && d_i + 1 < data_len && data[d_i + 1] == 'f') {
+        t = NVF_TOK_BLOB_REF;
+    }
+    return t;
+}
+
+// Find the end of the unquoted token starting at data[d_i], like a number.
+// Unquoted tokens end at whitespace or any brace or bracket.
+uintptr_t nvf_scan_bare(const char *data, uintptr_t data_len, uintptr_t d_i) {
+    for (; d_i < data_len &&
+           !NVF_IS_CC(data[d_i], NVF_CC_SPACE | NVF_CC_OPEN | NVF_CC_CLOSE);
+         ++d_i) {
+    }
+    return d_i;
+}
+
+uintptr_t nvf_next_token_i(const char *data, uintptr_t data_len) {
+    uintptr_t d_i = 0;
+    for (; d_i < data_len; ++d_i) {
+        if (NVF_IS_CC(data[d_i], NVF_CC_SPACE)) {
+            continue;
+        }
+        if (data[d_i] == '#') {
+            ++d_i;
+            if (d_i < data_len && data[d_i] == '[') {
+            scan_till_bracket:
+                for (; d_i < data_len && data[d_i] != ']'; ++d_i) {
+                }
+                ++d_i;
+                // Keep looking for the end of the comment.
+                if (d_i < data_len && data[d_i] != '#') {
+                    goto scan_till_bracket;
+                }
+            } else {
+                // Just go to a newline.
+                for (; d_i < data_len && data[d_i] != '\n'; ++d_i) {
+                }
+            }
+            continue;
+        }
+        break;
+    }
+    return d_i;
+}
+
+// Returns the character an escape sequence stands for, or -1 if the escape
+// sequence isn't valid.
+int nvf_unescape_char(char in) {
+    switch (in) {
+    case 'n':
+        return '\n';
+    case 't':
+        return '\t';
+    case 'r':
+        return '\r';
+    case '0':
+        return '\0';
+    case '"':
+        return '"';
+    case '\\':
+        return '\\';
+    default:
+        return -1;
+    }
+}
+
+// Scan the string starting at the quote at data[*d_i]. Strings on separate
+// lines are concatenated like C does.
+// string_name "line 1"
+//             "line 2"
+// 'string_name' will be "line 1line2".
+// On success, *d_i is the index of the last closing quote and *str_len is the
+// length of the string after escape sequences are replaced. On failure, *d_i
+// is where the error was found.
+nvf_err nvf_scan_str(const char *data, uintptr_t data_len, uintptr_t *d_i,
+                     uintptr_t *str_len) {
+    uintptr_t i = *d_i;
+    uintptr_t len = 0;
+    while (true) {
+        // Skip the opening quote.
+        ++i;
+        for (; i < data_len && data[i] != '"'; ++i) {
+            if (data[i] == '\\') {
+                ++i;
+                if (i >= data_len || nvf_unescape_char(data[i]) < 0) {
+                    *d_i = i;
+                    return i >= data_len ? NVF_BUF_OVF : NVF_BAD_DATA;
+                }
+            }
+            ++len;
+        }
+        if (i >= data_len) {
+            *d_i = i;
+            return NVF_BUF_OVF;
+        }
+        uintptr_t end_quote = i;
+        ++i;
+        i += nvf_next_token_i(data + i, data_len - i);
+        // If the next token isn't a string, then we're done.
+        if (i >= data_len || data[i] != '"') {
+            *d_i = end_quote;
+            *str_len = len;
+            return NVF_OK;
+        }
+    }
+}
+
+// Copy the string found with nvf_scan_str() into out, replacing escape
+// sequences. start is the first opening quote and end is the last closing
+// quote. The escape sequences were checked when scanning.
+void nvf_unescape_str(const char *data, uintptr_t start, uintptr_t end,
+                      char *out) {
+    uintptr_t o_i = 0;
+    for (uintptr_t i = start + 1; i < end; ++i) {
+        if (data[i] == '\\') {
+            ++i;
+            out[o_i++] = (char)nvf_unescape_char(data[i]);
+        } else if (data[i] == '"') {
+            // Go to the opening quote of the next string. The for loop skips
+            // the quote.
+            ++i;
+            i += nvf_next_token_i(data + i, end - i);
+        } else {
+            out[o_i++] = data[i];
+        }
+    }
+}
+
+// Parse an unsigned decimal or hex (0x prefixed) number at data[*d_i]. On
+// success, *d_i is the index of the first character after the number.
+nvf_err nvf_parse_u64(const char *data, uintptr_t data_len, uintptr_t *d_i,
+                      uint64_t *out) {
+    uintptr_t i = *d_i;
+    uint64_t base = 10;
+    if (i + 1 < data_len && data[i] == '0' &&
+        (data[i + 1] == 'x' || data[i + 1] == 'X')) {
+        base = 16;
+        i += 2;
+    }
+    uintptr_t num_start = i;
+    uint64_t val = 0;
+    for (; i < data_len; ++i) {
+        // Non-hex characters convert to UINT8_MAX, which ends the number.
+        uint8_t digit = nvf_hex_char_to_u8(data[i]);
+        if (digit >= base) {
+            break;
+        }
+        IF_RET(val > (UINT64_MAX - digit) / base, NVF_NUM_OVF);
+        val = val * base + digit;
+    }
+    IF_RET(i == num_start, NVF_BAD_VALUE_FMT);
+
+    *d_i = i;
+    *out = val;
+    return NVF_OK;
+}
+
+// Find the end of the name starting at data[d_i]. Names end at whitespace or
+// at the brace or bracket of a map or array value.
+uintptr_t nvf_scan_name(const char *data, uintptr_t data_len, uintptr_t d_i) {
+    for (; d_i < data_len && !NVF_IS_CC(data[d_i], NVF_CC_SPACE | NVF_CC_OPEN);
+         ++d_i) {
+    }
+    return d_i;
+}
+
+// Longest number, including its sign and exponent, that nvf_scan_number()
+// reads.
+#define NVF_NUM_TEXT_MAX 128
+
+// Parse the int or float at data[*d_i]. Numbers end at whitespace, a bracket,
+// a closing brace or the end of the data. Plain decimal ints are read
+// directly. Other ints are tried with strtoll() before strtod() because ints
+// are valid floats. On success, *d_i is the index of the first character
+// after the number.
+nvf_err nvf_scan_number(const char *data, uintptr_t data_len, uintptr_t *d_i,
+                        nvf_value *out, nvf_data_type *out_type) {
+    uintptr_t start = *d_i;
+    uintptr_t end_i = nvf_scan_bare(data, data_len, start);
+    uintptr_t len = end_i - start;
+    IF_RET(len == 0, NVF_BAD_VALUE_FMT);
+    IF_RET(end_i < data_len && data[end_i] == '{', NVF_BAD_VALUE_FMT);
+
+    // Leading zeros mean octal or hex, so those go through strtoll(). 18
+    // digits can't overflow.
+    const char *value = data + start;
+    bool neg = value[0] == '-';
+    uintptr_t digits = len - neg;
+    if (digits > 0 && digits <= 18 && (value[neg] != '0' || digits == 1)) {
+        int64_t v = 0;
+        uintptr_t i = neg;
+        for (; i < len && NVF_IS_CC(value[i], NVF_CC_DIGIT); ++i) {
+            v = v * 10 + (value[i] - '0');
+        }
+        if (i == len) {
+            out->v_int = neg ? -v : v;
+            *out_type = NVF_INT;
+            *d_i = end_i;
+            return NVF_OK;
+        }
+    }
+
+    // strtoll() and strtod() need a null terminated copy, since the data
+    // doesn't have to be null terminated.
+    char text[NVF_NUM_TEXT_MAX + 1];
+    IF_RET(len > NVF_NUM_TEXT_MAX, NVF_BAD_VALUE_FMT);
+    memcpy(text, value, len);
+    text[len] = '\0';
+    nvf_value npv = {0};
+    nvf_data_type npt = NVF_INT;
+    char *end = text;
+    npv.v_int = strtoll(text, &end, 0);
+    IF_RET(npv.v_int == LLONG_MAX || npv.v_int == LLONG_MIN, NVF_NUM_OVF);
+    IF_RET(end == text, NVF_BAD_VALUE_FMT);
+    if (end != text + len) {
+        npt = NVF_FLOAT;
+        npv.v_float = strtod(text, &end);
+        IF_RET(npv.v_float == HUGE_VAL || npv.v_float == HUGE_VALF ||
+                   npv.v_float == HUGE_VALL,
+               NVF_NUM_OVF);
+        IF_RET(end != text + len, NVF_BAD_VALUE_FMT);
+    }
+    *d_i = end_i;
+    *out = npv;
+    *out_type = npt;
+    return NVF_OK;
+}
+
+// Scan the BLOB at data[*d_i], like bx0102 or b64AQI=. Base64 BLOBs may
+// leave out their padding. On success, *digit_start is the index of the first
+// hex or base64 digit and *d_i is the index of the first character after the
+// BLOB. On failure, *d_i is where the error was found.
+nvf_err nvf_scan_blob(const char *data, uintptr_t data_len, uintptr_t *d_i,
+                      uintptr_t *digit_start) {
+    uintptr_t i = *d_i;
+    // Make sure there's space for 'x' and one nibble of data.
+    IF_RET(i + 2 >= data_len, NVF_BUF_OVF);
+    ++i;
+    *d_i = i;
+    if (data[i] == '6' && data[i + 1] == '4') {
+        i += 2;
+        uintptr_t start = i;
+        i += nvf_b64_span(data + i, data_len - i);
+        uintptr_t digits = i - start;
+        uintptr_t pad = 0;
+        for (; pad < 2 && i < data_len && data[i] == '='; ++pad, ++i) {
+        }
+        *d_i = i;
+        // One digit left over can't hold a whole byte.
+        IF_RET(digits == 0 || digits % 4 == 1, NVF_BAD_VALUE_FMT);
+        IF_RET(pad > 0 && (digits + pad) % 4 != 0, NVF_BAD_VALUE_FMT);
+        *digit_start = start;
+        return NVF_OK;
+    }
+    IF_RET(data[i] != 'x', NVF_BAD_VALUE_FMT);
+    ++i;
+    uintptr_t start = i;
+    for (; i < data_len && NVF_IS_CC(data[i], NVF_CC_HEX); ++i) {
+    }
+    *d_i = i;
+    IF_RET(i == start, NVF_BAD_VALUE_FMT);
+    *digit_start = start;
+    return NVF_OK;
+}
+
+// Convert the hex digits found with nvf_scan_blob() to (hex_len + 1) / 2
+// bytes. An odd last digit is the high nibble of the last byte.
+void nvf_decode_hex(const char *hex, uintptr_t hex_len, uint8_t *out) {
+    for (uintptr_t h_i = 0; h_i < hex_len; ++h_i) {
+        uint8_t bin_val = nvf_hex_char_to_u8(hex[h_i]);
+        if (h_i % 2 == 0) {
+            out[h_i / 2] = bin_val << 4;
+        } else {
+            out[h_i / 2] |= bin_val;
+        }
+    }
+}
+
+// The number of digits in a BLOB found with nvf_scan_blob(), without base64
+// padding. start and end come from nvf_scan_blob().
+uintptr_t nvf_blob_digits(const char *data, uintptr_t start, uintptr_t end) {
+    for (; end > start && data[end - 1] == '='; --end) {
+    }
+    return end - start;
+}
+
+// Check if a BLOB found with nvf_scan_blob() is in base64.
+bool nvf_blob_is_b64(const char *data, uintptr_t start) {
+    return data[start - 1] == '4';
+}
+
+// The length in bytes of a BLOB found with nvf_scan_blob().
+uintptr_t nvf_blob_len(const char *data, uintptr_t start, uintptr_t end) {
+    uintptr_t digits = nvf_blob_digits(data, start, end);
+    return nvf_blob_is_b64(data, start) ? digits * 3 / 4 : (digits + 1) / 2;
+}
+
+// Decode a BLOB found with nvf_scan_blob() into nvf_blob_len() bytes of out.
+void nvf_decode_blob(const char *data, uintptr_t start, uintptr_t end,
+                     uint8_t *out) {
+    uintptr_t digits = nvf_blob_digits(data, start, end);
+    if (nvf_blob_is_b64(data, start)) {
+        nvf_decode_b64(data + start, digits, out);
+    } else {
+        nvf_decode_hex(data + start, digits, out);
+    }
+}
+
+// Scan the BLOB reference at data[*d_i], like bf"path":offset:length. Only
+// out's offset, len and path_len are set, and the path starts at
+// data[*path_start]. On success, *d_i is the index of the first character
+// after the reference. On failure, *d_i is where the error was found.
+nvf_err nvf_scan_blob_ref(const char *data, uintptr_t data_len, uintptr_t *d_i,
+                          uintptr_t *path_start, nvf_blob_ref *out) {
+    uintptr_t i = *d_i + 2;
+    nvf_err e = NVF_OK;
+    if (i >= data_len || data[i] != '"') {
+        e = NVF_BAD_VALUE_FMT;
+        goto done;
+    }
+    ++i;
+    uintptr_t start = i;
+    for (; i < data_len && data[i] != '"'; ++i) {
+    }
+    if (i >= data_len) {
+        e = NVF_BUF_OVF;
+        goto done;
+    }
+    uintptr_t path_len = i - start;
+    ++i;
+
+    uint64_t ref_offset = 0;
+    uint64_t ref_len = 0;
+    if (path_len == 0 || i >= data_len || data[i] != ':') {
+        e = NVF_BAD_VALUE_FMT;
+        goto done;
+    }
+    ++i;
+    e = nvf_parse_u64(data, data_len, &i, &ref_offset);
+    if (e != NVF_OK) {
+        goto done;
+    }
+    if (i >= data_len || data[i] != ':') {
+        e = NVF_BAD_VALUE_FMT;
+        goto done;
+    }
+    ++i;
+    e = nvf_parse_u64(data, data_len, &i, &ref_len);
+    if (e != NVF_OK) {
+        goto done;
+    }
+    if (ref_len == 0 || ref_len > UINT32_MAX) {
+        e = ref_len == 0 ? NVF_BAD_VALUE_FMT : NVF_NUM_OVF;
+        goto done;
+    }
+    *path_start = start;
+    out->offset = ref_offset;
+    out->len = ref_len;
+    out->path_len = path_len;
+
+done:
+    *d_i = i;
+    return e;
+}
+
+// The length of a BLOB reference's path once it's resolved against the
+// root's ref_dir. Absolute paths are kept as they are.
+uintptr_t nvf_ref_path_len(const nvf_root *root, const char *path,
+                           uintptr_t path_len) {
+    if (root->ref_dir == NULL || path[0] == '/') {
+        return path_len;
+    }
+    return strlen(root->ref_dir) + 1 + path_len;
+}
+
+// Check a BLOB reference path is allowed in root. Roots with ref_confined set
+// only take relative paths without .. components, so they stay under ref_dir.
+nvf_err nvf_check_ref_path(const nvf_root *root, const char *path,
+                           uintptr_t path_len) {
+    IF_RET(!root->ref_confined, NVF_OK);
+    IF_RET(path[0] == '/', NVF_BAD_DATA);
+    for (uintptr_t p_i = 0; p_i < path_len;) {
+        uintptr_t end = p_i;
+        for (; end < path_len && path[end] != '/'; ++end) {
+        }
+        IF_RET(end - p_i == 2 && path[p_i] == '.' && path[p_i + 1] == '.',
+               NVF_BAD_DATA);
+        p_i = end + 1;
+    }
+    return NVF_OK;
+}
+
+// Get the capacity to grow a table with cap entries to, twice as big plus
+// extra. Returns 0 if that doesn't fit in an nvf_num.
+nvf_num nvf_grow_cap(nvf_num cap, uintptr_t extra) {
+    uint64_t next_cap = (uint64_t)cap * 2 + extra;
+    return next_cap > UINT32_MAX ? 0 : (nvf_num)next_cap;
+}
+
+// Grow the storage for an array's entries to next_cap entries, with the
+// names of its map if names isn't NULL. Each part is freed using the array's
+// capacity, so nothing is changed until all of them are allocated.
+nvf_err nvf_grow_entries(nvf_root *root, nvf_array *arr, nvf_name **names,
+                         nvf_num next_cap) {
+    nvf_num cap = arr->cap;
+    uint8_t *new_types =
+        nvf_realloc(root, NULL, 0, next_cap * sizeof(*new_types));
+    nvf_value *new_values =
+        nvf_realloc(root, NULL, 0, next_cap * sizeof(*new_values));
+    nvf_name *new_names =
+        names == NULL ? NULL
+                      : nvf_realloc(root, NULL, 0,
+                                    next_cap * sizeof(*new_names));
+    if (new_types == NULL || new_values == NULL ||
+        (names != NULL && new_names == NULL)) {
+        nvf_dealloc(root, new_types, next_cap * sizeof(*new_types));
+        nvf_dealloc(root, new_values, next_cap * sizeof(*new_values));
+        nvf_dealloc(root, new_names, next_cap * sizeof(*new_names));
+        return NVF_BAD_ALLOC;
+    }
+    if (cap > 0) {
+        memcpy(new_types, arr->types, cap * sizeof(*new_types));
+        memcpy(new_values, arr->values, cap * sizeof(*new_values));
+    }
+    bzero(new_types + cap, (next_cap - cap) * sizeof(*new_types));
+    bzero(new_values + cap, (next_cap - cap) * sizeof(*new_values));
+    nvf_dealloc(root, arr->types, cap * sizeof(*arr->types));
+    nvf_dealloc(root, arr->values, cap * sizeof(*arr->values));
+    arr->types = new_types;
+    arr->values = new_values;
+    if (names != NULL) {
+        if (cap > 0) {
+            memcpy(new_names, *names, cap * sizeof(*new_names));
+        }
+        bzero(new_names + cap, (next_cap - cap) * sizeof(*new_names));
+        nvf_dealloc(root, *names, cap * sizeof(**names));
+        *names = new_names;
+    }
+    arr->cap = next_cap;
+    return NVF_OK;
+}
+
+nvf_err nvf_ensure_array_cap(nvf_root *root, nvf_array *arr) {
+    IF_RET(root == NULL || arr == NULL, NVF_BAD_ARG);
+
+    if (arr->num + 1 > arr->cap) {
+        nvf_num next_cap = nvf_grow_cap(arr->cap, 4);
+        IF_RET(next_cap == 0, NVF_BAD_ALLOC);
+        return nvf_grow_entries(root, arr, NULL, next_cap);
+    }
+    return NVF_OK;
+}
+
+nvf_err nvf_ensure_map_cap(nvf_root *root, nvf_map *m) {
+    IF_RET(root == NULL, NVF_BAD_ARG);
+
+    // The names grow with the values.
+    if (m->arr.num + 1 > m->arr.cap) {
+        nvf_num next_cap = nvf_grow_cap(m->arr.cap, 4);
+        IF_RET(next_cap == 0, NVF_BAD_ALLOC);
+        return nvf_grow_entries(root, &m->arr, &m->names, next_cap);
+    }
+    return NVF_OK;
+}
+
+// Copy a name into a map's name data and point the map's next entry at it.
+nvf_err nvf_add_name(nvf_root *root, nvf_map *m, const char *name,
+                     uintptr_t name_len, uint32_t hash) {
+    IF_RET(name_len >= UINT32_MAX - m->name_len, NVF_NUM_OVF);
+    if (m->name_len + name_len + 1 > m->name_cap) {
+        nvf_num next_cap = nvf_grow_cap(m->name_cap, name_len + 1);
+        IF_RET(next_cap == 0, NVF_BAD_ALLOC);
+        char *new_data =
+            nvf_realloc(root, m->name_data, m->name_cap, next_cap);
+        IF_RET(new_data == NULL, NVF_BAD_ALLOC);
+        m->name_data = new_data;
+        m->name_cap = next_cap;
+    }
+    nvf_name *n = &m->names[m->arr.num];
+    n->hash = hash;
+    n->len = name_len;
+    n->offset = m->name_len;
+    memcpy(m->name_data + n->offset, name, name_len);
+    // Make sure we have a null terminator like all good C strings do.
+    m->name_data[n->offset + name_len] = '\0';
+    m->name_len += name_len + 1;
+    return NVF_OK;
+}
+
+nvf_err_data_i nvf_parse_buf_map_arr(const char *data, uintptr_t data_len,
+                                     nvf_root *root, nvf_num map_arr_i,
+                                     nvf_parse_type p_type) {
+    nvf_err_data_i r = {
+        .data_i = 0,
+        .err = NVF_OK,
+    };
+    IF_RET_DATA(root == NULL, r, NVF_BAD_ARG);
+    IF_RET_DATA(p_type != NVF_PARSE_MAP && p_type != NVF_PARSE_ARRAY, r,
+                NVF_BAD_ARG);
+    IF_RET_DATA(root->init_val != NVF_INIT_VAL, r, NVF_NOT_INIT);
+
+    // TODO: make a better error code for this.
+    bool ovf_cond = p_type == NVF_PARSE_MAP ? map_arr_i >= root->map_num
+                                            : map_arr_i >= root->array_num;
+    IF_RET_DATA(ovf_cond, r, NVF_BUF_OVF);
+    nvf_map *cur_map = p_type == NVF_PARSE_MAP ? root->maps + map_arr_i : NULL;
+    nvf_array *cur_arr =
+        cur_map == NULL ? root->arrays + map_arr_i : &cur_map->arr;
+    for (; r.data_i < data_len; ++r.data_i) {
+        NVF_INST_START(token_start);
+        r.data_i += nvf_next_token_i(data + r.data_i, data_len - r.data_i);
+        IF_RET_DATA(r.data_i >= data_len, r, NVF_OK);
+        if (nvf_token_kind[(uint8_t)data[r.data_i]] == NVF_TOK_CLOSE) {
+            // When parsing an array, encountering a brace might be valid since
+            // We don't put values in an array by defult.
+            IF_RET_DATA(data[r.data_i] == '}' && map_arr_i == 0, r,
+                        NVF_UNMATCHED_BRACE);
+            // Skip over the brace so the calling function doesn't detect it.
+            ++r.data_i;
+            r.err = NVF_OK;
+            return r;
+        }
+        // TODO: Add multiline comment scanning between the names and values.
+
+        const char *name = NULL;
+        uintptr_t name_len = 0;
+        uint32_t name_hash = 0;
+        // Skip checking names if we're not storing them anyway.
+        if (cur_map != NULL) {
+            name = &data[r.data_i];
+            r.data_i = nvf_scan_name(data, data_len, r.data_i);
+            IF_RET_DATA(data_len <= r.data_i, r, NVF_BUF_OVF);
+            name_len = (data + r.data_i) - name;
+            // Make sure the name doesn't collide with anything we already have.
+            // The name we inferred isn't null terminated, so compare it with
+            // the stored lengths.
+            name_hash = nvf_hash(name, name_len);
+            nvf_num n_i = 0;
+            for (; n_i < cur_arr->num; ++n_i) {
+                IF_RET_DATA(
+                    nvf_name_eq(cur_map, n_i, name_hash, name, name_len), r,
+                    NVF_DUP_NAME);
+            }
+            NVF_INST_ADD(tokens, 1);
+        }
+
+        r.data_i += nvf_next_token_i(data + r.data_i, data_len - r.data_i);
+        IF_RET_DATA(r.data_i >= data_len, r, NVF_BUF_OVF);
+        NVF_INST_STOP(token_start, NVF_PHASE_TOKEN);
+        NVF_INST_ADD(tokens, 1);
+
+        // We've found value. Parse it depending on what it is.
+        const char *value = &data[r.data_i];
+        NVF_INST_START(value_start);
+        switch (nvf_token_at(data, data_len, r.data_i)) {
+        case NVF_TOK_NUMBER: {
+            nvf_value npv = {0};
+            nvf_data_type npt = NVF_INT;
+            r.err = nvf_scan_number(data, data_len, &r.data_i, &npv, &npt);
+            IF_RET(r.err != NVF_OK, r);
+            // Subtract one because the for loop will increment it anyway.
+            --r.data_i;
+
+            // Grow the current map if we need to.
+            if (cur_map == NULL) {
+                r.err = nvf_ensure_array_cap(root, cur_arr);
+            } else {
+                r.err = nvf_ensure_map_cap(root, cur_map);
+            }
+            IF_RET_DATA(r.err != NVF_OK, r, r.err);
+            // The array's arrays could have been reallocated.
+            // Update the pointers so they point to the right location.
+            // cur_arr = &root->maps[map_arr_i].arr;
+
+            // Now that we have enough memory, add the integer value to the map.
+            cur_arr->values[cur_arr->num] = npv;
+            cur_arr->types[cur_arr->num] = npt;
+            break;
+        }
+        case NVF_TOK_STRING: {
+            // Grow the current map if we need to.
+            r.err = cur_map == NULL ? nvf_ensure_array_cap(root, cur_arr)
+                                    : nvf_ensure_map_cap(root, cur_map);
+            IF_RET_DATA(r.err != NVF_OK, r, r.err);
+
+            // Find the string's length first so it only gets allocated once.
+            uintptr_t str_start = r.data_i;
+            uintptr_t str_len = 0;
+            r.err = nvf_scan_str(data, data_len, &r.data_i, &str_len);
+            IF_RET(r.err != NVF_OK, r);
+
+            nvf_str **map_str = &cur_arr->values[cur_arr->num].v_string;
+            uintptr_t old_len = 0;
+            void *old = nvf_stale_leaf(cur_arr, &old_len);
+            nvf_str *str = nvf_alloc_leaf(root, old, old_len,
+                                          sizeof(*str) + str_len + 1);
+            IF_RET_DATA(str == NULL, r, NVF_BAD_ALLOC);
+            str->len = str_len;
+            nvf_unescape_str(data, str_start, r.data_i, str->data);
+            // Make sure we have a null terminator like all good C strings do.
+            str->data[str_len] = '\0';
+
+            *map_str = str;
+            cur_arr->types[cur_arr->num] = NVF_STRING;
+            break;
+        }
+        case NVF_TOK_BLOB_REF: {
+            // This is a BLOB in another file, like bf"path":offset:length.
+            // Only store where the BLOB is. It gets mapped when it's read.
+            uintptr_t path_start = 0;
+            nvf_blob_ref ref_info = {0};
+            r.err = nvf_scan_blob_ref(data, data_len, &r.data_i, &path_start,
+                                      &ref_info);
+            IF_RET(r.err != NVF_OK, r);
+            uintptr_t path_len = ref_info.path_len;
+            // Point errors at the path rather than past the reference.
+            r.err = nvf_check_ref_path(root, data + path_start, path_len);
+            if (r.err != NVF_OK) {
+                r.data_i = path_start;
+                return r;
+            }
+            uintptr_t full_len =
+                nvf_ref_path_len(root, data + path_start, path_len);
+            IF_RET_DATA(full_len >= UINT32_MAX, r, NVF_NUM_OVF);
+            // The for loop will increment this later. decrement it to account
+            // for that.
+            --r.data_i;
+
+            // Grow the current map if we need to.
+            if (cur_map == NULL) {
+                r.err = nvf_ensure_array_cap(root, cur_arr);
+            } else {
+                r.err = nvf_ensure_map_cap(root, cur_map);
+            }
+            IF_RET_DATA(r.err != NVF_OK, r, r.err);
+
+            nvf_blob_ref **map_ref = &cur_arr->values[cur_arr->num].v_blob_ref;
+            uintptr_t old_len = 0;
+            void *old = nvf_stale_leaf(cur_arr, &old_len);
+            nvf_blob_ref *ref = nvf_alloc_leaf(root, old, old_len,
+                                               sizeof(*ref) + full_len + 1);
+            IF_RET_DATA(ref == NULL, r, NVF_BAD_ALLOC);
+            bzero(ref, sizeof(*ref));
+            ref->offset = ref_info.offset;
+            ref->len = ref_info.len;
+            ref->path_len = full_len;
+            // Store relative paths resolved, so reading the BLOB doesn't
+            // depend on the working directory.
+            uintptr_t dir_len = full_len - path_len;
+            if (dir_len > 0) {
+                memcpy(ref->path, root->ref_dir, dir_len - 1);
+                ref->path[dir_len - 1] = '/';
+            }
+            memcpy(ref->path + dir_len, data + path_start, path_len);
+            ref->path[full_len] = '\0';
+
+            *map_ref = ref;
+            cur_arr->types[cur_arr->num] = NVF_BLOB_REF;
+            break;
+        }
+        case NVF_TOK_BLOB: {
+            uintptr_t blob_start = 0;
+            r.err = nvf_scan_blob(data, data_len, &r.data_i, &blob_start);
+            IF_RET(r.err != NVF_OK, r);
+            uintptr_t blob_end = r.data_i;
+            // The for loop will increment this later. decrement it to account
+            // for that.
+            --r.data_i;
+
+            // Grow the current map if we need to.
+            if (cur_map == NULL) {
+                r.err = nvf_ensure_array_cap(root, cur_arr);
+            } else {
+                r.err = nvf_ensure_map_cap(root, cur_map);
+            }
+            IF_RET_DATA(r.err != NVF_OK, r, r.err);
+
+            nvf_blob **map_blob = &cur_arr->values[cur_arr->num].v_blob;
+            uintptr_t bin_blob_len = nvf_blob_len(data, blob_start, blob_end);
+            uintptr_t old_len = 0;
+            void *old = nvf_stale_leaf(cur_arr, &old_len);
+            nvf_blob *blob = nvf_alloc_leaf(root, old, old_len,
+                                            sizeof(*blob) + bin_blob_len);
+            IF_RET_DATA(blob == NULL, r, NVF_BAD_ALLOC);
+            blob->len = bin_blob_len;
+
+            nvf_decode_blob(data, blob_start, blob_end, blob->data);
+            *map_blob = blob;
+            cur_arr->types[cur_arr->num] = NVF_BLOB;
+            break;
+        }
+        case NVF_TOK_MAP: {
+            // Don't allow maps to be nested in arrays.
+            IF_RET_DATA(p_type == NVF_PARSE_ARRAY || cur_map == NULL, r,
+                        NVF_ERROR);
+            ++r.data_i;
+            // Allocate a new map, then parse the data in the new map.
+            if (root->map_num + 1 > root->map_cap) {
+                // TODO: Make a macro for the 8 constant.
+                nvf_num new_cap = nvf_grow_cap(root->map_cap, 4);
+                IF_RET_DATA(new_cap == 0, r, NVF_BAD_ALLOC);
+                nvf_map *new_map = nvf_realloc(
+                    root, root->maps, root->map_cap * sizeof(*new_map),
+                    new_cap * sizeof(*new_map));
+                IF_RET_DATA(new_map == NULL, r, NVF_BAD_ALLOC);
+                bzero(new_map + root->map_num,
+                      (new_cap - root->map_num) * sizeof(*new_map));
+                root->maps = new_map;
+                root->map_cap = new_cap;
+            }
+            cur_map = root->maps + map_arr_i;
+            cur_arr = &root->maps[map_arr_i].arr;
+
+            // Grow the current map if we need to.
+            if (cur_map == NULL) {
+                r.err = nvf_ensure_array_cap(root, cur_arr);
+            } else {
+                r.err = nvf_ensure_map_cap(root, cur_map);
+            }
+            IF_RET_DATA(r.err != NVF_OK, r, r.err);
+
+            // TODO: See if we should increment map_num before or after this
+            // function.
+            ++root->map_num;
+            nvf_num new_map_num = root->map_num;
+            nvf_err_data_i r2 =
+                nvf_parse_buf_map_arr(data + r.data_i, data_len - r.data_i,
+                                      root, new_map_num - 1, NVF_PARSE_MAP);
+            r.data_i += r2.data_i;
+            // The for loop will increment this. Decrement it to account for
+            // that.
+            --r.data_i;
+            r.err = r2.err;
+            IF_RET(r.err != NVF_OK, r);
+
+            // The pointer to the map array may have moved, udpate it.
+            if (cur_map == NULL) {
+                cur_arr = root->arrays + map_arr_i;
+            } else {
+                cur_map = root->maps + map_arr_i;
+                cur_arr = &cur_map->arr;
+            }
+
+            cur_arr->values[cur_arr->num].map_i = new_map_num - 1;
+            cur_arr->types[cur_arr->num] = NVF_MAP;
+            break;
+        }
+        case NVF_TOK_ARRAY: {
+            ++r.data_i;
+            // Allocate a new map, then parse the data in the new map.
+            if (root->array_num + 1 > root->array_cap) {
+                // TODO: Make a macro for the 8 constant.
+                nvf_num new_cap = nvf_grow_cap(root->array_cap, 4);
+                IF_RET_DATA(new_cap == 0, r, NVF_BAD_ALLOC);
+                nvf_array *new_arr = nvf_realloc(
+                    root, root->arrays, root->array_cap * sizeof(*new_arr),
+                    new_cap * sizeof(*new_arr));
+                IF_RET_DATA(new_arr == NULL, r, NVF_BAD_ALLOC);
+                bzero(new_arr + root->array_num,
+                      (new_cap - root->array_num) * sizeof(*new_arr));
+                root->arrays = new_arr;
+                root->array_cap = new_cap;
+            }
+            // The pointer value will be different depending on if we're parsing
+            // an array or a map. Make sure we account for that here. If we're
+            // parsing a map, our current array won't be changed.
+            cur_arr = cur_map == NULL ? root->arrays + map_arr_i : cur_arr;
+
+            if (cur_map == NULL) {
+                r.err = nvf_ensure_array_cap(root, cur_arr);
+            } else {
+                r.err = nvf_ensure_map_cap(root, cur_map);
+            }
+            IF_RET_DATA(r.err != NVF_OK, r, r.err);
+
+            ++root->array_num;
+            // The array number may change if there's nested arrays. Save it
+            // just in case.
+            nvf_num new_arr_num = root->array_num;
+
+            nvf_err_data_i r2 =
+                nvf_parse_buf_map_arr(data + r.data_i, data_len - r.data_i,
+                                      root, new_arr_num - 1, NVF_PARSE_ARRAY);
+            r.data_i += r2.data_i;
+            // The for loop will increment this. Decrement it to account for
+            // that.
+            --r.data_i;
+            r.err = r2.err;
+            IF_RET(r.err != NVF_OK, r);
+
+            // The pointer to the map array may have moved, udpate it.
+            if (cur_map == NULL) {
+                cur_arr = root->arrays + map_arr_i;
+            } else {
+                cur_map = root->maps + map_arr_i;
+                cur_arr = &cur_map->arr;
+            }
+
+            cur_arr->values[cur_arr->num].array_i = new_arr_num - 1;
+            cur_arr->types[cur_arr->num] = NVF_ARRAY;
+            break;
+        }
+        default:
+            r.err = NVF_BAD_VALUE_TYPE;
+            return r;
+        }
+        NVF_INST_VALUE(cur_arr->types[cur_arr->num],
+                       data + r.data_i + 1 - value, value_start);
+        if (cur_map != NULL) {
+            r.err = nvf_add_name(root, cur_map, name, name_len, name_hash);
+            IF_RET(r.err != NVF_OK, r);
+        }
+        cur_arr->num++;
+    }
+
+    return r;
+}
+
+// We reallocate instead of mallocing just in case the old pointer points to
+// allocated memory. That means we don't really need to do cleanup if the old
+// pointer points to allocated memory. That implies we need to zero all the
+// pointers in the struct before they are passed into this function.
+// TODO: Re-think how to make cleanup simpler if an allocation fails.
+nvf_err_data_i nvf_parse_buf(const char *data, uintptr_t data_len,
+                             nvf_root *out_root) {
+    nvf_err_data_i r = {
+        .data_i = 0,
+        .err = NVF_OK,
+    };
+    IF_RET_DATA(out_root == NULL, r, NVF_BAD_ARG);
+    IF_RET_DATA(out_root->init_val != NVF_INIT_VAL, r, NVF_NOT_INIT);
+    IF_RET_DATA(out_root->frozen, r, NVF_READ_ONLY);
+    // The fingerprint covers everything parsed into the root, so parsing
+    // more data into it continues the hash. A root filled some other way has
+    // no fingerprint to continue. Check before the root map is added, since
+    // new and reset roots don't count one.
+    bool had_data = (out_root->map_num > 0 && out_root->maps[0].arr.num > 0) ||
+                    out_root->array_num > 0;
+
+    // Allocate space for the first map.
+    if (out_root->map_cap == 0 || out_root->maps == NULL) {
+        nvf_map *new_map = nvf_realloc(out_root, NULL, 0, sizeof(*new_map));
+        IF_RET_DATA(new_map == NULL, r, NVF_BAD_ALLOC);
+        bzero(new_map, sizeof(*new_map));
+        out_root->maps = new_map;
+        out_root->map_num = 1;
+        out_root->map_cap = 1;
+    }
+    // A reset root keeps its maps, but the root map isn't counted.
+    if (out_root->map_num == 0) {
+        out_root->map_num = 1;
+    }
+    uint64_t fingerprint = out_root->fingerprint;
+    out_root->fingerprint = 0;
+    NVF_INST_RESET();
+    // Use map_num - 1 so we can try parsing again, or parse multiple buffers
+    // with multiple function calls.
+    r = nvf_parse_buf_map_arr(data, data_len, out_root, out_root->map_num - 1,
+                              NVF_PARSE_MAP);
+    NVF_INST_FINISH();
+    if (r.err == NVF_OK && (!had_data || fingerprint != 0)) {
+        out_root->fingerprint =
+            nvf_fingerprint_seeded(data, data_len, had_data ? fingerprint : 0);
+    }
+    return r;
+}
+
+nvf_err_data_i nvf_parse_buf_if_changed(const char *data, uintptr_t data_len,
+                                        nvf_root *root, uint8_t *parsed) {
+    nvf_err_data_i r = {
+        .data_i = 0,
+        .err = NVF_OK,
+    };
+    IF_RET_DATA(root == NULL || (data == NULL && data_len > 0), r,
+                NVF_BAD_ARG);
+    IF_RET_DATA(root->init_val != NVF_INIT_VAL, r, NVF_NOT_INIT);
+    if (parsed != NULL) {
+        *parsed = 0;
+    }
+    if (root->fingerprint != 0 &&
+        root->fingerprint == nvf_fingerprint(data, data_len)) {
+        r.data_i = data_len;
+        return r;
+    }
+    r.err = nvf_root_reset(root);
+    IF_RET(r.err != NVF_OK, r);
+    if (parsed != NULL) {
+        *parsed = 1;
+    }
+    return nvf_parse_buf(data, data_len, root);
+}
+
+// Call an event callback if it's set. Return from the calling function if
+// the callback doesn't return NVF_OK.
+#define NVF_EVENT(r, cb, ...)                                                  \
+    do {                                                                       \
+        if ((cb) != NULL) {                                                    \
+            (r).err = (cb)(__VA_ARGS__);                                       \
+            if ((r).err != NVF_OK) {                                           \
+                return (r);                                                    \
+            }                                                                  \
+        }                                                                      \
+    } while (0)
+
+// Call the callbacks in ev for the names and values in data, reading them
+// like nvf_parse_buf_map_arr() does. depth is 0 for the root map.
+nvf_err_data_i nvf_events_map_arr(const char *data, uintptr_t data_len,
+                                  const nvf_events *ev, void *ctx,
+                                  nvf_parse_type p_type, nvf_num depth) {
+    nvf_err_data_i r = {
+        .data_i = 0,
+        .err = NVF_OK,
+    };
+    for (; r.data_i < data_len; ++r.data_i) {
+        r.data_i += nvf_next_token_i(data + r.data_i, data_len - r.data_i);
+        if (r.data_i >= data_len) {
+            break;
+        }
+        if (nvf_token_kind[(uint8_t)data[r.data_i]] == NVF_TOK_CLOSE) {
+            // Like nvf_parse_buf_map_arr(), a bracket closes whatever is open,
+            // and one outside of everything ends the data.
+            IF_RET_DATA(data[r.data_i] == '}' && depth == 0, r,
+                        NVF_UNMATCHED_BRACE);
+            // Skip over the brace so the calling function doesn't detect it.
+            ++r.data_i;
+            return r;
+        }
+
+        if (p_type == NVF_PARSE_MAP) {
+            uintptr_t name_start = r.data_i;
+            r.data_i = nvf_scan_name(data, data_len, r.data_i);
+            IF_RET_DATA(data_len <= r.data_i, r, NVF_BUF_OVF);
+            NVF_EVENT(r, ev->on_name, ctx, data + name_start,
+                      r.data_i - name_start);
+            r.data_i += nvf_next_token_i(data + r.data_i, data_len - r.data_i);
+            IF_RET_DATA(r.data_i >= data_len, r, NVF_BUF_OVF);
+        }
+
+        char ch = data[r.data_i];
+        switch (nvf_token_at(data, data_len, r.data_i)) {
+        case NVF_TOK_NUMBER: {
+            nvf_value npv = {0};
+            nvf_data_type npt = NVF_INT;
+            r.err = nvf_scan_number(data, data_len, &r.data_i, &npv, &npt);
+            IF_RET(r.err != NVF_OK, r);
+            // Subtract one because the for loop will increment it anyway.
+            --r.data_i;
+            if (npt == NVF_INT) {
+                NVF_EVENT(r, ev->on_int, ctx, npv.v_int);
+            } else {
+                NVF_EVENT(r, ev->on_float, ctx, npv.v_float);
+            }
+            break;
+        }
+        case NVF_TOK_STRING: {
+            uintptr_t str_start = r.data_i;
+            uintptr_t str_len = 0;
+            r.err = nvf_scan_str(data, data_len, &r.data_i, &str_len);
+            IF_RET(r.err != NVF_OK, r);
+            // Strings without escape sequences or concatenation can be used
+            // where they are.
+            const char *str = data + str_start + 1;
+            if (str_len != r.data_i - str_start - 1) {
+                IF_RET_DATA(str_len > ev->scratch_len, r, NVF_BUF_OVF);
+                nvf_unescape_str(data, str_start, r.data_i, ev->scratch);
+                str = ev->scratch;
+            }
+            NVF_EVENT(r, ev->on_string, ctx, str, str_len);
+            break;
+        }
+        case NVF_TOK_BLOB_REF: {
+            uintptr_t path_start = 0;
+            nvf_blob_ref ref_info = {0};
+            r.err = nvf_scan_blob_ref(data, data_len, &r.data_i, &path_start,
+                                      &ref_info);
+            IF_RET(r.err != NVF_OK, r);
+            --r.data_i;
+            NVF_EVENT(r, ev->on_blob_ref, ctx, data + path_start,
+                      ref_info.path_len, ref_info.offset, ref_info.len);
+            break;
+        }
+        case NVF_TOK_BLOB: {
+            uintptr_t blob_start = 0;
+            r.err = nvf_scan_blob(data, data_len, &r.data_i, &blob_start);
+            IF_RET(r.err != NVF_OK, r);
+            uintptr_t bin_blob_len = nvf_blob_len(data, blob_start, r.data_i);
+            IF_RET_DATA(bin_blob_len > ev->scratch_len, r, NVF_BUF_OVF);
+            nvf_decode_blob(data, blob_start, r.data_i, (uint8_t *)ev->scratch);
+            --r.data_i;
+            NVF_EVENT(r, ev->on_blob, ctx, (uint8_t *)ev->scratch,
+                      bin_blob_len);
+            break;
+        }
+        case NVF_TOK_MAP:
+        case NVF_TOK_ARRAY: {
+            // Don't allow maps to be nested in arrays.
+            IF_RET_DATA(ch == '{' && p_type == NVF_PARSE_ARRAY, r, NVF_ERROR);
+            NVF_EVENT(r, ch == '{' ? ev->begin_map : ev->begin_array, ctx);
+            ++r.data_i;
+            nvf_err_data_i r2 = nvf_events_map_arr(
+                data + r.data_i, data_len - r.data_i, ev, ctx,
+                ch == '{' ? NVF_PARSE_MAP : NVF_PARSE_ARRAY, depth + 1);
+            r.data_i += r2.data_i;
+            // The for loop will increment this. Decrement it to account for
             // that.
             --r.data_i;
             r.err = r2.err;
             IF_RET(r.err != NVF_OK, r);
+            NVF_EVENT(r, ch == '{' ? ev->end_map : ev->end_array, ctx);
+            break;
+        }
+        default:
+            r.err = NVF_BAD_VALUE_TYPE;
+            return r;
+        }
+    }
+    // Maps and arrays still open at the end of the data are closed, and the
+    // callers send their end events.
+    return r;
+}
+
+nvf_err_data_i nvf_parse_events(const char *data, uintptr_t data_len,
+                                const nvf_events *events, void *ctx) {
+    nvf_err_data_i r = {
+        .data_i = 0,
+        .err = NVF_OK,
+    };
+    IF_RET_DATA(data == NULL || events == NULL, r, NVF_BAD_ARG);
+    return nvf_events_map_arr(data, data_len, events, ctx, NVF_PARSE_MAP, 0);
+}
+
+// Find the end of the value at data[*d_i] without decoding it. Maps and
+// arrays are skipped by matching their brackets. Strings and comments in them
+// are only scanned for where they end, so brackets inside them don't count.
+// Other values aren't checked. On success, *d_i is the index of the first
+// character after the value.
+nvf_err nvf_skip_value(const char *data, uintptr_t data_len, uintptr_t *d_i) {
+    uintptr_t i = *d_i;
+    uintptr_t depth = 0;
+    nvf_err e = NVF_OK;
+    while (true) {
+        char ch = data[i];
+        if (ch == '"') {
+            uintptr_t str_len = 0;
+            e = nvf_scan_str(data, data_len, &i, &str_len);
+            if (e != NVF_OK) {
+                break;
+            }
+            ++i;
+        } else if (ch == '{' || ch == '[') {
+            ++depth;
+            ++i;
+        } else if (ch == '}' || ch == ']') {
+            if (depth == 0) {
+                e = NVF_BAD_VALUE_TYPE;
+                break;
+            }
+            --depth;
+            ++i;
+        } else {
+            // BLOB references have a quoted path, which may hold anything.
+            if (ch == 'b' && i + 2 < data_len && data[i + 1] == 'f' &&
+                data[i + 2] == '"') {
+                for (i += 3; i < data_len && data[i] != '"'; ++i) {
+                }
+            }
+            i = nvf_scan_bare(data, data_len, i);
+        }
+        if (depth == 0) {
+            break;
+        }
+        i += nvf_next_token_i(data + i, data_len - i);
+        if (i >= data_len) {
+            e = NVF_UNMATCHED_BRACE;
+            break;
+        }
+    }
+    *d_i = i;
+    return e;
+}
+
+// Decode the value at data[d_i] into the field described by f.
+nvf_err nvf_extract_value(const char *data, uintptr_t data_len, uintptr_t d_i,
+                          const nvf_bind_field *f, void *field) {
+    char ch = data[d_i];
+    if (f->type == NVF_INT || f->type == NVF_FLOAT) {
+        IF_RET(nvf_token_kind[(uint8_t)ch] != NVF_TOK_NUMBER,
+               NVF_BAD_VALUE_TYPE);
+        nvf_value val = {0};
+        nvf_data_type type = NVF_INT;
+        nvf_err e = nvf_scan_number(data, data_len, &d_i, &val, &type);
+        IF_RET(e != NVF_OK, e);
+        IF_RET(type != f->type, NVF_BAD_VALUE_TYPE);
+        return nvf_bind_value(f, type, val, field);
+    } else if (f->type == NVF_STRING) {
+        IF_RET(ch != '"', NVF_BAD_VALUE_TYPE);
+        uintptr_t end = d_i;
+        uintptr_t str_len = 0;
+        nvf_err e = nvf_scan_str(data, data_len, &end, &str_len);
+        IF_RET(e != NVF_OK, e);
+        IF_RET(str_len + 1 > f->size, NVF_BUF_OVF);
+        nvf_unescape_str(data, d_i, end, field);
+        ((char *)field)[str_len] = '\0';
+        return NVF_OK;
+    } else if (f->type == NVF_BLOB) {
+        IF_RET(ch != 'b', NVF_BAD_VALUE_TYPE);
+        // Extracting never opens other files.
+        IF_RET(d_i + 1 < data_len && data[d_i + 1] == 'f', NVF_NOT_SUPPORTED);
+        uintptr_t blob_start = 0;
+        nvf_err e = nvf_scan_blob(data, data_len, &d_i, &blob_start);
+        IF_RET(e != NVF_OK, e);
+        uintptr_t blob_len = nvf_blob_len(data, blob_start, d_i);
+        IF_RET(blob_len > f->size, NVF_BUF_OVF);
+        nvf_decode_blob(data, blob_start, d_i, field);
+        bzero((uint8_t *)field + blob_len, f->size - blob_len);
+        return NVF_OK;
+    }
+    return NVF_BAD_ARG;
+}
+
+// A map nvf_extract() is scanning, named by its parent map. depth is how
+// many maps it's nested in. The root map's frame is all zeros.
+typedef struct nvf_extract_frame {
+    const struct nvf_extract_frame *parent;
+    const char *name;
+    uintptr_t name_len;
+    nvf_num depth;
+} nvf_extract_frame;
+
+// What nvf_extract() is looking for. remaining counts the fields that haven't
+// been found yet.
+typedef struct nvf_extract_state {
+    const nvf_bind_field *fields;
+    nvf_num field_num;
+    nvf_num remaining;
+    uint8_t *out;
+    nvf_err *field_errs;
+} nvf_extract_state;
+
+// Check if a path segment is the same as a name that isn't null terminated.
+bool nvf_extract_name_eq(const char *seg, const char *name, uintptr_t len) {
+    return strncmp(seg, name, len) == 0 && seg[len] == '\0';
+}
+
+// Check if the path of a field goes through the map of a frame.
+bool nvf_extract_in_frame(const nvf_bind_field *f,
+                          const nvf_extract_frame *frame) {
+    for (; frame->parent != NULL; frame = frame->parent) {
+        if (!nvf_extract_name_eq(f->path[frame->depth - 1], frame->name,
+                                 frame->name_len)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Scan a map for the fields in st, decoding the values they point to and
+// skipping everything else. It returns early once every field is found.
+nvf_err_data_i nvf_extract_map(const char *data, uintptr_t data_len,
+                               nvf_extract_state *st,
+                               const nvf_extract_frame *frame) {
+    nvf_err_data_i r = {
+        .data_i = 0,
+        .err = NVF_OK,
+    };
+    while (st->remaining > 0) {
+        r.data_i += nvf_next_token_i(data + r.data_i, data_len - r.data_i);
+        if (r.data_i >= data_len) {
+            break;
+        }
+        if (data[r.data_i] == '}' || data[r.data_i] == ']') {
+            IF_RET_DATA(frame->parent == NULL || data[r.data_i] == ']', r,
+                        NVF_UNMATCHED_BRACE);
+            ++r.data_i;
+            return r;
+        }
+
+        const char *name = data + r.data_i;
+        r.data_i = nvf_scan_name(data, data_len, r.data_i);
+        uintptr_t name_len = data + r.data_i - name;
+        r.data_i += nvf_next_token_i(data + r.data_i, data_len - r.data_i);
+        IF_RET_DATA(r.data_i >= data_len, r, NVF_BUF_OVF);
+
+        // Decode the fields that end here and see if any go through here.
+        bool enter_map = false;
+        for (nvf_num f_i = 0; f_i < st->field_num; ++f_i) {
+            const nvf_bind_field *f = &st->fields[f_i];
+            if (st->field_errs[f_i] != NVF_NOT_FOUND ||
+                f->depth <= frame->depth ||
+                !nvf_extract_name_eq(f->path[frame->depth], name, name_len) ||
+                !nvf_extract_in_frame(f, frame)) {
+                continue;
+            }
+            if (f->depth > frame->depth + 1) {
+                if (data[r.data_i] == '{') {
+                    enter_map = true;
+                } else {
+                    // The path goes through a value that isn't a map.
+                    st->field_errs[f_i] = NVF_BAD_VALUE_TYPE;
+                    --st->remaining;
+                }
+                continue;
+            }
+            st->field_errs[f_i] = nvf_extract_value(
+                data, data_len, r.data_i, f, st->out + f->offset);
+            --st->remaining;
+        }
+
+        if (enter_map) {
+            nvf_extract_frame child = {
+                .parent = frame,
+                .name = name,
+                .name_len = name_len,
+                .depth = frame->depth + 1,
+            };
+            ++r.data_i;
+            nvf_err_data_i r2 = nvf_extract_map(
+                data + r.data_i, data_len - r.data_i, st, &child);
+            r.data_i += r2.data_i;
+            r.err = r2.err;
+            IF_RET(r.err != NVF_OK, r);
+        } else {
+            r.err = nvf_skip_value(data, data_len, &r.data_i);
+            IF_RET(r.err != NVF_OK, r);
+        }
+    }
+    // Maps have to be closed unless every field was found first.
+    IF_RET_DATA(st->remaining > 0 && frame->parent != NULL, r,
+                NVF_UNMATCHED_BRACE);
+    return r;
+}
 
-            // The pointer to the map array may have moved, udpate it.
-            if (cur_map == NULL) {
-                cur_arr = root->arrays + map_arr_i;
+nvf_err_data_i nvf_extract(const char *data, uintptr_t data_len,
+                           const nvf_bind_field *fields, nvf_num field_num,
+                           void *out, nvf_err *field_errs) {
+    nvf_err_data_i r = {
+        .data_i = 0,
+        .err = NVF_OK,
+    };
+    IF_RET_DATA(data == NULL || fields == NULL || out == NULL ||
+                    field_errs == NULL,
+                r, NVF_BAD_ARG);
+
+    nvf_extract_state st = {
+        .fields = fields,
+        .field_num = field_num,
+        .out = out,
+        .field_errs = field_errs,
+    };
+    for (nvf_num f_i = 0; f_i < field_num; ++f_i) {
+        bool bad_path = fields[f_i].path == NULL || fields[f_i].depth == 0;
+        field_errs[f_i] = bad_path ? NVF_BAD_ARG : NVF_NOT_FOUND;
+        st.remaining += !bad_path;
+    }
+    nvf_extract_frame root_frame = {0};
+    r = nvf_extract_map(data, data_len, &st, &root_frame);
+    IF_RET(r.err != NVF_OK, r);
+
+    for (nvf_num f_i = 0; f_i < field_num && r.err == NVF_OK; ++f_i) {
+        r.err = field_errs[f_i];
+    }
+    return r;
+}
+
+// Add an empty map to a root and set *out_i to its index.
+nvf_err nvf_new_map(nvf_root *root, nvf_num *out_i) {
+    if (root->map_num + 1 > root->map_cap) {
+        nvf_num new_cap = nvf_grow_cap(root->map_cap, 4);
+        IF_RET(new_cap == 0, NVF_BAD_ALLOC);
+        nvf_map *new_map =
+            nvf_realloc(root, root->maps, root->map_cap * sizeof(*new_map),
+                        new_cap * sizeof(*new_map));
+        IF_RET(new_map == NULL, NVF_BAD_ALLOC);
+        bzero(new_map + root->map_cap,
+              (new_cap - root->map_cap) * sizeof(*new_map));
+        root->maps = new_map;
+        root->map_cap = new_cap;
+    }
+    *out_i = root->map_num++;
+    return NVF_OK;
+}
+
+// Add an empty array to a root and set *out_i to its index.
+nvf_err nvf_new_array(nvf_root *root, nvf_num *out_i) {
+    if (root->array_num + 1 > root->array_cap) {
+        nvf_num new_cap = nvf_grow_cap(root->array_cap, 4);
+        IF_RET(new_cap == 0, NVF_BAD_ALLOC);
+        nvf_array *new_arr = nvf_realloc(root, root->arrays,
+                                         root->array_cap * sizeof(*new_arr),
+                                         new_cap * sizeof(*new_arr));
+        IF_RET(new_arr == NULL, NVF_BAD_ALLOC);
+        bzero(new_arr + root->array_cap,
+              (new_cap - root->array_cap) * sizeof(*new_arr));
+        root->arrays = new_arr;
+        root->array_cap = new_cap;
+    }
+    *out_i = root->array_num++;
+    return NVF_OK;
+}
+
+// Free a string or BLOB from nvf_copy_value() that couldn't be stored. Copied
+// arrays are already in dst, so they're freed with it.
+void nvf_free_copy(nvf_root *dst, nvf_data_type dt, nvf_value v) {
+    uintptr_t len = nvf_leaf_len(dt, v);
+    if (len > 0) {
+        nvf_free(dst, v.v_string, len);
+    }
+}
+
+// Copy a value from src so it can be stored in dst. Strings and BLOBs are
+// copied, and arrays are copied with everything in them. Maps aren't
+// handled here since they're merged.
+nvf_err nvf_copy_value(nvf_root *dst, const nvf_root *src, nvf_data_type dt,
+                       nvf_value v, nvf_value *out) {
+    *out = v;
+    uintptr_t len = nvf_leaf_len(dt, v);
+    if (len > 0) {
+        // All the leaf pointers are in the same place in the union.
+        void *leaf = nvf_alloc_leaf(dst, NULL, 0, len);
+        IF_RET(leaf == NULL, NVF_BAD_ALLOC);
+        memcpy(leaf, v.v_string, len);
+        out->v_string = leaf;
+        if (dt == NVF_BLOB_REF) {
+            // The copy maps the file itself when it's read.
+            out->v_blob_ref->data = NULL;
+            out->v_blob_ref->map_start = NULL;
+            out->v_blob_ref->map_len = 0;
+        }
+    } else if (dt == NVF_ARRAY) {
+        const nvf_array *src_arr = &src->arrays[v.array_i];
+        nvf_num arr_i = 0;
+        nvf_err e = nvf_new_array(dst, &arr_i);
+        IF_RET(e != NVF_OK, e);
+        out->array_i = arr_i;
+        for (nvf_num i = 0; i < src_arr->num; ++i) {
+            nvf_value item;
+            e = nvf_copy_value(dst, src, src_arr->types[i], src_arr->values[i],
+                               &item);
+            IF_RET(e != NVF_OK, e);
+            // Copying nested arrays can move dst's arrays.
+            nvf_array *dst_arr = &dst->arrays[arr_i];
+            e = nvf_ensure_array_cap(dst, dst_arr);
+            if (e != NVF_OK) {
+                nvf_free_copy(dst, src_arr->types[i], item);
+                return e;
+            }
+            dst_arr->types[dst_arr->num] = src_arr->types[i];
+            dst_arr->values[dst_arr->num] = item;
+            dst_arr->num++;
+        }
+    }
+    return NVF_OK;
+}
+
+// Add a value to the end of map m_i in root, named like entry n_i of src.
+nvf_err nvf_map_append(nvf_root *root, nvf_num m_i, const nvf_map *src,
+                       nvf_num n_i, nvf_data_type dt, nvf_value v) {
+    nvf_map *m = &root->maps[m_i];
+    nvf_err e = nvf_ensure_map_cap(root, m);
+    IF_RET(e != NVF_OK, e);
+    const nvf_name *name = &src->names[n_i];
+    e = nvf_add_name(root, m, src->name_data + name->offset, name->len,
+                     name->hash);
+    IF_RET(e != NVF_OK, e);
+    m->arr.types[m->arr.num] = dt;
+    m->arr.values[m->arr.num] = v;
+    m->arr.num++;
+    return NVF_OK;
+}
+
+// Merge one map from each layer of an overlay into map out_i of out. The
+// layers go from the lowest base up, and maps has NULL for layers without
+// the map.
+nvf_err nvf_merge_maps(nvf_root *out, nvf_num out_i, nvf_root **layers,
+                       const nvf_map **maps, nvf_num layer_num) {
+    const nvf_map **child =
+        nvf_realloc(out, NULL, 0, layer_num * sizeof(*child));
+    IF_RET(child == NULL, NVF_BAD_ALLOC);
+    nvf_err e = NVF_OK;
+    for (nvf_num l = 0; e == NVF_OK && l < layer_num; ++l) {
+        const nvf_map *m = maps[l];
+        nvf_num name_num = m == NULL ? 0 : m->arr.num;
+        for (nvf_num n_i = 0; e == NVF_OK && n_i < name_num; ++n_i) {
+            const nvf_name *name = &m->names[n_i];
+            const char *name_str = m->name_data + name->offset;
+            // Names go where the lowest layer has them, so skip names a
+            // lower layer already added.
+            bool added = false;
+            for (nvf_num below = 0; !added && below < l; ++below) {
+                nvf_num tmp = 0;
+                added = maps[below] != NULL &&
+                        nvf_map_find(maps[below], name->hash, name_str,
+                                     name->len, &tmp);
+            }
+            if (added) {
+                continue;
+            }
+
+            // The value comes from the highest layer, and maps are merged
+            // with every map of the same name under it.
+            nvf_num top = l, top_i = n_i;
+            for (nvf_num c = 0; c < layer_num; ++c) {
+                nvf_num c_i = 0;
+                child[c] = NULL;
+                if (maps[c] == NULL || !nvf_map_find(maps[c], name->hash,
+                                                     name_str, name->len,
+                                                     &c_i)) {
+                    continue;
+                }
+                if (c >= top) {
+                    top = c;
+                    top_i = c_i;
+                }
+                if (maps[c]->arr.types[c_i] == NVF_MAP) {
+                    child[c] =
+                        &layers[c]->maps[maps[c]->arr.values[c_i].map_i];
+                }
+            }
+            nvf_data_type dt = maps[top]->arr.types[top_i];
+            nvf_value v = maps[top]->arr.values[top_i];
+            if (dt == NVF_MAP) {
+                // Add the map before filling it so maps stay numbered in
+                // the order the parser would number them.
+                nvf_num new_i = 0;
+                e = nvf_new_map(out, &new_i);
+                v.map_i = new_i;
+                if (e == NVF_OK) {
+                    e = nvf_map_append(out, out_i, m, n_i, dt, v);
+                }
+                if (e == NVF_OK) {
+                    e = nvf_merge_maps(out, new_i, layers, child, layer_num);
+                }
             } else {
-                cur_map = root->maps + map_arr_i;
-                cur_arr = &cur_map->arr;
+                e = nvf_copy_value(out, layers[top], dt, v, &v);
+                if (e == NVF_OK) {
+                    e = nvf_map_append(out, out_i, m, n_i, dt, v);
+                    if (e != NVF_OK) {
+                        nvf_free_copy(out, dt, v);
+                    }
+                }
             }
+        }
+    }
+    nvf_dealloc(out, child, layer_num * sizeof(*child));
+    return e;
+}
 
-            cur_arr->values[cur_arr->num].array_i = new_arr_num - 1;
-            cur_arr->types[cur_arr->num] = NVF_ARRAY;
+nvf_err nvf_root_materialize(nvf_root *overlay, nvf_root *out) {
+    IF_RET(overlay == NULL || out == NULL, NVF_BAD_ARG);
+    IF_RET(out->init_val != NVF_INIT_VAL, NVF_NOT_INIT);
+    IF_RET(out->frozen, NVF_READ_ONLY);
+    // The copy is built from map 0 up, so out can't hold anything yet.
+    IF_RET(out->maps != NULL || out->arrays != NULL || out->pool != NULL,
+           NVF_BAD_ARG);
+
+    nvf_num layer_num = 0;
+    for (nvf_root *r = overlay; r != NULL; r = r->base) {
+        IF_RET(r->init_val != NVF_INIT_VAL, NVF_NOT_INIT);
+        ++layer_num;
+    }
+    nvf_root **layers =
+        nvf_realloc(out, NULL, 0, layer_num * sizeof(*layers));
+    IF_RET(layers == NULL, NVF_BAD_ALLOC);
+    const nvf_map **maps =
+        nvf_realloc(out, NULL, 0, layer_num * sizeof(*maps));
+    if (maps == NULL) {
+        nvf_dealloc(out, layers, layer_num * sizeof(*layers));
+        return NVF_BAD_ALLOC;
+    }
+    nvf_num l = layer_num;
+    for (nvf_root *r = overlay; r != NULL; r = r->base) {
+        --l;
+        layers[l] = r;
+        maps[l] = r->map_num > 0 ? &r->maps[0] : NULL;
+    }
+
+    nvf_num root_i = 0;
+    nvf_err e = nvf_new_map(out, &root_i);
+    if (e == NVF_OK) {
+        e = nvf_merge_maps(out, root_i, layers, maps, layer_num);
+    }
+    nvf_dealloc(out, layers, layer_num * sizeof(*layers));
+    nvf_dealloc(out, maps, layer_num * sizeof(*maps));
+    return e;
+}
+
+// Counts gathered by the presizing scan. Maps and arrays are counted in the
+// order they're found, which is the order the parser numbers them in.
+typedef struct nvf_presize_len {
+    nvf_num entries, name_bytes;
+} nvf_presize_len;
+
+typedef struct nvf_presize {
+    nvf_presize_len *map_lens;
+    nvf_num map_num, map_cap;
+    nvf_presize_len *arr_lens;
+    nvf_num arr_num, arr_cap;
+    uintptr_t pool_len;
+} nvf_presize;
+
+// Add a map or array to a list of counts and set *out_i to its index.
+nvf_err nvf_presize_add(nvf_root *root, nvf_presize_len **lens, nvf_num *num,
+                        nvf_num *cap, nvf_num *out_i) {
+    if (*num + 1 > *cap) {
+        nvf_num new_cap = nvf_grow_cap(*cap, 4);
+        IF_RET(new_cap == 0, NVF_BAD_ALLOC);
+        nvf_presize_len *new_lens = nvf_realloc(
+            root, *lens, *cap * sizeof(**lens), new_cap * sizeof(**lens));
+        IF_RET(new_lens == NULL, NVF_BAD_ALLOC);
+        *lens = new_lens;
+        *cap = new_cap;
+    }
+    (*lens)[*num] = (nvf_presize_len){0};
+    *out_i = (*num)++;
+    return NVF_OK;
+}
+
+// Count what nvf_parse_buf_map_arr() would store from data without storing
+// anything. Values are skipped, not checked. The parser reports any errors.
+nvf_err_data_i nvf_presize_map_arr(const char *data, uintptr_t data_len,
+                                   nvf_root *root, nvf_presize *ps,
+                                   nvf_num map_arr_i, nvf_parse_type p_type) {
+    nvf_err_data_i r = {
+        .data_i = 0,
+        .err = NVF_OK,
+    };
+    nvf_presize_len len = {0};
+    for (; r.data_i < data_len; ++r.data_i) {
+        r.data_i += nvf_next_token_i(data + r.data_i, data_len - r.data_i);
+        if (r.data_i >= data_len) {
+            break;
+        }
+        if (nvf_token_kind[(uint8_t)data[r.data_i]] == NVF_TOK_CLOSE) {
+            ++r.data_i;
+            break;
+        }
+        if (p_type == NVF_PARSE_MAP) {
+            uintptr_t name_start = r.data_i;
+            r.data_i = nvf_scan_name(data, data_len, r.data_i);
+            uintptr_t name_len = r.data_i - name_start;
+            IF_RET_DATA(name_len >= UINT32_MAX - len.name_bytes, r,
+                        NVF_NUM_OVF);
+            len.name_bytes += name_len + 1;
+            r.data_i += nvf_next_token_i(data + r.data_i, data_len - r.data_i);
+            IF_RET_DATA(r.data_i >= data_len, r, NVF_BUF_OVF);
+        }
+
+        char ch = data[r.data_i];
+        nvf_token tok = nvf_token_at(data, data_len, r.data_i);
+        switch (tok) {
+        case NVF_TOK_STRING: {
+            uintptr_t str_len = 0;
+            r.err = nvf_scan_str(data, data_len, &r.data_i, &str_len);
+            IF_RET(r.err != NVF_OK, r);
+            ps->pool_len += nvf_pool_size(sizeof(nvf_str) + str_len + 1);
+            break;
+        }
+        case NVF_TOK_BLOB: {
+            uintptr_t blob_start = 0;
+            r.err = nvf_scan_blob(data, data_len, &r.data_i, &blob_start);
+            IF_RET(r.err != NVF_OK, r);
+            uintptr_t bin_blob_len = nvf_blob_len(data, blob_start, r.data_i);
+            ps->pool_len += nvf_pool_size(sizeof(nvf_blob) + bin_blob_len);
+            --r.data_i;
+            break;
+        }
+        case NVF_TOK_BLOB_REF: {
+            uintptr_t path_start = 0;
+            nvf_blob_ref ref_info = {0};
+            r.err = nvf_scan_blob_ref(data, data_len, &r.data_i, &path_start,
+                                      &ref_info);
+            IF_RET(r.err != NVF_OK, r);
+            r.err = nvf_check_ref_path(root, data + path_start,
+                                       ref_info.path_len);
+            if (r.err != NVF_OK) {
+                r.data_i = path_start;
+                return r;
+            }
+            uintptr_t full_len = nvf_ref_path_len(root, data + path_start,
+                                                  ref_info.path_len);
+            ps->pool_len += nvf_pool_size(sizeof(nvf_blob_ref) + full_len + 1);
+            --r.data_i;
+            break;
+        }
+        case NVF_TOK_MAP:
+        case NVF_TOK_ARRAY: {
+            nvf_num new_i = 0;
+            r.err = ch == '{' ? nvf_presize_add(root, &ps->map_lens,
+                                                &ps->map_num, &ps->map_cap,
+                                                &new_i)
+                              : nvf_presize_add(root, &ps->arr_lens,
+                                                &ps->arr_num, &ps->arr_cap,
+                                                &new_i);
+            IF_RET(r.err != NVF_OK, r);
+            ++r.data_i;
+            nvf_err_data_i r2 = nvf_presize_map_arr(
+                data + r.data_i, data_len - r.data_i, root, ps, new_i,
+                ch == '{' ? NVF_PARSE_MAP : NVF_PARSE_ARRAY);
+            r.data_i += r2.data_i;
+            // The for loop will increment this. Decrement it to account for
+            // that.
+            --r.data_i;
+            r.err = r2.err;
+            IF_RET(r.err != NVF_OK, r);
+            break;
+        }
+        default:
+            // Numbers end at whitespace or a bracket.
+            r.data_i = nvf_scan_bare(data, data_len, r.data_i);
+            --r.data_i;
+            break;
+        }
+        ++len.entries;
+    }
+
+    nvf_presize_len *lens =
+        p_type == NVF_PARSE_MAP ? ps->map_lens : ps->arr_lens;
+    lens[map_arr_i] = len;
+    return r;
+}
+
+// Allocate storage for a map or array with room for exactly len entries.
+nvf_err nvf_presize_array(nvf_root *root, nvf_array *arr, nvf_num len) {
+    IF_RET(len == 0, NVF_OK);
+    arr->types = nvf_realloc(root, NULL, 0, len * sizeof(*arr->types));
+    IF_RET(arr->types == NULL, NVF_BAD_ALLOC);
+    bzero(arr->types, len * sizeof(*arr->types));
+    arr->values = nvf_realloc(root, NULL, 0, len * sizeof(*arr->values));
+    if (arr->values == NULL) {
+        nvf_dealloc(root, arr->types, len * sizeof(*arr->types));
+        arr->types = NULL;
+        return NVF_BAD_ALLOC;
+    }
+    bzero(arr->values, len * sizeof(*arr->values));
+    arr->cap = len;
+    return NVF_OK;
+}
+
+// Allocate all of the root's storage from the presizing scan's counts.
+nvf_err nvf_presize_root(nvf_root *root, const nvf_presize *ps) {
+    root->maps =
+        nvf_realloc(root, NULL, 0, ps->map_num * sizeof(*root->maps));
+    IF_RET(root->maps == NULL, NVF_BAD_ALLOC);
+    bzero(root->maps, ps->map_num * sizeof(*root->maps));
+    root->map_cap = ps->map_num;
+    // The root map is used by nvf_parse_buf().
+    root->map_num = 1;
+    for (nvf_num m_i = 0; m_i < ps->map_num; ++m_i) {
+        nvf_map *m = &root->maps[m_i];
+        nvf_err e =
+            nvf_presize_array(root, &m->arr, ps->map_lens[m_i].entries);
+        IF_RET(e != NVF_OK, e);
+        if (m->arr.cap > 0) {
+            m->names =
+                nvf_realloc(root, NULL, 0, m->arr.cap * sizeof(*m->names));
+            IF_RET(m->names == NULL, NVF_BAD_ALLOC);
+            bzero(m->names, m->arr.cap * sizeof(*m->names));
+
+            nvf_num name_bytes = ps->map_lens[m_i].name_bytes;
+            m->name_data = nvf_realloc(root, NULL, 0, name_bytes);
+            IF_RET(m->name_data == NULL, NVF_BAD_ALLOC);
+            m->name_cap = name_bytes;
+        }
+    }
+
+    if (ps->arr_num > 0) {
+        root->arrays =
+            nvf_realloc(root, NULL, 0, ps->arr_num * sizeof(*root->arrays));
+        IF_RET(root->arrays == NULL, NVF_BAD_ALLOC);
+        bzero(root->arrays, ps->arr_num * sizeof(*root->arrays));
+        root->array_cap = ps->arr_num;
+    }
+    for (nvf_num a_i = 0; a_i < ps->arr_num; ++a_i) {
+        nvf_err e = nvf_presize_array(root, &root->arrays[a_i],
+                                      ps->arr_lens[a_i].entries);
+        IF_RET(e != NVF_OK, e);
+    }
+
+    if (ps->pool_len > 0) {
+        root->pool = nvf_realloc(root, NULL, 0, ps->pool_len);
+        IF_RET(root->pool == NULL, NVF_BAD_ALLOC);
+        root->pool_cap = ps->pool_len;
+    }
+    return NVF_OK;
+}
+
+nvf_err_data_i nvf_parse_buf_presize(const char *data, uintptr_t data_len,
+                                     nvf_root *out_root) {
+    nvf_err_data_i r = {
+        .data_i = 0,
+        .err = NVF_OK,
+    };
+    IF_RET_DATA(out_root == NULL, r, NVF_BAD_ARG);
+    IF_RET_DATA(out_root->init_val != NVF_INIT_VAL, r, NVF_NOT_INIT);
+    IF_RET_DATA(out_root->frozen, r, NVF_READ_ONLY);
+    // Only an empty root can be presized.
+    if (out_root->maps != NULL || out_root->arrays != NULL ||
+        out_root->pool != NULL) {
+        return nvf_parse_buf(data, data_len, out_root);
+    }
+
+    nvf_presize ps = {0};
+    nvf_num root_i = 0;
+    r.err = nvf_presize_add(out_root, &ps.map_lens, &ps.map_num, &ps.map_cap,
+                            &root_i);
+    if (r.err == NVF_OK) {
+        nvf_err_data_i sr = nvf_presize_map_arr(data, data_len, out_root, &ps,
+                                                root_i, NVF_PARSE_MAP);
+        // Bad data is left for the parser to find and report. Only allocation
+        // failures stop here.
+        r.err = sr.err == NVF_BAD_ALLOC ? NVF_BAD_ALLOC : NVF_OK;
+        if (sr.err == NVF_OK) {
+            r.err = nvf_presize_root(out_root, &ps);
+        }
+    }
+    nvf_dealloc(out_root, ps.map_lens, ps.map_cap * sizeof(*ps.map_lens));
+    nvf_dealloc(out_root, ps.arr_lens, ps.arr_cap * sizeof(*ps.arr_lens));
+    IF_RET(r.err != NVF_OK, r);
+
+    return nvf_parse_buf(data, data_len, out_root);
+}
+
+// Snapshots written by nvf_parse_file() start with this header. The block of
+// a frozen root follows it, with every pointer in the block replaced by its
+// offset in the block plus one, so NULL stays 0.
+#define NVF_SNAP_MAGIC "NVFSNAP"
+#define NVF_SNAP_VERSION 1
+// Snapshots are only read back by builds with the same byte order and the
+// same struct sizes.
+#define NVF_SNAP_ORDER 0x0102030405060708ull
+#define NVF_SNAP_LAYOUT                                                        \
+    ((uint32_t)sizeof(void *) | (uint32_t)sizeof(nvf_map) << 8 |               \
+     (uint32_t)sizeof(nvf_array) << 16 | (uint32_t)sizeof(nvf_blob_ref) << 24)
+
+typedef struct nvf_snap_header {
+    char magic[8];
+    uint64_t order;
+    uint32_t version, layout;
+    uint64_t src_size;
+    int64_t src_mtime;
+    uint64_t src_fingerprint;
+    uint64_t block_len, block_fingerprint;
+    uintptr_t maps, arrays;
+    nvf_num map_num, array_num;
+} nvf_snap_header;
+
+// Write all of data to fd, continuing after short writes.
+bool nvf_write_all(int fd, const void *data, uintptr_t len) {
+    const uint8_t *d = data;
+    while (len > 0) {
+        ssize_t n = write(fd, d, len);
+        IF_RET(n <= 0, false);
+        d += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Read len bytes from fd into out, continuing after short reads.
+bool nvf_read_all(int fd, void *out, uintptr_t len) {
+    uint8_t *o = out;
+    while (len > 0) {
+        ssize_t n = read(fd, o, len);
+        IF_RET(n <= 0, false);
+        o += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Read a whole file into memory from the root's allocator.
+nvf_err nvf_read_file(nvf_root *root, const char *path, char **out,
+                      uintptr_t *out_len, struct stat *st) {
+    int fd = open(path, O_RDONLY);
+    IF_RET(fd < 0, NVF_IO_ERR);
+    if (fstat(fd, st) != 0) {
+        close(fd);
+        return NVF_IO_ERR;
+    }
+    uintptr_t len = st->st_size;
+    char *data = nvf_realloc(root, NULL, 0, len);
+    if (data == NULL && len > 0) {
+        close(fd);
+        return NVF_BAD_ALLOC;
+    }
+    bool got = nvf_read_all(fd, data, len);
+    close(fd);
+    if (!got) {
+        nvf_dealloc(root, data, len);
+        return NVF_IO_ERR;
+    }
+    *out = data;
+    *out_len = len;
+    return NVF_OK;
+}
+
+// Get the path of the snapshot for the file at path. It's named after the
+// fingerprint of the file's absolute path, so each file has one snapshot.
+char *nvf_snap_path(nvf_root *root, const char *path, const char *cache_dir) {
+    char *abs_path = realpath(path, NULL);
+    const char *key = abs_path != NULL ? abs_path : path;
+    uint64_t key_fp = nvf_fingerprint(key, strlen(key));
+    free(abs_path);
+
+    uintptr_t len = snprintf(NULL, 0, "%s/%016" PRIx64 ".nvfsnap", cache_dir,
+                             key_fp);
+    char *out = nvf_realloc(root, NULL, 0, len + 1);
+    IF_RET(out == NULL, NULL);
+    snprintf(out, len + 1, "%s/%016" PRIx64 ".nvfsnap", cache_dir, key_fp);
+    return out;
+}
+
+// Get the offset a snapshot stores for a pointer into a frozen root's block.
+uintptr_t nvf_snap_off(const nvf_root *root, const void *ptr) {
+    IF_RET(ptr == NULL, 0);
+    return (uintptr_t)((const uint8_t *)ptr - root->pool) + 1;
+}
+
+// Replace the pointer at field in copy, a copy of the root's block, with its
+// offset. field points into the root's block, not the copy.
+void nvf_snap_put(uint8_t *copy, const nvf_root *root, const void *field) {
+    const void *ptr = NULL;
+    memcpy(&ptr, field, sizeof(ptr));
+    uintptr_t off = nvf_snap_off(root, ptr);
+    memcpy(copy + ((const uint8_t *)field - root->pool), &off, sizeof(off));
+}
+
+// Replace the pointers in an array's copy with offsets.
+void nvf_snap_put_array(uint8_t *copy, const nvf_root *root,
+                        const nvf_array *a) {
+    nvf_snap_put(copy, root, &a->types);
+    nvf_snap_put(copy, root, &a->values);
+    for (nvf_num i = 0; i < a->num; ++i) {
+        if (nvf_leaf_len(a->types[i], a->values[i]) > 0) {
+            nvf_snap_put(copy, root, &a->values[i]);
+        }
+        // Mappings are made again when the snapshot is loaded.
+        if (a->types[i] == NVF_BLOB_REF) {
+            nvf_blob_ref ref_copy;
+            uint8_t *ref_at =
+                copy + ((uint8_t *)a->values[i].v_blob_ref - root->pool);
+            memcpy(&ref_copy, ref_at, sizeof(ref_copy));
+            ref_copy.data = NULL;
+            ref_copy.map_start = NULL;
+            ref_copy.map_len = 0;
+            memcpy(ref_at, &ref_copy, sizeof(ref_copy));
+        }
+    }
+}
+
+// Write a frozen root to a snapshot at path. The header needs its source
+// fields set. The snapshot is written to a temporary file that's renamed,
+// so readers never see part of one. This doesn't change the root, not even
+// alloc_calls.
+nvf_err nvf_snap_write(const nvf_root *root, const char *path,
+                       nvf_snap_header *h) {
+    uintptr_t path_len = strlen(path);
+    char *tmp_path = nvf_alloc_raw(root, NULL, 0, path_len + 32);
+    IF_RET(tmp_path == NULL, NVF_BAD_ALLOC);
+    snprintf(tmp_path, path_len + 32, "%s.tmp.%ld", path, (long)getpid());
+    uint8_t *copy = nvf_alloc_raw(root, NULL, 0, root->pool_cap);
+    if (copy == NULL) {
+        nvf_dealloc(root, tmp_path, path_len + 32);
+        return NVF_BAD_ALLOC;
+    }
+
+    memcpy(copy, root->pool, root->pool_cap);
+    for (nvf_num a_i = 0; a_i < root->array_num; ++a_i) {
+        nvf_snap_put_array(copy, root, &root->arrays[a_i]);
+    }
+    for (nvf_num m_i = 0; m_i < root->map_num; ++m_i) {
+        const nvf_map *m = &root->maps[m_i];
+        nvf_snap_put_array(copy, root, &m->arr);
+        nvf_snap_put(copy, root, &m->names);
+        nvf_snap_put(copy, root, &m->name_data);
+        nvf_snap_put(copy, root, &m->hash_seeds);
+        nvf_snap_put(copy, root, &m->hash_slots);
+    }
+    memcpy(h->magic, NVF_SNAP_MAGIC, sizeof(h->magic));
+    h->order = NVF_SNAP_ORDER;
+    h->version = NVF_SNAP_VERSION;
+    h->layout = NVF_SNAP_LAYOUT;
+    h->block_len = root->pool_cap;
+    h->block_fingerprint =
+        nvf_fingerprint((const char *)copy, root->pool_cap);
+    h->maps = nvf_snap_off(root, root->maps);
+    h->arrays = nvf_snap_off(root, root->arrays);
+    h->map_num = root->map_num;
+    h->array_num = root->array_num;
+
+    nvf_err r = NVF_IO_ERR;
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        bool put = nvf_write_all(fd, h, sizeof(*h)) &&
+                   nvf_write_all(fd, copy, root->pool_cap);
+        if (close(fd) == 0 && put && rename(tmp_path, path) == 0) {
+            r = NVF_OK;
         } else {
-            r.err = NVF_BAD_VALUE_TYPE;
-            return r;
+            unlink(tmp_path);
         }
-        if (cur_map != NULL) {
-            char *name_mem =
-                root->realloc_inst(cur_map->names[cur_arr->num], name_len + 1);
-            IF_RET_DATA(name_mem == NULL, r, NVF_BAD_ALLOC);
-            // Make sure we have a null terminator like all good C strings do.
-            name_mem[name_len] = '\0';
-            memcpy(name_mem, name, name_len);
-            cur_map->names[cur_arr->num] = name_mem;
+    }
+    nvf_dealloc(root, copy, root->pool_cap);
+    nvf_dealloc(root, tmp_path, path_len + 32);
+    return r;
+}
+
+// Turn the offset a snapshot stores at field back into a pointer into block.
+// The pointer must be aligned and have len bytes after it in the block. The
+// first bytes of the block hold the pool count, so nothing can point there.
+// NULL is only allowed when len is 0.
+bool nvf_snap_get(uint8_t *block, uintptr_t block_len, void *field,
+                  uintptr_t len) {
+    uintptr_t off = 0;
+    memcpy(&off, field, sizeof(off));
+    uint8_t *ptr = NULL;
+    if (off != 0) {
+        --off;
+        IF_RET(off < NVF_POOL_ALIGN || off % NVF_POOL_ALIGN != 0, false);
+        IF_RET(off > block_len || len > block_len - off, false);
+        ptr = block + off;
+    }
+    IF_RET(ptr == NULL && len > 0, false);
+    memcpy(field, &ptr, sizeof(ptr));
+    return true;
+}
+
+// Turn a string, BLOB or BLOB reference in a snapshot back into a pointer
+// and check that it fits in the block.
+bool nvf_snap_get_leaf(uint8_t *block, uintptr_t block_len, uint8_t type,
+                       nvf_value *v) {
+    uintptr_t head = type == NVF_STRING ? sizeof(nvf_str)
+                     : type == NVF_BLOB ? sizeof(nvf_blob)
+                                        : sizeof(nvf_blob_ref);
+    IF_RET(!nvf_snap_get(block, block_len, v, head), false);
+    // All the leaf pointers are in the same place in the union.
+    uintptr_t left = block_len - ((uint8_t *)v->v_string - block) - head;
+    if (type == NVF_STRING) {
+        return v->v_string->len < left &&
+               v->v_string->data[v->v_string->len] == '\0';
+    } else if (type == NVF_BLOB) {
+        return v->v_blob->len <= left;
+    }
+    nvf_blob_ref *ref = v->v_blob_ref;
+    ref->data = NULL;
+    ref->map_start = NULL;
+    ref->map_len = 0;
+    return ref->path_len < left && ref->path[ref->path_len] == '\0';
+}
+
+// Turn the offsets in an array from a snapshot back into pointers. Maps and
+// arrays it holds must come after it in the root's tables, so they can't
+// hold it in turn. Only maps hold maps.
+bool nvf_snap_get_array(uint8_t *block, uintptr_t block_len, nvf_array *a,
+                        const nvf_snap_header *h, bool in_map, nvf_num a_i) {
+    IF_RET(a->cap != a->num, false);
+    IF_RET(!nvf_snap_get(block, block_len, &a->types,
+                         a->num * sizeof(*a->types)),
+           false);
+    IF_RET(!nvf_snap_get(block, block_len, &a->values,
+                         a->num * sizeof(*a->values)),
+           false);
+    for (nvf_num i = 0; i < a->num; ++i) {
+        uint8_t type = a->types[i];
+        nvf_value *v = &a->values[i];
+        IF_RET(type >= NVF_TYPE_END, false);
+        if (type == NVF_STRING || type == NVF_BLOB || type == NVF_BLOB_REF) {
+            IF_RET(!nvf_snap_get_leaf(block, block_len, type, v), false);
+        } else if (type == NVF_MAP) {
+            IF_RET(!in_map || v->map_i <= a_i || v->map_i >= h->map_num,
+                   false);
+        } else if (type == NVF_ARRAY) {
+            IF_RET(v->array_i >= h->array_num, false);
+            IF_RET(!in_map && v->array_i <= a_i, false);
         }
-        cur_arr->num++;
+    }
+    return true;
+}
+
+// Turn the offsets in a map from a snapshot back into pointers, and check
+// its names and perfect hash.
+bool nvf_snap_get_map(uint8_t *block, uintptr_t block_len, nvf_map *m,
+                      const nvf_snap_header *h, nvf_num m_i) {
+    nvf_num n = m->arr.num;
+    IF_RET(m->name_cap != m->name_len, false);
+    IF_RET(!nvf_snap_get(block, block_len, &m->names, n * sizeof(*m->names)),
+           false);
+    IF_RET(!nvf_snap_get(block, block_len, &m->name_data, m->name_len),
+           false);
+    for (nvf_num i = 0; i < n; ++i) {
+        const nvf_name *name = &m->names[i];
+        IF_RET(name->offset >= m->name_len ||
+                   name->len >= m->name_len - name->offset ||
+                   m->name_data[name->offset + name->len] != '\0',
+               false);
+    }
+    // Maps the perfect hash couldn't be built for are scanned instead.
+    if (m->hash_seed_num == 0) {
+        m->hash_seeds = NULL;
+        m->hash_slots = NULL;
+    } else {
+        nvf_num slot_num = nvf_mph_slot_num(n);
+        IF_RET(m->hash_seed_num != nvf_mph_seed_num(n), false);
+        IF_RET(!nvf_snap_get(block, block_len, &m->hash_seeds,
+                             m->hash_seed_num * sizeof(*m->hash_seeds)),
+               false);
+        IF_RET(!nvf_snap_get(block, block_len, &m->hash_slots,
+                             slot_num * sizeof(*m->hash_slots)),
+               false);
+        for (nvf_num s = 0; s < slot_num; ++s) {
+            IF_RET(m->hash_slots[s] >= n, false);
+        }
+    }
+    return nvf_snap_get_array(block, block_len, &m->arr, h, true, m_i);
+}
+
+// Load the snapshot at path into out if it was made from the source described
+// by key. Everything in the snapshot is checked before it's used, and out is
+// only changed if it loads.
+nvf_err nvf_snap_read(nvf_root *out, const char *path,
+                      const nvf_snap_header *key) {
+    int fd = open(path, O_RDONLY);
+    IF_RET(fd < 0, NVF_IO_ERR);
+    struct stat st;
+    nvf_snap_header h;
+    if (fstat(fd, &st) != 0 || (uintptr_t)st.st_size < sizeof(h) ||
+        !nvf_read_all(fd, &h, sizeof(h))) {
+        close(fd);
+        return NVF_IO_ERR;
+    }
+    if (memcmp(h.magic, NVF_SNAP_MAGIC, sizeof(h.magic)) != 0 ||
+        h.order != NVF_SNAP_ORDER || h.version != NVF_SNAP_VERSION ||
+        h.layout != NVF_SNAP_LAYOUT || h.src_size != key->src_size ||
+        h.src_mtime != key->src_mtime ||
+        h.src_fingerprint != key->src_fingerprint ||
+        h.block_len != st.st_size - sizeof(h) ||
+        h.block_len < NVF_POOL_ALIGN || h.map_num == 0) {
+        close(fd);
+        return NVF_BAD_DATA;
+    }
+    uintptr_t block_len = h.block_len;
+    uint8_t *block = nvf_realloc(out, NULL, 0, block_len);
+    if (block == NULL) {
+        close(fd);
+        return NVF_BAD_ALLOC;
+    }
+    bool got = nvf_read_all(fd, block, block_len);
+    close(fd);
+    bool ok = got && h.block_fingerprint ==
+                         nvf_fingerprint((const char *)block, block_len);
+
+    nvf_root r = *out;
+    ok = ok &&
+         nvf_snap_get(block, block_len, &h.maps,
+                      h.map_num * sizeof(nvf_map)) &&
+         nvf_snap_get(block, block_len, &h.arrays,
+                      h.array_num * sizeof(nvf_array));
+    if (ok) {
+        memcpy(&r.maps, &h.maps, sizeof(r.maps));
+        memcpy(&r.arrays, &h.arrays, sizeof(r.arrays));
+    }
+    for (nvf_num a_i = 0; ok && a_i < h.array_num; ++a_i) {
+        ok = nvf_snap_get_array(block, block_len, &r.arrays[a_i], &h, false,
+                                a_i);
+    }
+    for (nvf_num m_i = 0; ok && m_i < h.map_num; ++m_i) {
+        ok = nvf_snap_get_map(block, block_len, &r.maps[m_i], &h, m_i);
+    }
+    if (!ok) {
+        nvf_dealloc(out, block, block_len);
+        return NVF_BAD_DATA;
     }
 
-    return r;
+    r.map_num = h.map_num;
+    r.map_cap = h.map_num;
+    r.array_num = h.array_num;
+    r.array_cap = h.array_num;
+    r.pool = block;
+    r.pool_len = block_len;
+    r.pool_cap = block_len;
+    r.pool_refs = (uint64_t *)block;
+    *r.pool_refs = 1;
+    r.fingerprint = key->src_fingerprint;
+    r.frozen = 1;
+    *out = r;
+    return NVF_OK;
 }
 
-// We reallocate instead of mallocing just in case the old pointer points to
-// allocated memory. That means we don't really need to do cleanup if the old
-// pointer points to allocated memory. That implies we need to zero all the
-// pointers in the struct before they are passed into this function.
-// TODO: Re-think how to make cleanup simpler if an allocation fails.
-nvf_err_data_i nvf_parse_buf(const char *data, uintptr_t data_len,
-                             nvf_root *out_root) {
+nvf_err_data_i nvf_parse_file(const char *path, const char *cache_dir,
+                              nvf_root *out_root, uint8_t *from_cache) {
     nvf_err_data_i r = {
         .data_i = 0,
         .err = NVF_OK,
     };
-    IF_RET_DATA(out_root == NULL, r, NVF_BAD_ARG);
+    IF_RET_DATA(path == NULL || out_root == NULL, r, NVF_BAD_ARG);
     IF_RET_DATA(out_root->init_val != NVF_INIT_VAL, r, NVF_NOT_INIT);
+    IF_RET_DATA(out_root->frozen, r, NVF_READ_ONLY);
+    // A snapshot replaces the whole root, so only empty roots can use one.
+    IF_RET_DATA(cache_dir != NULL &&
+                    (out_root->maps != NULL || out_root->arrays != NULL ||
+                     out_root->pool != NULL),
+                r, NVF_BAD_ARG);
+    if (from_cache != NULL) {
+        *from_cache = 0;
+    }
 
-    // Allocate space for the first map.
-    if (out_root->map_cap == 0 || out_root->maps == NULL) {
-        nvf_map *new_map = out_root->realloc_inst(NULL, sizeof(*new_map));
-        IF_RET_DATA(new_map == NULL, r, NVF_BAD_ALLOC);
-        bzero(new_map, sizeof(*new_map));
-        out_root->maps = new_map;
-        out_root->map_num = 1;
-        out_root->map_cap = 1;
+    char *data = NULL;
+    uintptr_t data_len = 0;
+    struct stat st;
+    r.err = nvf_read_file(out_root, path, &data, &data_len, &st);
+    IF_RET(r.err != NVF_OK, r);
+    // Relative BLOB reference paths are resolved against the file's
+    // directory. Snapshots are keyed by the file's real path too, so the
+    // paths stored in them stay right.
+    const char *old_ref_dir = out_root->ref_dir;
+    char *ref_dir = realpath(path, NULL);
+    if (ref_dir != NULL) {
+        *strrchr(ref_dir, '/') = '\0';
+        out_root->ref_dir = ref_dir;
     }
-    // Use map_num - 1 so we can try parsing again, or parse multiple buffers
-    // with multiple function calls.
-    return nvf_parse_buf_map_arr(data, data_len, out_root,
-                                 out_root->map_num - 1, NVF_PARSE_MAP);
+    if (cache_dir == NULL) {
+        r = nvf_parse_buf(data, data_len, out_root);
+        out_root->ref_dir = old_ref_dir;
+        free(ref_dir);
+        nvf_dealloc(out_root, data, data_len);
+        return r;
+    }
+
+    nvf_snap_header key = {
+        .src_size = data_len,
+        .src_mtime = st.st_mtime,
+        .src_fingerprint = nvf_fingerprint(data, data_len),
+    };
+    char *snap_path = nvf_snap_path(out_root, path, cache_dir);
+    // A snapshot's BLOB reference paths weren't checked against this root,
+    // so confined roots always parse.
+    if (snap_path != NULL && !out_root->ref_confined &&
+        nvf_snap_read(out_root, snap_path, &key) == NVF_OK) {
+        if (from_cache != NULL) {
+            *from_cache = 1;
+        }
+        r.data_i = data_len;
+    } else {
+        r = nvf_parse_buf(data, data_len, out_root);
+        // The cache only saves time, so if the root can't be frozen it's
+        // returned as it was parsed, and not being able to write the
+        // snapshot is fine.
+        if (r.err == NVF_OK && nvf_root_freeze(out_root) == NVF_OK &&
+            snap_path != NULL) {
+            nvf_snap_write(out_root, snap_path, &key);
+        }
+    }
+    if (snap_path != NULL) {
+        nvf_dealloc(out_root, snap_path, strlen(snap_path) + 1);
+    }
+    out_root->ref_dir = old_ref_dir;
+    free(ref_dir);
+    nvf_dealloc(out_root, data, data_len);
+    return r;
 }
 
 char nvf_bin_to_char(uint8_t byte) {
@@ -793,9 +4113,144 @@ char nvf_bin_to_char(uint8_t byte) {
     return byte + '0';
 }
 
+// Returns the escape character for a character that can't be written in a
+// string as-is, or '\0' if the character can be written as-is.
+char nvf_escape_char(char in) {
+    switch (in) {
+    case '\0':
+        return '0';
+    case '"':
+        return '"';
+    case '\\':
+        return '\\';
+    default:
+        return '\0';
+    }
+}
+
+// The length of a string after escaping it.
+uintptr_t nvf_escaped_len(const nvf_str *str) {
+    uintptr_t len = str->len;
+    for (nvf_num s_i = 0; s_i < str->len; ++s_i) {
+        len += nvf_escape_char(str->data[s_i]) != '\0';
+    }
+    return len;
+}
+
+// Write an escaped version of str to out. Returns the end of the written data.
+char *nvf_write_escaped(char *out, const nvf_str *str) {
+    for (nvf_num s_i = 0; s_i < str->len; ++s_i) {
+        char esc = nvf_escape_char(str->data[s_i]);
+        if (esc != '\0') {
+            *out++ = '\\';
+            *out++ = esc;
+        } else {
+            *out++ = str->data[s_i];
+        }
+    }
+    return out;
+}
+
+// Most significant digits nvf_fmt_float() writes, plus room for the sign,
+// exponent and ".0".
+#define NVF_FLOAT_TEXT_MAX 32
+
+// Write f with the fewest significant digits that read back as the same
+// double. ".0" is added when the digits would be read back as an int.
+// Returns the length written, or -1 on failure.
+int nvf_fmt_float(char *buf, size_t n, str_fmt_fn fmt_fn, double f) {
+    int len = -1;
+    for (int prec = 15; prec <= 17; ++prec) {
+        len = fmt_fn(buf, n, "%.*g", prec, f);
+        if (len < 0 || (size_t)len >= n || strtod(buf, NULL) == f) {
+            break;
+        }
+    }
+    IF_RET(len < 0 || (size_t)len + 2 >= n, -1);
+    // inf and nan have an 'n' in them.
+    if (strpbrk(buf, ".en") == NULL) {
+        buf[len++] = '.';
+        buf[len++] = '0';
+        buf[len] = '\0';
+    }
+    return len;
+}
+
+typedef struct nvf_name_order {
+    const char *name;
+    nvf_num len;
+    nvf_num i;
+} nvf_name_order;
+
+// qsort() comparison for sorting map entries by name, byte by byte.
+int nvf_name_order_cmp(const void *a, const void *b) {
+    const nvf_name_order *l = a;
+    const nvf_name_order *r = b;
+    int c = memcmp(l->name, r->name, l->len < r->len ? l->len : r->len);
+    IF_RET(c != 0, c);
+    return (l->len > r->len) - (l->len < r->len);
+}
+
+// Compact output separates values with a space. Drop the one after the last
+// value of a map, an array or the root.
+void nvf_trim_sep(char *out, uintptr_t *out_len, uint32_t flags) {
+    if ((flags & NVF_STR_COMPACT) && *out_len >= 2 &&
+        out[*out_len - 2] == ' ') {
+        --*out_len;
+        out[*out_len - 1] = '\0';
+    }
+}
+
 nvf_err nvf_map_arr_to_str(nvf_root *root, char **out, uintptr_t *out_len,
-                           nvf_num map_arr_i, str_fmt_fn fmt_fn,
-                           nvf_parse_type pt, nvf_num indent_i) {
+                           uintptr_t *out_cap, nvf_num map_arr_i,
+                           str_fmt_fn fmt_fn, nvf_parse_type pt,
+                           nvf_num indent_i, uint32_t flags);
+
+// Make room for size bytes of output. The output grows geometrically, so
+// writing a value doesn't reallocate it every time. The output is freed if
+// this fails.
+nvf_err nvf_str_reserve(nvf_root *root, char **out, uintptr_t *out_cap,
+                        uintptr_t size) {
+    IF_RET(size <= *out_cap, NVF_OK);
+    uintptr_t new_cap = *out_cap * 2 > size ? *out_cap * 2 : size;
+    char *new_out = nvf_realloc(root, *out, *out_cap, new_cap);
+    if (new_out == NULL) {
+        nvf_dealloc(root, *out, *out_cap);
+        return NVF_BAD_ALLOC;
+    }
+    *out = new_out;
+    *out_cap = new_cap;
+    return NVF_OK;
+}
+
+// Shrink a finished output to len bytes, so it can be freed with the length
+// returned with it. The output is freed if this fails.
+nvf_err nvf_str_fit(nvf_root *root, char **out, uintptr_t cap,
+                    uintptr_t len) {
+    IF_RET(cap == len, NVF_OK);
+    char *new_out = nvf_realloc(root, *out, cap, len);
+    if (new_out == NULL) {
+        nvf_dealloc(root, *out, cap);
+        return NVF_BAD_ALLOC;
+    }
+    *out = new_out;
+    return NVF_OK;
+}
+
+// Get the format for the line opening a map or array named name.
+const char *nvf_open_fmt(const char *name, uint32_t flags) {
+    IF_RET(flags & NVF_STR_COMPACT, "%s%c");
+    return name[0] != '\0' ? "%s %c\n" : "%s%c\n";
+}
+
+// Write the values of a map or array from begin up to end, in the order given
+// by order if it's not NULL.
+nvf_err nvf_map_arr_items_to_str(nvf_root *root, char **out,
+                                 uintptr_t *out_len, uintptr_t *out_cap,
+                                 nvf_num map_arr_i, str_fmt_fn fmt_fn,
+                                 nvf_parse_type pt, nvf_num indent_i,
+                                 uint32_t flags, const nvf_name_order *order,
+                                 nvf_num begin, nvf_num end) {
     nvf_map *iter = NULL;
     nvf_array *arr = NULL;
     if (pt == NVF_PARSE_MAP) {
@@ -806,104 +4261,145 @@ nvf_err nvf_map_arr_to_str(nvf_root *root, char **out, uintptr_t *out_len,
     } else {
         return NVF_BAD_ARG;
     }
-    for (nvf_num m_i = 0; m_i < arr->num; ++m_i) {
+    bool compact = (flags & NVF_STR_COMPACT) != 0;
+    // Compact output has no indentation, and array values have no name to
+    // separate them from.
+    nvf_num tabs = compact ? 0 : indent_i;
+    const char *sep = compact && iter == NULL ? "" : " ";
+    char end_c = compact ? ' ' : '\n';
+    for (nvf_num o_i = begin; o_i < end; ++o_i) {
+        nvf_num m_i = order == NULL ? o_i : order[o_i].i;
         int len = 0;
         nvf_data_type dt = arr->types[m_i];
-        char *name = iter == NULL ? "" : iter->names[m_i];
+        const char *name =
+            iter == NULL ? "" : iter->name_data + iter->names[m_i].offset;
         nvf_value nv = arr->values[m_i];
         nvf_err r = NVF_OK;
+        char f_buf[NVF_FLOAT_TEXT_MAX];
+        if (dt == NVF_FLOAT && compact &&
+            nvf_fmt_float(f_buf, sizeof(f_buf), fmt_fn, nv.v_float) < 0) {
+            nvf_dealloc(root, *out, *out_cap);
+            return NVF_ERROR;
+        }
         if (dt == NVF_INT) {
-            len = fmt_fn(NULL, 0, "%s %ld\n", name, nv.v_int);
+            len = fmt_fn(NULL, 0, "%s%s%ld%c", name, sep, nv.v_int, end_c);
         } else if (dt == NVF_FLOAT) {
-            len = fmt_fn(NULL, 0, "%s %f\n", name, nv.v_float);
+            len = compact ? fmt_fn(NULL, 0, "%s%s%s%c", name, sep, f_buf, end_c)
+                          : fmt_fn(NULL, 0, "%s%s%f%c", name, sep, nv.v_float,
+                                   end_c);
         } else if (dt == NVF_STRING) {
-            len = fmt_fn(NULL, 0, "%s \"%s\"\n", name, nv.v_string);
+            len = fmt_fn(NULL, 0, "%s%s\"\"%c", name, sep, end_c);
+            if (len < 0) {
+                nvf_dealloc(root, *out, *out_cap);
+                return NVF_ERROR;
+            }
+            len += nvf_escaped_len(nv.v_string);
+        } else if (dt == NVF_BLOB && (flags & NVF_STR_BLOB_B64)) {
+            len = fmt_fn(NULL, 0, "%s%sb64%c", name, sep, end_c);
+            if (len < 0) {
+                nvf_dealloc(root, *out, *out_cap);
+                return NVF_ERROR;
+            }
+            len += nvf_encoded_b64_len(nv.v_blob->len);
         } else if (dt == NVF_BLOB) {
-            len = fmt_fn(NULL, 0, "%s bx\n", name);
+            len = fmt_fn(NULL, 0, "%s%sbx%c", name, sep, end_c);
             if (len < 0) {
-                root->free_inst(*out);
+                nvf_dealloc(root, *out, *out_cap);
                 return NVF_ERROR;
             }
             len += 2 * nv.v_blob->len;
+        } else if (dt == NVF_BLOB_REF) {
+            len = fmt_fn(NULL, 0, "%s%sbf\"%s\":%" PRIu64 ":%" PRIu32 "%c",
+                         name, sep, nv.v_blob_ref->path, nv.v_blob_ref->offset,
+                         nv.v_blob_ref->len, end_c);
         } else if (dt == NVF_MAP || dt == NVF_ARRAY) {
             char start_c = dt == NVF_MAP ? '{' : '[';
-            len = strlen(name) > 0 ? fmt_fn(NULL, 0, "%s %c\n", name, start_c)
-                                   : fmt_fn(NULL, 0, "%c\n", start_c);
+            const char *open_fmt = nvf_open_fmt(name, flags);
+            len = fmt_fn(NULL, 0, open_fmt, name, start_c);
             if (len < 0) {
-                root->free_inst(*out);
+                nvf_dealloc(root, *out, *out_cap);
                 return NVF_ERROR;
             }
             len += 1;
-            uintptr_t new_len = *out_len + len;
-            char *new_out = root->realloc_inst(*out, new_len);
-            if (new_out == NULL) {
-                root->free_inst(*out);
-                return NVF_BAD_ALLOC;
-            }
-            *out = new_out;
+            r = nvf_str_reserve(root, out, out_cap, *out_len + len + tabs);
+            IF_RET(r != NVF_OK, r);
 
             char *out_start = *out + *out_len - 1;
-            memset(out_start, '\t', indent_i);
-            out_start += indent_i;
+            memset(out_start, '\t', tabs);
+            out_start += tabs;
 
-            int fmt_r = strlen(name) > 0
-                            ? fmt_fn(out_start, len, "%s %c\n", name, start_c)
-                            : fmt_fn(out_start, len, "%c\n", start_c);
+            int fmt_r = fmt_fn(out_start, len, open_fmt, name, start_c);
             if (fmt_r < 0) {
-                root->free_inst(*out);
+                nvf_dealloc(root, *out, *out_cap);
                 return NVF_BAD_ALLOC;
             }
-            *out_len += len + indent_i - 1;
+            *out_len += len + tabs - 1;
 
             nvf_parse_type new_pt =
                 dt == NVF_MAP ? NVF_PARSE_MAP : NVF_PARSE_ARRAY;
             nvf_num next_i = dt == NVF_MAP ? nv.map_i : nv.array_i;
-            r = nvf_map_arr_to_str(root, out, out_len, next_i, fmt_fn, new_pt,
-                                   indent_i + 1);
-            if (r != NVF_OK) {
-                root->free_inst(*out);
-                return r;
-            }
+            // The nested call frees the output if it fails.
+            r = nvf_map_arr_to_str(root, out, out_len, out_cap, next_i, fmt_fn,
+                                   new_pt, indent_i + 1, flags);
+            IF_RET(r != NVF_OK, r);
+            nvf_trim_sep(*out, out_len, flags);
             // Account for the closing brace/bracket and a \n
             len = 2;
         } else {
             // We're assuming free is null safe here.
-            root->free_inst(*out);
+            nvf_dealloc(root, *out, *out_cap);
             return NVF_BAD_VALUE_TYPE;
         }
         if (len < 0) {
-            root->free_inst(*out);
+            nvf_dealloc(root, *out, *out_cap);
             return NVF_ERROR;
         }
         // Add one to the length to account for the NULL terminator.
         len += 1;
 
         if (len > 0) {
-            uintptr_t new_len = *out_len + len + indent_i;
-            char *new_out = root->realloc_inst(*out, new_len);
-            if (new_out == NULL) {
-                root->free_inst(*out);
-                return NVF_BAD_ALLOC;
-            }
-            *out = new_out;
+            r = nvf_str_reserve(root, out, out_cap, *out_len + len + tabs);
+            IF_RET(r != NVF_OK, r);
         }
 
         // Subtract one to account for the NULL terminator.
         char *out_end = *out + *out_len - 1;
         int fmt_r = 0;
         // Add the indent level we need
-        memset(out_end, '\t', indent_i);
-        out_end += indent_i;
+        memset(out_end, '\t', tabs);
+        out_end += tabs;
         if (dt == NVF_INT) {
-            fmt_r = fmt_fn(out_end, len, "%s %ld\n", name, nv.v_int);
+            fmt_r =
+                fmt_fn(out_end, len, "%s%s%ld%c", name, sep, nv.v_int, end_c);
         } else if (dt == NVF_FLOAT) {
-            fmt_r = fmt_fn(out_end, len, "%s %f\n", name, nv.v_float);
+            fmt_r = compact ? fmt_fn(out_end, len, "%s%s%s%c", name, sep, f_buf,
+                                     end_c)
+                            : fmt_fn(out_end, len, "%s%s%f%c", name, sep,
+                                     nv.v_float, end_c);
         } else if (dt == NVF_STRING) {
-            fmt_r = fmt_fn(out_end, len, "%s \"%s\"\n", name, nv.v_string);
+            fmt_r = fmt_fn(out_end, len, "%s%s\"", name, sep);
+            if (fmt_r < 0) {
+                nvf_dealloc(root, *out, *out_cap);
+                return NVF_ERROR;
+            }
+            char *str_end = nvf_write_escaped(out_end + fmt_r, nv.v_string);
+            str_end[0] = '"';
+            str_end[1] = end_c;
+            str_end[2] = '\0';
+        } else if (dt == NVF_BLOB && (flags & NVF_STR_BLOB_B64)) {
+            fmt_r = fmt_fn(out_end, len, "%s%sb64", name, sep);
+            if (fmt_r < 0) {
+                nvf_dealloc(root, *out, *out_cap);
+                return NVF_ERROR;
+            }
+            char *b64_end = nvf_encode_b64(nv.v_blob->data, nv.v_blob->len,
+                                           out_end + fmt_r);
+            b64_end[0] = end_c;
+            b64_end[1] = '\0';
         } else if (dt == NVF_BLOB) {
-            fmt_r = fmt_fn(out_end, len, "%s bx", name);
+            fmt_r = fmt_fn(out_end, len, "%s%sbx", name, sep);
             if (fmt_r < 0) {
-                root->free_inst(*out);
+                nvf_dealloc(root, *out, *out_cap);
                 return NVF_ERROR;
             }
             uint8_t *bin_data = nv.v_blob->data;
@@ -912,52 +4408,889 @@ nvf_err nvf_map_arr_to_str(nvf_root *root, char **out, uintptr_t *out_len,
             for (uintptr_t bin_i = 0; bin_i < bin_len; ++bin_i) {
                 char tmp = nvf_bin_to_char(bin_data[bin_i] >> 4);
                 if (tmp == '\0') {
-                    root->free_inst(*out);
+                    nvf_dealloc(root, *out, *out_cap);
                     return NVF_BAD_DATA;
                 }
                 hex_start[2 * bin_i] = tmp;
 
                 tmp = nvf_bin_to_char(bin_data[bin_i] & 0xf);
                 if (tmp == '\0') {
-                    root->free_inst(*out);
+                    nvf_dealloc(root, *out, *out_cap);
                     return NVF_BAD_DATA;
                 }
                 hex_start[2 * bin_i + 1] = tmp;
             }
-            hex_start[2 * bin_len] = '\n';
+            hex_start[2 * bin_len] = end_c;
+            hex_start[2 * bin_len + 1] = '\0';
+        } else if (dt == NVF_BLOB_REF) {
+            fmt_r = fmt_fn(out_end, len,
+                           "%s%sbf\"%s\":%" PRIu64 ":%" PRIu32 "%c", name, sep,
+                           nv.v_blob_ref->path, nv.v_blob_ref->offset,
+                           nv.v_blob_ref->len, end_c);
         } else if (dt == NVF_MAP || dt == NVF_ARRAY) {
             char start_c = dt == NVF_MAP ? '}' : ']';
-            fmt_r = fmt_fn(out_end, len, "%c\n", start_c);
+            fmt_r = fmt_fn(out_end, len, "%c%c", start_c, end_c);
         }
         if (fmt_r < 0) {
-            root->free_inst(*out);
+            nvf_dealloc(root, *out, *out_cap);
             return NVF_ERROR;
         }
         // NOTE: This function probably has a buffer overflow somehwere.
         // Doing this kind of stuff with C strings is hard for me.
-        *out_len += len + indent_i - 1;
+        *out_len += len + tabs - 1;
+        NVF_INST_VALUE(dt, len + tabs - 1, 0);
     }
 
     return NVF_OK;
 }
 
+// Check if a map is written sorted by name.
+bool nvf_map_sorted(const nvf_map *m, uint32_t flags) {
+    return m != NULL && (flags & NVF_STR_COMPACT) && m->arr.num >= 2;
+}
+
+// Get a map's entries sorted by name. Returns NULL if allocation fails.
+nvf_name_order *nvf_map_name_order(nvf_root *root, const nvf_map *m) {
+    nvf_name_order *order =
+        nvf_realloc(root, NULL, 0, m->arr.num * sizeof(*order));
+    IF_RET(order == NULL, NULL);
+    for (nvf_num m_i = 0; m_i < m->arr.num; ++m_i) {
+        order[m_i].name = m->name_data + m->names[m_i].offset;
+        order[m_i].len = m->names[m_i].len;
+        order[m_i].i = m_i;
+    }
+    qsort(order, m->arr.num, sizeof(*order), nvf_name_order_cmp);
+    return order;
+}
+
+nvf_err nvf_map_arr_to_str(nvf_root *root, char **out, uintptr_t *out_len,
+                           uintptr_t *out_cap, nvf_num map_arr_i,
+                           str_fmt_fn fmt_fn, nvf_parse_type pt,
+                           nvf_num indent_i, uint32_t flags) {
+    const nvf_map *m = pt == NVF_PARSE_MAP ? root->maps + map_arr_i : NULL;
+    nvf_num num = m != NULL ? m->arr.num : root->arrays[map_arr_i].num;
+    if (!nvf_map_sorted(m, flags)) {
+        return nvf_map_arr_items_to_str(root, out, out_len, out_cap, map_arr_i,
+                                        fmt_fn, pt, indent_i, flags, NULL, 0,
+                                        num);
+    }
+    // Compact output is canonical, so maps are written sorted by name.
+    nvf_name_order *order = nvf_map_name_order(root, m);
+    if (order == NULL) {
+        nvf_dealloc(root, *out, *out_cap);
+        return NVF_BAD_ALLOC;
+    }
+    nvf_err r = nvf_map_arr_items_to_str(root, out, out_len, out_cap,
+                                         map_arr_i, fmt_fn, pt, indent_i,
+                                         flags, order, 0, num);
+    nvf_dealloc(root, order, num * sizeof(*order));
+    return r;
+}
+
 nvf_err nvf_root_to_str(nvf_root *root, char **out, uintptr_t *out_len,
                         str_fmt_fn fmt_fn) {
+    return nvf_root_to_str_flags(root, out, out_len, fmt_fn, NVF_STR_DEFAULT);
+}
+
+nvf_err nvf_root_to_str_flags(nvf_root *root, char **out, uintptr_t *out_len,
+                              str_fmt_fn fmt_fn, uint32_t flags) {
     IF_RET(root == NULL || out == NULL || out_len == NULL, NVF_BAD_ARG);
     // Iterate through the structure and append it to the string.
     // Use the allocator to allocate the string.
 
     IF_RET(root->map_num == 0, NVF_OK);
+    NVF_INST_RESET();
+    NVF_INST_START(to_str_start);
     // Allocate one byte for the NULL terminator.
-    *out = root->realloc_inst(NULL, 1);
+    *out = nvf_realloc(root, NULL, 0, 1);
     IF_RET(*out == NULL, NVF_BAD_ALLOC);
     *out[0] = '\0';
     *out_len = 1;
+    uintptr_t out_cap = 1;
 
-    return nvf_map_arr_to_str(root, out, out_len, 0, fmt_fn, NVF_PARSE_MAP, 0);
+    nvf_err r = nvf_map_arr_to_str(root, out, out_len, &out_cap, 0, fmt_fn,
+                                   NVF_PARSE_MAP, 0, flags);
+    if (r == NVF_OK) {
+        nvf_trim_sep(*out, out_len, flags);
+        r = nvf_str_fit(root, out, out_cap, *out_len);
+    }
+    NVF_INST_STOP(to_str_start, NVF_PHASE_TO_STR);
+    NVF_INST_FINISH();
+    return r;
 }
 
 nvf_err nvf_default_root_to_str(nvf_root *root, char **out,
                                 uintptr_t *out_len) {
     return nvf_root_to_str(root, out, out_len, snprintf);
 }
+
+// Roots whose output is estimated to be smaller than this are written on one
+// thread, since starting threads would take longer.
+#define NVF_STR_THREADS_MIN (64 * 1024)
+// Split the output into about this many jobs per thread, so threads that
+// finish early can take more.
+#define NVF_STR_JOBS_PER_THREAD 8
+
+// A piece of nvf_root_to_str_threads() output. Either some values of a map or
+// array, or the text opening or closing a map or array that was split up.
+typedef struct nvf_str_job {
+    nvf_num map_arr_i;
+    nvf_parse_type pt;
+    nvf_num indent_i;
+    const nvf_name_order *order;
+    nvf_num begin, end;
+    bool text, close;
+    char *out;
+    uintptr_t out_len, out_cap;
+    nvf_err err;
+} nvf_str_job;
+
+// A map's entries sorted by name, shared by the jobs writing the map.
+typedef struct nvf_str_order {
+    nvf_name_order *names;
+    nvf_num num;
+} nvf_str_order;
+
+typedef struct nvf_str_plan {
+    nvf_root *root;
+    str_fmt_fn fmt_fn;
+    uint32_t flags;
+    uint64_t *map_w, *arr_w;
+    uint64_t target;
+    nvf_str_job *jobs;
+    nvf_num job_num, job_cap;
+    nvf_str_order *orders;
+    nvf_num order_num, order_cap;
+    nvf_num next_job;
+} nvf_str_plan;
+
+uint64_t nvf_str_weight(nvf_str_plan *p, nvf_num map_arr_i, nvf_parse_type pt);
+
+// Estimate the bytes a value takes in the output.
+uint64_t nvf_str_item_weight(nvf_str_plan *p, const nvf_array *arr,
+                             nvf_num i) {
+    nvf_data_type dt = arr->types[i];
+    if (dt == NVF_MAP) {
+        return 16 + nvf_str_weight(p, arr->values[i].map_i, NVF_PARSE_MAP);
+    } else if (dt == NVF_ARRAY) {
+        return 16 + nvf_str_weight(p, arr->values[i].array_i, NVF_PARSE_ARRAY);
+    } else if (dt == NVF_BLOB) {
+        return 16 + 2 * (uint64_t)arr->values[i].v_blob->len;
+    }
+    return 16 + nvf_leaf_len(dt, arr->values[i]);
+}
+
+// Estimate the bytes a map or array takes in the output. Each one is only
+// added up once.
+uint64_t nvf_str_weight(nvf_str_plan *p, nvf_num map_arr_i,
+                        nvf_parse_type pt) {
+    uint64_t *w = pt == NVF_PARSE_MAP ? &p->map_w[map_arr_i]
+                                      : &p->arr_w[map_arr_i];
+    if (*w == UINT64_MAX) {
+        const nvf_array *arr = pt == NVF_PARSE_MAP
+                                   ? &p->root->maps[map_arr_i].arr
+                                   : &p->root->arrays[map_arr_i];
+        uint64_t sum = 0;
+        for (nvf_num i = 0; i < arr->num; ++i) {
+            sum += nvf_str_item_weight(p, arr, i);
+        }
+        *w = sum;
+    }
+    return *w;
+}
+
+// Add a job to the plan.
+nvf_err nvf_str_add_job(nvf_str_plan *p, const nvf_str_job *job) {
+    if (p->job_num == p->job_cap) {
+        nvf_num new_cap = nvf_grow_cap(p->job_cap, 16);
+        IF_RET(new_cap == 0, NVF_BAD_ALLOC);
+        nvf_str_job *new_jobs =
+            nvf_realloc(p->root, p->jobs, p->job_cap * sizeof(*new_jobs),
+                        new_cap * sizeof(*new_jobs));
+        IF_RET(new_jobs == NULL, NVF_BAD_ALLOC);
+        p->jobs = new_jobs;
+        p->job_cap = new_cap;
+    }
+    p->jobs[p->job_num++] = *job;
+    return NVF_OK;
+}
+
+// Add a job holding text: tabs tab characters, then fmt with name and c.
+nvf_err nvf_str_add_text(nvf_str_plan *p, nvf_num tabs, const char *fmt,
+                         const char *name, char c, bool close) {
+    int len = p->fmt_fn(NULL, 0, fmt, name, c);
+    IF_RET(len < 0, NVF_ERROR);
+    nvf_str_job job = {.text = true, .close = close};
+    job.out_len = tabs + len + 1;
+    job.out_cap = job.out_len;
+    job.out = nvf_realloc(p->root, NULL, 0, job.out_cap);
+    IF_RET(job.out == NULL, NVF_BAD_ALLOC);
+    memset(job.out, '\t', tabs);
+    if (p->fmt_fn(job.out + tabs, len + 1, fmt, name, c) < 0) {
+        nvf_dealloc(p->root, job.out, job.out_cap);
+        return NVF_ERROR;
+    }
+    nvf_err r = nvf_str_add_job(p, &job);
+    if (r != NVF_OK) {
+        nvf_dealloc(p->root, job.out, job.out_cap);
+    }
+    return r;
+}
+
+// Split the values of a map or array into jobs of about p->target bytes each,
+// in the order they're written. Maps and arrays too big for one job are split
+// the same way, between jobs holding their opening and closing text.
+nvf_err nvf_str_plan_map_arr(nvf_str_plan *p, nvf_num map_arr_i,
+                             nvf_parse_type pt, nvf_num indent_i) {
+    const nvf_map *m = pt == NVF_PARSE_MAP ? &p->root->maps[map_arr_i] : NULL;
+    const nvf_array *arr = m != NULL ? &m->arr : &p->root->arrays[map_arr_i];
+    const nvf_name_order *order = NULL;
+    if (nvf_map_sorted(m, p->flags)) {
+        if (p->order_num == p->order_cap) {
+            nvf_num new_cap = nvf_grow_cap(p->order_cap, 4);
+            IF_RET(new_cap == 0, NVF_BAD_ALLOC);
+            nvf_str_order *new_orders = nvf_realloc(
+                p->root, p->orders, p->order_cap * sizeof(*new_orders),
+                new_cap * sizeof(*new_orders));
+            IF_RET(new_orders == NULL, NVF_BAD_ALLOC);
+            p->orders = new_orders;
+            p->order_cap = new_cap;
+        }
+        nvf_str_order *o = &p->orders[p->order_num];
+        o->names = nvf_map_name_order(p->root, m);
+        IF_RET(o->names == NULL, NVF_BAD_ALLOC);
+        o->num = m->arr.num;
+        ++p->order_num;
+        order = o->names;
+    }
+
+    nvf_str_job job = {
+        .map_arr_i = map_arr_i,
+        .pt = pt,
+        .indent_i = indent_i,
+        .order = order,
+    };
+    bool compact = (p->flags & NVF_STR_COMPACT) != 0;
+    nvf_num tabs = compact ? 0 : indent_i;
+    uint64_t job_w = 0;
+    nvf_err r = NVF_OK;
+    for (nvf_num o_i = 0; o_i < arr->num && r == NVF_OK; ++o_i) {
+        nvf_num i = order == NULL ? o_i : order[o_i].i;
+        nvf_data_type dt = arr->types[i];
+        uint64_t item_w = nvf_str_item_weight(p, arr, i);
+        if ((dt == NVF_MAP || dt == NVF_ARRAY) && item_w > p->target) {
+            job.end = o_i;
+            if (job.end > job.begin) {
+                r = nvf_str_add_job(p, &job);
+            }
+            job.begin = o_i + 1;
+            job_w = 0;
+            // No job writes this one, so it's counted here.
+            NVF_INST_VALUE(dt, 0, 0);
+            const char *name =
+                m == NULL ? "" : m->name_data + m->names[i].offset;
+            if (r == NVF_OK) {
+                r = nvf_str_add_text(p, tabs, nvf_open_fmt(name, p->flags),
+                                     name, dt == NVF_MAP ? '{' : '[', false);
+            }
+            if (r == NVF_OK) {
+                r = nvf_str_plan_map_arr(
+                    p,
+                    dt == NVF_MAP ? arr->values[i].map_i
+                                  : arr->values[i].array_i,
+                    dt == NVF_MAP ? NVF_PARSE_MAP : NVF_PARSE_ARRAY,
+                    indent_i + 1);
+            }
+            if (r == NVF_OK) {
+                r = nvf_str_add_text(p, tabs, "%s%c",
+                                     dt == NVF_MAP ? "}" : "]",
+                                     compact ? ' ' : '\n', true);
+            }
+            continue;
+        }
+        job_w += item_w;
+        if (job_w >= p->target) {
+            job.end = o_i + 1;
+            r = nvf_str_add_job(p, &job);
+            job.begin = o_i + 1;
+            job_w = 0;
+        }
+    }
+    job.end = arr->num;
+    if (r == NVF_OK && job.end > job.begin) {
+        r = nvf_str_add_job(p, &job);
+    }
+    return r;
+}
+
+typedef struct nvf_str_worker {
+    nvf_root root;
+    nvf_str_plan *plan;
+    nvf_parse_stats inst; // The thread's counters, if it's instrumented
+} nvf_str_worker;
+
+// Take jobs from the plan until there are none left. Each worker allocates
+// through its own copy of the root, so their allocation counts don't race.
+void *nvf_str_work(void *arg) {
+    nvf_str_worker *w = arg;
+    nvf_str_plan *p = w->plan;
+    for (;;) {
+        nvf_num j_i = __atomic_fetch_add(&p->next_job, 1, __ATOMIC_RELAXED);
+        if (j_i >= p->job_num) {
+            break;
+        }
+        nvf_str_job *job = &p->jobs[j_i];
+        if (job->text) {
+            continue;
+        }
+        job->out = nvf_realloc(&w->root, NULL, 0, 1);
+        if (job->out == NULL) {
+            job->err = NVF_BAD_ALLOC;
+            continue;
+        }
+        job->out[0] = '\0';
+        job->out_len = 1;
+        job->out_cap = 1;
+        job->err = nvf_map_arr_items_to_str(
+            &w->root, &job->out, &job->out_len, &job->out_cap, job->map_arr_i,
+            p->fmt_fn, job->pt, job->indent_i, p->flags, job->order,
+            job->begin, job->end);
+        if (job->err != NVF_OK) {
+            // The output was freed.
+            job->out = NULL;
+        }
+    }
+    return NULL;
+}
+
+// Run nvf_str_work() on a new thread. Its counters are kept so the calling
+// thread can add them to its own.
+void *nvf_str_thread(void *arg) {
+    nvf_str_worker *w = arg;
+    NVF_INST_RESET();
+    nvf_str_work(w);
+    NVF_INST_SAVE(w->inst);
+    return NULL;
+}
+
+nvf_err nvf_root_to_str_threads(nvf_root *root, char **out, uintptr_t *out_len,
+                                str_fmt_fn fmt_fn, uint32_t flags,
+                                uint32_t thread_num) {
+    IF_RET(root == NULL || out == NULL || out_len == NULL, NVF_BAD_ARG);
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t cpu_num = cpus > 0 && cpus < UINT32_MAX ? (uint32_t)cpus : 1;
+    if (thread_num == 0) {
+        thread_num = cpu_num;
+    }
+    if (thread_num == 1 || root->map_num == 0) {
+        return nvf_root_to_str_flags(root, out, out_len, fmt_fn, flags);
+    }
+
+    nvf_str_plan p = {
+        .root = root,
+        .fmt_fn = fmt_fn,
+        .flags = flags,
+    };
+    nvf_err r = NVF_OK;
+    uintptr_t w_len = ((uintptr_t)root->map_num + root->array_num) *
+                      sizeof(uint64_t);
+    p.map_w = nvf_realloc(root, NULL, 0, w_len);
+    IF_RET(p.map_w == NULL, NVF_BAD_ALLOC);
+    memset(p.map_w, 0xff, w_len);
+    p.arr_w = p.map_w + root->map_num;
+    uint64_t total = nvf_str_weight(&p, 0, NVF_PARSE_MAP);
+    if (total < NVF_STR_THREADS_MIN) {
+        nvf_dealloc(root, p.map_w, w_len);
+        return nvf_root_to_str_flags(root, out, out_len, fmt_fn, flags);
+    }
+    NVF_INST_RESET();
+    NVF_INST_START(to_str_start);
+    // More threads than CPUs only take turns, and threads without a job to
+    // take would only be started and joined. The pieces are still planned
+    // and joined the same way when that leaves one thread.
+    if (thread_num > cpu_num) {
+        thread_num = cpu_num;
+    }
+    p.target = total / ((uint64_t)thread_num * NVF_STR_JOBS_PER_THREAD) + 1;
+    r = nvf_str_plan_map_arr(&p, 0, NVF_PARSE_MAP, 0);
+    nvf_num work_num = 0;
+    for (nvf_num j_i = 0; j_i < p.job_num; ++j_i) {
+        work_num += !p.jobs[j_i].text;
+    }
+    if (thread_num > work_num) {
+        thread_num = work_num > 0 ? work_num : 1;
+    }
+
+    nvf_str_worker *workers = NULL;
+    if (r == NVF_OK) {
+        workers = nvf_realloc(root, NULL, 0, thread_num * sizeof(*workers));
+        r = workers == NULL ? NVF_BAD_ALLOC : NVF_OK;
+    }
+    if (r == NVF_OK) {
+        // This thread is the first worker. If a thread can't be started, the
+        // others do its share.
+        pthread_t *threads =
+            nvf_realloc(root, NULL, 0, thread_num * sizeof(*threads));
+        uint64_t calls = root->alloc_calls;
+        uint32_t started = 0;
+        for (uint32_t t_i = 0; t_i < thread_num; ++t_i) {
+            workers[t_i].root = *root;
+            workers[t_i].plan = &p;
+        }
+        for (uint32_t t_i = 1; threads != NULL && t_i < thread_num; ++t_i) {
+            if (pthread_create(&threads[t_i], NULL, nvf_str_thread,
+                               &workers[t_i]) != 0) {
+                break;
+            }
+            ++started;
+        }
+        nvf_str_work(&workers[0]);
+        for (uint32_t t_i = 1; t_i <= started; ++t_i) {
+            pthread_join(threads[t_i], NULL);
+            NVF_INST_MERGE(workers[t_i].inst);
+        }
+        nvf_dealloc(root, threads, thread_num * sizeof(*threads));
+        if (!root->frozen) {
+            for (uint32_t t_i = 0; t_i < thread_num; ++t_i) {
+                root->alloc_calls += workers[t_i].root.alloc_calls - calls;
+            }
+        }
+    }
+    nvf_dealloc(root, workers, thread_num * sizeof(*workers));
+
+    // Join the jobs in order. A closing brace or bracket drops the separator
+    // before it, like nvf_map_arr_to_str() does.
+    uintptr_t len = 1;
+    for (nvf_num j_i = 0; r == NVF_OK && j_i < p.job_num; ++j_i) {
+        r = p.jobs[j_i].err;
+        len += p.jobs[j_i].out_len - 1;
+    }
+    char *joined = r == NVF_OK ? nvf_realloc(root, NULL, 0, len) : NULL;
+    r = r == NVF_OK && joined == NULL ? NVF_BAD_ALLOC : r;
+    uintptr_t joined_len = 1;
+    if (r == NVF_OK) {
+        joined[0] = '\0';
+        for (nvf_num j_i = 0; j_i < p.job_num; ++j_i) {
+            const nvf_str_job *job = &p.jobs[j_i];
+            if (job->close) {
+                nvf_trim_sep(joined, &joined_len, flags);
+            }
+            memcpy(joined + joined_len - 1, job->out, job->out_len);
+            joined_len += job->out_len - 1;
+        }
+        nvf_trim_sep(joined, &joined_len, flags);
+        r = nvf_str_fit(root, &joined, len, joined_len);
+    }
+    if (r == NVF_OK) {
+        *out = joined;
+        *out_len = joined_len;
+    }
+
+    for (nvf_num j_i = 0; j_i < p.job_num; ++j_i) {
+        nvf_dealloc(root, p.jobs[j_i].out, p.jobs[j_i].out_cap);
+    }
+    for (nvf_num o_i = 0; o_i < p.order_num; ++o_i) {
+        nvf_dealloc(root, p.orders[o_i].names,
+                    p.orders[o_i].num * sizeof(*p.orders[o_i].names));
+    }
+    nvf_dealloc(root, p.jobs, p.job_cap * sizeof(*p.jobs));
+    nvf_dealloc(root, p.orders, p.order_cap * sizeof(*p.orders));
+    nvf_dealloc(root, p.map_w, w_len);
+    NVF_INST_STOP(to_str_start, NVF_PHASE_TO_STR);
+    NVF_INST_FINISH();
+    return r;
+}
+
+// C output from nvf_root_to_c() while it's being written.
+typedef struct nvf_c_buf {
+    nvf_root *root;
+    char *data;
+    uintptr_t len, cap;
+    nvf_err err;
+} nvf_c_buf;
+
+// Append formatted text to a C output. The first error is kept in b->err and
+// later calls do nothing, so callers only check once at the end.
+void nvf_c_printf(nvf_c_buf *b, const char *fmt, ...) {
+    IF_RET(b->err != NVF_OK, );
+    va_list args;
+    va_start(args, fmt);
+    va_list args_copy;
+    va_copy(args_copy, args);
+    int len = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+    if (len < 0) {
+        b->err = NVF_ERROR;
+    } else if (b->len + len + 1 > b->cap) {
+        uintptr_t new_cap = b->cap * 2 + len + 1;
+        char *new_data = nvf_realloc(b->root, b->data, b->cap, new_cap);
+        if (new_data == NULL) {
+            b->err = NVF_BAD_ALLOC;
+        } else {
+            b->data = new_data;
+            b->cap = new_cap;
+        }
+    }
+    if (b->err == NVF_OK) {
+        vsnprintf(b->data + b->len, b->cap - b->len, fmt, args_copy);
+        b->len += len;
+    }
+    va_end(args_copy);
+}
+
+// Append bytes as a C string literal, split into lines. Everything but
+// letters, digits, spaces and a few safe symbols is written as an octal
+// escape so no byte can end the literal or form a trigraph.
+void nvf_c_str(nvf_c_buf *b, const char *data, uintptr_t len) {
+    nvf_c_printf(b, "\"");
+    uintptr_t line_len = 0;
+    for (uintptr_t i = 0; i < len; ++i) {
+        unsigned char c = data[i];
+        if (line_len >= 64) {
+            nvf_c_printf(b, "\"\n    \"");
+            line_len = 0;
+        }
+        if (isalnum(c) || (c != 0 && strchr(" _-.,:;/=+*!#%&()<>[]{}", c))) {
+            nvf_c_printf(b, "%c", c);
+            line_len += 1;
+        } else {
+            nvf_c_printf(b, "\\%03o", c);
+            line_len += 4;
+        }
+    }
+    nvf_c_printf(b, "\"");
+}
+
+// Append a value as an nvf_value initializer. Strings, BLOBs and BLOB
+// references point at the objects nvf_c_leaf() wrote for them.
+void nvf_c_value(nvf_c_buf *b, const char *name, const char *arr_name,
+                 nvf_data_type dt, nvf_value v, nvf_num i) {
+    if (dt == NVF_INT) {
+        if (v.v_int == INT64_MIN) {
+            nvf_c_printf(b, "{.v_int = INT64_MIN}");
+        } else {
+            nvf_c_printf(b, "{.v_int = INT64_C(%" PRId64 ")}", v.v_int);
+        }
+    } else if (dt == NVF_FLOAT) {
+        if (isnan(v.v_float)) {
+            nvf_c_printf(b, "{.v_float = NAN}");
+        } else if (isinf(v.v_float)) {
+            nvf_c_printf(b, "{.v_float = %sINFINITY}",
+                         v.v_float < 0 ? "-" : "");
+        } else {
+            // Hex floats round trip exactly.
+            nvf_c_printf(b, "{.v_float = %a}", v.v_float);
+        }
+    } else if (dt == NVF_MAP) {
+        nvf_c_printf(b, "{.map_i = %" PRIu32 "}", v.map_i);
+    } else if (dt == NVF_ARRAY) {
+        nvf_c_printf(b, "{.array_i = %" PRIu32 "}", v.array_i);
+    } else if (dt == NVF_STRING) {
+        nvf_c_printf(b, "{.v_string = (nvf_str *)&%s_%s_%" PRIu32 "}", name,
+                     arr_name, i);
+    } else if (dt == NVF_BLOB) {
+        nvf_c_printf(b, "{.v_blob = (nvf_blob *)&%s_%s_%" PRIu32 "}", name,
+                     arr_name, i);
+    } else if (dt == NVF_BLOB_REF) {
+        nvf_c_printf(b, "{.v_blob_ref = (nvf_blob_ref *)&%s_%s_%" PRIu32 "}",
+                     name, arr_name, i);
+    } else {
+        b->err = NVF_BAD_VALUE_TYPE;
+    }
+}
+
+// Append the objects holding an array's strings and BLOBs. They have the same
+// layout as nvf_str, nvf_blob and nvf_blob_ref with the flexible array given
+// a size. BLOB references aren't const since they're mapped when read, and
+// their struct comes from nvf.h since it has more members.
+void nvf_c_leaves(nvf_c_buf *b, const char *name, const char *arr_name,
+                  const nvf_array *a) {
+    for (nvf_num i = 0; i < a->num; ++i) {
+        nvf_value v = a->values[i];
+        if (a->types[i] == NVF_STRING) {
+            nvf_c_printf(b,
+                         "static const struct {\n"
+                         "    nvf_num len;\n"
+                         "    char data[%" PRIu32 "];\n"
+                         "} %s_%s_%" PRIu32 " = {%" PRIu32 ", ",
+                         v.v_string->len + 1, name, arr_name, i,
+                         v.v_string->len);
+            nvf_c_str(b, v.v_string->data, v.v_string->len);
+            nvf_c_printf(b, "};\n");
+        } else if (a->types[i] == NVF_BLOB) {
+            // Zero length arrays aren't standard C.
+            nvf_num len = v.v_blob->len > 0 ? v.v_blob->len : 1;
+            nvf_c_printf(b,
+                         "static const struct {\n"
+                         "    nvf_num len;\n"
+                         "    uint8_t data[%" PRIu32 "];\n"
+                         "} %s_%s_%" PRIu32 " = {%" PRIu32 ", {",
+                         len, name, arr_name, i, v.v_blob->len);
+            for (nvf_num d_i = 0; d_i < v.v_blob->len; ++d_i) {
+                nvf_c_printf(b, "%s0x%02x", d_i % 12 == 0 ? "\n    " : " ",
+                             v.v_blob->data[d_i]);
+                nvf_c_printf(b, d_i + 1 < v.v_blob->len ? "," : "\n");
+            }
+            nvf_c_printf(b, "}};\n");
+        } else if (a->types[i] == NVF_BLOB_REF) {
+            const nvf_blob_ref *ref = v.v_blob_ref;
+            nvf_c_printf(b,
+                         "static NVF_BLOB_REF_STRUCT(, %" PRIu32
+                         ") %s_%s_%" PRIu32 " = {\n"
+                         "    .offset = UINT64_C(%" PRIu64 "),\n"
+                         "    .len = %" PRIu32 ",\n"
+                         "    .path_len = %" PRIu32 ",\n"
+                         "    .path = ",
+                         ref->path_len + 1, name, arr_name, i, ref->offset,
+                         ref->len, ref->path_len);
+            nvf_c_str(b, ref->path, ref->path_len);
+            nvf_c_printf(b, ",\n};\n");
+        }
+    }
+}
+
+// Append an array's types and values, after the objects they point to.
+void nvf_c_array(nvf_c_buf *b, const char *name, const char *arr_name,
+                 const nvf_array *a) {
+    IF_RET(a->num == 0, );
+    nvf_c_leaves(b, name, arr_name, a);
+    nvf_c_printf(b, "static const uint8_t %s_%s_types[] = {", name, arr_name);
+    for (nvf_num i = 0; i < a->num; ++i) {
+        nvf_c_printf(b, "\n    %s,", nvf_type_str(a->types[i]));
+    }
+    nvf_c_printf(b, "\n};\nstatic const nvf_value %s_%s_values[] = {", name,
+                 arr_name);
+    for (nvf_num i = 0; i < a->num; ++i) {
+        nvf_c_printf(b, "\n    ");
+        nvf_c_value(b, name, arr_name, a->types[i], a->values[i], i);
+        nvf_c_printf(b, ",");
+    }
+    nvf_c_printf(b, "\n};\n");
+}
+
+// Append an nvf_array initializer pointing at what nvf_c_array() wrote,
+// indented by indent spaces.
+void nvf_c_array_init(nvf_c_buf *b, const char *name, const char *arr_name,
+                      const nvf_array *a, int indent) {
+    if (a->num == 0) {
+        nvf_c_printf(b, "{0}");
+        return;
+    }
+    nvf_c_printf(b,
+                 "{\n"
+                 "%*s    .types = (uint8_t *)%s_%s_types,\n"
+                 "%*s    .values = (nvf_value *)%s_%s_values,\n"
+                 "%*s    .num = %" PRIu32 ",\n"
+                 "%*s    .cap = %" PRIu32 ",\n"
+                 "%*s}",
+                 indent, "", name, arr_name, indent, "", name, arr_name,
+                 indent, "", a->num, indent, "", a->num, indent, "");
+}
+
+// Append a map's names and perfect hash. The hash is copied from a frozen
+// root, or built here so compiling a root doesn't have to freeze it. Returns
+// the number of seeds written, or 0 if the map is scanned.
+nvf_num nvf_c_map_names(nvf_c_buf *b, const char *name, const char *map_name,
+                     nvf_map *m) {
+    IF_RET(m->arr.num == 0, 0);
+    nvf_c_printf(b, "static const nvf_name %s_%s_names[] = {", name, map_name);
+    for (nvf_num i = 0; i < m->arr.num; ++i) {
+        nvf_c_printf(b, "\n    {0x%08" PRIx32 ", %" PRIu32 ", %" PRIu32 "},",
+                     m->names[i].hash, m->names[i].len, m->names[i].offset);
+    }
+    // Every name ends with a null terminator already, and the literal adds
+    // one more.
+    nvf_c_printf(b, "\n};\nstatic const char %s_%s_name_data[] =\n    ", name,
+                 map_name);
+    nvf_c_str(b, m->name_data, m->name_len);
+    nvf_c_printf(b, ";\n");
+
+    nvf_map hashed = *m;
+    uint32_t *seeds = NULL;
+    uintptr_t seeds_len = 0;
+    if (m->hash_slots == NULL && nvf_mph_slot_num(m->arr.num) > 0) {
+        hashed.hash_seed_num = nvf_mph_seed_num(m->arr.num);
+        seeds_len = hashed.hash_seed_num * sizeof(*seeds) +
+                    m->arr.num * sizeof(*hashed.hash_slots);
+        seeds = nvf_realloc(b->root, NULL, 0, seeds_len);
+        if (seeds == NULL) {
+            b->err = NVF_BAD_ALLOC;
+            return 0;
+        }
+        hashed.hash_seeds = seeds;
+        hashed.hash_slots = (nvf_num *)(seeds + hashed.hash_seed_num);
+        if (!nvf_build_mph(b->root, &hashed)) {
+            hashed.hash_slots = NULL;
+        }
+    }
+    if (hashed.hash_slots != NULL) {
+        nvf_c_printf(b, "static const uint32_t %s_%s_hash_seeds[] = {", name,
+                     map_name);
+        for (nvf_num i = 0; i < hashed.hash_seed_num; ++i) {
+            nvf_c_printf(b, "%s0x%08" PRIx32 ",", i % 6 == 0 ? "\n    " : " ",
+                         hashed.hash_seeds[i]);
+        }
+        nvf_c_printf(b, "\n};\nstatic const nvf_num %s_%s_hash_slots[] = {",
+                     name, map_name);
+        for (nvf_num i = 0; i < m->arr.num; ++i) {
+            nvf_c_printf(b, "%s%" PRIu32 ",", i % 8 == 0 ? "\n    " : " ",
+                         hashed.hash_slots[i]);
+        }
+        nvf_c_printf(b, "\n};\n");
+    }
+    nvf_dealloc(b->root, seeds, seeds_len);
+    return hashed.hash_slots != NULL ? hashed.hash_seed_num : 0;
+}
+
+// Append an nvf_map initializer pointing at what nvf_c_map_names() and
+// nvf_c_array() wrote. seed_num is what nvf_c_map_names() returned.
+void nvf_c_map_init(nvf_c_buf *b, const char *name, const char *map_name,
+                    const nvf_map *m, nvf_num seed_num) {
+    if (m->arr.num == 0) {
+        nvf_c_printf(b, "{0}");
+        return;
+    }
+    nvf_c_printf(b,
+                 "{\n"
+                 "        .names = (nvf_name *)%s_%s_names,\n"
+                 "        .name_data = (char *)%s_%s_name_data,\n"
+                 "        .name_len = %" PRIu32 ",\n"
+                 "        .name_cap = %" PRIu32 ",\n"
+                 "        .arr = ",
+                 name, map_name, name, map_name, m->name_len, m->name_len);
+    nvf_c_array_init(b, name, map_name, &m->arr, 8);
+    if (seed_num > 0) {
+        nvf_c_printf(b,
+                     ",\n"
+                     "        .hash_seeds = (uint32_t *)%s_%s_hash_seeds,\n"
+                     "        .hash_slots = (nvf_num *)%s_%s_hash_slots,\n"
+                     "        .hash_seed_num = %" PRIu32,
+                     name, map_name, name, map_name, seed_num);
+    }
+    nvf_c_printf(b, ",\n    }");
+}
+
+nvf_err nvf_root_to_c(nvf_root *root, const char *name, char **c_out,
+                      uintptr_t *c_len, char **h_out, uintptr_t *h_len) {
+    IF_RET(root == NULL || name == NULL || c_out == NULL || c_len == NULL ||
+               h_out == NULL || h_len == NULL,
+           NVF_BAD_ARG);
+    IF_RET(root->init_val != NVF_INIT_VAL, NVF_NOT_INIT);
+    // The name starts every identifier written, so it has to be one too.
+    IF_RET(!isalpha((unsigned char)name[0]) && name[0] != '_', NVF_BAD_ARG);
+    for (const char *c = name; *c != '\0'; ++c) {
+        IF_RET(!isalnum((unsigned char)*c) && *c != '_', NVF_BAD_ARG);
+    }
+
+    nvf_num *seed_nums = NULL;
+    if (root->map_num > 0) {
+        seed_nums =
+            nvf_realloc(root, NULL, 0, root->map_num * sizeof(*seed_nums));
+        IF_RET(seed_nums == NULL, NVF_BAD_ALLOC);
+    }
+    nvf_c_buf b = {.root = root};
+    char arr_name[16];
+    nvf_c_printf(&b, "// Generated by nvf_root_to_c(). Do not edit.\n"
+                     "#include \"nvf.h\"\n\n"
+                     "#include <math.h>\n"
+                     "#include <stdlib.h>\n\n");
+    for (nvf_num a_i = 0; a_i < root->array_num; ++a_i) {
+        snprintf(arr_name, sizeof(arr_name), "a%" PRIu32, a_i);
+        nvf_c_array(&b, name, arr_name, &root->arrays[a_i]);
+    }
+    for (nvf_num m_i = 0; m_i < root->map_num; ++m_i) {
+        snprintf(arr_name, sizeof(arr_name), "m%" PRIu32, m_i);
+        nvf_c_array(&b, name, arr_name, &root->maps[m_i].arr);
+        seed_nums[m_i] = nvf_c_map_names(&b, name, arr_name, &root->maps[m_i]);
+    }
+
+    if (root->array_num > 0) {
+        nvf_c_printf(&b, "static const nvf_array %s_arrays[] = {", name);
+        for (nvf_num a_i = 0; a_i < root->array_num; ++a_i) {
+            snprintf(arr_name, sizeof(arr_name), "a%" PRIu32, a_i);
+            nvf_c_printf(&b, "\n    ");
+            nvf_c_array_init(&b, name, arr_name, &root->arrays[a_i], 4);
+            nvf_c_printf(&b, ",");
+        }
+        nvf_c_printf(&b, "\n};\n");
+    }
+    if (root->map_num > 0) {
+        nvf_c_printf(&b, "static const nvf_map %s_maps[] = {", name);
+        for (nvf_num m_i = 0; m_i < root->map_num; ++m_i) {
+            snprintf(arr_name, sizeof(arr_name), "m%" PRIu32, m_i);
+            nvf_c_printf(&b, "\n    ");
+            nvf_c_map_init(&b, name, arr_name, &root->maps[m_i],
+                           seed_nums[m_i]);
+            nvf_c_printf(&b, ",");
+        }
+        nvf_c_printf(&b, "\n};\n");
+    }
+    nvf_dealloc(root, seed_nums, root->map_num * sizeof(*seed_nums));
+
+    nvf_c_printf(&b, "\nnvf_root %s = {\n"
+                     "    .realloc_inst = realloc,\n"
+                     "    .free_inst = free,\n",
+                 name);
+    if (root->array_num > 0) {
+        nvf_c_printf(&b,
+                     "    .array_num = %" PRIu32 ",\n"
+                     "    .array_cap = %" PRIu32 ",\n"
+                     "    .arrays = (nvf_array *)%s_arrays,\n",
+                     root->array_num, root->array_num, name);
+    }
+    if (root->map_num > 0) {
+        nvf_c_printf(&b,
+                     "    .map_num = %" PRIu32 ",\n"
+                     "    .map_cap = %" PRIu32 ",\n"
+                     "    .maps = (nvf_map *)%s_maps,\n",
+                     root->map_num, root->map_num, name);
+    }
+    if (root->fingerprint != 0) {
+        nvf_c_printf(&b, "    .fingerprint = %#" PRIx64 "ull,\n",
+                     root->fingerprint);
+    }
+    nvf_c_printf(&b, "    .frozen = NVF_FROZEN_STATIC,\n"
+                     "    .init_val = NVF_INIT_VAL,\n"
+                     "};\n");
+    if (b.err != NVF_OK) {
+        nvf_dealloc(root, b.data, b.cap);
+        return b.err;
+    }
+
+    nvf_c_buf h = {.root = root};
+    nvf_c_printf(&h, "// Generated by nvf_root_to_c(). Do not edit.\n"
+                     "#ifndef ");
+    for (const char *c = name; *c != '\0'; ++c) {
+        nvf_c_printf(&h, "%c", toupper((unsigned char)*c));
+    }
+    nvf_c_printf(&h, "_H\n#define ");
+    for (const char *c = name; *c != '\0'; ++c) {
+        nvf_c_printf(&h, "%c", toupper((unsigned char)*c));
+    }
+    nvf_c_printf(&h, "_H\n\n"
+                     "#include \"nvf.h\"\n\n"
+                     "extern nvf_root %s;\n\n"
+                     "#endif\n",
+                 name);
+    if (h.err != NVF_OK) {
+        nvf_dealloc(root, b.data, b.cap);
+        nvf_dealloc(root, h.data, h.cap);
+        return h.err;
+    }
+    // Both are freed with their lengths, which count the null terminator.
+    nvf_err r = nvf_str_fit(root, &b.data, b.cap, b.len + 1);
+    if (r != NVF_OK) {
+        nvf_dealloc(root, h.data, h.cap);
+        return r;
+    }
+    r = nvf_str_fit(root, &h.data, h.cap, h.len + 1);
+    if (r != NVF_OK) {
+        nvf_dealloc(root, b.data, b.len + 1);
+        return r;
+    }
+    *c_out = b.data;
+    *c_len = b.len + 1;
+    *h_out = h.data;
+    *h_len = h.len + 1;
+    return NVF_OK;
+}
@@ -33,6 +33,16 @@
             multiline_string "multiline\n"
                              " string"
             BLOB bx010203040506070809
+            # The same BLOB in base64. The = padding is optional.
+            b64_BLOB b64AQIDBAUGBwgJ
+            # A BLOB that is 4096 bytes from offset 0 of payload.bin.
+            # The file is only read when the BLOB is. A relative path is
+            # resolved against the NVF file's directory when it's parsed
+            # with nvf_parse_file(), or against nvf_root::ref_dir.
+            # Otherwise it's relative to the working directory when the
+            # BLOB is read. The path ends at the next quote and has no
+            # escape sequences.
+            file_BLOB bf"payload.bin":0:4096
             array [32 2.0 "string" bx0708 [67]]
             map {
                     int 72333
@@ -43,6 +53,11 @@
             }
     \endcode
 
+    BLOB references let the data name any file the process can read,
+    including absolute paths and paths with .. in them. Only parse data you
+    don't trust into a root with nvf_root::ref_confined set, which keeps
+    references under nvf_root::ref_dir.
+
     See the source of \ref nvf_example.c for API usage examples.
 
     \section build Building
@@ -55,6 +70,20 @@
     That will build the docs, library, example and test executable.
     It runs the example and the tests too.
 
+    Define NVF_INSTRUMENT when compiling nvf.c to collect parsing counters
+    and timers. See ::nvf_parse_stats_get(). The instrumentation is compiled
+    out by default. This target runs the tests with it compiled in.
+    \code{.unparsed}
+    $ make test_instrument
+    \endcode
+
+    Base64 BLOBs are decoded and encoded with SSSE3 on x86 CPUs that have
+    it. Define NVF_NO_SSSE3 when compiling nvf.c to always use the portable
+    code. This target runs the tests with it defined.
+    \code{.unparsed}
+    $ make test_scalar
+    \endcode
+
     Run the tests by building this target.
     \code{.unparsed}
     $ make test
@@ -70,6 +99,23 @@
     $ make doc
     \endcode
 
+    Run the benchmarks by building this target. Each result is printed as a
+    line of JSON. The memory results come from parsing with a counting
+    allocator passed to ::nvf_root_init(). Run build/nvf_bench with a size in
+    MB to change how much data each parsing benchmark uses.
+    \code{.unparsed}
+    $ make bench
+    \endcode
+
+    Build the config compiler with this target. build/nvfc turns an NVF
+    file into a C source and header holding the parsed root as static data,
+    so a program can embed its defaults without parsing them at startup.
+    See ::nvf_root_to_c().
+    \code{.unparsed}
+    $ make nvfc
+    $ build/nvfc defaults.nvf defaults_cfg defaults_cfg
+    \endcode
+
     Build this target to format the C code.
     \code{.unparsed}
     $ make fmt
@@ -91,6 +137,10 @@ typedef enum {
     NVF_DUP_NAME,        ///< Name already exists
     NVF_UNMATCHED_BRACE, ///< Found brace or bracket without a match
     NVF_NUM_OVF,         ///< Number is too big to be represented
+    NVF_IO_ERR,          ///< A file couldn't be opened or read
+    NVF_NOT_SUPPORTED,   ///< The library was built without this feature
+    NVF_READ_ONLY,       ///< The root is frozen and can't be changed
+    NVF_STOPPED,         ///< A callback stopped parsing early
     NVF_ERR_END,         ///< An end sentinel
 } nvf_err;
 
@@ -106,9 +156,10 @@ typedef enum {
     NVF_FLOAT,    ///< Floating point number
     NVF_INT,      ///< Integer number
     NVF_BLOB,     ///< Big-endian, binary data
-    NVF_STRING,   ///< A C string
+    NVF_STRING,   ///< A length-prefixed string
     NVF_MAP,      ///< A map (names associated with values)
     NVF_ARRAY,    ///< An array (values without names)
+    NVF_BLOB_REF, ///< A BLOB stored in another file
     NVF_TYPE_END, ///< An end sentinel
 } nvf_data_type;
 
@@ -121,14 +172,42 @@ typedef struct nvf_blob {
     uint8_t data[]; ///< The data itself
 } nvf_blob;
 
+/// Declares a struct laid out like ::nvf_blob_ref, with room for a path of
+/// \a path_size bytes. An empty \a path_size declares ::nvf_blob_ref itself.
+/// ::nvf_root_to_c() uses this for the references it writes, since a struct
+/// with a flexible array can't be initialized.
+#define NVF_BLOB_REF_STRUCT(tag, path_size)                                    \
+    struct tag {                                                               \
+        uint64_t offset;      /* Where the BLOB starts in the file */          \
+        nvf_num len;          /* The BLOB length in bytes */                   \
+        nvf_num path_len;     /* The length of path */                         \
+        uint8_t *data;        /* The mapped BLOB, NULL until it's read */      \
+        void *map_start;      /* The start of the page aligned mapping */      \
+        uintptr_t map_len;    /* The length of the mapping */                  \
+        char path[path_size]; /* The file's path, always null terminated */    \
+    }
+
+/// Points a BLOB at a byte range of another file. The range is mapped into
+/// memory the first time the BLOB is read, so parsing never reads the file.
+/// See ::NVF_BLOB_REF_STRUCT for its members.
+typedef NVF_BLOB_REF_STRUCT(nvf_blob_ref, ) nvf_blob_ref;
+
+/// Holds a string and its length. The length is stored so that strings can
+/// hold NUL bytes and so nothing has to scan for the end of the string.
+typedef struct nvf_str {
+    nvf_num len; ///< The string length in bytes, without the null terminator
+    char data[]; ///< The string itself, always null terminated
+} nvf_str;
+
 /// The possible values used in NVF
 typedef union nvf_value {
-    nvf_num map_i;    ///< Index into the maps array
-    nvf_num array_i;  ///< Index into the arrays array
-    int64_t v_int;    ///< Integer
-    double v_float;   ///< Floating point number
-    char *v_string;   ///< C string
-    nvf_blob *v_blob; ///< Binary data
+    nvf_num map_i;            ///< Index into the maps array
+    nvf_num array_i;          ///< Index into the arrays array
+    int64_t v_int;            ///< Integer
+    double v_float;           ///< Floating point number
+    nvf_str *v_string;        ///< String
+    nvf_blob *v_blob;         ///< Binary data
+    nvf_blob_ref *v_blob_ref; ///< Binary data in another file
 } nvf_value;
 
 /// Holds values without names
@@ -139,10 +218,28 @@ typedef struct nvf_array {
         cap;           ///< The array's capacity
 } nvf_array;
 
+/// Where a map's name is stored. The hash and length let lookups skip most
+/// names without reading them.
+typedef struct nvf_name {
+    uint32_t hash;  ///< The FNV-1a hash of the name
+    nvf_num len;    ///< The name length in bytes, without the null terminator
+    nvf_num offset; ///< Where the name starts in nvf_map::name_data
+} nvf_name;
+
 /// Holds values associated with names
 typedef struct nvf_map {
-    char **names;  ///< The names for each value
-    nvf_array arr; ///< where the values are stored
+    nvf_name *names;  ///< The names for each value
+    char *name_data;  ///< Every name in one block, each one null terminated
+    nvf_num name_len, ///< The bytes of \a name_data in use
+        name_cap;     ///< The size of \a name_data
+    nvf_array arr;    ///< where the values are stored
+
+    /// A minimal perfect hash of the names, only built by
+    /// ::nvf_root_freeze(). A name's hash picks a seed, and the seed picks
+    /// the slot holding the name's index.
+    uint32_t *hash_seeds;
+    nvf_num *hash_slots;   ///< The index of the name in each slot
+    nvf_num hash_seed_num; ///< The number of seeds
 } nvf_map;
 
 /// The function signature for realloc()
@@ -151,12 +248,32 @@ typedef void *(*realloc_fn)(void *, size_t);
 /// The function signature for free()
 typedef void (*free_fn)(void *);
 
+/** The function signature for an allocator with a context, like Lua's
+    lua_Alloc. \a ptr is NULL or memory from an earlier call, and \a old_size
+    is the size it was allocated or last resized with, or 0 if \a ptr is NULL.
+    A \a new_size of 0 frees \a ptr, and the return value is ignored.
+    Otherwise this returns \a new_size bytes starting with the contents of
+    \a ptr, or NULL without changing \a ptr if it fails.
+*/
+typedef void *(*nvf_alloc_fn)(void *ctx, void *ptr, size_t old_size,
+                              size_t new_size);
+
+/// An allocator and its state. See ::nvf_root_alloc_init().
+typedef struct nvf_allocator {
+    nvf_alloc_fn alloc; ///< Allocates, resizes and frees memory
+    void *ctx;          ///< Passed to every call of \a alloc
+} nvf_allocator;
+
 /// The function signature for snprintf()
 typedef int (*str_fmt_fn)(char *s, size_t n, const char *format, ...);
 
 /// A magic init value to see if the NVF root is setup before use.
 #define NVF_INIT_VAL (0x72)
 
+/// The value of nvf_root::frozen for a root compiled into static data by
+/// ::nvf_root_to_c(). Nothing in such a root was allocated.
+#define NVF_FROZEN_STATIC (2)
+
 /// Return \a rv if \a expr is true
 #define IF_RET(expr, rv)                                                       \
     do {                                                                       \
@@ -200,6 +317,9 @@ typedef struct nvf_root {
     realloc_fn
         realloc_inst;  ///< The function that allocates memory for this root
     free_fn free_inst; ///< A function that frees memory for this root
+    /// Used instead of \a realloc_inst and \a free_inst when \a alloc is
+    /// set. Only set by ::nvf_root_alloc_init().
+    nvf_allocator allocator;
 
     nvf_num array_num, ///< The number of arrays
         array_cap;     ///< The array capacity
@@ -208,10 +328,58 @@ typedef struct nvf_root {
     nvf_num map_num, ///< The number of maps stored
         map_cap;     ///< Map storage capacity
     nvf_map *maps;   ///< Map storage
+
+    uint8_t *pool;      ///< Strings and BLOBs from a presized parse
+    uintptr_t pool_len, ///< The bytes of \a pool in use
+        pool_cap;       ///< The size of \a pool
+    /// How many roots share \a pool, or NULL if only this root uses it.
+    /// Shared pools are freed by the last root using them.
+    uint64_t *pool_refs;
+
+    /// The root to look in when a name isn't in this one. Only set by
+    /// ::nvf_root_overlay_init().
+    struct nvf_root *base;
+
+    /// ::nvf_fingerprint() of the data parsed into this root, or 0 if the
+    /// root wasn't filled only by parsing. See ::nvf_parse_buf_if_changed().
+    uint64_t fingerprint;
+    /// The directory relative BLOB reference paths are resolved against
+    /// when they're parsed, without a trailing slash. The resolved path is
+    /// stored. NULL keeps paths as they're written. Only read while
+    /// parsing. ::nvf_parse_file() uses the file's directory.
+    const char *ref_dir;
+    /// Set to only accept relative BLOB reference paths without ..
+    /// components, so the data can't name files outside \a ref_dir. Other
+    /// paths fail parsing with ::NVF_BAD_DATA. Symbolic links under \a ref_dir
+    /// are still followed. ::nvf_parse_file() doesn't load snapshots into
+    /// confined roots. Set by hand before parsing data that isn't trusted.
+    uint8_t ref_confined;
+    uint64_t alloc_calls; ///< The number of allocations and reallocations
+    uint8_t frozen;       ///< Set once ::nvf_root_freeze() packs the root
     uint8_t
         init_val; ///< Set to \ref NVF_INIT_VAL when this struct is initialized.
 } nvf_root;
 
+/// How much memory one kind of storage in a root uses.
+typedef struct nvf_mem_usage {
+    uintptr_t used;     ///< Bytes holding data
+    uintptr_t reserved; ///< Bytes allocated, including unused capacity
+} nvf_mem_usage;
+
+/// Memory statistics for a root. See ::nvf_root_stats().
+typedef struct nvf_stats {
+    nvf_mem_usage names;   ///< Map names and the arrays pointing to them
+    nvf_mem_usage strings; ///< String values
+    nvf_mem_usage blobs;   ///< BLOBs and BLOB references
+    nvf_mem_usage values;  ///< The types and values of every map and array
+    nvf_mem_usage tables;  ///< The root's map and array tables
+    nvf_mem_usage total;   ///< All of the above added together
+    uintptr_t slack;       ///< Bytes reserved by growing storage but not used
+    uintptr_t mapped;      ///< Bytes of BLOB references mapped into memory
+    uintptr_t allocs;      ///< The number of live allocations the root holds
+    uint64_t alloc_calls;  ///< Calls made to the root's allocator since init
+} nvf_stats;
+
 // A return type used to figure out where the called function stopped while
 // parsing.
 // TODO: Maybe make data_i a u32. That should match the alignment and size of
@@ -232,6 +400,82 @@ typedef struct {
     const nvf_data_type type; ///< The value's type
 } nvf_tag_value;
 
+/// Describes one field of a struct filled by ::nvf_bind() or ::nvf_extract().
+typedef struct nvf_bind_field {
+    const char **path;  ///< The names leading to the value
+    nvf_num depth;      ///< The number of names in \a path
+    nvf_data_type type; ///< The value's type
+    uintptr_t offset;   ///< Where the field is in the struct, from offsetof()
+    uintptr_t size;     ///< The size of the field, from sizeof()
+} nvf_bind_field;
+
+/// A position in one of a root's maps or arrays. Cursors point into the
+/// root, so walking one doesn't copy or allocate anything. They stay valid
+/// until the root changes.
+typedef struct nvf_cursor {
+    const nvf_root *root; ///< The root being walked
+    const nvf_map *map;   ///< The map being walked, NULL for arrays
+    const nvf_array *arr; ///< The values being walked
+    nvf_num i;            ///< The index of the current entry
+} nvf_cursor;
+
+/// The callbacks ::nvf_parse_events() calls for what it finds. Each one gets
+/// the \a ctx passed to ::nvf_parse_events() and returns ::NVF_OK to keep
+/// parsing. Any other code, like ::NVF_STOPPED, stops parsing and is returned.
+/// Callbacks that are NULL are skipped.
+typedef struct nvf_events {
+    /// A map entry's name, before its value. \a name isn't null terminated.
+    nvf_err (*on_name)(void *ctx, const char *name, uintptr_t len);
+    nvf_err (*on_int)(void *ctx, int64_t val);  ///< An int value
+    nvf_err (*on_float)(void *ctx, double val); ///< A float value
+    /// A string value. \a str isn't null terminated. It points into the
+    /// parsed data, or into \a scratch if escape sequences were replaced or
+    /// strings were concatenated.
+    nvf_err (*on_string)(void *ctx, const char *str, uintptr_t len);
+    /// A BLOB value. \a data points into \a scratch.
+    nvf_err (*on_blob)(void *ctx, const uint8_t *data, uintptr_t len);
+    /// A BLOB reference. \a path points into the parsed data and isn't null
+    /// terminated. The BLOB isn't mapped, and the path isn't resolved or
+    /// checked like nvf_root::ref_confined does.
+    nvf_err (*on_blob_ref)(void *ctx, const char *path, uintptr_t path_len,
+                           uint64_t offset, uint64_t len);
+    nvf_err (*begin_map)(void *ctx);   ///< The start of a map value
+    nvf_err (*end_map)(void *ctx);     ///< The end of a map value
+    nvf_err (*begin_array)(void *ctx); ///< The start of an array value
+    nvf_err (*end_array)(void *ctx);   ///< The end of an array value
+    /// Where decoded strings and BLOBs go. It's reused for every value.
+    char *scratch;
+    uintptr_t scratch_len; ///< The size of \a scratch
+} nvf_events;
+
+/// The phases timed by the parser instrumentation.
+typedef enum {
+    NVF_PHASE_TOKEN = 0, ///< Skipping whitespace and comments, reading names
+    NVF_PHASE_NUMBER,    ///< Parsing ints and floats
+    NVF_PHASE_STRING,    ///< Scanning strings and replacing escape sequences
+    NVF_PHASE_BLOB,      ///< Decoding BLOBs and BLOB references
+    NVF_PHASE_ALLOC,     ///< Allocating memory, also counted in other phases
+    NVF_PHASE_TO_STR,    ///< All of ::nvf_root_to_str()
+    NVF_PHASE_END,       ///< An end sentinel
+} nvf_phase;
+
+/// Counters from the last parse or ::nvf_root_to_str() call on a thread.
+/// These are only collected when nvf.c is compiled with NVF_INSTRUMENT.
+typedef struct nvf_parse_stats {
+    uint64_t tokens;                    ///< Names and values read
+    uint64_t values[NVF_TYPE_END];      ///< Values read or written by type
+    uint64_t value_bytes[NVF_TYPE_END]; ///< Bytes read or written by type
+    uint64_t allocs;                    ///< Allocations of new memory
+    uint64_t reallocs;                  ///< Reallocations of old memory
+    /// Time spent in each phase. This is in TSC cycles on x86 and in
+    /// nanoseconds everywhere else.
+    uint64_t ticks[NVF_PHASE_END];
+} nvf_parse_stats;
+
+/// A function that gets parsing counters when a parse or
+/// ::nvf_root_to_str() call finishes.
+typedef void (*nvf_parse_hook)(const nvf_parse_stats *stats, void *ctx);
+
 /** Initialize the root with a custom allocator.
     See \ref nvf_root_default_init() if you just want to use realloc() and
     free().
@@ -248,7 +492,67 @@ nvf_root nvf_root_init(realloc_fn realloc_inst, free_fn free_inst);
 */
 nvf_root nvf_root_default_init(void);
 
+/** Initialize the root with an allocator that has its own state, like an
+    arena or a per-thread pool. The root's memory all comes from it. Every
+    call is told the size the memory has, so the allocator doesn't need to
+    store sizes itself, and it's never asked for 0 bytes.
+    Memory the root returns, like the output of ::nvf_get_str_alloc(), is
+    freed with ::nvf_root_free(). Overlays and shared clones of the root use
+    the same allocator.
+    Any initialized root should be cleaned up with ::nvf_deinit().
+
+    \param allocator The allocator. Its \a alloc can't be NULL.
+    \return The initialized root, or an uninitialized root if \a allocator
+    has no \a alloc
+*/
+nvf_root nvf_root_alloc_init(nvf_allocator allocator);
+
+/** Free memory that a function returned from \a root's allocator. This works
+    for roots made by any of the init functions.
+    \param [in] root The root the memory came from
+    \param ptr The memory to free. Nothing happens if it's NULL.
+    \param size The memory's size. That's the length the function gave with
+    it.
+*/
+void nvf_root_free(nvf_root *root, void *ptr, uintptr_t size);
+
+/** Initialize an overlay root on top of \a base. Parse overrides into the
+    overlay like any other root. The getters look in the overlay first and
+    go to \a base when a name or a map on the way to it isn't there, so maps
+    are merged name by name and a value in the overlay replaces the same
+    value in \a base. Bases can be overlays too.
+
+    The overlay only stores its own entries, and uses the same allocator as
+    \a base. Many overlays can share one base, which has to outlive them and
+    shouldn't change while they're used. Freeze the base with
+    ::nvf_root_freeze() to share it between threads.
+
+    Array indices refer to the root an array was found in, so
+    ::nvf_get_array_from_i() on an overlay only sees the overlay's arrays.
+    Rendering and statistics only cover the overlay's entries too. Use
+    ::nvf_root_materialize() to get the merged tree as one root.
+
+    \param [in] base The root to fall back to
+    \return The initialized overlay, or an uninitialized root if \a base
+    isn't initialized
+*/
+nvf_root nvf_root_overlay_init(nvf_root *base);
+
+/** Copy the merged tree of an overlay and all of its bases into \a out.
+    Each name is placed where it first appears in the lowest root that has
+    it. The value comes from the highest root that has the name, and maps
+    with the same name are merged. \a out doesn't depend on any of the
+    source roots after this.
+    \param [in] overlay The overlay to copy, or any other root
+    \param [in,out] out An initialized root to copy into. It can't have
+    been parsed into or reset, so it has no storage yet.
+    \return An error code indicating success or failure
+*/
+nvf_err nvf_root_materialize(nvf_root *overlay, nvf_root *out);
+
 /** Parse text data from \a data and put it into \a out_root.
+    On success, \a out_root->fingerprint is set to ::nvf_fingerprint() of
+    \a data. Parsing more data into a root continues its fingerprint.
     \param [in] data NVF text to parse
     \param data_len the length of \a data
     \param [in,out] out_root The root where data is stored.
@@ -257,6 +561,121 @@ nvf_root nvf_root_default_init(void);
 nvf_err_data_i nvf_parse_buf(const char *data, uintptr_t data_len,
                              nvf_root *out_root);
 
+/** Like ::nvf_parse_buf(), but scan \a data first to count the entries in
+    every map and array and the bytes needed for names, strings and BLOBs.
+    Every table is then allocated at its final size and the strings and
+    BLOBs are put in one block, so parsing doesn't reallocate anything.
+    The extra pass over \a data can make parsing slower, but the root uses
+    less memory and far fewer allocations.
+    If \a out_root already holds data, this just calls ::nvf_parse_buf().
+    \param [in] data NVF text to parse
+    \param data_len the length of \a data
+    \param [in,out] out_root The root where data is stored.
+    \return A struct with the parsing results
+*/
+nvf_err_data_i nvf_parse_buf_presize(const char *data, uintptr_t data_len,
+                                     nvf_root *out_root);
+
+/** Hash \a data the way ::nvf_parse_buf() does for nvf_root::fingerprint.
+    The hash reads 32 bytes at a time, so it costs far less than parsing, but
+    it isn't cryptographic. It never returns 0. Hashes of the same bytes
+    only match on machines with the same byte order.
+    \param [in] data The data to hash
+    \param data_len The length of \a data
+    \return The hash of \a data
+*/
+uint64_t nvf_fingerprint(const char *data, uintptr_t data_len);
+
+/** Parse \a data into \a root unless it's the data \a root was parsed from.
+    If \a data has the same fingerprint as \a root, \a root is left as it is.
+    Otherwise \a root is emptied with ::nvf_root_reset() and \a data is parsed
+    into it. A program reloading its config can call this every time the file
+    may have changed.
+    \param [in] data NVF text to parse
+    \param data_len The length of \a data
+    \param [in,out] root A root that \a data is parsed into if it changed
+    \param [out] parsed Set to 1 if \a data was parsed and 0 if it wasn't.
+    May be NULL.
+    \return A struct with the parsing results
+*/
+nvf_err_data_i nvf_parse_buf_if_changed(const char *data, uintptr_t data_len,
+                                        nvf_root *root, uint8_t *parsed);
+
+/** Parse the file at \a path into \a out_root, using a snapshot from an
+    earlier parse when there is one.
+    Without \a cache_dir this reads the file and calls ::nvf_parse_buf().
+    With \a cache_dir, a snapshot of the parsed root is kept in that
+    directory. It's the block of a frozen root, see ::nvf_root_freeze(), so
+    loading it is one read and a pass to check it and fix up its pointers.
+    A snapshot is only used if the file's size, modification time and
+    ::nvf_fingerprint() match the ones it was made from. Snapshots that are
+    stale, corrupt or from a different build are ignored and the file is
+    parsed again, then a new snapshot is written. Not being able to write a
+    snapshot isn't an error.
+    With \a cache_dir, \a out_root has to be empty and is frozen
+    afterwards. If it can't be frozen, it's left as it was parsed and no
+    snapshot is written, so the result is the same as without \a cache_dir.
+    Relative BLOB reference paths are resolved against the directory \a path
+    is really in, with symbolic links followed, so they don't depend on the
+    working directory. See nvf_root::ref_dir.
+    \param [in] path The NVF file to parse
+    \param [in] cache_dir The directory for snapshots, or NULL to not use
+    them. It has to exist already.
+    \param [in,out] out_root The root where the data is stored
+    \param [out] from_cache Set to 1 if a snapshot was loaded and 0 if the
+    file was parsed. May be NULL.
+    \return A struct with the parsing results. ::NVF_IO_ERR if the file
+    can't be read, and ::NVF_BAD_ARG if \a cache_dir is set and \a out_root
+    isn't empty.
+*/
+nvf_err_data_i nvf_parse_file(const char *path, const char *cache_dir,
+                              nvf_root *out_root, uint8_t *from_cache);
+
+/** Parse \a data without building a tree, calling the callbacks in
+    \a events for each name and value in the order they're found. Nothing
+    is allocated, so this is a cheap way to validate data, find a few values
+    or fill custom structures. Duplicate names aren't checked since nothing
+    is stored.
+    The root map doesn't get map events. BLOBs and strings that need
+    decoding are put in \a events->scratch, so it has to hold the largest of
+    them or parsing fails with ::NVF_BUF_OVF.
+    Brackets are read like ::nvf_parse_buf() reads them. Maps and arrays
+    still open at the end of \a data are closed, and get their end events.
+    A ']' outside of every map and array ends the data.
+    \param [in] data NVF text to parse
+    \param data_len the length of \a data
+    \param [in] events The callbacks to call
+    \param ctx A pointer passed to the callbacks
+    \return A struct with the parsing results. If a callback stops parsing,
+    its error code is returned.
+*/
+nvf_err_data_i nvf_parse_events(const char *data, uintptr_t data_len,
+                                const nvf_events *events, void *ctx);
+
+/** Get the instrumentation counters for the last ::nvf_parse_buf() or
+    ::nvf_root_to_str() call made on this thread. Maps and arrays aren't
+    counted in \a value_bytes or \a ticks since they hold other values.
+    ::nvf_root_to_str_threads() adds its other threads' counters to the
+    calling thread's, so its \a ticks can add up to more than the time taken.
+    \param [out] out The counters
+    \return NVF_NOT_SUPPORTED if nvf.c wasn't compiled with NVF_INSTRUMENT,
+    NVF_OK otherwise
+*/
+nvf_err nvf_parse_stats_get(nvf_parse_stats *out);
+
+/** Set a function to call with the instrumentation counters at the end of
+    every ::nvf_parse_buf() and ::nvf_root_to_str() call. The hook is shared
+    by all threads, and can be changed while other threads parse. Each
+    thread calls either the old hook with its \a ctx or the new one with its
+    \a ctx. Every call keeps a few bytes allocated until the program exits,
+    so set the hook once instead of around every parse.
+    \param hook The function to call, or NULL to stop calling it
+    \param ctx A pointer passed to \a hook
+    \return NVF_NOT_SUPPORTED if nvf.c wasn't compiled with NVF_INSTRUMENT,
+    NVF_BAD_ALLOC if the hook couldn't be stored, NVF_OK otherwise
+*/
+nvf_err nvf_set_parse_hook(nvf_parse_hook hook, void *ctx);
+
 /** Get an integer from a data root.
     \param [in] root The root to query
     \param [in] names The path to the integer to get
@@ -277,12 +696,79 @@ nvf_err nvf_get_int(nvf_root *root, const char **names, nvf_num name_depth,
 nvf_err nvf_get_map(nvf_root *root, const char **m_names, nvf_num name_depth,
                     nvf_map *map_out);
 
+/** Pack a root that won't change anymore into one block of memory. All
+    unused capacity is trimmed and every map gets a minimal perfect hash of
+    its names, so finding a name takes one probe and one compare. BLOB
+    references are still mapped the first time they're read, so a reference
+    to a missing file doesn't stop a root from being frozen.
+
+    A frozen root can't be parsed into or reset, and those calls return
+    ::NVF_READ_ONLY. Nothing else in a frozen root changes after this, not
+    even \a alloc_calls, so several threads can read it at once. See
+    ::nvf_blob_ref_get().
+    \param [in,out] root The root to freeze
+    \return An error code indicating success or failure
+*/
+nvf_err nvf_root_freeze(nvf_root *root);
+
+/// How ::nvf_root_clone() copies a root.
+typedef enum {
+    NVF_CLONE_COPY = 0,  ///< Copy everything into memory owned by the clone
+    NVF_CLONE_SHARE = 1, ///< Share strings and BLOBs instead of copying them
+} nvf_clone_flags;
+
+/** Make a private copy of \a src in \a dst that can be changed without
+    changing \a src. The map and array tables are copied with their exact
+    sizes. Perfect hashes aren't copied, so a clone of a frozen root isn't
+    frozen.
+
+    By default the strings and BLOBs are copied into one block. With
+    ::NVF_CLONE_SHARE they're shared instead, so cloning only copies the
+    tables. Shared strings and BLOBs are reference counted and freed with
+    the last root using them. The first shared clone of a root that isn't
+    frozen moves that root's strings and BLOBs into one block, so \a src
+    changes, but not its contents. Sharing needs \a src and \a dst to use
+    the same allocator. BLOB references are always copied since each
+    root maps them itself.
+
+    \param [in,out] dst An initialized root that hasn't been used yet
+    \param [in] src The root to copy
+    \param flags A value from ::nvf_clone_flags
+    \return An error code indicating success or failure
+*/
+nvf_err nvf_root_clone(nvf_root *dst, nvf_root *src, uint32_t flags);
+
+/** Get the name of one of a map's values.
+    \param [in] m The map to get the name from
+    \param name_i The index of the value
+    \return The null terminated name, or NULL if \a name_i is out of range
+*/
+const char *nvf_map_name(const nvf_map *m, nvf_num name_i);
+
 /** Frees the memory associated with a root and zeros said root.
     \param [in] n_r The root to clean up.
     \return An error code indicating success or failure
 */
 nvf_err nvf_deinit(nvf_root *n_r);
 
+/** Empty a root so it can be parsed into again, but keep its memory. The map
+    and array tables and each map's and array's storage are kept, names
+    included. The memory for strings and BLOBs becomes one pool that new ones
+    are taken from. Parsing data shaped like the old data then allocates
+    very little.
+    \param [in,out] root The root to empty.
+    \return An error code indicating success or failure
+*/
+nvf_err nvf_root_reset(nvf_root *root);
+
+/** Report how much memory a root uses. This walks the root's tables, but it
+    never reads string or BLOB data, so it's cheap to call periodically.
+    \param [in] root The root to measure
+    \param [out] out The root's statistics
+    \return An error code indicating success or failure
+*/
+nvf_err nvf_root_stats(nvf_root *root, nvf_stats *out);
+
 /** Get a floating point number from a data root.
     \param [in] root The root to query
     \param [in] names The path to the integer to get
@@ -293,12 +779,14 @@ nvf_err nvf_deinit(nvf_root *n_r);
 nvf_err nvf_get_float(nvf_root *root, const char **names, nvf_num name_depth,
                       double *out);
 
-/** Get a C string from a data root.
+/** Get a C string from a data root. The string may contain NUL bytes, so use
+    \a str_out_len instead of strlen() to find its length.
     \param [in] root The root to query
     \param [in] names The path to the integer to get
     \param name_depth The number of path segments in \a names
     \param [out] str_out The result of the query
-    \param [in,out] str_out_len The length of \a str_out. Set to the length of the queried string on failure
+    \param [in,out] str_out_len The length of \a str_out. Set to the length
+    of the queried string (including the null terminator)
     \return An error code indicating success or failure
 */
 nvf_err nvf_get_str(nvf_root *root, const char **names, nvf_num name_depth,
@@ -309,12 +797,26 @@ nvf_err nvf_get_str(nvf_root *root, const char **names, nvf_num name_depth,
     \param [in] names The path to the integer to get
     \param name_depth The number of path segments in \a names
     \param [out] bin_out The result of the query
-    \param [in,out] bin_out_len The length of \a bin_out. Set to the length of the queried BLOB on failure
+    \param [in,out] bin_out_len The length of \a bin_out. Set to the length
+    of the queried BLOB on failure
     \return An error code indicating success or failure
 */
 nvf_err nvf_get_blob(nvf_root *root, const char **names, nvf_num name_depth,
                      uint8_t *bin_out, uintptr_t *bin_out_len);
 
+/** Get the data a BLOB reference points to, mapping the file into memory if
+    it isn't mapped yet. The mapping is owned by the root holding \a ref and
+    is unmapped when the root is deinitialized. Several threads can read the
+    same unmapped reference at once. They all get the same mapping.
+    The getters for BLOBs call this for you.
+    \param [in,out] ref The reference to read
+    \param [out] out Set to the start of the BLOB's data
+    \param [out] out_len Set to the length of the BLOB
+    \return An error code indicating success or failure
+*/
+nvf_err nvf_blob_ref_get(nvf_blob_ref *ref, const uint8_t **out,
+                         uintptr_t *out_len);
+
 /** Get an array from a data root.
     \param [in] root The root to query
     \param [in] names The path to the integer to get
@@ -332,12 +834,13 @@ nvf_err nvf_get_array(nvf_root *root, const char **names, nvf_num name_depth,
 */
 nvf_tag_value nvf_array_get_item(const nvf_array *arr, nvf_num arr_i);
 
-/** Get a BLOB from a data root. The returned BLOB uses memory from the root's 
-    realloc_inst() function and should be freed with the root's free_inst() function.
+/** Get a BLOB from a data root. The returned BLOB uses memory from the
+    root's allocator and should be freed with
+    ::nvf_root_free(root, *out, *out_len).
     \param [in] root The root to query
     \param [in] names The path to the integer to get
     \param name_depth The number of path segments in \a names
-    \param [out] out The result of the query, allocated from \a root->realloc_inst()
+    \param [out] out The result of the query, allocated from \a root
     \param [out] out_len The length of \a bin_out
     \return An error code indicating success or failure
 */
@@ -345,18 +848,99 @@ nvf_err nvf_get_blob_alloc(nvf_root *root, const char **names,
                            nvf_num name_depth, uint8_t **out,
                            uintptr_t *out_len);
 
-/** Get a C string from a data root. The returned string uses memory from the root's 
-    realloc_inst() function and should be freed with the root's free_inst() function.
+/** Get a C string from a data root. The returned string uses memory from the
+    root's allocator and should be freed with
+    ::nvf_root_free(root, *out, *out_len).
     \param [in] root The root to query
     \param [in] names The path to the integer to get
     \param name_depth The number of path segments in \a names
-    \param [out] out The result of the query, allocated from \a root->realloc_inst()
+    \param [out] out The result of the query, allocated from \a root
     \param [out] out_len The length of \a bin_out
     \return An error code indicating success or failure
 */
 nvf_err nvf_get_str_alloc(nvf_root *root, const char **names,
                           nvf_num name_depth, char **out, uintptr_t *out_len);
 
+/** Get a view of a string in a data root without copying it. The view points
+    into memory owned by \a root and is valid until \a root is changed or
+    deinitialized. The string is null terminated, but may contain NUL bytes.
+    \param [in] root The root to query
+    \param [in] names The path to the string to get
+    \param name_depth The number of path segments in \a names
+    \param [out] out Set to the start of the string
+    \param [out] out_len Set to the length of the string, not counting the
+    null terminator
+    \return An error code indicating success or failure
+*/
+nvf_err nvf_get_str_view(nvf_root *root, const char **names,
+                         nvf_num name_depth, const char **out,
+                         uintptr_t *out_len);
+
+/** Get a view of a BLOB in a data root without copying it. The view points
+    into memory owned by \a root and is valid until \a root is changed or
+    deinitialized.
+    \param [in] root The root to query
+    \param [in] names The path to the BLOB to get
+    \param name_depth The number of path segments in \a names
+    \param [out] out Set to the start of the BLOB's data
+    \param [out] out_len Set to the length of the BLOB
+    \return An error code indicating success or failure
+*/
+nvf_err nvf_get_blob_view(nvf_root *root, const char **names,
+                          nvf_num name_depth, const uint8_t **out,
+                          uintptr_t *out_len);
+
+/** Fill a struct with values from a data root. Each field is described by
+    an entry in \a fields. Fields that share a parent map, one after the
+    other, only look the map up once, so keep fields from the same map
+    together.
+
+    How a value is stored depends on the field's type:
+    - ::NVF_INT fields are signed integers 1, 2, 4 or 8 bytes big.
+      ::NVF_NUM_OVF is returned if the value doesn't fit.
+    - ::NVF_FLOAT fields are a float or a double.
+    - ::NVF_STRING fields are char arrays. The string and its null terminator
+      have to fit.
+    - ::NVF_BLOB fields are byte arrays. Bytes after the BLOB are zeroed.
+
+    Fields with errors are left unchanged, so set any defaults before
+    calling this. Every field is tried, even after one fails.
+    \param [in] root The root to get values from
+    \param [in] fields Descriptions of the fields to fill
+    \param field_num The number of entries in \a fields
+    \param [out] out The struct to fill
+    \param [out] field_errs If not NULL, set to each field's result. It needs
+    room for \a field_num entries.
+    \return ::NVF_OK if every field was filled, otherwise the error of the
+    first field in \a fields that failed
+*/
+nvf_err nvf_bind(nvf_root *root, const nvf_bind_field *fields,
+                 nvf_num field_num, void *out, nvf_err *field_errs);
+
+/** Fill a struct with values straight from NVF text, like ::nvf_bind() does
+    from a root. Nothing is allocated and no tree is built. Only the values
+    in \a fields are decoded. Everything else is skipped by matching
+    brackets and quotes, and scanning stops once every field is found, so
+    the rest of \a data isn't checked.
+    Fields are stored the same way ::nvf_bind() stores them, except that
+    BLOB references give ::NVF_NOT_SUPPORTED since no files are opened.
+    A field whose path goes through a value that isn't a map gives
+    ::NVF_BAD_VALUE_TYPE.
+    \param [in] data NVF text to search
+    \param data_len the length of \a data
+    \param [in] fields Descriptions of the fields to fill
+    \param field_num The number of entries in \a fields
+    \param [out] out The struct to fill
+    \param [out] field_errs Set to each field's result, ::NVF_NOT_FOUND if
+    it wasn't in \a data. It needs room for \a field_num entries.
+    \return A struct with the scanning results. If \a data was scanned
+    without errors, the error is the one of the first field in \a fields
+    that failed, or ::NVF_OK if none did.
+*/
+nvf_err_data_i nvf_extract(const char *data, uintptr_t data_len,
+                           const nvf_bind_field *fields, nvf_num field_num,
+                           void *out, nvf_err *field_errs);
+
 /** Get an array from a data root using the array's index.
     \param [in] root The root to get the array from
     \param arr_i The index of the array to get
@@ -365,19 +949,128 @@ nvf_err nvf_get_str_alloc(nvf_root *root, const char **names,
 */
 nvf_err nvf_get_array_from_i(nvf_root *root, nvf_num arr_i, nvf_array *out);
 
-/** Makes a string representation of \a root. This string is allocated from 
-    \a root->realloc_inst() and should be freed with \a root->free_inst().
+/** Point a cursor at the first entry of a root's top map. Walk the map
+    like this:
+    \code{.c}
+    nvf_cursor c;
+    for (nvf_err e = nvf_cursor_root(&root, &c); e == NVF_OK;
+         e = nvf_cursor_next(&c)) {
+        // Use nvf_cursor_name() and nvf_cursor_value().
+    }
+    \endcode
+    An overlay's cursor only sees the overlay's own entries, not its base's.
+    \param [in] root The root to walk
+    \param [out] out The cursor
+    \return NVF_NOT_FOUND if the map is empty, NVF_OK if \a out is at an
+    entry, or another error code
+*/
+nvf_err nvf_cursor_root(const nvf_root *root, nvf_cursor *out);
+
+/** Point a cursor at the first entry of the map or array at \a c.
+    \param [in] c A cursor at a map or array value
+    \param [out] out The cursor for the map or array
+    \return NVF_BAD_VALUE_TYPE if the value isn't a map or array,
+    NVF_NOT_FOUND if it's empty, or NVF_OK if \a out is at an entry
+*/
+nvf_err nvf_cursor_child(const nvf_cursor *c, nvf_cursor *out);
+
+/** Move a cursor to the next entry.
+    \param [in,out] c The cursor to move
+    \return NVF_NOT_FOUND if there are no more entries, NVF_OK otherwise
+*/
+nvf_err nvf_cursor_next(nvf_cursor *c);
+
+/** Move a cursor to the named entry of its map. The name is found the same
+    way the getters find it.
+    \param [in,out] c A cursor walking a map
+    \param [in] name The name to find
+    \return NVF_BAD_VALUE_TYPE if \a c is walking an array, NVF_NOT_FOUND
+    if the name isn't in the map, NVF_OK otherwise
+*/
+nvf_err nvf_cursor_find(nvf_cursor *c, const char *name);
+
+/** Get the name of the entry at a cursor. The name points into the root.
+    \param [in] c The cursor
+    \param [out] len The name's length if it isn't NULL
+    \return The null terminated name, or NULL if \a c is walking an array or
+    isn't at an entry
+*/
+const char *nvf_cursor_name(const nvf_cursor *c, nvf_num *len);
+
+/** Get the value of the entry at a cursor. Strings and BLOBs point into the
+    root. Map and array values are indices, see ::nvf_cursor_child().
+    \param [in] c The cursor
+    \return The value, or a value of type NVF_NONE if \a c isn't at an entry
+*/
+nvf_tag_value nvf_cursor_value(const nvf_cursor *c);
+
+/** Makes a string representation of \a root. This string is allocated from
+    \a root's allocator and should be freed with
+    ::nvf_root_free(root, *out, *out_len).
     \param [in] root The root used to generate the string
     \param [out] out The C string version of \a root
-    \param [out] out_len The length of the output C string.
+    \param [out] out_len The length of the output C string, including the
+    null terminator
     \param fmt_fn A snprintf()-like function to make the string output
     \return An error code indicating success or failure
 */
 nvf_err nvf_root_to_str(nvf_root *root, char **out, uintptr_t *out_len,
                         str_fmt_fn fmt_fn);
 
-/** Like ::nvf_root_to_str() with snprintf() passed as \a fmt_fn. The output string
-    is allocaed using \a root->realloc_inst() and should be freed with \a root->free_inst().
+/// Options for ::nvf_root_to_str_flags(). Combine them with |.
+typedef enum {
+    NVF_STR_DEFAULT = 0,       ///< Write everything the way it's parsed
+    NVF_STR_BLOB_B64 = 1 << 0, ///< Write BLOBs in base64 instead of hex
+    NVF_STR_COMPACT = 1 << 1,  ///< Write sorted output with minimal whitespace
+} nvf_str_flags;
+
+/** Like ::nvf_root_to_str(), with options for how the output is written.
+    Base64 BLOBs (b64 followed by the digits) are a third smaller than hex
+    ones and parse faster.
+
+    With ::NVF_STR_COMPACT, the output only depends on the names and values in
+    \a root, so equal roots give equal bytes. Map entries are sorted by name,
+    byte by byte. Values are separated by one space, without indentation or
+    newlines. Ints are written in decimal, and floats with the fewest digits
+    that read back as the same value.
+    \param [in] root The root used to generate the string
+    \param [out] out The C string version of \a root
+    \param [out] out_len The length of the output C string.
+    \param fmt_fn A snprintf()-like function to make the string output
+    \param flags Values from ::nvf_str_flags
+    \return An error code indicating success or failure
+*/
+nvf_err nvf_root_to_str_flags(nvf_root *root, char **out, uintptr_t *out_len,
+                              str_fmt_fn fmt_fn, uint32_t flags);
+
+/** Like ::nvf_root_to_str_flags(), but split the work between threads. The
+    output is split into pieces of about the same size in the order it's
+    written: runs of values, and maps and arrays too big for one piece split
+    the same way. Each thread writes pieces into its own buffer, and the
+    buffers are joined in order, so the output is the same as
+    ::nvf_root_to_str_flags() gives.
+    Small roots are written on the calling thread. \a fmt_fn and the root's
+    allocator are called from several threads at once, so they have to be
+    thread safe. snprintf(), realloc() and free() are. Programs using this
+    need to be linked with -pthread. Instrumentation counters from all the
+    threads are reported as one call on the calling thread.
+    \param [in] root The root used to generate the string
+    \param [out] out The C string version of \a root
+    \param [out] out_len The length of the output C string.
+    \param fmt_fn A snprintf()-like function to make the string output
+    \param flags Values from ::nvf_str_flags
+    \param thread_num The most threads to use, including the calling one.
+    0 uses one per CPU. No more threads are started than there are CPUs or
+    pieces to write.
+    \return An error code indicating success or failure
+*/
+nvf_err nvf_root_to_str_threads(nvf_root *root, char **out, uintptr_t *out_len,
+                                str_fmt_fn fmt_fn, uint32_t flags,
+                                uint32_t thread_num);
+
+/** Like ::nvf_root_to_str() with snprintf() passed as \a fmt_fn. The output
+    string is allocated from \a root's allocator and should be freed with
+    ::nvf_root_free(root, *out, *out_len).
     \param [in] root The root used to generate the string
     \param [out] out The C string version of \a root
     \param [out] out_len The length of the output C string.
@@ -385,6 +1078,29 @@ nvf_err nvf_root_to_str(nvf_root *root, char **out, uintptr_t *out_len,
 */
 nvf_err nvf_default_root_to_str(nvf_root *root, char **out, uintptr_t *out_len);
 
+/** Write \a root as C code that defines it with static data. \a c_out holds
+    the definition of an ::nvf_root called \a name, and \a h_out declares it.
+    The compiled root is frozen, its tables are const, and it's read with the
+    normal getters without parsing or allocating anything. Maps get the same
+    perfect hash ::nvf_root_freeze() builds.
+
+    Deiniting a compiled root returns ::NVF_READ_ONLY. BLOB references are
+    still mapped the first time they're read, using their path at run time.
+    That's safe to do from several threads, like the rest of reading a
+    compiled root.
+    Both outputs are allocated from \a root's allocator. Free them with
+    ::nvf_root_free() and their lengths, like ::nvf_root_to_str()'s output.
+    \param [in] root The root to write
+    \param [in] name The C identifier for the root
+    \param [out] c_out The C source defining the root
+    \param [out] c_len The length of \a c_out, including the null terminator
+    \param [out] h_out The C header declaring the root
+    \param [out] h_len The length of \a h_out, including the null terminator
+    \return An error code indicating success or failure
+*/
+nvf_err nvf_root_to_c(nvf_root *root, const char *name, char **c_out,
+                      uintptr_t *c_len, char **h_out, uintptr_t *h_len);
+
 /** Converts an NVF return code to a string
     \param e The return code to convert to a string
     \returns A string if \a e has a match, NULL otherwise
@@ -0,0 +1,785 @@
+#include "nvf.h"
+
+#include <dirent.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+  \file nvf_bench.c
+  Measures how fast NVF data is parsed, queried and turned back into text,
+  and how much memory parsing uses. Every result is printed as a line of
+  JSON so results can be compared across releases.
+*/
+
+/// The minimum time to spend running each benchmark, in seconds.
+#define BENCH_MIN_SECS (0.25)
+
+/// A growable buffer used to generate test data.
+typedef struct {
+    char *data;
+    uintptr_t len, cap;
+} bench_buf;
+
+void buf_printf(bench_buf *b, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+
+    if (b->len + len + 1 > b->cap) {
+        b->cap = (b->len + len + 1) * 2;
+        b->data = realloc(b->data, b->cap);
+        if (b->data == NULL) {
+            printf("Allocating the corpus failed!\n");
+            exit(1);
+        }
+    }
+    va_start(args, fmt);
+    vsnprintf(b->data + b->len, len + 1, fmt, args);
+    va_end(args);
+    b->len += len;
+}
+
+double now_secs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/// Counters kept by the counting allocator.
+typedef struct {
+    uintptr_t live_bytes; ///< Bytes currently allocated
+    uintptr_t peak_bytes; ///< The most bytes allocated at once
+    uint64_t calls;       ///< Calls to count_realloc()
+} alloc_counts;
+
+alloc_counts counts = {0};
+
+/// A header stored before each counted allocation so frees know its size.
+/// The union keeps the memory after it aligned like malloc()'s.
+typedef union {
+    uintptr_t size;
+    max_align_t align;
+} alloc_header;
+
+void *count_realloc(void *ptr, size_t size) {
+    ++counts.calls;
+    uintptr_t old_size = 0;
+    alloc_header *hdr = NULL;
+    if (ptr != NULL) {
+        hdr = (alloc_header *)ptr - 1;
+        old_size = hdr->size;
+    }
+    alloc_header *new_hdr = realloc(hdr, sizeof(*hdr) + size);
+    if (new_hdr == NULL) {
+        return NULL;
+    }
+    new_hdr->size = size;
+    counts.live_bytes += size - old_size;
+    if (counts.live_bytes > counts.peak_bytes) {
+        counts.peak_bytes = counts.live_bytes;
+    }
+    return new_hdr + 1;
+}
+
+void count_free(void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    alloc_header *hdr = (alloc_header *)ptr - 1;
+    counts.live_bytes -= hdr->size;
+    free(hdr);
+}
+
+/// The kinds of data the corpus generator makes.
+typedef enum {
+    CORPUS_WIDE_MAP = 0,
+    CORPUS_DEEP_MAP,
+    CORPUS_INT_ARRAY,
+    CORPUS_FLOAT_ARRAY,
+    CORPUS_ESCAPED_STR,
+    CORPUS_LARGE_BLOB,
+    CORPUS_COMMENTS,
+    CORPUS_END,
+} corpus_type;
+
+const char *corpus_names[CORPUS_END] = {
+    "wide_map",    "deep_map",   "int_array", "float_array",
+    "escaped_str", "large_blob", "comments",
+};
+
+/// Make about \a target_len bytes of NVF data shaped like \a ct.
+bench_buf gen_corpus(corpus_type ct, uintptr_t target_len) {
+    bench_buf b = {0};
+    for (uint32_t i = 0; b.len < target_len; ++i) {
+        if (ct == CORPUS_WIDE_MAP) {
+            // One huge map would be slow to parse since duplicate names are
+            // checked with a linear scan. Make many wide maps instead. The
+            // other corpora do the same so they measure their values.
+            buf_printf(&b, "map_%u {\n", i);
+            for (uint32_t k_i = 0; k_i < 1024; ++k_i) {
+                buf_printf(&b, "\tkey_%u %u\n", k_i, k_i * 7919);
+            }
+            buf_printf(&b, "}\n");
+        } else if (ct == CORPUS_DEEP_MAP) {
+            uint32_t depth = 32;
+            buf_printf(&b, "deep_%u ", i);
+            for (uint32_t d_i = 0; d_i < depth; ++d_i) {
+                buf_printf(&b, "{\n%*sv %u\n%*sd ", d_i + 1, "", d_i, d_i + 1,
+                           "");
+            }
+            buf_printf(&b, "{ leaf 1 }");
+            for (uint32_t d_i = 0; d_i < depth; ++d_i) {
+                buf_printf(&b, "\n}");
+            }
+            buf_printf(&b, "\n");
+        } else if (ct == CORPUS_INT_ARRAY) {
+            buf_printf(&b, "ints_%u [", i);
+            for (uint32_t a_i = 0; a_i < 1024; ++a_i) {
+                buf_printf(&b, " %d", (int)(a_i * 2654435761u) / 16);
+            }
+            buf_printf(&b, " ]\n");
+        } else if (ct == CORPUS_FLOAT_ARRAY) {
+            buf_printf(&b, "floats_%u [", i);
+            for (uint32_t a_i = 0; a_i < 1024; ++a_i) {
+                buf_printf(&b, " %.6f", a_i * 1.61803398875 - 500.0);
+            }
+            buf_printf(&b, " ]\n");
+        } else if (ct == CORPUS_ESCAPED_STR) {
+            buf_printf(&b, "group_%u {\n", i);
+            for (uint32_t s_i = 0; s_i < 1024; ++s_i) {
+                buf_printf(&b,
+                           "\tstr_%u \"a \\\"quoted\\\" value"
+                           "\\twith tabs\\n\"\n"
+                           "\t\t\" and \\\\backslashes\\\\ on line two\"\n",
+                           s_i);
+            }
+            buf_printf(&b, "}\n");
+        } else if (ct == CORPUS_LARGE_BLOB) {
+            buf_printf(&b, "blob_%u bx", i);
+            for (uint32_t x_i = 0; x_i < 64 * 1024; ++x_i) {
+                buf_printf(&b, "%02x", (x_i * 31 + i) & 0xff);
+            }
+            buf_printf(&b, "\n");
+        } else if (ct == CORPUS_COMMENTS) {
+            buf_printf(&b, "group_%u {\n", i);
+            for (uint32_t c_i = 0; c_i < 1024; ++c_i) {
+                buf_printf(
+                    &b,
+                    "# This line describes the value below it in detail.\n"
+                    "#[ This is a longer comment that spans a few lines\n"
+                    "   and explains what the value is for. ]#\n"
+                    "value_%u #[ inline ]# %u # trailing comment\n",
+                    c_i, c_i);
+            }
+            buf_printf(&b, "}\n");
+        }
+    }
+    return b;
+}
+
+void print_result(const char *bench, const char *corpus, const char *unit,
+                  double rate, uintptr_t bytes, uint64_t iters, double secs) {
+    printf("{\"bench\":\"%s\",\"corpus\":\"%s\",\"%s\":%.3f,"
+           "\"bytes\":%lu,\"iters\":%lu,\"secs\":%.6f}\n",
+           bench, corpus, unit, rate, (unsigned long)bytes,
+           (unsigned long)iters, secs);
+}
+
+/// The signature of ::nvf_parse_buf() and ::nvf_parse_buf_presize().
+typedef nvf_err_data_i (*parse_fn)(const char *data, uintptr_t data_len,
+                                   nvf_root *out_root);
+
+/// Time parsing \a b with \a parse. If \a reset is true, one root is reset
+/// and reused for every parse, like a program reloading its config would.
+int bench_parse(const char *bench, parse_fn parse, bool reset, corpus_type ct,
+                const bench_buf *b) {
+    uint64_t iters = 0;
+    nvf_root root = nvf_root_default_init();
+    double start = now_secs();
+    double elapsed = 0;
+    do {
+        nvf_err_data_i rd = parse(b->data, b->len, &root);
+        if (rd.err != NVF_OK) {
+            printf("Parsing %s failed with %s at %lu!\n", corpus_names[ct],
+                   nvf_err_str(rd.err), (unsigned long)rd.data_i);
+            nvf_deinit(&root);
+            return 1;
+        }
+        if (reset) {
+            nvf_root_reset(&root);
+        } else {
+            nvf_deinit(&root);
+            root = nvf_root_default_init();
+        }
+        ++iters;
+        elapsed = now_secs() - start;
+    } while (elapsed < BENCH_MIN_SECS || iters < 3);
+    nvf_deinit(&root);
+
+    print_result(bench, corpus_names[ct], "mb_per_s",
+                 b->len * iters / elapsed / 1e6, b->len, iters, elapsed);
+    return 0;
+}
+
+/// A bump allocator for ::nvf_root_alloc_init(). Frees do nothing, and all
+/// the memory is given back at once by setting \a len to 0.
+typedef struct {
+    uint8_t *data;
+    uintptr_t len, cap;
+    uintptr_t last; ///< Where the newest block starts, so it can grow in place
+} bench_arena;
+
+void *arena_alloc(void *ctx, void *ptr, size_t old_size, size_t new_size) {
+    bench_arena *a = ctx;
+    if (new_size <= old_size) {
+        return new_size == 0 ? NULL : ptr;
+    }
+    if (ptr != NULL && (uint8_t *)ptr == a->data + a->last &&
+        a->last + new_size <= a->cap) {
+        a->len = a->last + new_size;
+        return ptr;
+    }
+    uintptr_t align = _Alignof(max_align_t);
+    uintptr_t start = (a->len + align - 1) & ~(align - 1);
+    if (start + new_size > a->cap) {
+        return NULL;
+    }
+    if (ptr != NULL) {
+        memcpy(a->data + start, ptr, old_size);
+    }
+    a->last = start;
+    a->len = start + new_size;
+    return a->data + start;
+}
+
+/// Time parsing \a b into roots that allocate from an arena, which is reset
+/// between parses.
+int bench_parse_arena(corpus_type ct, const bench_buf *b) {
+    bench_arena arena = {.cap = b->len * 4};
+    nvf_allocator a = {arena_alloc, &arena};
+    uint64_t iters = 0;
+    double start = now_secs();
+    double elapsed = 0;
+    do {
+        if (arena.data == NULL) {
+            arena.data = malloc(arena.cap);
+            if (arena.data == NULL) {
+                return 1;
+            }
+        }
+        arena.len = 0;
+        nvf_root root = nvf_root_alloc_init(a);
+        nvf_err_data_i rd = nvf_parse_buf(b->data, b->len, &root);
+        nvf_deinit(&root);
+        if (rd.err == NVF_BAD_ALLOC) {
+            // Grow the arena and start timing again.
+            free(arena.data);
+            arena.data = NULL;
+            arena.cap *= 2;
+            iters = 0;
+            start = now_secs();
+            continue;
+        }
+        if (rd.err != NVF_OK) {
+            printf("Parsing %s into an arena failed with %s at %lu!\n",
+                   corpus_names[ct], nvf_err_str(rd.err),
+                   (unsigned long)rd.data_i);
+            free(arena.data);
+            return 1;
+        }
+        ++iters;
+        elapsed = now_secs() - start;
+    } while (elapsed < BENCH_MIN_SECS || iters < 3);
+    free(arena.data);
+
+    print_result("parse_arena", corpus_names[ct], "mb_per_s",
+                 b->len * iters / elapsed / 1e6, b->len, iters, elapsed);
+    return 0;
+}
+
+/// Count the ints seen by ::nvf_parse_events() so the parse has a use.
+nvf_err count_int(void *ctx, int64_t val) {
+    ++*(uint64_t *)ctx;
+    return NVF_OK;
+}
+
+/// Time parsing \a b with ::nvf_parse_events(), which doesn't build a tree.
+int bench_events(corpus_type ct, const bench_buf *b) {
+    // Any string or BLOB fits in a scratch buffer as big as the corpus.
+    nvf_events ev = {
+        .on_int = count_int,
+        .scratch = malloc(b->len),
+        .scratch_len = b->len,
+    };
+    if (ev.scratch == NULL) {
+        return 1;
+    }
+
+    uint64_t iters = 0;
+    uint64_t ints = 0;
+    double start = now_secs();
+    double elapsed = 0;
+    do {
+        nvf_err_data_i rd = nvf_parse_events(b->data, b->len, &ev, &ints);
+        if (rd.err != NVF_OK) {
+            printf("Parsing events from %s failed with %s at %lu!\n",
+                   corpus_names[ct], nvf_err_str(rd.err),
+                   (unsigned long)rd.data_i);
+            free(ev.scratch);
+            return 1;
+        }
+        ++iters;
+        elapsed = now_secs() - start;
+    } while (elapsed < BENCH_MIN_SECS || iters < 3);
+    free(ev.scratch);
+
+    print_result("events", corpus_names[ct], "mb_per_s",
+                 b->len * iters / elapsed / 1e6, b->len, iters, elapsed);
+    return 0;
+}
+
+/// Time reloading \a b into a root that was already parsed from it, which
+/// only hashes \a b.
+int bench_reload(corpus_type ct, const bench_buf *b) {
+    nvf_root root = nvf_root_default_init();
+    nvf_err_data_i rd = nvf_parse_buf(b->data, b->len, &root);
+    if (rd.err != NVF_OK) {
+        nvf_deinit(&root);
+        return 1;
+    }
+
+    uint64_t iters = 0;
+    double start = now_secs();
+    double elapsed = 0;
+    do {
+        uint8_t parsed = 0;
+        rd = nvf_parse_buf_if_changed(b->data, b->len, &root, &parsed);
+        if (rd.err != NVF_OK || parsed) {
+            printf("Reloading %s failed with %s!\n", corpus_names[ct],
+                   nvf_err_str(rd.err));
+            nvf_deinit(&root);
+            return 1;
+        }
+        ++iters;
+        elapsed = now_secs() - start;
+    } while (elapsed < BENCH_MIN_SECS || iters < 3);
+
+    print_result("reload_unchanged", corpus_names[ct], "mb_per_s",
+                 b->len * iters / elapsed / 1e6, b->len, iters, elapsed);
+    nvf_deinit(&root);
+    return 0;
+}
+
+/// Time nvf_parse_file() on \a b written to a file, without a cache
+/// directory and with a snapshot already in one.
+int bench_parse_file(corpus_type ct, const bench_buf *b) {
+    const char path[] = "nvf_bench_file.nvf";
+    const char cache_dir[] = "nvf_bench_cache";
+    FILE *f = fopen(path, "wb");
+    if (f == NULL || fwrite(b->data, 1, b->len, f) != b->len) {
+        printf("Writing %s failed!\n", path);
+        if (f != NULL) {
+            fclose(f);
+        }
+        return 1;
+    }
+    fclose(f);
+    mkdir(cache_dir, 0755);
+
+    int rc = 0;
+    for (int cached = 0; cached < 2 && rc == 0; ++cached) {
+        const char *dir = cached ? cache_dir : NULL;
+        if (cached) {
+            // Write the snapshot.
+            nvf_root root = nvf_root_default_init();
+            nvf_parse_file(path, dir, &root, NULL);
+            nvf_deinit(&root);
+        }
+        uint64_t iters = 0;
+        double start = now_secs();
+        double elapsed = 0;
+        do {
+            nvf_root root = nvf_root_default_init();
+            uint8_t from_cache = 0;
+            nvf_err_data_i rd = nvf_parse_file(path, dir, &root, &from_cache);
+            nvf_deinit(&root);
+            if (rd.err != NVF_OK || from_cache != cached) {
+                printf("Parsing %s from a file failed with %s!\n",
+                       corpus_names[ct], nvf_err_str(rd.err));
+                rc = 1;
+                break;
+            }
+            ++iters;
+            elapsed = now_secs() - start;
+        } while (elapsed < BENCH_MIN_SECS || iters < 3);
+        if (rc == 0) {
+            print_result(cached ? "parse_file_cached" : "parse_file",
+                         corpus_names[ct], "mb_per_s",
+                         b->len * iters / elapsed / 1e6, b->len, iters,
+                         elapsed);
+        }
+    }
+
+    DIR *d = opendir(cache_dir);
+    for (struct dirent *de = d != NULL ? readdir(d) : NULL; de != NULL;
+         de = readdir(d)) {
+        if (de->d_name[0] != '.') {
+            char snap_path[sizeof(cache_dir) + 256];
+            snprintf(snap_path, sizeof(snap_path), "%s/%s", cache_dir,
+                     de->d_name);
+            remove(snap_path);
+        }
+    }
+    if (d != NULL) {
+        closedir(d);
+    }
+    rmdir(cache_dir);
+    remove(path);
+    return rc;
+}
+
+/// Time parsing and rendering the large_blob corpus with base64 BLOBs. The
+/// base64 text is made by rendering the hex corpus.
+int bench_b64(const bench_buf *b) {
+    nvf_root root = nvf_root_default_init();
+    char *b64 = NULL;
+    uintptr_t b64_len = 0;
+    nvf_err_data_i rd = nvf_parse_buf(b->data, b->len, &root);
+    nvf_err rc = rd.err;
+    if (rc == NVF_OK) {
+        rc = nvf_root_to_str_flags(&root, &b64, &b64_len, snprintf,
+                                   NVF_STR_BLOB_B64);
+    }
+    if (rc != NVF_OK) {
+        printf("Making base64 BLOBs failed with %s!\n", nvf_err_str(rc));
+        nvf_deinit(&root);
+        return 1;
+    }
+    // The length includes the null terminator.
+    bench_buf b64_buf = {.data = b64, .len = b64_len - 1};
+    int r = bench_parse("parse_b64", nvf_parse_buf, false, CORPUS_LARGE_BLOB,
+                        &b64_buf);
+
+    uint64_t iters = 0;
+    double start = now_secs();
+    double elapsed = 0;
+    do {
+        char *out = NULL;
+        uintptr_t out_len = 0;
+        rc = nvf_root_to_str_flags(&root, &out, &out_len, snprintf,
+                                   NVF_STR_BLOB_B64);
+        if (rc != NVF_OK) {
+            r = 1;
+            break;
+        }
+        root.free_inst(out);
+        ++iters;
+        elapsed = now_secs() - start;
+    } while (elapsed < BENCH_MIN_SECS || iters < 3);
+    print_result("to_str_b64", corpus_names[CORPUS_LARGE_BLOB], "mb_per_s",
+                 b64_buf.len * iters / elapsed / 1e6, b64_buf.len, iters,
+                 elapsed);
+
+    root.free_inst(b64);
+    nvf_deinit(&root);
+    return r;
+}
+
+/// Time pulling three values out of the wide_map corpus with
+/// ::nvf_extract(). The last value is in the last map, so nearly all of \a b
+/// is skipped over.
+int bench_extract(const bench_buf *b) {
+    // Find the name of the last map.
+    char last_map[32] = {0};
+    for (uintptr_t i = b->len; i > 0; --i) {
+        if (b->data[i - 1] == '\n' && strncmp(b->data + i, "map_", 4) == 0) {
+            sscanf(b->data + i, "%31s", last_map);
+            break;
+        }
+    }
+    typedef struct {
+        int64_t first, middle, last;
+    } extract_out;
+    const char *first_path[] = {"map_0", "key_1"};
+    const char *middle_path[] = {"map_0", "key_512"};
+    const char *last_path[] = {last_map, "key_1023"};
+    const nvf_bind_field fields[] = {
+        {first_path, 2, NVF_INT, offsetof(extract_out, first), 8},
+        {middle_path, 2, NVF_INT, offsetof(extract_out, middle), 8},
+        {last_path, 2, NVF_INT, offsetof(extract_out, last), 8},
+    };
+    nvf_err field_errs[3];
+    extract_out out = {0};
+
+    uint64_t iters = 0;
+    double start = now_secs();
+    double elapsed = 0;
+    do {
+        nvf_err_data_i rd =
+            nvf_extract(b->data, b->len, fields, 3, &out, field_errs);
+        if (rd.err != NVF_OK || out.last != 1023 * 7919) {
+            printf("Extracting from %s failed with %s at %lu!\n",
+                   corpus_names[CORPUS_WIDE_MAP], nvf_err_str(rd.err),
+                   (unsigned long)rd.data_i);
+            return 1;
+        }
+        ++iters;
+        elapsed = now_secs() - start;
+    } while (elapsed < BENCH_MIN_SECS || iters < 3);
+
+    print_result("extract", corpus_names[CORPUS_WIDE_MAP], "mb_per_s",
+                 b->len * iters / elapsed / 1e6, b->len, iters, elapsed);
+    return 0;
+}
+
+/// Time writing a root parsed from \a b with ::nvf_root_to_str_threads() on
+/// up to \a thread_num threads. The bytes reported are the size of the output.
+int bench_to_str(const char *bench, uint32_t flags, uint32_t thread_num,
+                 corpus_type ct, const bench_buf *b) {
+    nvf_root root = nvf_root_default_init();
+    nvf_err_data_i rd = nvf_parse_buf(b->data, b->len, &root);
+    if (rd.err != NVF_OK) {
+        nvf_deinit(&root);
+        return 1;
+    }
+
+    uint64_t iters = 0;
+    uintptr_t out_len = 0;
+    double start = now_secs();
+    double elapsed = 0;
+    do {
+        char *out = NULL;
+        nvf_err rc = nvf_root_to_str_threads(&root, &out, &out_len, snprintf,
+                                             flags, thread_num);
+        if (rc != NVF_OK) {
+            printf("Rendering %s failed with %s!\n", corpus_names[ct],
+                   nvf_err_str(rc));
+            nvf_deinit(&root);
+            return 1;
+        }
+        root.free_inst(out);
+        ++iters;
+        elapsed = now_secs() - start;
+    } while (elapsed < BENCH_MIN_SECS || iters < 3);
+
+    print_result(bench, corpus_names[ct], "mb_per_s",
+                 out_len * iters / elapsed / 1e6, out_len, iters, elapsed);
+    nvf_deinit(&root);
+    return 0;
+}
+
+/// Time cloning a root parsed from \a b. The rate is in MB of the text the
+/// root came from, so it compares directly with the parsing results.
+int bench_clone(const char *bench, uint32_t flags, corpus_type ct,
+                const bench_buf *b) {
+    nvf_root root = nvf_root_default_init();
+    nvf_err_data_i rd = nvf_parse_buf(b->data, b->len, &root);
+    if (rd.err != NVF_OK) {
+        nvf_deinit(&root);
+        return 1;
+    }
+
+    uint64_t iters = 0;
+    double start = now_secs();
+    double elapsed = 0;
+    do {
+        nvf_root clone = nvf_root_default_init();
+        nvf_err rc = nvf_root_clone(&clone, &root, flags);
+        if (rc != NVF_OK) {
+            printf("Cloning %s failed with %s!\n", corpus_names[ct],
+                   nvf_err_str(rc));
+            nvf_deinit(&clone);
+            nvf_deinit(&root);
+            return 1;
+        }
+        nvf_deinit(&clone);
+        ++iters;
+        elapsed = now_secs() - start;
+    } while (elapsed < BENCH_MIN_SECS || iters < 3);
+
+    print_result(bench, corpus_names[ct], "mb_per_s",
+                 b->len * iters / elapsed / 1e6, b->len, iters, elapsed);
+    nvf_deinit(&root);
+    return 0;
+}
+
+/// Count the values in \a root, not counting maps and arrays.
+uint64_t count_values(const nvf_root *root) {
+    uint64_t val_num = 0;
+    for (nvf_num a_i = 0; a_i < root->array_num + root->map_num; ++a_i) {
+        const nvf_array *arr = a_i < root->array_num
+                                   ? &root->arrays[a_i]
+                                   : &root->maps[a_i - root->array_num].arr;
+        for (nvf_num v_i = 0; v_i < arr->num; ++v_i) {
+            val_num += arr->types[v_i] != NVF_MAP &&
+                       arr->types[v_i] != NVF_ARRAY;
+        }
+    }
+    return val_num;
+}
+
+/// Parse \a b with the counting allocator and report how much memory the
+/// parse used.
+int bench_memory(const char *bench, parse_fn parse, corpus_type ct,
+                 const bench_buf *b) {
+    counts = (alloc_counts){0};
+    nvf_root root = nvf_root_init(count_realloc, count_free);
+    nvf_err_data_i rd = parse(b->data, b->len, &root);
+    if (rd.err != NVF_OK) {
+        printf("Parsing %s failed with %s at %lu!\n", corpus_names[ct],
+               nvf_err_str(rd.err), (unsigned long)rd.data_i);
+        nvf_deinit(&root);
+        return 1;
+    }
+
+    uintptr_t live_bytes = counts.live_bytes;
+    uint64_t val_num = count_values(&root);
+    nvf_deinit(&root);
+    if (counts.live_bytes != 0) {
+        printf("Deiniting %s leaked %lu bytes!\n", corpus_names[ct],
+               (unsigned long)counts.live_bytes);
+        return 1;
+    }
+
+    printf("{\"bench\":\"%s\",\"corpus\":\"%s\",\"bytes\":%lu,"
+           "\"peak_bytes\":%lu,\"live_bytes\":%lu,\"values\":%lu,"
+           "\"bytes_per_value\":%.3f,\"alloc_calls\":%lu,"
+           "\"alloc_calls_per_kb\":%.3f}\n",
+           bench, corpus_names[ct], (unsigned long)b->len,
+           (unsigned long)counts.peak_bytes, (unsigned long)live_bytes,
+           (unsigned long)val_num,
+           val_num ? (double)live_bytes / val_num : 0.0,
+           (unsigned long)counts.calls, counts.calls * 1024.0 / b->len);
+    return 0;
+}
+
+/// Time int lookups in a map \a width values wide, nested \a depth maps deep.
+/// The root is frozen first if \a freeze is true.
+int bench_lookup(uint32_t width, uint32_t depth, bool freeze) {
+    bench_buf b = {0};
+    for (uint32_t d_i = 1; d_i < depth; ++d_i) {
+        buf_printf(&b, "m {\n");
+    }
+    for (uint32_t w_i = 0; w_i < width; ++w_i) {
+        buf_printf(&b, "key_%u %u\n", w_i, w_i);
+    }
+    for (uint32_t d_i = 1; d_i < depth; ++d_i) {
+        buf_printf(&b, "}\n");
+    }
+
+    nvf_root root = nvf_root_default_init();
+    nvf_err_data_i rd = nvf_parse_buf(b.data, b.len, &root);
+    if (rd.err != NVF_OK) {
+        printf("Parsing the lookup corpus failed with %s!\n",
+               nvf_err_str(rd.err));
+        nvf_deinit(&root);
+        free(b.data);
+        return 1;
+    }
+    if (freeze) {
+        nvf_err rc = nvf_root_freeze(&root);
+        if (rc != NVF_OK) {
+            printf("Freezing the lookup corpus failed with %s!\n",
+                   nvf_err_str(rc));
+            nvf_deinit(&root);
+            free(b.data);
+            return 1;
+        }
+    }
+
+    // Look up keys spread over the whole map.
+    uint32_t key_num = width < 64 ? width : 64;
+    char keys[64][32];
+    const char *paths[64][64];
+    for (uint32_t k_i = 0; k_i < key_num; ++k_i) {
+        snprintf(keys[k_i], sizeof(keys[k_i]), "key_%u",
+                 (uint32_t)((uint64_t)k_i * width / key_num));
+        for (uint32_t d_i = 0; d_i + 1 < depth; ++d_i) {
+            paths[k_i][d_i] = "m";
+        }
+        paths[k_i][depth - 1] = keys[k_i];
+    }
+
+    uint64_t iters = 0;
+    int64_t sum = 0;
+    double start = now_secs();
+    double elapsed = 0;
+    do {
+        for (uint32_t k_i = 0; k_i < key_num; ++k_i) {
+            int64_t val = 0;
+            nvf_err rc = nvf_get_int(&root, paths[k_i], depth, &val);
+            if (rc != NVF_OK) {
+                printf("Looking up %s failed with %s!\n", keys[k_i],
+                       nvf_err_str(rc));
+                nvf_deinit(&root);
+                free(b.data);
+                return 1;
+            }
+            sum += val;
+        }
+        iters += key_num;
+        elapsed = now_secs() - start;
+    } while (elapsed < BENCH_MIN_SECS);
+
+    char corpus[64];
+    snprintf(corpus, sizeof(corpus), "width_%u_depth_%u", width, depth);
+    print_result(freeze ? "lookup_frozen" : "lookup", corpus, "lookups_per_s",
+                 iters / elapsed, b.len, iters, elapsed);
+
+    nvf_deinit(&root);
+    free(b.data);
+    // Use the sum so the lookups can't be optimized away.
+    return sum < 0;
+}
+
+int main(int argc, char *argv[]) {
+    // The corpus size can be set with the first argument, in MB.
+    double corpus_mb = argc > 1 ? atof(argv[1]) : 4;
+    uintptr_t corpus_len = corpus_mb * 1e6;
+
+    int rc = 0;
+    for (corpus_type ct = 0; ct < CORPUS_END; ++ct) {
+        bench_buf b = gen_corpus(ct, corpus_len);
+        rc |= bench_parse("parse", nvf_parse_buf, false, ct, &b);
+        rc |= bench_parse("parse_presize", nvf_parse_buf_presize, false, ct,
+                          &b);
+        rc |= bench_parse("parse_reset", nvf_parse_buf, true, ct, &b);
+        rc |= bench_parse_arena(ct, &b);
+        rc |= bench_events(ct, &b);
+        rc |= bench_reload(ct, &b);
+        rc |= bench_parse_file(ct, &b);
+        if (ct == CORPUS_WIDE_MAP) {
+            rc |= bench_extract(&b);
+        }
+        if (ct == CORPUS_LARGE_BLOB) {
+            rc |= bench_b64(&b);
+        }
+        rc |= bench_to_str("to_str", NVF_STR_DEFAULT, 1, ct, &b);
+        rc |= bench_to_str("to_str_compact", NVF_STR_COMPACT, 1, ct, &b);
+        rc |= bench_to_str("to_str_threads", NVF_STR_DEFAULT, 4, ct, &b);
+        rc |= bench_clone("clone", NVF_CLONE_COPY, ct, &b);
+        rc |= bench_clone("clone_share", NVF_CLONE_SHARE, ct, &b);
+        rc |= bench_memory("memory", nvf_parse_buf, ct, &b);
+        rc |= bench_memory("memory_presize", nvf_parse_buf_presize, ct, &b);
+        free(b.data);
+    }
+
+    uint32_t widths[] = {1, 16, 256, 4096};
+    uint32_t depths[] = {1, 4, 16, 64};
+    for (uintptr_t w_i = 0; w_i < sizeof(widths) / sizeof(*widths); ++w_i) {
+        for (uintptr_t d_i = 0; d_i < sizeof(depths) / sizeof(*depths);
+             ++d_i) {
+            rc |= bench_lookup(widths[w_i], depths[d_i], false);
+            rc |= bench_lookup(widths[w_i], depths[d_i], true);
+        }
+    }
+    return rc;
+}
@@ -104,7 +104,16 @@ int main(int argc, char *argv[]) {
         rc = nvf_get_str_alloc(&root, s_names, 1, &str_out, &out_len);
         IF_GOTO_PRINT(rc != NVF_OK, "Getting an allocated string", rc, deinit);
         printf("* The allocatedstring is \"%s\".\n", str_out);
-        root.free_inst(str_out);
+        nvf_root_free(&root, str_out, out_len);
+    }
+    {
+        const char *str_view = NULL;
+        uintptr_t view_len = 0;
+        const char *s_names[] = {"string"};
+        printf("* Getting a string view\n");
+        rc = nvf_get_str_view(&root, s_names, 1, &str_view, &view_len);
+        IF_GOTO_PRINT(rc != NVF_OK, "Getting a string view", rc, deinit);
+        printf("* The string view is \"%.*s\".\n", (int)view_len, str_view);
     }
     {
         char str_out[32] = {0};
@@ -148,7 +157,7 @@ int main(int argc, char *argv[]) {
         printf("* The nested, allocated BLOB is 0x");
         hexdump(bin_out, bin_out_len);
         printf("\n");
-        root.free_inst(bin_out);
+        nvf_root_free(&root, bin_out, bin_out_len);
     }
     {
         nvf_array arr = {0};
@@ -170,7 +179,7 @@ int main(int argc, char *argv[]) {
         printf("\tGetting an array's third value\n");
         nvf_tag_value tv_s = nvf_array_get_item(&arr, 2);
         printf("\tThe value has type %u and is %s\n", tv_s.type,
-               tv_s.val.v_string);
+               tv_s.val.v_string->data);
 
         printf("\tGetting an array's fourth value\n");
         nvf_tag_value tv_b = nvf_array_get_item(&arr, 3);
@@ -217,7 +226,7 @@ int main(int argc, char *argv[]) {
         printf("\tGetting an array's third value\n");
         nvf_tag_value tv_s = nvf_array_get_item(&arr, 2);
         printf("\tThe value has type %u and is %s\n", tv_s.type,
-               tv_s.val.v_string);
+               tv_s.val.v_string->data);
 
         printf("\tGetting an array's fourth value\n");
         nvf_tag_value tv_b = nvf_array_get_item(&arr, 3);
@@ -230,6 +239,18 @@ int main(int argc, char *argv[]) {
         printf("\tThis data's type is %u\n", tv_n.type);
     }
 
+    {
+        nvf_cursor c;
+        printf("* Walking the root with a cursor\n");
+        for (rc = nvf_cursor_root(&root, &c); rc == NVF_OK;
+             rc = nvf_cursor_next(&c)) {
+            nvf_tag_value tv = nvf_cursor_value(&c);
+            printf("\t%s has type %s\n", nvf_cursor_name(&c, NULL),
+                   nvf_type_str(tv.type));
+        }
+        IF_GOTO_PRINT(rc != NVF_NOT_FOUND, "Walking the root", rc, deinit);
+    }
+
     {
         char *str_out = NULL;
         uintptr_t str_len = 0;
@@ -1,8 +1,17 @@
 
 #include "nvf.h"
 
+#include <dirent.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #define ASSERT_FLOAT(r, exp, ret_val, label)                                   \
     do {                                                                       \
@@ -26,10 +35,216 @@
         }                                                                      \
     } while (0)
 
+// Records the events from nvf_parse_events() as text.
+typedef struct event_log {
+    char buf[512];
+    uintptr_t len;
+    const char *scratch;
+    int events;
+    int stop_after;
+} event_log;
+
+nvf_err log_event(event_log *log, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(log->buf + log->len, sizeof(log->buf) - log->len, fmt,
+                      args);
+    va_end(args);
+    if (n < 0 || (uintptr_t)n >= sizeof(log->buf) - log->len) {
+        return NVF_BUF_OVF;
+    }
+    log->len += n;
+    return ++log->events == log->stop_after ? NVF_STOPPED : NVF_OK;
+}
+
+nvf_err log_name(void *ctx, const char *name, uintptr_t len) {
+    return log_event(ctx, "%.*s=", (int)len, name);
+}
+
+nvf_err log_int(void *ctx, int64_t val) {
+    return log_event(ctx, "%lld ", (long long)val);
+}
+
+nvf_err log_float(void *ctx, double val) { return log_event(ctx, "%g ", val); }
+
+nvf_err log_string(void *ctx, const char *str, uintptr_t len) {
+    event_log *log = ctx;
+    // Mark strings that were decoded into the scratch buffer.
+    return log_event(ctx, "%s\"%.*s\" ", str == log->scratch ? "s" : "",
+                     (int)len, str);
+}
+
+nvf_err log_blob(void *ctx, const uint8_t *data, uintptr_t len) {
+    nvf_err e = log_event(ctx, "bx");
+    for (uintptr_t i = 0; i < len && e == NVF_OK; ++i) {
+        e = log_event(ctx, "%02x", data[i]);
+    }
+    return e == NVF_OK ? log_event(ctx, " ") : e;
+}
+
+nvf_err log_blob_ref(void *ctx, const char *path, uintptr_t path_len,
+                     uint64_t offset, uint64_t len) {
+    return log_event(ctx, "bf\"%.*s\":%llu:%llu ", (int)path_len, path,
+                     (unsigned long long)offset, (unsigned long long)len);
+}
+
+nvf_err log_begin_map(void *ctx) { return log_event(ctx, "{ "); }
+
+nvf_err log_end_map(void *ctx) { return log_event(ctx, "} "); }
+
+nvf_err log_begin_array(void *ctx) { return log_event(ctx, "[ "); }
+
+nvf_err log_end_array(void *ctx) { return log_event(ctx, "] "); }
+
+// Log the entries from a cursor the way nvf_parse_events() reports them. e is
+// the result of getting the cursor.
+nvf_err log_cursor(event_log *log, nvf_cursor *c, nvf_err e) {
+    for (; e == NVF_OK; e = nvf_cursor_next(c)) {
+        nvf_num len = 0;
+        const char *name = nvf_cursor_name(c, &len);
+        nvf_err le = name == NULL ? NVF_OK : log_name(log, name, len);
+        nvf_tag_value tv = nvf_cursor_value(c);
+        if (le != NVF_OK) {
+            return le;
+        }
+        switch (tv.type) {
+        case NVF_INT:
+            le = log_int(log, tv.val.v_int);
+            break;
+        case NVF_FLOAT:
+            le = log_float(log, tv.val.v_float);
+            break;
+        case NVF_STRING:
+            le = log_string(log, tv.val.v_string->data, tv.val.v_string->len);
+            break;
+        case NVF_BLOB:
+            le = log_blob(log, tv.val.v_blob->data, tv.val.v_blob->len);
+            break;
+        case NVF_BLOB_REF: {
+            nvf_blob_ref *ref = tv.val.v_blob_ref;
+            le = log_blob_ref(log, ref->path, ref->path_len, ref->offset,
+                              ref->len);
+            break;
+        }
+        case NVF_MAP:
+        case NVF_ARRAY: {
+            bool is_map = tv.type == NVF_MAP;
+            nvf_cursor child;
+            le = is_map ? log_begin_map(log) : log_begin_array(log);
+            if (le == NVF_OK) {
+                le = log_cursor(log, &child, nvf_cursor_child(c, &child));
+            }
+            if (le == NVF_OK) {
+                le = is_map ? log_end_map(log) : log_end_array(log);
+            }
+            break;
+        }
+        default:
+            le = NVF_BAD_VALUE_TYPE;
+        }
+        if (le != NVF_OK) {
+            return le;
+        }
+    }
+    return e == NVF_NOT_FOUND ? NVF_OK : e;
+}
+
+// A BLOB reference for several threads to read at once.
+typedef struct ref_race {
+    nvf_blob_ref *ref;
+    pthread_barrier_t start;
+} ref_race;
+
+// Read a BLOB reference once every thread is ready and return where its
+// data is.
+void *read_blob_ref(void *ctx) {
+    ref_race *race = ctx;
+    const uint8_t *data = NULL;
+    uintptr_t len = 0;
+    pthread_barrier_wait(&race->start);
+    nvf_blob_ref_get(race->ref, &data, &len);
+    return (void *)data;
+}
+
+// Calls to the parse hooks below. Each hook counts its calls in its own slot
+// and calls with another hook's context in the last one.
+uint64_t hook_calls[3];
+
+void count_hook_a(const nvf_parse_stats *stats, void *ctx) {
+    uint64_t *slot = ctx == &hook_calls[0] ? &hook_calls[0] : &hook_calls[2];
+    __atomic_add_fetch(slot, 1, __ATOMIC_RELAXED);
+}
+
+void count_hook_b(const nvf_parse_stats *stats, void *ctx) {
+    uint64_t *slot = ctx == &hook_calls[1] ? &hook_calls[1] : &hook_calls[2];
+    __atomic_add_fetch(slot, 1, __ATOMIC_RELAXED);
+}
+
+// Switch between the parse hooks while another thread parses.
+void *swap_hooks(void *arg) {
+    for (int s_i = 0; s_i < 1000; ++s_i) {
+        nvf_set_parse_hook(s_i % 2 == 0 ? count_hook_a : count_hook_b,
+                           &hook_calls[s_i % 2]);
+    }
+    return NULL;
+}
+
+// An allocator that remembers the size of each block to check the sizes it's
+// given. It fails the allocation numbered fail_at. Calls are locked so
+// threads writing a root can share it.
+typedef struct sized_alloc {
+    pthread_mutex_t lock;
+    void *ptrs[1024];
+    size_t sizes[1024];
+    int num;
+    int calls;
+    int fail_at;
+    int bad;
+} sized_alloc;
+
+void *sized_alloc_locked(sized_alloc *sa, void *ptr, size_t old_size,
+                         size_t new_size) {
+    int i = 0;
+    while (ptr != NULL && i < sa->num && sa->ptrs[i] != ptr) {
+        ++i;
+    }
+    if (ptr == NULL ? old_size != 0
+                    : i == sa->num || sa->sizes[i] != old_size) {
+        ++sa->bad;
+        return NULL;
+    }
+    if (new_size == 0) {
+        if (ptr != NULL) {
+            free(ptr);
+            --sa->num;
+            sa->ptrs[i] = sa->ptrs[sa->num];
+            sa->sizes[i] = sa->sizes[sa->num];
+        }
+        return NULL;
+    }
+    if (sa->calls++ == sa->fail_at || (ptr == NULL && sa->num == 1024)) {
+        return NULL;
+    }
+    void *out = realloc(ptr, new_size);
+    if (out != NULL) {
+        i = ptr == NULL ? sa->num++ : i;
+        sa->ptrs[i] = out;
+        sa->sizes[i] = new_size;
+    }
+    return out;
+}
+
+void *sized_alloc_fn(void *ctx, void *ptr, size_t old_size, size_t new_size) {
+    sized_alloc *sa = ctx;
+    pthread_mutex_lock(&sa->lock);
+    void *out = sized_alloc_locked(sa, ptr, old_size, new_size);
+    pthread_mutex_unlock(&sa->lock);
+    return out;
+}
+
 int main(int argc, char *argv[]) {
     nvf_root root = {0};
 
-    // TODO: Add tests where all values are at the end of the string..
     const char int_test[] = "i_name 32343 # A comment\n"
                             "ix_name #[ another comment ]# 0x32343\n"
                             "io_name 032343\n"
@@ -61,6 +276,58 @@ int main(int argc, char *argv[]) {
     ASSERT_INT(rd.err, NVF_OK, 1, "Testing parsing");
     ASSERT_INT(rd.data_i >= test_len, 1, 1, "Testing parsing data index");
 
+    {
+        nvf_parse_stats ps = {0};
+        nvf_err ps_rc = nvf_parse_stats_get(&ps);
+#ifdef NVF_INSTRUMENT
+        ASSERT_INT(ps_rc, NVF_OK, 1, "Getting parsing counters");
+        ASSERT_INT(ps.values[NVF_STRING], 5, 1, "Counting strings");
+        ASSERT_INT(ps.values[NVF_MAP], 1, 1, "Counting maps");
+        ASSERT_INT(ps.values[NVF_ARRAY], 3, 1, "Counting arrays");
+        // 15 named values and 10 array items.
+        ASSERT_INT(ps.tokens, 15 * 2 + 10, 1, "Counting tokens");
+        ASSERT_INT(ps.allocs > 0, 1, 1, "Counting allocations");
+        ASSERT_INT(ps.value_bytes[NVF_BLOB] > 0, 1, 1, "Counting BLOB bytes");
+#else
+        ASSERT_INT(ps_rc, NVF_NOT_SUPPORTED, 1, "Getting parsing counters");
+#endif
+    }
+
+#ifdef NVF_INSTRUMENT
+    {
+        // Every parse calls the hook, and a hook changed by another thread is
+        // always called with its own context.
+        pthread_t swapper;
+        ASSERT_INT(pthread_create(&swapper, NULL, swap_hooks, NULL), 0, 1,
+                   "Starting a thread to change the parse hook");
+        int parses = 0;
+        for (; parses < 2000; ++parses) {
+            nvf_root h_root = nvf_root_default_init();
+            rd = nvf_parse_buf("a 1", 3, &h_root);
+            ASSERT_INT(rd.err, NVF_OK, 1, "Parsing with a hook");
+            nvf_deinit(&h_root);
+        }
+        pthread_join(swapper, NULL);
+        ASSERT_INT(hook_calls[2], 0, 1, "Checking hooks get their own context");
+        ASSERT_INT(hook_calls[0] + hook_calls[1] <= parses, 1, 1,
+                   "Counting parse hook calls");
+
+        ASSERT_INT(nvf_set_parse_hook(count_hook_a, &hook_calls[0]), NVF_OK, 1,
+                   "Setting a parse hook");
+        uint64_t calls = hook_calls[0];
+        nvf_root h_root = nvf_root_default_init();
+        rd = nvf_parse_buf("a 1", 3, &h_root);
+        nvf_deinit(&h_root);
+        ASSERT_INT(hook_calls[0], calls + 1, 1, "Calling the parse hook");
+        ASSERT_INT(nvf_set_parse_hook(NULL, NULL), NVF_OK, 1,
+                   "Clearing the parse hook");
+        h_root = nvf_root_default_init();
+        rd = nvf_parse_buf("a 1", 3, &h_root);
+        nvf_deinit(&h_root);
+        ASSERT_INT(hook_calls[0], calls + 1, 1, "Checking a cleared hook");
+    }
+#endif
+
     int64_t bin_int = 0;
     const char *names[] = {"i_name"};
     nvf_err rc = nvf_get_int(&root, names, 1, &bin_int);
@@ -85,6 +352,26 @@ int main(int argc, char *argv[]) {
     ASSERT_INT(rc, NVF_OK, 1, "Getting a float");
     ASSERT_FLOAT(bin_f, 0.8, 1, "Checking the float's value");
 
+    {
+        // Every kind of whitespace separates tokens, and hex digits of
+        // either case make up a BLOB.
+        const char ws_data[] = "i\v-19\fb\rbx09aF\t\n";
+        nvf_root ws_root = nvf_root_default_init();
+        rd = nvf_parse_buf(ws_data, sizeof(ws_data) - 1, &ws_root);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Parsing with all whitespace kinds");
+        const char *i_names[] = {"i"};
+        int64_t i_out = 0;
+        rc = nvf_get_int(&ws_root, i_names, 1, &i_out);
+        ASSERT_INT(i_out, -19, 1, "Getting an int after a vertical tab");
+        const char *b_names[] = {"b"};
+        uint8_t b_out[2] = {0};
+        uintptr_t b_len = sizeof(b_out);
+        rc = nvf_get_blob(&ws_root, b_names, 1, b_out, &b_len);
+        ASSERT_INT(rc, NVF_OK, 1, "Getting a hex BLOB");
+        ASSERT_INT(b_out[0] == 0x09 && b_out[1] == 0xaf, 1, 1,
+                   "Reading mixed case hex digits");
+        nvf_deinit(&ws_root);
+    }
     {
         char str_out[32] = {0};
         uintptr_t out_len = sizeof(str_out);
@@ -154,7 +441,7 @@ int main(int argc, char *argv[]) {
 
     nvf_tag_value tv_s = nvf_array_get_item(&arr, 2);
     ASSERT_INT(tv_s.type, NVF_STRING, 1, "Getting string type from array");
-    ASSERT_INT(strcmp(tv_s.val.v_string, "str"), 0, 1,
+    ASSERT_INT(strcmp(tv_s.val.v_string->data, "str"), 0, 1,
                "Getting string value from array");
 
     nvf_tag_value tv_b = nvf_array_get_item(&arr, 3);
@@ -197,7 +484,7 @@ int main(int argc, char *argv[]) {
         nvf_tag_value m_tv_s = nvf_array_get_item(&arr, 2);
         ASSERT_INT(m_tv_s.type, NVF_STRING, 1,
                    "Getting string type from array");
-        ASSERT_INT(strcmp(m_tv_s.val.v_string, "str2"), 0, 1,
+        ASSERT_INT(strcmp(m_tv_s.val.v_string->data, "str2"), 0, 1,
                    "Getting string value from array");
 
         nvf_tag_value m_tv_b = nvf_array_get_item(&arr, 3);
@@ -213,6 +500,18 @@ int main(int argc, char *argv[]) {
         ASSERT_INT(m_tv_n.type, NVF_NONE, 1,
                    "Getting none value from an iterator");
     }
+    {
+        nvf_map m = {0};
+        const char *m_names[] = {"m_name"};
+        rc = nvf_get_map(&root, m_names, 1, &m);
+        ASSERT_INT(rc, NVF_OK, 1, "Getting a map");
+        ASSERT_INT(strcmp(nvf_map_name(&m, 0), "i_name"), 0, 1,
+                   "Getting a map's first name");
+        ASSERT_INT(strcmp(nvf_map_name(&m, 4), "a_name"), 0, 1,
+                   "Getting a map's last name");
+        ASSERT_INT(nvf_map_name(&m, 5) == NULL, 1, 1,
+                   "Getting a name past the end of a map");
+    }
     {
         const char *b_names[] = {"m_name", "b_name"};
         uint8_t *bin_out = NULL;
@@ -239,6 +538,32 @@ int main(int argc, char *argv[]) {
 
         root.free_inst(str_out);
     }
+    {
+        const char *s_names[] = {"m_name", "s_name"};
+        const char *str_view = NULL;
+        uintptr_t str_view_len = 0;
+        rc = nvf_get_str_view(&root, s_names, 2, &str_view, &str_view_len);
+        ASSERT_INT(rc, NVF_OK, 1, "Getting a string view");
+        ASSERT_INT(str_view_len, strlen("other test str"), 1,
+                   "Checking the string view length");
+        ASSERT_INT(strcmp(str_view, "other test str"), 0, 1,
+                   "Checking the string view");
+
+        const char *b_names[] = {"b_name"};
+        const uint8_t *bin_view = NULL;
+        uintptr_t bin_view_len = 0;
+        uint8_t bin_exp[] = {1, 2, 3, 4};
+        rc = nvf_get_blob_view(&root, b_names, 1, &bin_view, &bin_view_len);
+        ASSERT_INT(rc, NVF_OK, 1, "Getting a BLOB view");
+        ASSERT_INT(bin_view_len, sizeof(bin_exp), 1,
+                   "Checking the BLOB view length");
+        ASSERT_INT(memcmp(bin_view, bin_exp, bin_view_len), 0, 1,
+                   "Checking the BLOB view");
+
+        rc = nvf_get_blob_view(&root, s_names, 2, &bin_view, &bin_view_len);
+        ASSERT_INT(rc, NVF_BAD_VALUE_TYPE, 1,
+                   "Getting a BLOB view of a string");
+    }
     {
         char *str_out = NULL;
         uintptr_t str_len = 0;
@@ -251,13 +576,1667 @@ int main(int argc, char *argv[]) {
         root.free_inst(str_out);
     }
 
+    {
+        nvf_stats st = {0};
+        rc = nvf_root_stats(&root, &st);
+        ASSERT_INT(rc, NVF_OK, 1, "Getting root statistics");
+        ASSERT_INT(st.strings.used > 0, 1, 1, "Checking string bytes");
+        ASSERT_INT(st.blobs.used > 0, 1, 1, "Checking BLOB bytes");
+        ASSERT_INT(st.total.used <= st.total.reserved, 1, 1,
+                   "Checking used bytes fit in reserved bytes");
+        ASSERT_INT(st.slack, st.total.reserved - st.total.used, 1,
+                   "Checking slack");
+        // Every live allocation took at least one call to the allocator.
+        ASSERT_INT(st.allocs > 0 && st.alloc_calls >= st.allocs, 1, 1,
+                   "Checking allocation counts");
+    }
+
+    {
+        // Count every byte of a small root. Tables and names grow to twice
+        // their size plus a little, starting from nothing, except the root
+        // map's table which starts with room for one map.
+        const char st_test[] = "s \"ab\" b bx0102 a [1] m { i 1 }";
+        nvf_root st_root = nvf_root_default_init();
+        rd = nvf_parse_buf(st_test, strlen(st_test), &st_root);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Parsing data to count");
+        nvf_stats st = {0};
+        rc = nvf_root_stats(&st_root, &st);
+        ASSERT_INT(rc, NVF_OK, 1, "Getting small root statistics");
+        // The root map has 4 entries and "s b a m" in 14 bytes of names. The
+        // map m has room for 4 entries and 2 bytes of names, holding "i".
+        ASSERT_INT(st.names.used, 5 * sizeof(nvf_name) + 10, 1,
+                   "Counting used name bytes");
+        ASSERT_INT(st.names.reserved, 8 * sizeof(nvf_name) + 16, 1,
+                   "Counting reserved name bytes");
+        ASSERT_INT(st.strings.used, sizeof(nvf_str) + 3, 1,
+                   "Counting used string bytes");
+        ASSERT_INT(st.strings.reserved, st.strings.used, 1,
+                   "Counting reserved string bytes");
+        ASSERT_INT(st.blobs.used, sizeof(nvf_blob) + 2, 1,
+                   "Counting used BLOB bytes");
+        ASSERT_INT(st.blobs.reserved, st.blobs.used, 1,
+                   "Counting reserved BLOB bytes");
+        // 6 values with room for 12, in the two maps and the array.
+        uintptr_t entry_len = sizeof(uint8_t) + sizeof(nvf_value);
+        ASSERT_INT(st.values.used, 6 * entry_len, 1,
+                   "Counting used value bytes");
+        ASSERT_INT(st.values.reserved, 12 * entry_len, 1,
+                   "Counting reserved value bytes");
+        ASSERT_INT(st.tables.used, 2 * sizeof(nvf_map) + sizeof(nvf_array), 1,
+                   "Counting used table bytes");
+        ASSERT_INT(st.tables.reserved,
+                   6 * sizeof(nvf_map) + 4 * sizeof(nvf_array), 1,
+                   "Counting reserved table bytes");
+        ASSERT_INT(st.slack,
+                   3 * sizeof(nvf_name) + 6 + 6 * entry_len +
+                       4 * sizeof(nvf_map) + 3 * sizeof(nvf_array),
+                   1, "Counting slack bytes");
+        // The 2 tables, 4 blocks for each map, 2 for the array, the string
+        // and the BLOB.
+        ASSERT_INT(st.allocs, 14, 1, "Counting allocations");
+        ASSERT_INT(st.mapped, 0, 1, "Counting mapped bytes");
+        ASSERT_INT(nvf_deinit(&st_root), NVF_OK, 1, "Deiniting a root");
+    }
+
+    {
+        nvf_root p_root = nvf_root_default_init();
+        rd = nvf_parse_buf_presize(int_test, test_len, &p_root);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Parsing with presizing");
+
+        // A presized root should render the same as a normal one.
+        char *str_out = NULL;
+        uintptr_t str_len = 0;
+        char *p_str_out = NULL;
+        uintptr_t p_str_len = 0;
+        rc = nvf_default_root_to_str(&root, &str_out, &str_len);
+        ASSERT_INT(rc, NVF_OK, 1, "Rendering the root");
+        rc = nvf_default_root_to_str(&p_root, &p_str_out, &p_str_len);
+        ASSERT_INT(rc, NVF_OK, 1, "Rendering the presized root");
+        ASSERT_INT(p_str_len, str_len, 1, "Comparing rendered lengths");
+        ASSERT_INT(memcmp(p_str_out, str_out, str_len), 0, 1,
+                   "Comparing rendered roots");
+        root.free_inst(str_out);
+        p_root.free_inst(p_str_out);
+        p_str_out = NULL;
+
+        nvf_stats st = {0};
+        rc = nvf_root_stats(&p_root, &st);
+        ASSERT_INT(rc, NVF_OK, 1, "Getting presized root statistics");
+        // Only padding between pooled blocks should be unused.
+        ASSERT_INT(st.values.reserved, st.values.used, 1,
+                   "Checking presized values have no slack");
+        ASSERT_INT(st.tables.reserved, st.tables.used, 1,
+                   "Checking presized tables have no slack");
+        ASSERT_INT(st.names.reserved, st.names.used, 1,
+                   "Checking presized names have no slack");
+        ASSERT_INT(p_root.pool_len, p_root.pool_cap, 1,
+                   "Checking the presized pool is full");
+
+        // The root already has data, so this is a normal parse.
+        const char more_test[] = "more_name 5\n";
+        rd = nvf_parse_buf_presize(more_test, strlen(more_test), &p_root);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Parsing into a presized root");
+
+        // Parsing the same data after a reset shouldn't allocate anything.
+        rc = nvf_root_reset(&p_root);
+        ASSERT_INT(rc, NVF_OK, 1, "Resetting a root");
+        uint64_t alloc_calls = p_root.alloc_calls;
+        rd = nvf_parse_buf(int_test, test_len, &p_root);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Parsing into a reset root");
+        ASSERT_INT(p_root.alloc_calls, alloc_calls, 1,
+                   "Checking a reset root reuses its memory");
+        rc = nvf_default_root_to_str(&p_root, &p_str_out, &p_str_len);
+        ASSERT_INT(rc, NVF_OK, 1, "Rendering the reset root");
+        ASSERT_INT(p_str_len, str_len, 1, "Comparing reset lengths");
+        p_root.free_inst(p_str_out);
+
+        ASSERT_INT(nvf_deinit(&p_root), NVF_OK, 1, "Deiniting the root");
+    }
+
+    {
+        typedef struct {
+            int64_t i;
+            int32_t i32;
+            int8_t i8;
+            double f;
+            float f32;
+            char s[16];
+            uint8_t b[12];
+            int64_t missing;
+        } bind_test;
+        const char *i_path[] = {"m_name", "i_name"};
+        const char *f_path[] = {"m_name", "f_name"};
+        const char *s_path[] = {"m_name", "s_name"};
+        const char *b_path[] = {"m_name", "b_name"};
+        const char *x_path[] = {"m_name", "x_name"};
+        const char *top_path[] = {"i_name"};
+        const nvf_bind_field fields[] = {
+            {i_path, 2, NVF_INT, offsetof(bind_test, i), sizeof(int64_t)},
+            {i_path, 2, NVF_INT, offsetof(bind_test, i32), sizeof(int32_t)},
+            {i_path, 2, NVF_INT, offsetof(bind_test, i8), sizeof(int8_t)},
+            {f_path, 2, NVF_FLOAT, offsetof(bind_test, f), sizeof(double)},
+            {f_path, 2, NVF_FLOAT, offsetof(bind_test, f32), sizeof(float)},
+            {s_path, 2, NVF_STRING, offsetof(bind_test, s), 16},
+            {b_path, 2, NVF_BLOB, offsetof(bind_test, b), 12},
+            {x_path, 2, NVF_INT, offsetof(bind_test, missing), 8},
+            {top_path, 1, NVF_STRING, offsetof(bind_test, s), 16},
+        };
+        nvf_num field_num = sizeof(fields) / sizeof(*fields);
+        nvf_err field_errs[sizeof(fields) / sizeof(*fields)];
+        bind_test bt = {.i8 = -1, .missing = 7};
+        rc = nvf_bind(&root, fields, field_num, &bt, field_errs);
+        ASSERT_INT(rc, NVF_NUM_OVF, 1, "Binding a struct");
+
+        ASSERT_INT(field_errs[0], NVF_OK, 1, "Binding an int64_t");
+        ASSERT_INT(bt.i, 72333, 1, "Checking a bound int64_t");
+        ASSERT_INT(field_errs[1], NVF_OK, 1, "Binding an int32_t");
+        ASSERT_INT(bt.i32, 72333, 1, "Checking a bound int32_t");
+        ASSERT_INT(field_errs[2], NVF_NUM_OVF, 1, "Binding a small int");
+        ASSERT_INT(bt.i8, -1, 1, "Checking a failed field is unchanged");
+        ASSERT_INT(field_errs[3], NVF_OK, 1, "Binding a double");
+        ASSERT_FLOAT(bt.f, 0.8, 1, "Checking a bound double");
+        ASSERT_INT(field_errs[4], NVF_OK, 1, "Binding a float");
+        ASSERT_FLOAT(bt.f32, 0.8f, 1, "Checking a bound float");
+        ASSERT_INT(field_errs[5], NVF_OK, 1, "Binding a string");
+        ASSERT_INT(strcmp(bt.s, "other test str"), 0, 1,
+                   "Checking a bound string");
+        ASSERT_INT(field_errs[6], NVF_OK, 1, "Binding a BLOB");
+        uint8_t b_exp[12] = {5, 6, 7, 8, 9, 0xa, 0xb, 0xc, 0xd};
+        ASSERT_INT(memcmp(bt.b, b_exp, sizeof(b_exp)), 0, 1,
+                   "Checking a bound BLOB");
+        ASSERT_INT(field_errs[7], NVF_NOT_FOUND, 1, "Binding a missing name");
+        ASSERT_INT(bt.missing, 7, 1, "Checking a missing field is unchanged");
+        ASSERT_INT(field_errs[8], NVF_BAD_VALUE_TYPE, 1,
+                   "Binding the wrong type");
+
+        // Extracting from the text fills the struct the same way.
+        nvf_err ex_errs[sizeof(fields) / sizeof(*fields)];
+        bind_test ex = {.i8 = -1, .missing = 7};
+        nvf_err_data_i rd =
+            nvf_extract(int_test, test_len, fields, field_num, &ex, ex_errs);
+        ASSERT_INT(rd.err, NVF_NUM_OVF, 1, "Extracting a struct");
+        ASSERT_INT(memcmp(ex_errs, field_errs, sizeof(ex_errs)), 0, 1,
+                   "Comparing extracted errors");
+        ASSERT_INT(memcmp(&ex, &bt, sizeof(ex)), 0, 1,
+                   "Comparing an extracted struct");
+
+        // Skipped values aren't decoded or checked, and scanning stops once
+        // everything is found.
+        const char ex_test[] = "skip { s \"}{\" a [1 \"]\" {x 1}] # ]\n"
+                               "  b bf\"}\":0:1 n{ i 1 } }\n"
+                               "m { s \"a\" \"b\" i 3 n { i 4 } }\n"
+                               "i 5 later { not parsed";
+        const char *m_i_path[] = {"m", "i"};
+        const char *m_n_i_path[] = {"m", "n", "i"};
+        const char *ex_i_path[] = {"i"};
+        const nvf_bind_field ex_fields[] = {
+            {m_i_path, 2, NVF_INT, offsetof(bind_test, i), sizeof(int64_t)},
+            {m_n_i_path, 3, NVF_INT, offsetof(bind_test, i32), 4},
+            {ex_i_path, 1, NVF_INT, offsetof(bind_test, i8), 1},
+            {top_path, 1, NVF_INT, offsetof(bind_test, missing), 8},
+        };
+        rd = nvf_extract(ex_test, strlen(ex_test), ex_fields, 3, &ex, ex_errs);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Extracting around skipped values");
+        ASSERT_INT(ex.i, 3, 1, "Checking an extracted int");
+        ASSERT_INT(ex.i32, 4, 1, "Checking a nested extracted int");
+        ASSERT_INT(ex.i8, 5, 1, "Checking the last extracted int");
+        rd = nvf_extract(ex_test, strlen(ex_test), ex_fields, 4, &ex, ex_errs);
+        ASSERT_INT(rd.err, NVF_UNMATCHED_BRACE, 1,
+                   "Extracting from broken text");
+
+        const char *ref_path[] = {"skip", "b"};
+        const nvf_bind_field ref_field = {ref_path, 2, NVF_BLOB,
+                                          offsetof(bind_test, b), 12};
+        rd = nvf_extract(ex_test, strlen(ex_test), &ref_field, 1, &ex,
+                         ex_errs);
+        ASSERT_INT(rd.err, NVF_NOT_SUPPORTED, 1, "Extracting a BLOB reference");
+
+        // Paths through values that aren't maps are the wrong type, and
+        // the first field that failed gives the error.
+        const char *int_parent_path[] = {"i", "x"};
+        const char *arr_parent_path[] = {"skip", "a", "x"};
+        const nvf_bind_field parent_fields[] = {
+            {m_i_path, 2, NVF_INT, offsetof(bind_test, i), sizeof(int64_t)},
+            {arr_parent_path, 3, NVF_INT, offsetof(bind_test, i32), 4},
+            {int_parent_path, 2, NVF_INT, offsetof(bind_test, i8), 1},
+        };
+        rd = nvf_extract(ex_test, strlen(ex_test), parent_fields, 3, &ex,
+                         ex_errs);
+        ASSERT_INT(rd.err, NVF_BAD_VALUE_TYPE, 1,
+                   "Extracting through values that aren't maps");
+        ASSERT_INT(ex_errs[0], NVF_OK, 1, "Checking a field that was found");
+        ASSERT_INT(ex_errs[1], NVF_BAD_VALUE_TYPE, 1,
+                   "Checking a field through an array");
+        ASSERT_INT(ex_errs[2], NVF_BAD_VALUE_TYPE, 1,
+                   "Checking a field through an int");
+    }
+    {
+        rc = nvf_root_freeze(&root);
+        ASSERT_INT(rc, NVF_OK, 1, "Freezing the root");
+
+        nvf_stats st = {0};
+        rc = nvf_root_stats(&root, &st);
+        ASSERT_INT(rc, NVF_OK, 1, "Getting frozen root statistics");
+        ASSERT_INT(st.allocs, 1, 1, "Checking a frozen root is one block");
+
+        int64_t f_int = 0;
+        const char *i_names[] = {"m_name", "i_name"};
+        rc = nvf_get_int(&root, i_names, 2, &f_int);
+        ASSERT_INT(rc, NVF_OK, 1, "Getting an int from a frozen root");
+        ASSERT_INT(f_int, 72333, 1, "Checking an int from a frozen root");
+        const char *s_names[] = {"m_name", "s_name"};
+        const char *str_view = NULL;
+        uintptr_t view_len = 0;
+        rc = nvf_get_str_view(&root, s_names, 2, &str_view, &view_len);
+        ASSERT_INT(rc, NVF_OK, 1, "Getting a str from a frozen root");
+        ASSERT_INT(strcmp(str_view, "other test str"), 0, 1,
+                   "Checking a str from a frozen root");
+        const char *x_names[] = {"m_name", "x_name"};
+        rc = nvf_get_int(&root, x_names, 2, &f_int);
+        ASSERT_INT(rc, NVF_NOT_FOUND, 1, "Getting a missing frozen name");
+
+        rd = nvf_parse_buf(int_test, test_len, &root);
+        ASSERT_INT(rd.err, NVF_READ_ONLY, 1, "Parsing into a frozen root");
+        rc = nvf_root_reset(&root);
+        ASSERT_INT(rc, NVF_READ_ONLY, 1, "Resetting a frozen root");
+    }
+    {
+        // Check every name in a wider map is found through its perfect hash.
+        char w_test[4096] = {0};
+        uintptr_t w_len = 0;
+        for (int w_i = 0; w_i < 200; ++w_i) {
+            w_len += snprintf(w_test + w_len, sizeof(w_test) - w_len,
+                              "w%d %d\n", w_i, w_i);
+        }
+        nvf_root w_root = nvf_root_default_init();
+        rd = nvf_parse_buf(w_test, w_len, &w_root);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Parsing a wide map");
+        rc = nvf_root_freeze(&w_root);
+        ASSERT_INT(rc, NVF_OK, 1, "Freezing a wide map");
+        ASSERT_INT(w_root.maps[0].hash_slots != NULL, 1, 1,
+                   "Checking the wide map has a perfect hash");
+        for (int w_i = 0; w_i < 200; ++w_i) {
+            char w_name[16];
+            snprintf(w_name, sizeof(w_name), "w%d", w_i);
+            const char *w_names[] = {w_name};
+            int64_t w_int = -1;
+            rc = nvf_get_int(&w_root, w_names, 1, &w_int);
+            ASSERT_INT(rc, NVF_OK, 1, "Getting a frozen wide map value");
+            ASSERT_INT(w_int, w_i, 1, "Checking a frozen wide map value");
+        }
+
+        char *c_out = NULL, *h_out = NULL;
+        uintptr_t c_len = 0, h_len = 0;
+        rc = nvf_root_to_c(&w_root, "1cfg", &c_out, &c_len, &h_out, &h_len);
+        ASSERT_INT(rc, NVF_BAD_ARG, 1, "Compiling with a bad C name");
+        rc = nvf_root_to_c(&w_root, "w_cfg", &c_out, &c_len, &h_out, &h_len);
+        ASSERT_INT(rc, NVF_OK, 1, "Compiling a root to C");
+        ASSERT_INT(c_len, strlen(c_out) + 1, 1, "Checking the C length");
+        ASSERT_INT(h_len, strlen(h_out) + 1, 1, "Checking the header length");
+        ASSERT_INT(strstr(h_out, "extern nvf_root w_cfg;") != NULL, 1, 1,
+                   "Checking the header declares the root");
+        ASSERT_INT(strstr(c_out, "\nnvf_root w_cfg = {") != NULL, 1, 1,
+                   "Checking the C defines the root");
+        ASSERT_INT(strstr(c_out, "{.v_int = INT64_C(199)},") != NULL, 1, 1,
+                   "Checking the C has the values");
+        ASSERT_INT(strstr(c_out, "w_cfg_m0_hash_slots[]") != NULL, 1, 1,
+                   "Checking the C has the perfect hash");
+        w_root.free_inst(c_out);
+        w_root.free_inst(h_out);
+        // make test_nvfc builds and reads back nvfc's output.
+        ASSERT_INT(nvf_deinit(&w_root), NVF_OK, 1, "Deiniting the root");
+    }
+
+    {
+        // Short names have hashes that differ in only a few bits. Freezing a
+        // map of hundreds of them still builds a perfect hash quickly.
+        char n_test[4096] = {0};
+        uintptr_t n_len = 0;
+        for (int n_i = 0; n_i < 400; ++n_i) {
+            n_len += snprintf(n_test + n_len, sizeof(n_test) - n_len,
+                              "%c%c %d\n", 'a' + n_i / 26, 'a' + n_i % 26, n_i);
+        }
+        nvf_root n_root = nvf_root_default_init();
+        rd = nvf_parse_buf(n_test, n_len, &n_root);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Parsing a map of short names");
+        struct timespec n_start = {0}, n_end = {0};
+        clock_gettime(CLOCK_MONOTONIC, &n_start);
+        rc = nvf_root_freeze(&n_root);
+        clock_gettime(CLOCK_MONOTONIC, &n_end);
+        ASSERT_INT(rc, NVF_OK, 1, "Freezing a map of short names");
+        ASSERT_INT(n_root.maps[0].hash_slots != NULL, 1, 1,
+                   "Checking short names get a perfect hash");
+        int64_t n_ms = (n_end.tv_sec - n_start.tv_sec) * 1000 +
+                       (n_end.tv_nsec - n_start.tv_nsec) / 1000000;
+        ASSERT_INT(n_ms < 100, 1, 1, "Checking short names freeze quickly");
+        for (int n_i = 0; n_i < 400; ++n_i) {
+            char n_name[3] = {'a' + n_i / 26, 'a' + n_i % 26, '\0'};
+            const char *n_names[] = {n_name};
+            int64_t n_int = -1;
+            rc = nvf_get_int(&n_root, n_names, 1, &n_int);
+            ASSERT_INT(rc, NVF_OK, 1, "Getting a short name's value");
+            ASSERT_INT(n_int, n_i, 1, "Checking a short name's value");
+        }
+        ASSERT_INT(nvf_deinit(&n_root), NVF_OK, 1, "Deiniting the root");
+    }
+
     rc = nvf_deinit(&root);
     ASSERT_INT(rc, NVF_OK, 1, "Deiniting the root");
 
+    {
+        nvf_root s_root = nvf_root_default_init();
+        const char s_test[] = "nul_name \"a\\0b\\\"c\"\n"
+                              "dup_name 1\n"
+                              "dup_name 2\n";
+        rd = nvf_parse_buf(s_test, strlen(s_test), &s_root);
+        ASSERT_INT(rd.err, NVF_DUP_NAME, 1, "Parsing a duplicate name");
+
+        char str_out[32] = {0};
+        uintptr_t out_len = sizeof(str_out);
+        const char *s_names[] = {"nul_name"};
+        rc = nvf_get_str(&s_root, s_names, 1, str_out, &out_len);
+        ASSERT_INT(rc, NVF_OK, 1, "Getting a str with a NUL byte");
+        ASSERT_INT(out_len, sizeof("a\0b\"c"), 1,
+                   "Comparing the string length");
+        ASSERT_INT(memcmp(str_out, "a\0b\"c", out_len), 0, 1,
+                   "Comparing the string with a NUL byte");
+
+        // Render the root and make sure the NUL survives being parsed again.
+        char *rendered = NULL;
+        uintptr_t rendered_len = 0;
+        rc = nvf_default_root_to_str(&s_root, &rendered, &rendered_len);
+        ASSERT_INT(rc, NVF_OK, 1, "Rendering a string with a NUL byte");
+        nvf_root r_root = nvf_root_default_init();
+        rd = nvf_parse_buf(rendered, rendered_len - 1, &r_root);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Parsing a rendered NUL byte");
+        out_len = sizeof(str_out);
+        rc = nvf_get_str(&r_root, s_names, 1, str_out, &out_len);
+        ASSERT_INT(rc, NVF_OK, 1, "Getting a rendered NUL byte");
+        ASSERT_INT(memcmp(str_out, "a\0b\"c", out_len), 0, 1,
+                   "Comparing a rendered NUL byte");
+
+        s_root.free_inst(rendered);
+        ASSERT_INT(nvf_deinit(&r_root), NVF_OK, 1, "Deiniting the root");
+        ASSERT_INT(nvf_deinit(&s_root), NVF_OK, 1, "Deiniting the root");
+    }
+
     nvf_root zero_root = {0};
     ASSERT_INT(memcmp(&zero_root, &root, sizeof(zero_root)), 0, 1,
                "Checking deinited root is zero");
 
+    {
+        // Write a file for the BLOB reference to point at.
+        const char ref_path[] = "nvf_test_blob_ref.bin";
+        uint8_t ref_file[] = {0, 1, 2, 3, 4, 5, 6, 7};
+        FILE *ref_f = fopen(ref_path, "wb");
+        ASSERT_INT(ref_f != NULL, 1, 1, "Opening the BLOB reference file");
+        fwrite(ref_file, 1, sizeof(ref_file), ref_f);
+        fclose(ref_f);
+
+        nvf_root r_root = nvf_root_default_init();
+        const char r_test[] = "ref bf\"nvf_test_blob_ref.bin\":3:4\n"
+                              "bad_ref bf\"nvf_test_blob_ref.bin\":6:4\n"
+                              "arr [bf\"nvf_test_blob_ref.bin\":0x1:2]\n";
+        rd = nvf_parse_buf(r_test, strlen(r_test), &r_root);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Parsing BLOB references");
+
+        uint8_t bin_out[8] = {0};
+        uintptr_t bin_out_len = sizeof(bin_out);
+        const char *r_names[] = {"ref"};
+        rc = nvf_get_blob(&r_root, r_names, 1, bin_out, &bin_out_len);
+        ASSERT_INT(rc, NVF_OK, 1, "Getting a BLOB reference");
+        ASSERT_INT(bin_out_len, 4, 1, "Checking the BLOB reference length");
+        ASSERT_INT(memcmp(bin_out, ref_file + 3, 4), 0, 1,
+                   "Checking the BLOB reference data");
+
+        const char *bad_names[] = {"bad_ref"};
+        bin_out_len = sizeof(bin_out);
+        rc = nvf_get_blob(&r_root, bad_names, 1, bin_out, &bin_out_len);
+        ASSERT_INT(rc, NVF_BAD_DATA, 1, "Getting a BLOB past the file's end");
+
+        // Binding a BLOB field reads references too.
+        uint8_t bound[2][8] = {{0}};
+        const nvf_bind_field ref_fields[] = {
+            {r_names, 1, NVF_BLOB, 0, sizeof(bound[0])},
+            {bad_names, 1, NVF_BLOB, sizeof(bound[0]), sizeof(bound[1])},
+        };
+        nvf_err ref_errs[2];
+        rc = nvf_bind(&r_root, ref_fields, 2, bound, ref_errs);
+        ASSERT_INT(rc, NVF_BAD_DATA, 1, "Binding BLOB references");
+        ASSERT_INT(ref_errs[0], NVF_OK, 1, "Binding a BLOB reference");
+        uint8_t bound_exp[8] = {0};
+        memcpy(bound_exp, ref_file + 3, 4);
+        ASSERT_INT(memcmp(bound[0], bound_exp, sizeof(bound_exp)), 0, 1,
+                   "Checking a bound BLOB reference");
+
+        nvf_array r_arr = {0};
+        const char *arr_names[] = {"arr"};
+        rc = nvf_get_array(&r_root, arr_names, 1, &r_arr);
+        ASSERT_INT(rc, NVF_OK, 1, "Getting an array of BLOB references");
+        nvf_tag_value r_tv = nvf_array_get_item(&r_arr, 0);
+        ASSERT_INT(r_tv.type, NVF_BLOB_REF, 1, "Checking the reference type");
+        const uint8_t *ref_data = NULL;
+        uintptr_t ref_len = 0;
+        rc = nvf_blob_ref_get(r_tv.val.v_blob_ref, &ref_data, &ref_len);
+        ASSERT_INT(rc, NVF_OK, 1, "Reading an array BLOB reference");
+        ASSERT_INT(ref_len, 2, 1, "Checking the array reference length");
+        ASSERT_INT(memcmp(ref_data, ref_file + 1, 2), 0, 1,
+                   "Checking the array reference data");
+
+        // Clones map their references themselves.
+        nvf_root c_root = nvf_root_default_init();
+        rc = nvf_root_clone(&c_root, &r_root, NVF_CLONE_SHARE);
+        ASSERT_INT(rc, NVF_OK, 1, "Cloning BLOB references");
+        bin_out_len = sizeof(bin_out);
+        rc = nvf_get_blob(&c_root, r_names, 1, bin_out, &bin_out_len);
+        ASSERT_INT(rc, NVF_OK, 1, "Getting a cloned BLOB reference");
+        ASSERT_INT(memcmp(bin_out, ref_file + 3, 4), 0, 1,
+                   "Checking the cloned BLOB reference data");
+        ASSERT_INT(nvf_deinit(&c_root), NVF_OK, 1, "Deiniting a clone");
+
+        // Threads reading an unmapped reference at once all get the same
+        // mapping, and only one mapping is kept.
+        for (int t_round = 0; t_round < 16; ++t_round) {
+            nvf_root t_root = nvf_root_default_init();
+            rd = nvf_parse_buf(r_test, strlen(r_test), &t_root);
+            ASSERT_INT(rd.err, NVF_OK, 1, "Parsing references for threads");
+            nvf_blob_ref *t_ref = t_root.maps[0].arr.values[0].v_blob_ref;
+            ref_race race = {.ref = t_ref};
+            pthread_barrier_init(&race.start, NULL, 8);
+            pthread_t threads[8];
+            void *t_data[8] = {0};
+            for (int t_i = 0; t_i < 8; ++t_i) {
+                ASSERT_INT(pthread_create(&threads[t_i], NULL, read_blob_ref,
+                                          &race),
+                           0, 1, "Starting a thread");
+            }
+            for (int t_i = 0; t_i < 8; ++t_i) {
+                pthread_join(threads[t_i], &t_data[t_i]);
+            }
+            pthread_barrier_destroy(&race.start);
+            for (int t_i = 0; t_i < 8; ++t_i) {
+                ASSERT_INT(t_data[t_i] != NULL && t_data[t_i] == t_data[0], 1,
+                           1, "Checking threads share a reference's mapping");
+            }
+            ASSERT_INT(memcmp(t_data[0], ref_file + 3, 4), 0, 1,
+                       "Checking a reference read by threads");
+            nvf_stats t_st = {0};
+            ASSERT_INT(nvf_root_stats(&t_root, &t_st), NVF_OK, 1,
+                       "Getting stats after threads read a reference");
+            ASSERT_INT(t_st.mapped, t_ref->map_len, 1,
+                       "Checking only one mapping is kept");
+            ASSERT_INT(t_ref->map_len, 7, 1, "Checking the mapping's length");
+            ASSERT_INT(nvf_deinit(&t_root), NVF_OK, 1, "Deiniting a root");
+        }
+
+        // Sharing a presized root's strings moves them to a new pool, and
+        // references in the old pool have to move out of it too.
+        nvf_root p_root = nvf_root_default_init();
+        const char p_test[] = "ref bf\"nvf_test_blob_ref.bin\":3:4\n"
+                              "p_arr [bf\"nvf_test_blob_ref.bin\":0:2]\n"
+                              "p \"a string in the pool that's longer "
+                              "than the reference, so the reference "
+                              "fits in the pool first\"\n";
+        rd = nvf_parse_buf_presize(p_test, strlen(p_test), &p_root);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Presizing BLOB references");
+        // The presizing scan makes room for references in the pool too.
+        ASSERT_INT(p_root.pool_len, p_root.pool_cap, 1,
+                   "Checking a pool with references is full");
+        for (nvf_num a_i = 0; a_i < p_root.map_num + p_root.array_num; ++a_i) {
+            const nvf_array *a = a_i < p_root.map_num
+                                     ? &p_root.maps[a_i].arr
+                                     : &p_root.arrays[a_i - p_root.map_num];
+            for (nvf_num i = 0; i < a->num; ++i) {
+                const uint8_t *leaf = (const uint8_t *)a->values[i].v_string;
+                if (a->types[i] == NVF_STRING || a->types[i] == NVF_BLOB_REF) {
+                    ASSERT_INT(leaf >= p_root.pool &&
+                                   leaf < p_root.pool + p_root.pool_cap,
+                               1, 1, "Checking a presized leaf is pooled");
+                }
+            }
+        }
+        const char p_more[] = "s \"a string that isn't in the pool\"\n";
+        rd = nvf_parse_buf(p_more, strlen(p_more), &p_root);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Parsing past a presized pool");
+        c_root = nvf_root_default_init();
+        rc = nvf_root_clone(&c_root, &p_root, NVF_CLONE_SHARE);
+        ASSERT_INT(rc, NVF_OK, 1, "Sharing a presized root with references");
+        for (int c_i = 0; c_i < 2; ++c_i) {
+            bin_out_len = sizeof(bin_out);
+            rc = nvf_get_blob(c_i == 0 ? &p_root : &c_root, r_names, 1,
+                              bin_out, &bin_out_len);
+            ASSERT_INT(rc, NVF_OK, 1, "Getting a packed BLOB reference");
+            ASSERT_INT(memcmp(bin_out, ref_file + 3, 4), 0, 1,
+                       "Checking a packed BLOB reference");
+        }
+        ASSERT_INT(nvf_deinit(&c_root), NVF_OK, 1, "Deiniting a clone");
+        ASSERT_INT(nvf_deinit(&p_root), NVF_OK, 1, "Deiniting a root");
+
+        // References are mapped when they're read, so a bad one doesn't stop
+        // the root from being frozen.
+        rc = nvf_root_freeze(&r_root);
+        ASSERT_INT(rc, NVF_OK, 1, "Freezing a bad BLOB reference");
+        bin_out_len = sizeof(bin_out);
+        rc = nvf_get_blob(&r_root, bad_names, 1, bin_out, &bin_out_len);
+        ASSERT_INT(rc, NVF_BAD_DATA, 1, "Getting a frozen bad BLOB reference");
+        bin_out_len = sizeof(bin_out);
+        rc = nvf_get_blob(&r_root, r_names, 1, bin_out, &bin_out_len);
+        ASSERT_INT(rc, NVF_OK, 1, "Getting a frozen BLOB reference");
+        ASSERT_INT(memcmp(bin_out, ref_file + 3, 4), 0, 1,
+                   "Checking a frozen BLOB reference");
+
+        ASSERT_INT(nvf_deinit(&r_root), NVF_OK, 1, "Deiniting the root");
+        remove(ref_path);
+    }
+
+    {
+        nvf_root base = nvf_root_default_init();
+        const char base_test[] = "a 1\n"
+                                 "m {\n"
+                                 "\tx 1\n"
+                                 "\ty \"base\"\n"
+                                 "}\n"
+                                 "arr [1 [2]]\n";
+        rd = nvf_parse_buf(base_test, strlen(base_test), &base);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Parsing an overlay's base");
+        rc = nvf_root_freeze(&base);
+        ASSERT_INT(rc, NVF_OK, 1, "Freezing an overlay's base");
+
+        nvf_root tenant = nvf_root_overlay_init(&base);
+        const char tenant_test[] = "a 2\n"
+                                   "m {\n"
+                                   "\ty \"tenant\"\n"
+                                   "\tz 3\n"
+                                   "}\n"
+                                   "new 4\n";
+        rd = nvf_parse_buf(tenant_test, strlen(tenant_test), &tenant);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Parsing an overlay");
+        nvf_root host = nvf_root_overlay_init(&tenant);
+        const char host_test[] = "m {\n"
+                                 "\tx 9\n"
+                                 "}\n";
+        rd = nvf_parse_buf(host_test, strlen(host_test), &host);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Parsing an overlay of an overlay");
+
+        int64_t o_int = 0;
+        const char *a_names[] = {"a"};
+        rc = nvf_get_int(&tenant, a_names, 1, &o_int);
+        ASSERT_INT(rc, NVF_OK, 1, "Getting an overridden int");
+        ASSERT_INT(o_int, 2, 1, "Checking an overridden int");
+        const char *x_names[] = {"m", "x"};
+        rc = nvf_get_int(&tenant, x_names, 2, &o_int);
+        ASSERT_INT(rc, NVF_OK, 1, "Getting an int from a base map");
+        ASSERT_INT(o_int, 1, 1, "Checking an int from a base map");
+        rc = nvf_get_int(&host, x_names, 2, &o_int);
+        ASSERT_INT(rc, NVF_OK, 1, "Getting an int from a top overlay");
+        ASSERT_INT(o_int, 9, 1, "Checking an int from a top overlay");
+        rc = nvf_get_int(&host, a_names, 1, &o_int);
+        ASSERT_INT(rc, NVF_OK, 1, "Getting an int from a middle overlay");
+        ASSERT_INT(o_int, 2, 1, "Checking an int from a middle overlay");
+        const char *y_names[] = {"m", "y"};
+        const char *o_view = NULL;
+        uintptr_t o_len = 0;
+        rc = nvf_get_str_view(&host, y_names, 2, &o_view, &o_len);
+        ASSERT_INT(rc, NVF_OK, 1, "Getting an overridden str");
+        ASSERT_INT(strcmp(o_view, "tenant"), 0, 1,
+                   "Checking an overridden str");
+        rc = nvf_get_float(&host, a_names, 1, &(double){0});
+        ASSERT_INT(rc, NVF_BAD_VALUE_TYPE, 1,
+                   "Getting an overridden value as the wrong type");
+        const char *q_names[] = {"m", "q"};
+        rc = nvf_get_int(&host, q_names, 2, &o_int);
+        ASSERT_INT(rc, NVF_NOT_FOUND, 1, "Getting a name no layer has");
+
+        nvf_array o_arr = {0};
+        const char *arr_names[] = {"arr"};
+        rc = nvf_get_array(&host, arr_names, 1, &o_arr);
+        ASSERT_INT(rc, NVF_OK, 1, "Getting an array from a base");
+        ASSERT_INT(o_arr.num, 2, 1, "Checking an array from a base");
+
+        int64_t bound[2] = {0};
+        const nvf_bind_field o_fields[] = {
+            {x_names, 2, NVF_INT, 0, sizeof(int64_t)},
+            {a_names, 1, NVF_INT, sizeof(int64_t), sizeof(int64_t)},
+        };
+        rc = nvf_bind(&host, o_fields, 2, bound, NULL);
+        ASSERT_INT(rc, NVF_OK, 1, "Binding from an overlay");
+        ASSERT_INT(bound[0], 9, 1, "Checking a bound overlay value");
+        ASSERT_INT(bound[1], 2, 1, "Checking a bound base value");
+
+        nvf_root merged = nvf_root_default_init();
+        rc = nvf_root_materialize(&host, &merged);
+        ASSERT_INT(rc, NVF_OK, 1, "Materializing an overlay");
+        rc = nvf_root_materialize(&host, &merged);
+        ASSERT_INT(rc, NVF_BAD_ARG, 1, "Materializing into a full root");
+        nvf_root reused = nvf_root_default_init();
+        rd = nvf_parse_buf("q [1]", 5, &reused);
+        ASSERT_INT(nvf_root_reset(&reused), NVF_OK, 1, "Resetting a root");
+        rc = nvf_root_materialize(&host, &reused);
+        ASSERT_INT(rc, NVF_BAD_ARG, 1, "Materializing into a reset root");
+        ASSERT_INT(nvf_deinit(&reused), NVF_OK, 1, "Deiniting a root");
+        ASSERT_INT(nvf_deinit(&host), NVF_OK, 1, "Deiniting an overlay");
+        ASSERT_INT(nvf_deinit(&tenant), NVF_OK, 1, "Deiniting an overlay");
+        ASSERT_INT(nvf_deinit(&base), NVF_OK, 1, "Deiniting a base");
+
+        // Names keep the order of the lowest layer they're in.
+        char *m_str = NULL;
+        uintptr_t m_len = 0;
+        rc = nvf_default_root_to_str(&merged, &m_str, &m_len);
+        ASSERT_INT(rc, NVF_OK, 1, "Rendering a materialized root");
+        const char m_exp[] = "a 2\n"
+                             "m {\n"
+                             "\tx 9\n"
+                             "\ty \"tenant\"\n"
+                             "\tz 3\n"
+                             "}\n"
+                             "arr [\n"
+                             "\t 1\n"
+                             "\t[\n"
+                             "\t\t 2\n"
+                             "\t]\n"
+                             "]\n"
+                             "new 4\n";
+        ASSERT_INT(strcmp(m_str, m_exp), 0, 1,
+                   "Checking a materialized root");
+        merged.free_inst(m_str);
+        ASSERT_INT(nvf_deinit(&merged), NVF_OK, 1, "Deiniting a merged root");
+    }
+
+    {
+        nvf_root src = nvf_root_default_init();
+        const char c_test[] = "i 1\n"
+                              "s \"a string\"\n"
+                              "b bx0102\n"
+                              "m {\n"
+                              "\ts \"nested\"\n"
+                              "\ta [1 \"in array\" [2]]\n"
+                              "}\n";
+        rd = nvf_parse_buf(c_test, strlen(c_test), &src);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Parsing a root to clone");
+        char *src_str = NULL, *c_str = NULL;
+        uintptr_t src_len = 0, c_len = 0;
+        rc = nvf_default_root_to_str(&src, &src_str, &src_len);
+        ASSERT_INT(rc, NVF_OK, 1, "Rendering a root to clone");
+
+        nvf_root copy = nvf_root_default_init();
+        rc = nvf_root_clone(&copy, &src, NVF_CLONE_COPY);
+        ASSERT_INT(rc, NVF_OK, 1, "Cloning a root");
+        rc = nvf_root_clone(&copy, &src, NVF_CLONE_COPY);
+        ASSERT_INT(rc, NVF_BAD_ARG, 1, "Cloning into a used root");
+        nvf_stats st = {0};
+        rc = nvf_root_stats(&copy, &st);
+        ASSERT_INT(rc, NVF_OK, 1, "Getting a clone's statistics");
+        // Only the pool's alignment padding is left over.
+        ASSERT_INT(st.values.reserved, st.values.used, 1,
+                   "Checking a clone's values have no slack");
+        ASSERT_INT(st.names.reserved, st.names.used, 1,
+                   "Checking a clone's names have no slack");
+        ASSERT_INT(st.tables.reserved, st.tables.used, 1,
+                   "Checking a clone's tables have no slack");
+        rc = nvf_default_root_to_str(&copy, &c_str, &c_len);
+        ASSERT_INT(rc, NVF_OK, 1, "Rendering a clone");
+        ASSERT_INT(strcmp(c_str, src_str), 0, 1, "Comparing a clone");
+        copy.free_inst(c_str);
+
+        // Changing a clone doesn't change the original.
+        const char more[] = "extra 2\n";
+        rd = nvf_parse_buf(more, strlen(more), &copy);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Parsing into a clone");
+        const char *extra_names[] = {"extra"};
+        int64_t c_int = 0;
+        rc = nvf_get_int(&src, extra_names, 1, &c_int);
+        ASSERT_INT(rc, NVF_NOT_FOUND, 1, "Checking the original is unchanged");
+        ASSERT_INT(nvf_deinit(&copy), NVF_OK, 1, "Deiniting a clone");
+
+        nvf_root shared = nvf_root_default_init();
+        rc = nvf_root_clone(&shared, &src, NVF_CLONE_SHARE);
+        ASSERT_INT(rc, NVF_OK, 1, "Cloning a root with sharing");
+        ASSERT_INT(*src.pool_refs, 2, 1, "Checking the shared pool count");
+        const char *s_names[] = {"m", "s"};
+        const char *src_view = NULL, *c_view = NULL;
+        uintptr_t view_len = 0;
+        rc = nvf_get_str_view(&src, s_names, 2, &src_view, &view_len);
+        ASSERT_INT(rc, NVF_OK, 1, "Getting an original str");
+        rc = nvf_get_str_view(&shared, s_names, 2, &c_view, &view_len);
+        ASSERT_INT(rc, NVF_OK, 1, "Getting a shared str");
+        ASSERT_INT(src_view == c_view, 1, 1, "Checking the str is shared");
+        ASSERT_INT(nvf_deinit(&src), NVF_OK, 1, "Deiniting a shared root");
+        rc = nvf_default_root_to_str(&shared, &c_str, &c_len);
+        ASSERT_INT(rc, NVF_OK, 1, "Rendering a shared clone");
+        ASSERT_INT(strcmp(c_str, src_str), 0, 1, "Comparing a shared clone");
+        shared.free_inst(c_str);
+
+        // Resetting a clone gives it its own pool again.
+        rc = nvf_root_reset(&shared);
+        ASSERT_INT(rc, NVF_OK, 1, "Resetting a shared clone");
+        ASSERT_INT(shared.pool_refs == NULL, 1, 1,
+                   "Checking a reset clone stops sharing");
+        rd = nvf_parse_buf(c_test, strlen(c_test), &shared);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Parsing into a reset clone");
+
+        // Clones of a frozen root share its block.
+        rc = nvf_root_freeze(&shared);
+        ASSERT_INT(rc, NVF_OK, 1, "Freezing a root to clone");
+        nvf_root f_clone = nvf_root_default_init();
+        rc = nvf_root_clone(&f_clone, &shared, NVF_CLONE_SHARE);
+        ASSERT_INT(rc, NVF_OK, 1, "Cloning a frozen root");
+        ASSERT_INT(f_clone.frozen, 0, 1, "Checking a clone isn't frozen");
+        ASSERT_INT(nvf_deinit(&shared), NVF_OK, 1, "Deiniting a frozen root");
+        rc = nvf_default_root_to_str(&f_clone, &c_str, &c_len);
+        ASSERT_INT(rc, NVF_OK, 1, "Rendering a frozen root's clone");
+        ASSERT_INT(strcmp(c_str, src_str), 0, 1,
+                   "Comparing a frozen root's clone");
+        f_clone.free_inst(c_str);
+        f_clone.free_inst(src_str);
+        ASSERT_INT(nvf_deinit(&f_clone), NVF_OK, 1, "Deiniting a clone");
+    }
+
+    {
+        // Numbers may end the data or the map they're in. The data doesn't
+        // have to be null terminated.
+        const char num_data[] = "i 12 h 0x1f n -42 z 0 f 1e3 "
+                                "l 1234567890123456789 m {i 5} e 12345";
+        nvf_root n_root = nvf_root_default_init();
+        rd = nvf_parse_buf(num_data, sizeof(num_data) - 4, &n_root);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Parsing numbers");
+        const char *n_names[][2] = {{"i"}, {"h"}, {"n"}, {"z"},
+                                    {"l"}, {"m", "i"}, {"e"}};
+        int64_t n_exp[] = {12, 31, -42, 0, 1234567890123456789, 5, 12};
+        for (uint32_t n_i = 0; n_i < sizeof(n_exp) / sizeof(*n_exp); ++n_i) {
+            int64_t n_out = 0;
+            rc = nvf_get_int(&n_root, n_names[n_i], n_names[n_i][1] ? 2 : 1,
+                             &n_out);
+            ASSERT_INT(rc, NVF_OK, 1, "Getting a parsed number");
+            ASSERT_INT(n_out == n_exp[n_i], 1, 1, "Checking a parsed number");
+        }
+        const char *f_name[] = {"f"};
+        rc = nvf_get_float(&n_root, f_name, 1, &bin_f);
+        ASSERT_INT(rc, NVF_OK, 1, "Getting a parsed float");
+        ASSERT_FLOAT(bin_f, 1000.0, 1, "Checking a parsed float");
+        ASSERT_INT(nvf_deinit(&n_root), NVF_OK, 1, "Deiniting numbers");
+
+        const char *bad_nums[] = {"a 1{", "a -", "a 1x", "a 1.5.5",
+                                  "a 123456789012345678901"};
+        nvf_err bad_exp[] = {NVF_BAD_VALUE_FMT, NVF_BAD_VALUE_FMT,
+                             NVF_BAD_VALUE_FMT, NVF_BAD_VALUE_FMT,
+                             NVF_NUM_OVF};
+        for (uint32_t n_i = 0; n_i < sizeof(bad_exp) / sizeof(*bad_exp);
+             ++n_i) {
+            n_root = nvf_root_default_init();
+            rd = nvf_parse_buf(bad_nums[n_i], strlen(bad_nums[n_i]), &n_root);
+            ASSERT_INT(rd.err, bad_exp[n_i], 1, "Parsing a bad number");
+            nvf_deinit(&n_root);
+        }
+
+        // Numbers are copied to be null terminated, so long ones are refused.
+        char long_num[160] = "a 1.";
+        memset(long_num + 4, '0', sizeof(long_num) - 5);
+        n_root = nvf_root_default_init();
+        rd = nvf_parse_buf(long_num, strlen(long_num), &n_root);
+        ASSERT_INT(rd.err, NVF_BAD_VALUE_FMT, 1, "Parsing a long number");
+        nvf_deinit(&n_root);
+    }
+
+    {
+        // Growing a map's names past what an nvf_num holds fails instead of
+        // wrapping around. Pretend the names are almost that big.
+        nvf_root g_root = nvf_root_default_init();
+        rd = nvf_parse_buf("a 1", 3, &g_root);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Parsing a map to grow");
+        nvf_map *g_map = &g_root.maps[0];
+        nvf_num name_len = g_map->name_len, name_cap = g_map->name_cap;
+        g_map->name_len = 0xc0000000u;
+        g_map->name_cap = 0xc0000000u;
+        rd = nvf_parse_buf("b 2", 3, &g_root);
+        ASSERT_INT(rd.err, NVF_BAD_ALLOC, 1, "Growing a map's names too far");
+        g_map = &g_root.maps[0];
+        g_map->name_len = name_len;
+        g_map->name_cap = name_cap;
+        ASSERT_INT(nvf_deinit(&g_root), NVF_OK, 1, "Deiniting the root");
+    }
+
+    {
+        char scratch[16] = {0};
+        nvf_events ev = {
+            .on_name = log_name,
+            .on_int = log_int,
+            .on_float = log_float,
+            .on_string = log_string,
+            .on_blob = log_blob,
+            .on_blob_ref = log_blob_ref,
+            .begin_map = log_begin_map,
+            .end_map = log_end_map,
+            .begin_array = log_begin_array,
+            .end_array = log_end_array,
+            .scratch = scratch,
+            .scratch_len = sizeof(scratch),
+        };
+        const char ev_test[] = "i -5 f 0.5 s \"str\" es \"a\\tb\" \"c\"\n"
+                               "b bx0102 r bf\"x.bin\":0x10:4\n"
+                               "m{ a[1 [2] \"x\"] n{} }";
+        uintptr_t ev_len = strlen(ev_test);
+        const char *ev_exp = "i=-5 f=0.5 s=\"str\" es=s\"a\tbc\" b=bx0102 "
+                             "r=bf\"x.bin\":16:4 m={ a=[ 1 [ 2 ] \"x\" ] "
+                             "n={ } } ";
+        event_log log = {.scratch = scratch};
+        nvf_err_data_i rd = nvf_parse_events(ev_test, ev_len, &ev, &log);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Parsing events");
+        ASSERT_INT(strcmp(log.buf, ev_exp), 0, 1, "Checking parsed events");
+
+        log = (event_log){.scratch = scratch, .stop_after = 3};
+        rd = nvf_parse_events(ev_test, ev_len, &ev, &log);
+        ASSERT_INT(rd.err, NVF_STOPPED, 1, "Stopping parsing events");
+        ASSERT_INT(strcmp(log.buf, "i=-5 f="), 0, 1, "Checking stopped events");
+
+        // Parsing the same data into a root gives the same values, even with
+        // brackets that aren't matched.
+        const char *same_events[] = {ev_test, "a {", "a [1 [2]", "a {b 1 ]",
+                                     "a [] ] b 1", "]"};
+        for (uintptr_t i = 0; i < sizeof(same_events) / sizeof(*same_events);
+             ++i) {
+            // Leave out the scratch buffer so decoded strings aren't marked.
+            log = (event_log){0};
+            uintptr_t same_len = strlen(same_events[i]);
+            rd = nvf_parse_events(same_events[i], same_len, &ev, &log);
+            ASSERT_INT(rd.err, NVF_OK, 1, "Parsing the same events");
+            nvf_root ev_root = nvf_root_default_init();
+            nvf_err_data_i root_rd =
+                nvf_parse_buf(same_events[i], same_len, &ev_root);
+            ASSERT_INT(root_rd.err, NVF_OK, 1, "Parsing events into a root");
+            ASSERT_INT(root_rd.data_i, rd.data_i, 1,
+                       "Checking events and a root end at the same place");
+            event_log root_log = {0};
+            nvf_cursor ev_c;
+            rc = log_cursor(&root_log, &ev_c, nvf_cursor_root(&ev_root, &ev_c));
+            ASSERT_INT(rc, NVF_OK, 1, "Walking an event root");
+            ASSERT_INT(strcmp(root_log.buf, log.buf), 0, 1,
+                       "Comparing a root with events");
+            ASSERT_INT(nvf_deinit(&ev_root), NVF_OK, 1,
+                       "Deiniting an event root");
+        }
+
+        ev.scratch_len = 2;
+        log = (event_log){.scratch = scratch};
+        rd = nvf_parse_events(ev_test, ev_len, &ev, &log);
+        ASSERT_INT(rd.err, NVF_BUF_OVF, 1, "Parsing events without scratch");
+
+        const char *bad_events[] = {"a [{}]", "}", "a 1 }", "a q"};
+        const nvf_err bad_errs[] = {NVF_ERROR, NVF_UNMATCHED_BRACE,
+                                    NVF_UNMATCHED_BRACE, NVF_BAD_VALUE_TYPE};
+        for (uintptr_t i = 0; i < sizeof(bad_errs) / sizeof(*bad_errs); ++i) {
+            log = (event_log){.scratch = scratch};
+            rd = nvf_parse_events(bad_events[i], strlen(bad_events[i]), &ev,
+                                  &log);
+            ASSERT_INT(rd.err, bad_errs[i], 1, "Parsing bad events");
+        }
+        // Events without callbacks are skipped.
+        nvf_events no_ev = {.scratch = scratch, .scratch_len = sizeof(scratch)};
+        rd = nvf_parse_events(int_test, test_len, &no_ev, NULL);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Parsing without callbacks");
+        rd = nvf_parse_events(NULL, 0, &no_ev, NULL);
+        ASSERT_INT(rd.err, NVF_BAD_ARG, 1, "Parsing events without data");
+    }
+
+    {
+        const char cur_test[] = "i -5 f 0.5 s \"str\"\n"
+                                "b bx0102\n"
+                                "m{ a[1 [2] \"x\" []] n{} }";
+        uintptr_t cur_len = strlen(cur_test);
+        char scratch[16] = {0};
+        nvf_events ev = {
+            .on_name = log_name,
+            .on_int = log_int,
+            .on_float = log_float,
+            .on_string = log_string,
+            .on_blob = log_blob,
+            .on_blob_ref = log_blob_ref,
+            .begin_map = log_begin_map,
+            .end_map = log_end_map,
+            .begin_array = log_begin_array,
+            .end_array = log_end_array,
+            .scratch = scratch,
+            .scratch_len = sizeof(scratch),
+        };
+        event_log ev_log = {.scratch = scratch};
+        nvf_err_data_i rd = nvf_parse_events(cur_test, cur_len, &ev, &ev_log);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Parsing events for cursors");
+
+        nvf_cursor c;
+        nvf_root cur_root = nvf_root_default_init();
+        rc = nvf_cursor_root(&cur_root, &c);
+        ASSERT_INT(rc, NVF_NOT_FOUND, 1, "Getting an empty root's cursor");
+        ASSERT_INT(nvf_cursor_value(&c).type, NVF_NONE, 1,
+                   "Getting an empty cursor's value");
+        rd = nvf_parse_buf(cur_test, cur_len, &cur_root);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Parsing a root for cursors");
+
+        // Walking the root gives the same entries as parsing events.
+        event_log cur_log = {0};
+        rc = log_cursor(&cur_log, &c, nvf_cursor_root(&cur_root, &c));
+        ASSERT_INT(rc, NVF_OK, 1, "Walking a root with cursors");
+        ASSERT_INT(strcmp(cur_log.buf, ev_log.buf), 0, 1,
+                   "Comparing cursors with events");
+        ASSERT_INT(nvf_cursor_next(&c), NVF_NOT_FOUND, 1,
+                   "Moving a cursor past the end");
+        ASSERT_INT(nvf_cursor_name(&c, NULL) == NULL, 1, 1,
+                   "Getting a name past the end");
+
+        nvf_cursor m_c, a_c;
+        rc = nvf_cursor_root(&cur_root, &c);
+        ASSERT_INT(rc, NVF_OK, 1, "Getting a root cursor");
+        ASSERT_INT(nvf_cursor_child(&c, &m_c), NVF_BAD_VALUE_TYPE, 1,
+                   "Getting an int's child");
+        ASSERT_INT(nvf_cursor_find(&c, "m"), NVF_OK, 1, "Finding a map");
+        ASSERT_INT(nvf_cursor_find(&c, "q"), NVF_NOT_FOUND, 1,
+                   "Finding a missing name");
+        ASSERT_INT(nvf_cursor_child(&c, &m_c), NVF_OK, 1, "Entering a map");
+        ASSERT_INT(nvf_cursor_find(&m_c, "n"), NVF_OK, 1,
+                   "Finding a nested map");
+        ASSERT_INT(nvf_cursor_child(&m_c, &a_c), NVF_NOT_FOUND, 1,
+                   "Entering an empty map");
+        ASSERT_INT(nvf_cursor_find(&m_c, "a"), NVF_OK, 1, "Finding an array");
+        ASSERT_INT(nvf_cursor_child(&m_c, &a_c), NVF_OK, 1,
+                   "Entering an array");
+        ASSERT_INT(nvf_cursor_name(&a_c, NULL) == NULL, 1, 1,
+                   "Getting an array item's name");
+        ASSERT_INT(nvf_cursor_find(&a_c, "a"), NVF_BAD_VALUE_TYPE, 1,
+                   "Finding a name in an array");
+        ASSERT_INT(nvf_cursor_value(&a_c).val.v_int, 1, 1,
+                   "Getting an array item");
+
+        // Frozen roots are walked the same way.
+        rc = nvf_root_freeze(&cur_root);
+        ASSERT_INT(rc, NVF_OK, 1, "Freezing a root for cursors");
+        cur_log = (event_log){0};
+        rc = log_cursor(&cur_log, &c, nvf_cursor_root(&cur_root, &c));
+        ASSERT_INT(rc, NVF_OK, 1, "Walking a frozen root with cursors");
+        ASSERT_INT(strcmp(cur_log.buf, ev_log.buf), 0, 1,
+                   "Comparing frozen cursors with events");
+        ASSERT_INT(nvf_deinit(&cur_root), NVF_OK, 1, "Deiniting a cursor root");
+    }
+
+    {
+        const char b64_test[] = "p b64AQIDBAUGBwgJ\n"
+                                "q b64AQI=\n"
+                                "r b64AQI\n"
+                                "s b64AQ==\n";
+        uintptr_t b64_len = strlen(b64_test);
+        const uint8_t b64_exp[] = {1, 2, 3, 4, 5, 6, 7, 8, 9};
+        const uintptr_t b64_lens[] = {9, 2, 2, 1};
+        nvf_root b_root = nvf_root_default_init();
+        nvf_err_data_i rd = nvf_parse_buf_presize(b64_test, b64_len, &b_root);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Parsing base64 BLOBs");
+        for (uintptr_t b_i = 0; b_i < 4; ++b_i) {
+            char b_name[2] = {'p' + b_i, '\0'};
+            const char *b_names[] = {b_name};
+            const uint8_t *view = NULL;
+            uintptr_t view_len = 0;
+            rc = nvf_get_blob_view(&b_root, b_names, 1, &view, &view_len);
+            ASSERT_INT(rc, NVF_OK, 1, "Getting a base64 BLOB");
+            ASSERT_INT(view_len, b64_lens[b_i], 1, "Checking a base64 length");
+            ASSERT_INT(memcmp(view, b64_exp, view_len), 0, 1,
+                       "Checking a base64 BLOB");
+        }
+        ASSERT_INT(nvf_deinit(&b_root), NVF_OK, 1, "Deiniting a base64 root");
+
+        const char *bad_b64[] = {"a b64", "a b64A", "a b64AQ=", "a b64AQI=="};
+        for (uintptr_t b_i = 0; b_i < 4; ++b_i) {
+            b_root = nvf_root_default_init();
+            rd = nvf_parse_buf(bad_b64[b_i], strlen(bad_b64[b_i]), &b_root);
+            nvf_deinit(&b_root);
+            ASSERT_INT(rd.err != NVF_OK, 1, 1, "Parsing a bad base64 BLOB");
+        }
+
+        // Round trip BLOBs long enough for the vectorized code and with every
+        // kind of tail.
+        char hex_text[2200];
+        uint8_t bin[1000];
+        for (uintptr_t b_i = 0; b_i < sizeof(bin); ++b_i) {
+            bin[b_i] = b_i * 167 + 13;
+        }
+        const uintptr_t trip_lens[] = {1, 2, 3, 11, 12, 15, 16, 17, 47, 48, 49,
+                                       1000};
+        for (uintptr_t t_i = 0; t_i < sizeof(trip_lens) / sizeof(*trip_lens);
+             ++t_i) {
+            uintptr_t n = trip_lens[t_i];
+            uintptr_t h_len = sprintf(hex_text, "b bx");
+            for (uintptr_t b_i = 0; b_i < n; ++b_i) {
+                h_len += sprintf(hex_text + h_len, "%02x", bin[b_i]);
+            }
+            b_root = nvf_root_default_init();
+            rd = nvf_parse_buf(hex_text, h_len, &b_root);
+            ASSERT_INT(rd.err, NVF_OK, 1, "Parsing a hex BLOB");
+            char *b64_out = NULL;
+            uintptr_t b64_out_len = 0;
+            rc = nvf_root_to_str_flags(&b_root, &b64_out, &b64_out_len,
+                                       snprintf, NVF_STR_BLOB_B64);
+            ASSERT_INT(rc, NVF_OK, 1, "Rendering a base64 BLOB");
+            ASSERT_INT(strncmp(b64_out, "b b64", 5), 0, 1,
+                       "Checking a rendered base64 BLOB");
+            ASSERT_INT(strlen(b64_out), 5 + (n + 2) / 3 * 4 + 1, 1,
+                       "Checking a rendered base64 length");
+            nvf_root b64_root = nvf_root_default_init();
+            rd = nvf_parse_buf(b64_out, strlen(b64_out), &b64_root);
+            ASSERT_INT(rd.err, NVF_OK, 1, "Parsing a rendered base64 BLOB");
+            const char *b_names[] = {"b"};
+            const uint8_t *view = NULL;
+            uintptr_t view_len = 0;
+            rc = nvf_get_blob_view(&b64_root, b_names, 1, &view, &view_len);
+            ASSERT_INT(rc, NVF_OK, 1, "Getting a round trip BLOB");
+            ASSERT_INT(view_len, n, 1, "Checking a round trip length");
+            ASSERT_INT(memcmp(view, bin, n), 0, 1, "Checking a round trip");
+            b_root.free_inst(b64_out);
+            nvf_deinit(&b64_root);
+            ASSERT_INT(nvf_deinit(&b_root), NVF_OK, 1, "Deiniting a hex root");
+        }
+
+        // Events and extraction decode base64 too.
+        char scratch[16] = {0};
+        nvf_events ev = {
+            .on_blob = log_blob,
+            .scratch = scratch,
+            .scratch_len = sizeof(scratch),
+        };
+        event_log log = {.scratch = scratch};
+        rd = nvf_parse_events(b64_test, b64_len, &ev, &log);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Parsing base64 events");
+        ASSERT_INT(strcmp(log.buf, "bx010203040506070809 bx0102 bx0102 bx01 "),
+                   0, 1, "Checking base64 events");
+        uint8_t ex_b[12] = {0};
+        const char *q_path[] = {"q"};
+        const nvf_bind_field q_field = {q_path, 1, NVF_BLOB, 0, sizeof(ex_b)};
+        nvf_err q_err = NVF_OK;
+        rd = nvf_extract(b64_test, b64_len, &q_field, 1, ex_b, &q_err);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Extracting a base64 BLOB");
+        ASSERT_INT(memcmp(ex_b, b64_exp, 2), 0, 1,
+                   "Checking an extracted base64 BLOB");
+    }
+
+    {
+        // Compact output doesn't depend on the order values were added in or
+        // how they were written.
+        const char *compact_in[] = {"z 1\n"
+                                    "f 2.0\n"
+                                    "g 0.1\n"
+                                    "h 1e300\n"
+                                    "m {\n"
+                                    "\tb [0x10 2 \"x\" bx01 [3]]\n"
+                                    "\ta \"s\\\"q\"\n"
+                                    "\te {}\n"
+                                    "}\n"
+                                    "r bf\"p\":0:4\n"
+                                    "b bx010203\n",
+                                    "b bx010203 r bf\"p\":0x0:4 h 1.0e300 "
+                                    "m{e{} a \"s\\\"\" \"q\" "
+                                    "b[16 2 \"x\" bx01 [3]]} "
+                                    "g 0.10 f 2. z 1"};
+        const char compact_exp[] =
+            "b bx010203 f 2.0 g 0.1 h 1e+300 m{a \"s\\\"q\" "
+            "b[16 2 \"x\" bx01 [3]] e{}} r bf\"p\":0:4 z 1";
+        for (uint32_t c_i = 0; c_i < 2; ++c_i) {
+            nvf_root c_root = nvf_root_default_init();
+            rd = nvf_parse_buf(compact_in[c_i], strlen(compact_in[c_i]),
+                               &c_root);
+            ASSERT_INT(rd.err, NVF_OK, 1, "Parsing data to compact");
+            char *c_out = NULL;
+            uintptr_t c_out_len = 0;
+            rc = nvf_root_to_str_flags(&c_root, &c_out, &c_out_len, snprintf,
+                                       NVF_STR_COMPACT);
+            ASSERT_INT(rc, NVF_OK, 1, "Writing compact output");
+            ASSERT_INT(strcmp(c_out, compact_exp), 0, 1,
+                       "Checking compact output");
+            ASSERT_INT(c_out_len, sizeof(compact_exp), 1,
+                       "Checking compact output's length");
+            ASSERT_INT(nvf_deinit(&c_root), NVF_OK, 1, "Deiniting a root");
+
+            // Compact output parses back to the same output.
+            c_root = nvf_root_default_init();
+            rd = nvf_parse_buf(c_out, c_out_len - 1, &c_root);
+            ASSERT_INT(rd.err, NVF_OK, 1, "Parsing compact output");
+            char *c_out2 = NULL;
+            rc = nvf_root_to_str_flags(&c_root, &c_out2, &c_out_len, snprintf,
+                                       NVF_STR_COMPACT);
+            ASSERT_INT(rc, NVF_OK, 1, "Writing compact output again");
+            ASSERT_INT(strcmp(c_out2, compact_exp), 0, 1,
+                       "Checking compact output's round trip");
+            c_root.free_inst(c_out);
+            c_root.free_inst(c_out2);
+            ASSERT_INT(nvf_deinit(&c_root), NVF_OK, 1, "Deiniting a root");
+        }
+    }
+
+    {
+        // Parsing fingerprints the data, so reloading it can be skipped.
+        const char fp_a[] = "v 1\nm {s \"str\"}\n";
+        const char fp_b[] = "v 2\nm {s \"str\"}\n";
+        const char *v_name[] = {"v"};
+        nvf_root fp_root = nvf_root_default_init();
+        ASSERT_INT(fp_root.fingerprint, 0, 1, "Checking a new fingerprint");
+        uint8_t parsed = 0;
+        rd = nvf_parse_buf_if_changed(fp_a, strlen(fp_a), &fp_root, &parsed);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Parsing new data");
+        ASSERT_INT(parsed, 1, 1, "Checking new data was parsed");
+        uint64_t fp = nvf_fingerprint(fp_a, strlen(fp_a));
+        ASSERT_INT(fp != 0 && fp_root.fingerprint == fp, 1, 1,
+                   "Checking a parsed root's fingerprint");
+
+        uint64_t calls = fp_root.alloc_calls;
+        rd = nvf_parse_buf_if_changed(fp_a, strlen(fp_a), &fp_root, &parsed);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Parsing unchanged data");
+        ASSERT_INT(parsed, 0, 1, "Checking unchanged data wasn't parsed");
+        ASSERT_INT(fp_root.alloc_calls == calls, 1, 1,
+                   "Checking skipping a parse doesn't allocate");
+
+        rd = nvf_parse_buf_if_changed(fp_b, strlen(fp_b), &fp_root, &parsed);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Parsing changed data");
+        ASSERT_INT(parsed, 1, 1, "Checking changed data was parsed");
+        ASSERT_INT(nvf_get_int(&fp_root, v_name, 1, &bin_int), NVF_OK, 1,
+                   "Getting a reparsed int");
+        ASSERT_INT(bin_int, 2, 1, "Checking a reparsed int");
+        ASSERT_INT(fp_root.fingerprint == nvf_fingerprint(fp_b, strlen(fp_b)),
+                   1, 1, "Checking a reparsed root's fingerprint");
+
+        // Clones and frozen roots keep the fingerprint. Frozen roots can't be
+        // reparsed, but unchanged data is still fine.
+        nvf_root fp_clone = nvf_root_default_init();
+        rc = nvf_root_clone(&fp_clone, &fp_root, NVF_CLONE_COPY);
+        ASSERT_INT(rc, NVF_OK, 1, "Cloning a fingerprinted root");
+        ASSERT_INT(fp_clone.fingerprint == fp_root.fingerprint, 1, 1,
+                   "Checking a clone's fingerprint");
+        ASSERT_INT(nvf_root_freeze(&fp_clone), NVF_OK, 1, "Freezing a clone");
+        rd = nvf_parse_buf_if_changed(fp_b, strlen(fp_b), &fp_clone, &parsed);
+        ASSERT_INT(rd.err, NVF_OK, 1,
+                   "Parsing unchanged data into a frozen root");
+        rd = nvf_parse_buf_if_changed(fp_a, strlen(fp_a), &fp_clone, &parsed);
+        ASSERT_INT(rd.err, NVF_READ_ONLY, 1,
+                   "Parsing changed data into a frozen root");
+        ASSERT_INT(nvf_deinit(&fp_clone), NVF_OK, 1, "Deiniting a clone");
+
+        // A failed parse or a reset leaves no fingerprint.
+        rd = nvf_parse_buf("x", 1, &fp_root);
+        ASSERT_INT(rd.err != NVF_OK, 1, 1, "Parsing bad data");
+        ASSERT_INT(fp_root.fingerprint, 0, 1, "Checking a failed fingerprint");
+        rd = nvf_parse_buf_if_changed(fp_a, strlen(fp_a), &fp_root, NULL);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Parsing after a failed parse");
+        ASSERT_INT(nvf_root_reset(&fp_root), NVF_OK, 1, "Resetting a root");
+        ASSERT_INT(fp_root.fingerprint, 0, 1, "Checking a reset fingerprint");
+        ASSERT_INT(nvf_deinit(&fp_root), NVF_OK, 1, "Deiniting a root");
+
+        // Every prefix and every one byte change hashes differently.
+        char fp_data[96];
+        uint64_t fps[2 * sizeof(fp_data) + 1];
+        uint32_t fp_num = 0;
+        for (uint32_t f_i = 0; f_i < sizeof(fp_data); ++f_i) {
+            fp_data[f_i] = (char)(f_i * 7);
+        }
+        for (uint32_t f_i = 0; f_i <= sizeof(fp_data); ++f_i) {
+            fps[fp_num++] = nvf_fingerprint(fp_data, f_i);
+        }
+        for (uint32_t f_i = 0; f_i < sizeof(fp_data); ++f_i) {
+            fp_data[f_i] ^= 1;
+            fps[fp_num++] = nvf_fingerprint(fp_data, sizeof(fp_data));
+            fp_data[f_i] ^= 1;
+        }
+        for (uint32_t f_i = 0; f_i < fp_num; ++f_i) {
+            for (uint32_t f_j = f_i + 1; f_j < fp_num; ++f_j) {
+                ASSERT_INT(fps[f_i] != fps[f_j], 1, 1,
+                           "Checking fingerprints differ");
+            }
+        }
+    }
+
+    {
+        // Parsing a file with a cache directory keeps a snapshot there that
+        // later parses load.
+        const char src_path[] = "nvf_test_cache.nvf";
+        const char cache_dir[] = "nvf_test_cache";
+        const char src[] = "a 1 b 2 c 3 d 4 e 5 f 6 g 7 h 8 i 9 j 10\n"
+                           "s \"string\" x bx0102 k 0.5\n"
+                           "m {n {v 11} arr [1 [2 \"x\"] bx03]}\n"
+                           "r bf\"nvf_test_cache.nvf\":2:3\n";
+        FILE *src_f = fopen(src_path, "wb");
+        ASSERT_INT(src_f != NULL, 1, 1, "Opening the cached file");
+        fwrite(src, 1, strlen(src), src_f);
+        fclose(src_f);
+        mkdir(cache_dir, 0755);
+
+        // Without a cache directory the file is just parsed.
+        nvf_root f_root = nvf_root_default_init();
+        uint8_t from_cache = 1;
+        rd = nvf_parse_file(src_path, NULL, &f_root, &from_cache);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Parsing a file");
+        ASSERT_INT(from_cache, 0, 1, "Checking a file wasn't cached");
+        ASSERT_INT(f_root.frozen, 0, 1, "Checking a parsed file isn't frozen");
+        char *f_exp = NULL;
+        uintptr_t f_len = 0;
+        rc = nvf_default_root_to_str(&f_root, &f_exp, &f_len);
+        ASSERT_INT(rc, NVF_OK, 1, "Writing a parsed file");
+        rd = nvf_parse_file(src_path, cache_dir, &f_root, NULL);
+        ASSERT_INT(rd.err, NVF_BAD_ARG, 1, "Loading a cache into a full root");
+        ASSERT_INT(nvf_deinit(&f_root), NVF_OK, 1, "Deiniting a root");
+
+        const char *n_names[] = {"m", "n", "v"};
+        const char *r_names[] = {"r"};
+        const char *j_names[] = {"j"};
+        for (int f_i = 0; f_i < 2; ++f_i) {
+            f_root = nvf_root_default_init();
+            rd = nvf_parse_file(src_path, cache_dir, &f_root, &from_cache);
+            ASSERT_INT(rd.err, NVF_OK, 1, "Parsing a cached file");
+            ASSERT_INT(from_cache, f_i, 1, "Checking where a file came from");
+            ASSERT_INT(rd.data_i, strlen(src), 1, "Checking the parsed length");
+            ASSERT_INT(f_root.frozen, 1, 1, "Checking a cached root is frozen");
+            ASSERT_INT(f_root.fingerprint == nvf_fingerprint(src, strlen(src)),
+                       1, 1, "Checking a cached root's fingerprint");
+            char *f_out = NULL;
+            rc = nvf_default_root_to_str(&f_root, &f_out, &f_len);
+            ASSERT_INT(rc, NVF_OK, 1, "Writing a cached file");
+            ASSERT_INT(strcmp(f_out, f_exp), 0, 1, "Checking a cached file");
+            f_root.free_inst(f_out);
+            ASSERT_INT(nvf_get_int(&f_root, n_names, 3, &bin_int), NVF_OK, 1,
+                       "Getting a nested cached int");
+            ASSERT_INT(bin_int, 11, 1, "Checking a nested cached int");
+            ASSERT_INT(nvf_get_int(&f_root, j_names, 1, &bin_int), NVF_OK, 1,
+                       "Getting a hashed cached int");
+            ASSERT_INT(bin_int, 10, 1, "Checking a hashed cached int");
+            uint8_t ref_out[4] = {0};
+            uintptr_t ref_len = sizeof(ref_out);
+            rc = nvf_get_blob(&f_root, r_names, 1, ref_out, &ref_len);
+            ASSERT_INT(rc, NVF_OK, 1, "Getting a cached BLOB reference");
+            ASSERT_INT(ref_len == 3 && memcmp(ref_out, src + 2, 3) == 0, 1, 1,
+                       "Checking a cached BLOB reference");
+            ASSERT_INT(nvf_deinit(&f_root), NVF_OK, 1, "Deiniting a root");
+        }
+
+        // Find the snapshot, the only file in the cache directory.
+        char snap_path[sizeof(cache_dir) + 256] = {0};
+        DIR *dir = opendir(cache_dir);
+        ASSERT_INT(dir != NULL, 1, 1, "Opening the cache directory");
+        for (struct dirent *de = readdir(dir); de != NULL; de = readdir(dir)) {
+            if (de->d_name[0] != '.') {
+                snprintf(snap_path, sizeof(snap_path), "%s/%s", cache_dir,
+                         de->d_name);
+            }
+        }
+        closedir(dir);
+        ASSERT_INT(snap_path[0] != '\0', 1, 1, "Finding the snapshot");
+
+        // Corrupt and cut short snapshots are parsed again and replaced.
+        struct stat snap_st;
+        ASSERT_INT(stat(snap_path, &snap_st), 0, 1, "Checking the snapshot");
+        for (int f_i = 0; f_i < 3; ++f_i) {
+            if (f_i == 0) {
+                FILE *snap_f = fopen(snap_path, "r+b");
+                fseek(snap_f, snap_st.st_size - 8, SEEK_SET);
+                fputc(0x55, snap_f);
+                fclose(snap_f);
+            } else if (f_i == 1) {
+                ASSERT_INT(truncate(snap_path, snap_st.st_size / 2), 0, 1,
+                           "Cutting the snapshot short");
+            }
+            f_root = nvf_root_default_init();
+            rd = nvf_parse_file(src_path, cache_dir, &f_root, &from_cache);
+            ASSERT_INT(rd.err, NVF_OK, 1, "Parsing a cached file again");
+            ASSERT_INT(from_cache, f_i == 2, 1,
+                       "Checking a bad snapshot isn't used");
+            ASSERT_INT(nvf_get_int(&f_root, n_names, 3, &bin_int), NVF_OK, 1,
+                       "Getting a nested int after a bad snapshot");
+            ASSERT_INT(bin_int, 11, 1, "Checking an int after a bad snapshot");
+            ASSERT_INT(nvf_deinit(&f_root), NVF_OK, 1, "Deiniting a root");
+        }
+
+        // A changed file is parsed again, even with the same size and time.
+        src_f = fopen(src_path, "r+b");
+        fputs("a 9", src_f);
+        fclose(src_f);
+        f_root = nvf_root_default_init();
+        rd = nvf_parse_file(src_path, cache_dir, &f_root, &from_cache);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Parsing a changed file");
+        ASSERT_INT(from_cache, 0, 1, "Checking a changed file was parsed");
+        const char *a_names[] = {"a"};
+        ASSERT_INT(nvf_get_int(&f_root, a_names, 1, &bin_int), NVF_OK, 1,
+                   "Getting a changed int");
+        ASSERT_INT(bin_int, 9, 1, "Checking a changed int");
+        ASSERT_INT(nvf_deinit(&f_root), NVF_OK, 1, "Deiniting a root");
+
+        // A missing cache directory only means there's no snapshot.
+        f_root = nvf_root_default_init();
+        rd = nvf_parse_file(src_path, "nvf_test_no_dir", &f_root, &from_cache);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Parsing without a cache directory");
+        ASSERT_INT(from_cache, 0, 1, "Checking there was no snapshot");
+        ASSERT_INT(nvf_deinit(&f_root), NVF_OK, 1, "Deiniting a root");
+        f_root = nvf_root_default_init();
+        rd = nvf_parse_file("nvf_test_no_file", cache_dir, &f_root, NULL);
+        ASSERT_INT(rd.err, NVF_IO_ERR, 1, "Parsing a missing file");
+        ASSERT_INT(nvf_deinit(&f_root), NVF_OK, 1, "Deiniting a root");
+
+        free(f_exp);
+        remove(snap_path);
+        rmdir(cache_dir);
+        remove(src_path);
+    }
+
+    {
+        // Relative BLOB reference paths are resolved against the directory
+        // of the file they're in, not the working directory.
+        const char dir[] = "nvf_test_ref_dir";
+        const char bin_path[] = "nvf_test_ref_dir/ref.bin";
+        const char cfg_path[] = "nvf_test_ref_dir/ref.nvf";
+        const char cache_dir[] = "nvf_test_ref_dir/cache";
+        ASSERT_INT(mkdir(dir, 0755) == 0 && mkdir(cache_dir, 0755) == 0, 1, 1,
+                   "Making the BLOB reference directories");
+        uint8_t ref_file[] = {9, 8, 7, 6};
+        FILE *ref_f = fopen(bin_path, "wb");
+        ASSERT_INT(ref_f != NULL, 1, 1, "Opening the BLOB reference file");
+        fwrite(ref_file, 1, sizeof(ref_file), ref_f);
+        fclose(ref_f);
+        const char ref_cfg[] = "r bf\"ref.bin\":1:2\n";
+        ref_f = fopen(cfg_path, "wb");
+        ASSERT_INT(ref_f != NULL, 1, 1, "Opening the BLOB reference config");
+        fwrite(ref_cfg, 1, strlen(ref_cfg), ref_f);
+        fclose(ref_f);
+
+        const char *r_names[] = {"r"};
+        for (int c_i = 0; c_i < 3; ++c_i) {
+            nvf_root d_root = nvf_root_default_init();
+            uint8_t from_cache = 0;
+            rd = nvf_parse_file(cfg_path, c_i == 0 ? NULL : cache_dir, &d_root,
+                                &from_cache);
+            ASSERT_INT(rd.err, NVF_OK, 1, "Parsing a file with a reference");
+            ASSERT_INT(from_cache, c_i == 2, 1,
+                       "Checking a reference's snapshot is used");
+            ASSERT_INT(d_root.ref_dir == NULL, 1, 1,
+                       "Checking the reference directory is put back");
+            uint8_t bin_out[4] = {0};
+            uintptr_t bin_out_len = sizeof(bin_out);
+            rc = nvf_get_blob(&d_root, r_names, 1, bin_out, &bin_out_len);
+            ASSERT_INT(rc, NVF_OK, 1, "Getting a BLOB next to its file");
+            ASSERT_INT(bin_out_len, 2, 1, "Checking a BLOB next to its file");
+            ASSERT_INT(memcmp(bin_out, ref_file + 1, 2), 0, 1,
+                       "Checking a BLOB next to its file");
+            ASSERT_INT(nvf_deinit(&d_root), NVF_OK, 1, "Deiniting a root");
+        }
+
+        // A reference to a missing file only fails when it's read, with or
+        // without a snapshot.
+        const char miss_path[] = "nvf_test_ref_dir/missing.nvf";
+        const char miss_cfg[] = "a 1 r bf\"missing.bin\":0:4\n";
+        ref_f = fopen(miss_path, "wb");
+        ASSERT_INT(ref_f != NULL, 1, 1, "Opening a missing reference config");
+        fwrite(miss_cfg, 1, strlen(miss_cfg), ref_f);
+        fclose(ref_f);
+        for (int c_i = 0; c_i < 3; ++c_i) {
+            nvf_root d_root = nvf_root_default_init();
+            uint8_t from_cache = 0;
+            rd = nvf_parse_file(miss_path, c_i == 0 ? NULL : cache_dir,
+                                &d_root, &from_cache);
+            ASSERT_INT(rd.err, NVF_OK, 1, "Parsing a missing reference");
+            ASSERT_INT(from_cache, c_i == 2, 1,
+                       "Checking a missing reference's snapshot is used");
+            uint8_t bin_out[4] = {0};
+            uintptr_t bin_out_len = sizeof(bin_out);
+            rc = nvf_get_blob(&d_root, r_names, 1, bin_out, &bin_out_len);
+            ASSERT_INT(rc, NVF_IO_ERR, 1, "Getting a missing reference");
+            ASSERT_INT(nvf_deinit(&d_root), NVF_OK, 1, "Deiniting a root");
+        }
+
+        // The directory can be given for parsing a buffer too. The resolved
+        // path is what's stored.
+        nvf_root d_root = nvf_root_default_init();
+        d_root.ref_dir = dir;
+        rd = nvf_parse_buf(ref_cfg, strlen(ref_cfg), &d_root);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Parsing a reference with a directory");
+        nvf_blob_ref *ref = d_root.maps[0].arr.values[0].v_blob_ref;
+        ASSERT_INT(strcmp(ref->path, bin_path), 0, 1,
+                   "Checking a resolved reference path");
+        ASSERT_INT(ref->path_len, strlen(bin_path), 1,
+                   "Checking a resolved reference path length");
+        ASSERT_INT(nvf_deinit(&d_root), NVF_OK, 1, "Deiniting a root");
+
+        // Confined roots only take paths that stay under the directory,
+        // whichever way they're parsed.
+        const char *conf_cfgs[] = {
+            "r bf\"/etc/passwd\":0:4", "r bf\"../ref.bin\":0:4",
+            "r bf\"a/../../ref.bin\":0:4", "r bf\"..\":0:4",
+            "r bf\"a/..b/ref.bin\":0:4", "r bf\"ref.bin\":0:4"};
+        for (int c_i = 0; c_i < 6; ++c_i) {
+            nvf_err conf_err = c_i < 4 ? NVF_BAD_DATA : NVF_OK;
+            for (int p_i = 0; p_i < 2; ++p_i) {
+                d_root = nvf_root_default_init();
+                d_root.ref_dir = dir;
+                d_root.ref_confined = 1;
+                rd = p_i == 0 ? nvf_parse_buf(conf_cfgs[c_i],
+                                              strlen(conf_cfgs[c_i]), &d_root)
+                              : nvf_parse_buf_presize(
+                                    conf_cfgs[c_i], strlen(conf_cfgs[c_i]),
+                                    &d_root);
+                ASSERT_INT(rd.err, conf_err, 1,
+                           "Parsing a reference into a confined root");
+                // The path starts after r bf".
+                uintptr_t conf_i =
+                    conf_err == NVF_OK ? strlen(conf_cfgs[c_i]) : 5;
+                ASSERT_INT(rd.data_i, conf_i, 1,
+                           "Checking where a confined reference failed");
+                nvf_deinit(&d_root);
+            }
+        }
+        // A snapshot written without the check isn't loaded into a
+        // confined root.
+        d_root = nvf_root_default_init();
+        d_root.ref_confined = 1;
+        uint8_t conf_cached = 1;
+        rd = nvf_parse_file(cfg_path, cache_dir, &d_root, &conf_cached);
+        ASSERT_INT(rd.err == NVF_OK && conf_cached == 0, 1, 1,
+                   "Parsing a file into a confined root");
+        ASSERT_INT(nvf_deinit(&d_root), NVF_OK, 1, "Deiniting a root");
+
+        DIR *c_dir = opendir(cache_dir);
+        ASSERT_INT(c_dir != NULL, 1, 1, "Opening the snapshot directory");
+        char snap_path[512];
+        for (struct dirent *ent = readdir(c_dir); ent != NULL;
+             ent = readdir(c_dir)) {
+            if (ent->d_name[0] != '.') {
+                snprintf(snap_path, sizeof(snap_path), "%s/%s", cache_dir,
+                         ent->d_name);
+                remove(snap_path);
+            }
+        }
+        closedir(c_dir);
+        rmdir(cache_dir);
+        remove(miss_path);
+        remove(cfg_path);
+        remove(bin_path);
+        rmdir(dir);
+    }
+
+    {
+        // Writing with threads gives the same output as one thread. Make a
+        // root big enough to be split, with maps and arrays too big for one
+        // piece.
+        uintptr_t t_cap = 1 << 20, t_len = 0;
+        char *t_data = malloc(t_cap);
+        ASSERT_INT(t_data != NULL, 1, 1, "Allocating threaded test data");
+        t_len += snprintf(t_data + t_len, t_cap - t_len, "e {} ea []\n");
+        for (int t_i = 0; t_i < 500; ++t_i) {
+            t_len += snprintf(t_data + t_len, t_cap - t_len, "k%d %d\n",
+                              t_i * 7919 % 500, t_i);
+        }
+        t_len += snprintf(t_data + t_len, t_cap - t_len, "big [");
+        for (int t_i = 0; t_i < 3000; ++t_i) {
+            t_len += snprintf(t_data + t_len, t_cap - t_len,
+                              "%d \"s%d\" [%d 0.5] bx0a0b ", t_i, t_i, t_i);
+        }
+        t_len += snprintf(t_data + t_len, t_cap - t_len, "]\nm { n {");
+        for (int t_i = 0; t_i < 2000; ++t_i) {
+            t_len += snprintf(t_data + t_len, t_cap - t_len,
+                              "x%d \"str\\t%d\" y%d [] ", 1999 - t_i, t_i, t_i);
+        }
+        t_len += snprintf(t_data + t_len, t_cap - t_len,
+                          "} f 1.25 a [[1 [2]] []] }\nz \"last\"\n");
+        nvf_root t_root = nvf_root_default_init();
+        rd = nvf_parse_buf(t_data, t_len, &t_root);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Parsing threaded test data");
+        free(t_data);
+
+        uint32_t t_flags[] = {NVF_STR_DEFAULT, NVF_STR_COMPACT,
+                              NVF_STR_BLOB_B64 | NVF_STR_COMPACT};
+        uint32_t t_nums[] = {0, 1, 2, 3, 8, 33, UINT32_MAX};
+        for (int freeze = 0; freeze < 2; ++freeze) {
+            for (uintptr_t f_i = 0; f_i < sizeof(t_flags) / sizeof(*t_flags);
+                 ++f_i) {
+                char *exp = NULL;
+                uintptr_t exp_len = 0;
+                rc = nvf_root_to_str_flags(&t_root, &exp, &exp_len, snprintf,
+                                           t_flags[f_i]);
+                ASSERT_INT(rc, NVF_OK, 1, "Writing on one thread");
+#ifdef NVF_INSTRUMENT
+                nvf_parse_stats exp_ps = {0};
+                nvf_parse_stats_get(&exp_ps);
+#endif
+                for (uintptr_t n_i = 0; n_i < sizeof(t_nums) / sizeof(*t_nums);
+                     ++n_i) {
+                    char *t_out = NULL;
+                    uintptr_t t_out_len = 0;
+                    rc = nvf_root_to_str_threads(&t_root, &t_out, &t_out_len,
+                                                 snprintf, t_flags[f_i],
+                                                 t_nums[n_i]);
+                    ASSERT_INT(rc, NVF_OK, 1, "Writing with threads");
+                    ASSERT_INT(t_out_len, exp_len, 1,
+                               "Checking the threaded output length");
+                    ASSERT_INT(strcmp(t_out, exp), 0, 1,
+                               "Checking the threaded output");
+#ifdef NVF_INSTRUMENT
+                    // Every thread's values are counted.
+                    nvf_parse_stats t_ps = {0};
+                    nvf_parse_stats_get(&t_ps);
+                    for (int t_i = 0; t_i < NVF_TYPE_END; ++t_i) {
+                        ASSERT_INT(t_ps.values[t_i], exp_ps.values[t_i], 1,
+                                   "Counting values written by threads");
+                        ASSERT_INT(t_ps.value_bytes[t_i],
+                                   exp_ps.value_bytes[t_i], 1,
+                                   "Counting bytes written by threads");
+                    }
+#endif
+                    t_root.free_inst(t_out);
+                }
+                t_root.free_inst(exp);
+            }
+            ASSERT_INT(nvf_root_freeze(&t_root), NVF_OK, 1,
+                       "Freezing threaded test data");
+        }
+        ASSERT_INT(nvf_deinit(&t_root), NVF_OK, 1, "Deiniting a root");
+
+        // Small roots are written on one thread.
+        t_root = nvf_root_default_init();
+        rd = nvf_parse_buf("a 1 b [2]", 9, &t_root);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Parsing a small root");
+        char *t_out = NULL;
+        uintptr_t t_out_len = 0;
+        rc = nvf_root_to_str_threads(&t_root, &t_out, &t_out_len, snprintf,
+                                     NVF_STR_COMPACT, 4);
+        ASSERT_INT(rc, NVF_OK, 1, "Writing a small root with threads");
+        ASSERT_INT(strcmp(t_out, "a 1 b[2]"), 0, 1,
+                   "Checking a small root's threaded output");
+        t_root.free_inst(t_out);
+        ASSERT_INT(nvf_deinit(&t_root), NVF_OK, 1, "Deiniting a root");
+    }
+
+    {
+        // A root with its own allocator is told every block's size when the
+        // block is resized or freed, and frees everything it allocated.
+        static sized_alloc sa = {.lock = PTHREAD_MUTEX_INITIALIZER,
+                                 .fail_at = -1};
+        nvf_allocator a = {sized_alloc_fn, &sa};
+        nvf_root bad_root = nvf_root_alloc_init((nvf_allocator){NULL, &sa});
+        ASSERT_INT(nvf_deinit(&bad_root), NVF_NOT_INIT, 1,
+                   "Initializing a root without an allocator");
+        const char a_test[] = "a 1\n"
+                              "s \"str\"\n"
+                              "b bx0a0b0c\n"
+                              "m {\n"
+                              "\tf 0.5\n"
+                              "\tarr [1 \"two\" [3] bx01]\n"
+                              "}\n"
+                              "e []\n";
+        nvf_root a_root = nvf_root_alloc_init(a);
+        rd = nvf_parse_buf(a_test, strlen(a_test), &a_root);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Parsing with an allocator");
+        ASSERT_INT(a_root.alloc_calls > 0, 1, 1,
+                   "Counting allocator calls");
+
+        const char *s_names[] = {"s"};
+        char *a_str = NULL;
+        uintptr_t a_len = 0;
+        rc = nvf_get_str_alloc(&a_root, s_names, 1, &a_str, &a_len);
+        ASSERT_INT(rc, NVF_OK, 1, "Getting a str with an allocator");
+        ASSERT_INT(strcmp(a_str, "str"), 0, 1, "Checking an allocated str");
+        nvf_root_free(&a_root, a_str, a_len);
+        const char *b_names[] = {"b"};
+        uint8_t *a_blob = NULL;
+        rc = nvf_get_blob_alloc(&a_root, b_names, 1, &a_blob, &a_len);
+        ASSERT_INT(rc, NVF_OK, 1, "Getting a BLOB with an allocator");
+        ASSERT_INT(a_len, 3, 1, "Checking an allocated BLOB");
+        nvf_root_free(&a_root, a_blob, a_len);
+
+        char *a_out = NULL;
+        rc = nvf_root_to_str(&a_root, &a_out, &a_len, snprintf);
+        ASSERT_INT(rc, NVF_OK, 1, "Writing with an allocator");
+        ASSERT_INT(a_len, strlen(a_out) + 1, 1,
+                   "Checking the written length");
+        nvf_root_free(&a_root, a_out, a_len);
+        rc = nvf_root_to_str_threads(&a_root, &a_out, &a_len, snprintf,
+                                     NVF_STR_COMPACT, 2);
+        ASSERT_INT(rc, NVF_OK, 1, "Writing with threads and an allocator");
+        nvf_root_free(&a_root, a_out, a_len);
+        char *a_h = NULL;
+        uintptr_t a_h_len = 0;
+        rc = nvf_root_to_c(&a_root, "a_cfg", &a_out, &a_len, &a_h, &a_h_len);
+        ASSERT_INT(rc, NVF_OK, 1, "Writing C with an allocator");
+        nvf_root_free(&a_root, a_out, a_len);
+        nvf_root_free(&a_root, a_h, a_h_len);
+
+        // Clones, overlays and resets use the allocator too.
+        nvf_root a_copy = nvf_root_alloc_init(a);
+        rc = nvf_root_clone(&a_copy, &a_root, NVF_CLONE_COPY);
+        ASSERT_INT(rc, NVF_OK, 1, "Copying a root with an allocator");
+        ASSERT_INT(nvf_root_freeze(&a_copy), NVF_OK, 1,
+                   "Freezing a root with an allocator");
+        nvf_root a_share = nvf_root_alloc_init(a);
+        rc = nvf_root_clone(&a_share, &a_root, NVF_CLONE_SHARE);
+        ASSERT_INT(rc, NVF_OK, 1, "Sharing a root with an allocator");
+        nvf_root a_over = nvf_root_overlay_init(&a_copy);
+        rd = nvf_parse_buf("s \"top\" m {g 2}", 15, &a_over);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Parsing an overlay with an allocator");
+        nvf_root a_merged = nvf_root_alloc_init(a);
+        rc = nvf_root_materialize(&a_over, &a_merged);
+        ASSERT_INT(rc, NVF_OK, 1, "Materializing with an allocator");
+        ASSERT_INT(nvf_root_reset(&a_root), NVF_OK, 1,
+                   "Resetting a root with an allocator");
+        rd = nvf_parse_buf(a_test, strlen(a_test), &a_root);
+        ASSERT_INT(rd.err, NVF_OK, 1, "Parsing a reset root with an allocator");
+        ASSERT_INT(nvf_deinit(&a_merged), NVF_OK, 1, "Deiniting a root");
+        ASSERT_INT(nvf_deinit(&a_over), NVF_OK, 1, "Deiniting an overlay");
+        ASSERT_INT(nvf_deinit(&a_share), NVF_OK, 1, "Deiniting a root");
+        ASSERT_INT(nvf_deinit(&a_copy), NVF_OK, 1, "Deiniting a root");
+        ASSERT_INT(nvf_deinit(&a_root), NVF_OK, 1, "Deiniting a root");
+        ASSERT_INT(sa.bad, 0, 1, "Checking the allocator got the right sizes");
+        ASSERT_INT(sa.num, 0, 1, "Checking everything allocated was freed");
+
+        // A parse that runs out of memory at any point frees what it had.
+        for (sa.fail_at = 0;; ++sa.fail_at) {
+            sa.calls = 0;
+            a_root = nvf_root_alloc_init(a);
+            rd = nvf_parse_buf(a_test, strlen(a_test), &a_root);
+            ASSERT_INT(nvf_deinit(&a_root), NVF_OK, 1, "Deiniting a root");
+            ASSERT_INT(sa.bad, 0, 1, "Checking sizes after a failed parse");
+            ASSERT_INT(sa.num, 0, 1, "Checking a failed parse freed it all");
+            if (rd.err == NVF_OK) {
+                break;
+            }
+            ASSERT_INT(rd.err, NVF_BAD_ALLOC, 1,
+                       "Parsing without enough memory");
+        }
+    }
+
     rc = NVF_OK;
     for (const char *es = nvf_err_str(rc); rc <= NVF_ERR_END;
          ++rc, es = nvf_err_str(rc)) {
@@ -0,0 +1,112 @@
+#include "nvf.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+  \file nvfc.c
+  Compiles an NVF file into C code, so programs can embed their defaults
+  without parsing them at startup. See ::nvf_root_to_c().
+*/
+
+// Read a whole file into a buffer allocated with malloc().
+nvf_err read_file(const char *path, char **out, uintptr_t *out_len) {
+    FILE *f = fopen(path, "rb");
+    IF_RET(f == NULL, NVF_IO_ERR);
+    char *data = NULL;
+    uintptr_t len = 0, cap = 0;
+    nvf_err r = NVF_OK;
+    while (r == NVF_OK) {
+        if (len == cap) {
+            cap = cap * 2 + 4096;
+            char *new_data = realloc(data, cap);
+            if (new_data == NULL) {
+                r = NVF_BAD_ALLOC;
+                break;
+            }
+            data = new_data;
+        }
+        uintptr_t got = fread(data + len, 1, cap - len, f);
+        len += got;
+        if (got == 0) {
+            r = ferror(f) ? NVF_IO_ERR : NVF_OK;
+            break;
+        }
+    }
+    fclose(f);
+    if (r != NVF_OK) {
+        free(data);
+        return r;
+    }
+    *out = data;
+    *out_len = len;
+    return NVF_OK;
+}
+
+// Write len bytes of data to a file named base followed by ext.
+nvf_err write_file(const char *base, const char *ext, const char *data,
+                   uintptr_t len) {
+    uintptr_t base_len = strlen(base);
+    char *path = malloc(base_len + strlen(ext) + 1);
+    IF_RET(path == NULL, NVF_BAD_ALLOC);
+    memcpy(path, base, base_len);
+    strcpy(path + base_len, ext);
+    FILE *f = fopen(path, "wb");
+    free(path);
+    IF_RET(f == NULL, NVF_IO_ERR);
+    uintptr_t put = fwrite(data, 1, len, f);
+    int close_r = fclose(f);
+    IF_RET(put != len || close_r != 0, NVF_IO_ERR);
+    return NVF_OK;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 4) {
+        fprintf(stderr, "Usage: %s <input.nvf> <output base> <root name>\n"
+                        "Writes <output base>.c and <output base>.h\n",
+                argv[0]);
+        return 1;
+    }
+    char *data = NULL;
+    uintptr_t data_len = 0;
+    nvf_err r = read_file(argv[1], &data, &data_len);
+    if (r != NVF_OK) {
+        fprintf(stderr, "Reading %s failed with error %s\n", argv[1],
+                nvf_err_str(r));
+        return 1;
+    }
+
+    nvf_root root = nvf_root_default_init();
+    char *c_out = NULL, *h_out = NULL;
+    uintptr_t c_len = 0, h_len = 0;
+    nvf_err_data_i rd = nvf_parse_buf(data, data_len, &root);
+    if (rd.err != NVF_OK) {
+        fprintf(stderr, "Parsing %s failed with error %s at byte %lu\n",
+                argv[1], nvf_err_str(rd.err), (unsigned long)rd.data_i);
+        r = rd.err;
+        goto deinit;
+    }
+    r = nvf_root_to_c(&root, argv[3], &c_out, &c_len, &h_out, &h_len);
+    if (r != NVF_OK) {
+        fprintf(stderr, "Compiling %s failed with error %s\n", argv[1],
+                nvf_err_str(r));
+        goto deinit;
+    }
+    // The files don't get the null terminators.
+    r = write_file(argv[2], ".c", c_out, c_len - 1);
+    if (r == NVF_OK) {
+        r = write_file(argv[2], ".h", h_out, h_len - 1);
+    }
+    if (r != NVF_OK) {
+        fprintf(stderr, "Writing %s failed with error %s\n", argv[2],
+                nvf_err_str(r));
+    }
+
+deinit:
+    free(c_out);
+    free(h_out);
+    free(data);
+    nvf_deinit(&root);
+    return r == NVF_OK ? 0 : 1;
+}
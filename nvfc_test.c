@@ -0,0 +1,88 @@
+#include "nvfc_test_cfg.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/**
+  \file nvfc_test.c
+  Reads back the root nvfc compiled from nvfc_test.nvf with the normal
+  getters. Built and run by make test_nvfc.
+*/
+
+#define ASSERT_INT(r, exp, ret_val, label)                                     \
+    do {                                                                       \
+        int _tmp_r = (r);                                                      \
+        int _tmp_exp = (exp);                                                  \
+        if (_tmp_r != _tmp_exp) {                                              \
+            printf("%s:%u. %s failed. Expected %d (%s), got %d (%s)!\n",       \
+                   __FILE__, __LINE__, label, _tmp_exp, #exp, _tmp_r, #r);     \
+            return ret_val;                                                    \
+        }                                                                      \
+    } while (0)
+
+int main(int argc, char *argv[]) {
+    nvf_root *root = &nvfc_test_cfg;
+    const char *str = NULL;
+    uintptr_t len = 0;
+    const char *name_path[] = {"name"};
+    nvf_err rc = nvf_get_str_view(root, name_path, 1, &str, &len);
+    ASSERT_INT(rc, NVF_OK, 1, "Getting a compiled string");
+    ASSERT_INT(len, 9, 1, "Checking a compiled string's length");
+    ASSERT_INT(strcmp(str, "nvfc test"), 0, 1, "Checking a compiled string");
+
+    int64_t i = 0;
+    const char *count_path[] = {"count"};
+    rc = nvf_get_int(root, count_path, 1, &i);
+    ASSERT_INT(rc, NVF_OK, 1, "Getting a compiled int");
+    ASSERT_INT(i, 42, 1, "Checking a compiled int");
+    double f = 0;
+    const char *ratio_path[] = {"ratio"};
+    rc = nvf_get_float(root, ratio_path, 1, &f);
+    ASSERT_INT(rc, NVF_OK, 1, "Getting a compiled float");
+    ASSERT_INT(f == 0.25, 1, 1, "Checking a compiled float");
+
+    const uint8_t *blob = NULL;
+    const char *bin_path[] = {"bin"};
+    rc = nvf_get_blob_view(root, bin_path, 1, &blob, &len);
+    ASSERT_INT(rc, NVF_OK, 1, "Getting a compiled BLOB");
+    ASSERT_INT(len == 3 && memcmp(blob, "\x0a\x0b\x0c", 3) == 0, 1, 1,
+               "Checking a compiled BLOB");
+    // The reference is mapped when it's read, from the path it was written
+    // with, so make test_nvfc runs this from the directory of the fixture.
+    const char *ref_path[] = {"ref"};
+    rc = nvf_get_blob_view(root, ref_path, 1, &blob, &len);
+    ASSERT_INT(rc, NVF_OK, 1, "Getting a compiled BLOB reference");
+    ASSERT_INT(len == 8 && memcmp(blob, "Compiled", 8) == 0, 1, 1,
+               "Checking a compiled BLOB reference");
+
+    nvf_array arr;
+    const char *list_path[] = {"list"};
+    rc = nvf_get_array(root, list_path, 1, &arr);
+    ASSERT_INT(rc, NVF_OK, 1, "Getting a compiled array");
+    ASSERT_INT(arr.num, 4, 1, "Checking a compiled array's length");
+    nvf_tag_value tv = nvf_array_get_item(&arr, 1);
+    ASSERT_INT(tv.type, NVF_STRING, 1, "Checking a compiled array item");
+    ASSERT_INT(strcmp(tv.val.v_string->data, "two"), 0, 1,
+               "Checking a compiled array string");
+
+    // Every name in the hashed map is found.
+    const char *m_path[] = {"m", "a"};
+    for (char c = 'a'; c <= 'i'; ++c) {
+        char m_name[2] = {c, '\0'};
+        m_path[1] = m_name;
+        rc = nvf_get_int(root, m_path, 2, &i);
+        ASSERT_INT(rc, NVF_OK, 1, "Getting a compiled map value");
+        ASSERT_INT(i, c - 'a' + 1, 1, "Checking a compiled map value");
+    }
+    m_path[1] = "z";
+    rc = nvf_get_int(root, m_path, 2, &i);
+    ASSERT_INT(rc, NVF_NOT_FOUND, 1, "Getting a missing compiled name");
+    const char *sub_path[] = {"m", "sub", "x"};
+    rc = nvf_get_str_view(root, sub_path, 3, &str, &len);
+    ASSERT_INT(rc, NVF_OK, 1, "Getting a nested compiled string");
+    ASSERT_INT(strcmp(str, "nested"), 0, 1, "Checking a nested string");
+
+    ASSERT_INT(nvf_deinit(root), NVF_READ_ONLY, 1, "Deiniting a compiled root");
+    printf("All tests passed.\n");
+    return 0;
+}